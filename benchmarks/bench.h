@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Minimal helpers shared by the benchmarks.
+// Image sizes and iteration counts can be overriden via the
+// SWA_BENCH_WIDTH, SWA_BENCH_HEIGHT and SWA_BENCH_ITERATIONS
+// environment variables.
+
+static inline double bench_now(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static inline unsigned bench_env(const char* name, unsigned fallback) {
+	const char* val = getenv(name);
+	if(!val) {
+		return fallback;
+	}
+
+	unsigned ret = (unsigned) strtoul(val, NULL, 10);
+	return ret ? ret : fallback;
+}
+
+// Prints the throughput of `bytes` processed `iterations` times
+// in the given time.
+static inline void bench_report(const char* name, double bytes,
+		unsigned iterations, double seconds) {
+	double gbs = (bytes * iterations) / seconds / 1e9;
+	double ms = 1000.0 * seconds / iterations;
+	printf("%-40s %8.3f ms %8.2f GB/s\n", name, ms, gbs);
+}
@@ -0,0 +1,182 @@
+#include "bench.h"
+#include <swa/image.h>
+#include <string.h>
+
+// Measures swa_convert_image for every pair of formats, serially
+// and with swa_convert_flags_parallel. Also measures sRGB encoding
+// from the linear 16-bit formats into every other format and the
+// conversion from the planar yuv formats.
+// The reported throughput includes both read and written bytes.
+
+static const struct {
+	enum swa_image_format format;
+	const char* name;
+} formats[] = {
+	{swa_image_format_a8, "a8"},
+	{swa_image_format_rgba32, "rgba32"},
+	{swa_image_format_argb32, "argb32"},
+	{swa_image_format_xrgb32, "xrgb32"},
+	{swa_image_format_rgb24, "rgb24"},
+	{swa_image_format_abgr32, "abgr32"},
+	{swa_image_format_bgra32, "bgra32"},
+	{swa_image_format_bgrx32, "bgrx32"},
+	{swa_image_format_bgr24, "bgr24"},
+	{swa_image_format_rgba32_premul, "rgba32_premul"},
+	{swa_image_format_argb32_premul, "argb32_premul"},
+	{swa_image_format_abgr32_premul, "abgr32_premul"},
+	{swa_image_format_bgra32_premul, "bgra32_premul"},
+	{swa_image_format_rgb565, "rgb565"},
+	{swa_image_format_xrgb2101010, "xrgb2101010"},
+	{swa_image_format_rgba16f, "rgba16f"},
+	{swa_image_format_rgba64, "rgba64"},
+};
+
+// Can only be converted from, not to.
+static const struct {
+	enum swa_image_format format;
+	const char* name;
+} yuv_formats[] = {
+	{swa_image_format_nv12, "nv12"},
+	{swa_image_format_i420, "i420"},
+};
+
+struct bench {
+	unsigned width;
+	unsigned height;
+	unsigned iterations;
+	uint8_t* src_data;
+	uint8_t* dst_data;
+};
+
+static void bench_pair(const struct bench* bench, unsigned s, unsigned d,
+		enum swa_convert_flags flags) {
+	unsigned src_size = swa_image_format_size(formats[s].format);
+	unsigned dst_size = swa_image_format_size(formats[d].format);
+	struct swa_image src = {
+		.width = bench->width,
+		.height = bench->height,
+		.stride = bench->width * src_size,
+		.format = formats[s].format,
+		.data = bench->src_data,
+	};
+	struct swa_image dst = {
+		.width = bench->width,
+		.height = bench->height,
+		.stride = bench->width * dst_size,
+		.format = formats[d].format,
+		.data = bench->dst_data,
+	};
+
+	// warmup
+	swa_convert_image_flags(&src, &dst, flags);
+
+	double start = bench_now();
+	for(unsigned i = 0u; i < bench->iterations; ++i) {
+		swa_convert_image_flags(&src, &dst, flags);
+	}
+	double time = bench_now() - start;
+
+	char name[64];
+	snprintf(name, sizeof(name), "%s -> %s%s%s", formats[s].name,
+		formats[d].name,
+		(flags & swa_convert_flags_srgb_encode) ? " (srgb)" : "",
+		(flags & swa_convert_flags_parallel) ? " (parallel)" : "");
+	double bytes = (double) bench->width * bench->height * (src_size + dst_size);
+	bench_report(name, bytes, bench->iterations, time);
+}
+
+static void bench_yuv(const struct bench* bench, unsigned s, unsigned d,
+		enum swa_convert_flags flags) {
+	unsigned dst_size = swa_image_format_size(formats[d].format);
+	struct swa_image src = {
+		.width = bench->width,
+		.height = bench->height,
+		.stride = (bench->width + 1) & ~1u,
+		.format = yuv_formats[s].format,
+		.data = bench->src_data,
+	};
+	struct swa_image dst = {
+		.width = bench->width,
+		.height = bench->height,
+		.stride = bench->width * dst_size,
+		.format = formats[d].format,
+		.data = bench->dst_data,
+	};
+
+	swa_convert_image_flags(&src, &dst, flags);
+
+	double start = bench_now();
+	for(unsigned i = 0u; i < bench->iterations; ++i) {
+		swa_convert_image_flags(&src, &dst, flags);
+	}
+	double time = bench_now() - start;
+
+	char name[64];
+	snprintf(name, sizeof(name), "%s -> %s%s", yuv_formats[s].name,
+		formats[d].name,
+		(flags & swa_convert_flags_parallel) ? " (parallel)" : "");
+	double bytes = (double) swa_image_data_size(&src) +
+		(double) bench->width * bench->height * dst_size;
+	bench_report(name, bytes, bench->iterations, time);
+}
+
+int main(void) {
+	struct bench bench = {
+		.width = bench_env("SWA_BENCH_WIDTH", 3840),
+		.height = bench_env("SWA_BENCH_HEIGHT", 2160),
+		.iterations = bench_env("SWA_BENCH_ITERATIONS", 20),
+	};
+
+	// rgba16f and rgba64 have the largest pixels
+	size_t max_size = (size_t) bench.width * bench.height * 8;
+	bench.src_data = malloc(max_size);
+	bench.dst_data = malloc(max_size);
+	if(!bench.src_data || !bench.dst_data) {
+		fprintf(stderr, "Allocation failed\n");
+		return EXIT_FAILURE;
+	}
+
+	for(size_t i = 0u; i < max_size; ++i) {
+		bench.src_data[i] = (uint8_t) (i * 31u);
+	}
+	memset(bench.dst_data, 0, max_size);
+
+	printf("swa_convert_image, %ux%u, %u iterations\n",
+		bench.width, bench.height, bench.iterations);
+
+	unsigned n_formats = sizeof(formats) / sizeof(formats[0]);
+	for(unsigned s = 0u; s < n_formats; ++s) {
+		for(unsigned d = 0u; d < n_formats; ++d) {
+			bench_pair(&bench, s, d, swa_convert_flags_none);
+		}
+	}
+
+	for(unsigned s = 0u; s < n_formats; ++s) {
+		for(unsigned d = 0u; d < n_formats; ++d) {
+			bench_pair(&bench, s, d, swa_convert_flags_parallel);
+		}
+	}
+
+	for(unsigned s = 0u; s < n_formats; ++s) {
+		if(formats[s].format != swa_image_format_rgba16f &&
+				formats[s].format != swa_image_format_rgba64) {
+			continue;
+		}
+
+		for(unsigned d = 0u; d < n_formats; ++d) {
+			bench_pair(&bench, s, d, swa_convert_flags_srgb_encode);
+		}
+	}
+
+	unsigned n_yuv = sizeof(yuv_formats) / sizeof(yuv_formats[0]);
+	for(unsigned s = 0u; s < n_yuv; ++s) {
+		for(unsigned d = 0u; d < n_formats; ++d) {
+			bench_yuv(&bench, s, d, swa_convert_flags_none);
+			bench_yuv(&bench, s, d, swa_convert_flags_parallel);
+		}
+	}
+
+	free(bench.src_data);
+	free(bench.dst_data);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+#include "bench.h"
+#include <swa/image.h>
+#include <string.h>
+
+// Measures the 2D primitives swa_image_fill_rect, swa_image_blit and
+// swa_image_blend_over. The operation is given as first argument
+// ("fill", "blit" or "blend"). Each is measured on a full frame and
+// on cursor-sized images, using typical buffer surface formats.
+// The reported throughput includes all read and written bytes.
+
+enum op {
+	op_fill,
+	op_blit,
+	op_blend,
+};
+
+static const struct {
+	enum op op;
+	const char* name;
+} ops[] = {
+	{op_fill, "fill"},
+	{op_blit, "blit"},
+	{op_blend, "blend"},
+};
+
+static struct swa_image create_image(unsigned width, unsigned height,
+		enum swa_image_format format) {
+	unsigned size = swa_image_format_size(format);
+	struct swa_image img = {
+		.width = width,
+		.height = height,
+		.stride = size * width,
+		.format = format,
+		.data = malloc((size_t) size * width * height),
+	};
+	if(!img.data) {
+		fprintf(stderr, "Allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// half transparent gradients, some pixels fully transparent
+	for(unsigned y = 0u; y < height; ++y) {
+		for(unsigned x = 0u; x < width; ++x) {
+			struct swa_pixel px = {x, y, x + y, (x * y) % 3 ? x ^ y : 0};
+			swa_write_pixel(img.data + y * img.stride + x * size, format, px);
+		}
+	}
+
+	return img;
+}
+
+static void run(enum op op, const struct swa_image* src,
+		const struct swa_image* dst) {
+	switch(op) {
+		case op_fill: {
+			struct swa_rect rect = {0, 0, src->width, src->height};
+			swa_image_fill_rect(dst, &rect, (struct swa_pixel) {10, 20, 30, 255});
+			break;
+		} case op_blit:
+			swa_image_blit(src, dst, 0, 0);
+			break;
+		case op_blend:
+			swa_image_blend_over(src, dst, 0, 0);
+			break;
+	}
+}
+
+static void bench_op(enum op op, const char* op_name, unsigned iterations,
+		unsigned width, unsigned height, enum swa_image_format src_format,
+		const char* src_name, enum swa_image_format dst_format,
+		const char* dst_name) {
+	struct swa_image src = create_image(width, height, src_format);
+	struct swa_image dst = create_image(width, height, dst_format);
+
+	// warmup
+	run(op, &src, &dst);
+
+	double start = bench_now();
+	for(unsigned i = 0u; i < iterations; ++i) {
+		run(op, &src, &dst);
+	}
+	double time = bench_now() - start;
+
+	unsigned src_size = swa_image_format_size(src_format);
+	unsigned dst_size = swa_image_format_size(dst_format);
+	double px = (double) width * height;
+	double bytes = px * dst_size;
+	if(op == op_blit) {
+		bytes += px * src_size;
+	} else if(op == op_blend) {
+		bytes += px * (src_size + dst_size);
+	}
+
+	char name[64];
+	if(op == op_fill) {
+		snprintf(name, sizeof(name), "%s %ux%u %s", op_name, width, height,
+			dst_name);
+	} else {
+		snprintf(name, sizeof(name), "%s %ux%u %s -> %s", op_name, width,
+			height, src_name, dst_name);
+	}
+
+	bench_report(name, bytes, iterations, time);
+	free(src.data);
+	free(dst.data);
+}
+
+int main(int argc, char** argv) {
+	unsigned width = bench_env("SWA_BENCH_WIDTH", 3840);
+	unsigned height = bench_env("SWA_BENCH_HEIGHT", 2160);
+	unsigned iterations = bench_env("SWA_BENCH_ITERATIONS", 20);
+
+	for(unsigned i = 0u; i < sizeof(ops) / sizeof(ops[0]); ++i) {
+		if(argc > 1 && strcmp(argv[1], ops[i].name) != 0) {
+			continue;
+		}
+
+		enum op op = ops[i].op;
+		const char* name = ops[i].name;
+		printf("%s, %u iterations\n", name, iterations);
+
+		bench_op(op, name, iterations, width, height,
+			swa_image_format_rgba32, "rgba32",
+			swa_image_format_bgra32_premul, "bgra32_premul");
+		bench_op(op, name, iterations, width, height,
+			swa_image_format_bgra32_premul, "bgra32_premul",
+			swa_image_format_bgrx32, "bgrx32");
+		bench_op(op, name, iterations, width, height,
+			swa_image_format_bgra32_premul, "bgra32_premul",
+			swa_image_format_rgb565, "rgb565");
+		bench_op(op, name, 1000 * iterations, 64, 64,
+			swa_image_format_rgba32, "rgba32",
+			swa_image_format_bgra32_premul, "bgra32_premul");
+	}
+
+	return EXIT_SUCCESS;
+}
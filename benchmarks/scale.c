@@ -0,0 +1,77 @@
+#include "bench.h"
+#include <swa/image.h>
+#include <string.h>
+
+// Measures swa_scale_image with all filters for common scale factors,
+// e.g. HiDPI downscaling and cursor/icon sizes.
+// The reported throughput includes both read and written bytes.
+
+static const struct {
+	enum swa_scale_filter filter;
+	const char* name;
+} filters[] = {
+	{swa_scale_filter_box, "box"},
+	{swa_scale_filter_bilinear, "bilinear"},
+	{swa_scale_filter_lanczos, "lanczos"},
+};
+
+static void bench_scale(unsigned iterations, unsigned sw, unsigned sh,
+		unsigned dw, unsigned dh) {
+	struct swa_image src = {
+		.width = sw,
+		.height = sh,
+		.stride = 4 * sw,
+		.format = swa_image_format_bgra32_premul,
+		.data = malloc((size_t) 4 * sw * sh),
+	};
+	struct swa_image dst = {
+		.width = dw,
+		.height = dh,
+		.stride = 4 * dw,
+		.format = swa_image_format_bgra32_premul,
+		.data = malloc((size_t) 4 * dw * dh),
+	};
+	if(!src.data || !dst.data) {
+		fprintf(stderr, "Allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for(size_t i = 0u; i < (size_t) 4 * sw * sh; ++i) {
+		src.data[i] = (uint8_t) (i * 31u);
+	}
+
+	unsigned n_filters = sizeof(filters) / sizeof(filters[0]);
+	for(unsigned f = 0u; f < n_filters; ++f) {
+		// warmup
+		swa_scale_image(&src, &dst, filters[f].filter);
+
+		double start = bench_now();
+		for(unsigned i = 0u; i < iterations; ++i) {
+			swa_scale_image(&src, &dst, filters[f].filter);
+		}
+		double time = bench_now() - start;
+
+		char name[64];
+		snprintf(name, sizeof(name), "%ux%u -> %ux%u %s", sw, sh, dw, dh,
+			filters[f].name);
+		double bytes = 4.0 * ((double) sw * sh + (double) dw * dh);
+		bench_report(name, bytes, iterations, time);
+	}
+
+	free(src.data);
+	free(dst.data);
+}
+
+int main(void) {
+	unsigned width = bench_env("SWA_BENCH_WIDTH", 3840);
+	unsigned height = bench_env("SWA_BENCH_HEIGHT", 2160);
+	unsigned iterations = bench_env("SWA_BENCH_ITERATIONS", 20);
+
+	printf("swa_scale_image, %u iterations\n", iterations);
+	bench_scale(iterations, width, height, width / 2, height / 2);
+	bench_scale(iterations, width / 2, height / 2, width, height);
+	bench_scale(iterations, width, height, (2 * width) / 3, (2 * height) / 3);
+	bench_scale(100 * iterations, 256, 256, 64, 64);
+	bench_scale(100 * iterations, 32, 32, 48, 48);
+	return EXIT_SUCCESS;
+}
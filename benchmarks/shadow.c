@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "bench.h"
+#include <swa/image.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+
+// Compares rendering directly into a dumb buffer (what the kms backend
+// returns by default) with rendering into a shadow image in system
+// memory that is then copied into the dumb buffer, see
+// swa_buffer_surface_settings::shadow. The frame blends a number of
+// sprites, i.e. reads the destination, into either the whole buffer
+// or a band of damaged rows.
+// Dumb buffers are created on the drm device given by the
+// SWA_BENCH_DRM_DEVICE environment variable (/dev/dri/card0 by
+// default), e.g. a vkms device. No drm master is needed.
+// The reported throughput is based on the size of the damaged rows.
+
+struct dumb {
+	int fd;
+	uint32_t handle;
+	uint64_t size;
+	struct swa_image img;
+};
+
+static bool create_dumb(int fd, unsigned width, unsigned height,
+		struct dumb* dumb) {
+	struct drm_mode_create_dumb create = {
+		.width = width,
+		.height = height,
+		.bpp = 32,
+	};
+	if(drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) != 0) {
+		fprintf(stderr, "Creating dumb buffer failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	struct drm_mode_map_dumb map = {.handle = create.handle};
+	if(drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &map) != 0) {
+		fprintf(stderr, "Mapping dumb buffer failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	void* data = mmap(NULL, create.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, map.offset);
+	if(data == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	dumb->fd = fd;
+	dumb->handle = create.handle;
+	dumb->size = create.size;
+	dumb->img = (struct swa_image) {
+		.width = width,
+		.height = height,
+		.stride = create.pitch,
+		.format = swa_image_format_bgrx32,
+		.data = data,
+	};
+	return true;
+}
+
+static void destroy_dumb(struct dumb* dumb) {
+	munmap(dumb->img.data, dumb->size);
+	struct drm_mode_destroy_dumb destroy = {.handle = dumb->handle};
+	drmIoctl(dumb->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+}
+
+static struct swa_image create_sprite(unsigned size) {
+	struct swa_image img = {
+		.width = size,
+		.height = size,
+		.stride = 4 * size,
+		.format = swa_image_format_bgra32_premul,
+		.data = malloc((size_t) 4 * size * size),
+	};
+	if(!img.data) {
+		fprintf(stderr, "Allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// round, antialiased-looking shape with a transparent border
+	for(unsigned y = 0u; y < size; ++y) {
+		for(unsigned x = 0u; x < size; ++x) {
+			int dx = 2 * (int) x - (int) size;
+			int dy = 2 * (int) y - (int) size;
+			unsigned d = (unsigned) (dx * dx + dy * dy);
+			unsigned r = size * size;
+			uint8_t a = d >= r ? 0 : (uint8_t) (255u - 255u * d / r);
+			struct swa_pixel px = {a, a / 2, a / 4, a};
+			swa_write_pixel(img.data + y * img.stride + 4 * x, img.format, px);
+		}
+	}
+
+	return img;
+}
+
+// Draws a frame into the rows [y, y + height) of `dst`.
+static void render(const struct swa_image* dst, const struct swa_image* sprite,
+		unsigned y, unsigned height) {
+	struct swa_rect rect = {0, y, dst->width, height};
+	swa_image_fill_rect(dst, &rect, (struct swa_pixel) {40, 40, 48, 255});
+	for(unsigned sy = y; sy + sprite->height <= y + height;
+			sy += sprite->height) {
+		for(unsigned sx = 0u; sx + sprite->width <= dst->width;
+				sx += sprite->width / 2) {
+			swa_image_blend_over(sprite, dst, (int) sx, (int) sy);
+		}
+	}
+}
+
+static void bench_frame(const char* name, unsigned iterations,
+		const struct swa_image* target, const struct swa_image* shadow,
+		const struct swa_image* sprite, unsigned y, unsigned height) {
+	const struct swa_image* dst = shadow ? shadow : target;
+	render(dst, sprite, y, height);
+	if(shadow) {
+		swa_image_copy_rows(shadow, target, y, height);
+	}
+
+	double start = bench_now();
+	for(unsigned i = 0u; i < iterations; ++i) {
+		render(dst, sprite, y, height);
+		if(shadow) {
+			swa_image_copy_rows(shadow, target, y, height);
+		}
+	}
+	double time = bench_now() - start;
+
+	char full[64];
+	snprintf(full, sizeof(full), "%s %ux%u", name, target->width, height);
+	bench_report(full, 4.0 * target->width * height, iterations, time);
+}
+
+int main(void) {
+	unsigned width = bench_env("SWA_BENCH_WIDTH", 1920);
+	unsigned height = bench_env("SWA_BENCH_HEIGHT", 1080);
+	unsigned iterations = bench_env("SWA_BENCH_ITERATIONS", 20);
+	const char* path = getenv("SWA_BENCH_DRM_DEVICE");
+	path = path ? path : "/dev/dri/card0";
+
+	int fd = open(path, O_RDWR | O_CLOEXEC);
+	if(fd < 0) {
+		fprintf(stderr, "Can't open %s: %s, skipping\n", path, strerror(errno));
+		return 77; // skipped
+	}
+
+	struct dumb dumb;
+	if(!create_dumb(fd, width, height, &dumb)) {
+		close(fd);
+		return 77;
+	}
+
+	// like the shadow images of the kms backend
+	unsigned stride = (4 * width + 63u) & ~63u;
+	struct swa_image shadow = {
+		.width = width,
+		.height = height,
+		.stride = stride,
+		.format = swa_image_format_bgrx32,
+		.data = aligned_alloc(64u, (size_t) stride * height),
+	};
+	if(!shadow.data) {
+		fprintf(stderr, "Allocation failed\n");
+		return EXIT_FAILURE;
+	}
+
+	struct swa_image sprite = create_sprite(32);
+	unsigned band = height / 10;
+	printf("shadow, %s, %u iterations\n", path, iterations);
+	bench_frame("direct full", iterations, &dumb.img, NULL, &sprite,
+		0, height);
+	bench_frame("shadow full", iterations, &dumb.img, &shadow, &sprite,
+		0, height);
+	bench_frame("direct band", 10 * iterations, &dumb.img, NULL, &sprite,
+		height / 2, band);
+	bench_frame("shadow band", 10 * iterations, &dumb.img, &shadow, &sprite,
+		height / 2, band);
+
+	// cost of the copy alone
+	double start = bench_now();
+	for(unsigned i = 0u; i < iterations; ++i) {
+		swa_image_copy_rows(&shadow, &dumb.img, 0, height);
+	}
+	double time = bench_now() - start;
+	char name[64];
+	snprintf(name, sizeof(name), "copy rows %ux%u", width, height);
+	bench_report(name, 4.0 * width * height, iterations, time);
+
+	free(sprite.data);
+	free(shadow.data);
+	destroy_dumb(&dumb);
+	close(fd);
+	return EXIT_SUCCESS;
+}
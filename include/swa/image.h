@@ -1,7 +1,9 @@
 #pragma once
 
 #include <swa/config.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,6 +38,48 @@ enum swa_image_format {
 	swa_image_format_bgra32,
 	swa_image_format_bgrx32,
 	swa_image_format_bgr24,
+
+	// Variants of the formats above with premultiplied alpha, i.e. the
+	// color components are already multiplied with the alpha component.
+	// This is what most compositors expect for transparent buffers.
+	// swa_pixel always uses straight (non-premultiplied) alpha, so
+	// reading, writing and converting from/to these formats
+	// will (un-)premultiply as needed.
+	swa_image_format_rgba32_premul,
+	swa_image_format_argb32_premul,
+	swa_image_format_abgr32_premul,
+	swa_image_format_bgra32_premul,
+
+	// Packed formats. Unlike all formats above, these are defined in
+	// native word order (like the packed vulkan formats), e.g. rgb565
+	// is a 16-bit word with red in the 5 most significant bits.
+	// swa_image_format_toggle_byte_word returns them unchanged.
+	swa_image_format_rgb565,
+	swa_image_format_xrgb2101010,
+
+	// Four 16-bit half floats per pixel in byte order, i.e. like rgba32.
+	// Uses straight alpha. Values are clamped to [0, 1] when
+	// converting to other formats.
+	swa_image_format_rgba16f,
+	// Four 16-bit unsigned normalized components per pixel in byte
+	// order, each in native endianess. Uses straight alpha.
+	swa_image_format_rgba64,
+
+	// Planar yuv 4:2:0 formats with 8-bit samples, e.g. for presenting
+	// decoded video frames. Interpreted as BT.601 limited range, which
+	// is what wl_shm, KMS planes and XVideo assume by default.
+	// The luma plane (`height` rows with `stride` bytes) is directly
+	// followed by the chroma samples for every 2x2 block of pixels,
+	// in (height + 1) / 2 rows:
+	// - nv12: a single plane of interleaved u, v samples with `stride`
+	// - i420: a u plane followed by a v plane, both with `stride / 2`.
+	//   The stride must be even.
+	// swa_image_format_size returns the size of a luma sample (1) for
+	// them, swa_image_data_size the size of all planes. Images can be
+	// converted from (but not to) these formats with swa_convert_image.
+	// Reading or writing single pixels isn't supported.
+	swa_image_format_nv12,
+	swa_image_format_i420,
 };
 
 // Describes a 2 dimensional image.
@@ -50,10 +94,79 @@ struct swa_pixel {
 	uint8_t r, g, b, a;
 };
 
+// Rectangular region of an image, in pixels.
+struct swa_rect {
+	unsigned x, y;
+	unsigned width, height;
+};
+
+// Flags modifying the behavior of swa_convert_image_flags.
+enum swa_convert_flags {
+	swa_convert_flags_none = 0,
+	// Splits the image into row bands that are converted in parallel
+	// on the image worker pool, see swa_image_set_thread_count.
+	// Small images are always converted on the calling thread.
+	swa_convert_flags_parallel = (1u << 0),
+	// Applies ordered (4x4 bayer) dithering when converting to a format
+	// with less precision than the source, e.g. from rgba32 to rgb565.
+	// Without it, components are simply rounded which may lead to
+	// visible banding in gradients.
+	swa_convert_flags_dither = (1u << 1),
+	// The source contains linear color values that are encoded with
+	// the sRGB transfer function when writing the destination, e.g. to
+	// present linear rendering results on a buffer surface. Alpha stays
+	// linear. The source should have more than 8 bits per component
+	// (e.g. rgba16f or rgba64), linear 8-bit values lose too much
+	// precision in dark colors.
+	swa_convert_flags_srgb_encode = (1u << 2),
+	// The inverse of swa_convert_flags_srgb_encode: the source contains
+	// sRGB-encoded colors that are converted to linear values.
+	// Must not be combined with swa_convert_flags_srgb_encode.
+	swa_convert_flags_srgb_decode = (1u << 3),
+};
+
+// Filters used by swa_scale_image.
+enum swa_scale_filter {
+	// Averages all covered source pixels when downscaling,
+	// nearest neighbor when upscaling. Fastest.
+	swa_scale_filter_box,
+	// Linear interpolation, a triangle filter when downscaling.
+	swa_scale_filter_bilinear,
+	// 3-lobed lanczos filter. Sharpest results but slowest.
+	swa_scale_filter_lanczos,
+};
+
+// Clockwise rotations, see swa_rotate_image.
+enum swa_image_rotation {
+	swa_image_rotation_none = 0,
+	swa_image_rotation_90,
+	swa_image_rotation_180,
+	swa_image_rotation_270,
+};
+
+// A single task of a parallel image operation.
+// `data` is the data passed to the swa_image_parallel_for function,
+// `index` the index of the task in [0, count).
+typedef void (*swa_image_task)(void* data, unsigned index);
+
+// Function that executes `task(data, i)` for every i in [0, count)
+// and only returns when all of them have finished.
+// The order and the threads the tasks are executed on is undefined.
+// `userdata` is the pointer passed to swa_image_set_parallel_for.
+typedef void (*swa_image_parallel_for)(void* userdata, unsigned count,
+	swa_image_task task, void* data);
+
 
 // Returns the size of one pixel in the given formats in bytes.
 SWA_API unsigned swa_image_format_size(enum swa_image_format);
 
+// Returns whether the given format stores its data in multiple planes.
+SWA_API bool swa_image_format_is_planar(enum swa_image_format);
+
+// Returns the number of bytes the data of the given image spans,
+// including all planes.
+SWA_API size_t swa_image_data_size(const struct swa_image*);
+
 // Reads one pixel from the given image data with the given format.
 SWA_API struct swa_pixel swa_read_pixel(const uint8_t* data, enum swa_image_format);
 
@@ -70,6 +183,102 @@ SWA_API void swa_write_pixel(uint8_t* data, enum swa_image_format, struct swa_pi
 SWA_API void swa_convert_image(const struct swa_image* src,
 	const struct swa_image* dst);
 
+// Like swa_convert_image but allows to pass additional flags,
+// e.g. swa_convert_flags_parallel to convert large images
+// using multiple threads.
+SWA_API void swa_convert_image_flags(const struct swa_image* src,
+	const struct swa_image* dst, enum swa_convert_flags flags);
+
+// Converts only the given regions of `src` into the same regions of `dst`.
+// Like swa_convert_image, width and height of both images must match.
+// Pixels outside the regions are not touched, regions are clipped
+// against the image size and may overlap.
+SWA_API void swa_convert_image_region(const struct swa_image* src,
+	const struct swa_image* dst, const struct swa_rect* rects,
+	unsigned n_rects);
+
+// Converts the given image to `format` without a second buffer and
+// sets img->format on success. Only possible for formats with
+// the same pixel size (e.g. rgba32 to bgra32_premul), returns false
+// otherwise.
+SWA_API bool swa_convert_image_inplace(struct swa_image* img,
+	enum swa_image_format format);
+
+// Scales `src` to the size of `dst`, converting between the formats
+// as well. Filtering happens on premultiplied alpha, i.e. fully
+// transparent pixels don't bleed into their neighbors.
+// The images must not overlap.
+SWA_API void swa_scale_image(const struct swa_image* src,
+	const struct swa_image* dst, enum swa_scale_filter filter);
+
+// Fills the given rectangle of `img` with `color`. The rectangle is
+// clipped against the image, NULL fills the whole image.
+SWA_API void swa_image_fill_rect(const struct swa_image* img,
+	const struct swa_rect* rect, struct swa_pixel color);
+
+// Copies `src` into `dst` with its top-left corner at (x, y), converting
+// between the formats. Parts outside of `dst` are clipped, i.e. the
+// position may also be negative. The images must not overlap.
+SWA_API void swa_image_blit(const struct swa_image* src,
+	const struct swa_image* dst, int x, int y);
+
+// Like swa_image_blit but composites `src` over the content of `dst`
+// (porter-duff over) instead of replacing it. Both images may use
+// straight or premultiplied alpha, blending happens on premultiplied
+// values. Formats without alpha are treated as opaque.
+SWA_API void swa_image_blend_over(const struct swa_image* src,
+	const struct swa_image* dst, int x, int y);
+
+// Copies `src` into `dst`, rotated clockwise by the given angle.
+// For 90 and 270 degrees, `dst` must have the width and height of `src`
+// swapped. Both images must have the same format, the planar yuv
+// formats are not supported. The images must not overlap.
+// Large images are rotated in parallel.
+SWA_API void swa_rotate_image(const struct swa_image* src,
+	const struct swa_image* dst, enum swa_image_rotation rotation);
+
+// Copies the rows [y, y + height) of `src` into the same rows of `dst`.
+// Uses non-temporal (streaming) stores where available, meant for
+// destinations in write-combined or uncached memory, e.g. scanout
+// buffers, which should only be written sequentially and never read.
+// Both images must have the same size and format, the planar yuv
+// formats are not supported.
+SWA_API void swa_image_copy_rows(const struct swa_image* src,
+	const struct swa_image* dst, unsigned y, unsigned height);
+
+// Compares `a` and `b` in square tiles of `tile_size` pixels and stores
+// the regions in which they differ in `rects`. Changed tiles next to
+// each other in a row of tiles are merged into one region, such
+// regions with the same horizontal extent in consecutive rows as well.
+// Returns the number of regions, 0 if the images are equal. If more than
+// `max_rects` regions would be needed, a single one covering all
+// changes is returned instead. Both images must have the same size and
+// format, the planar yuv formats are not supported.
+SWA_API unsigned swa_image_diff(const struct swa_image* a,
+	const struct swa_image* b, unsigned tile_size,
+	struct swa_rect* rects, unsigned max_rects);
+
+// Sets the number of threads used for parallel image operations.
+// This includes the calling thread, i.e. 1 will disable the internal
+// worker pool (and destroy it if it was already created).
+// 0 chooses the number of available cpu cores (the default).
+// The worker pool is only created on the first parallel operation.
+// Must not be called while a parallel operation is in progress.
+SWA_API void swa_image_set_thread_count(unsigned count);
+
+// Joins and frees the threads of the internal worker pool, e.g. before
+// the application exits or unloads swa. The pool is created again on the
+// next parallel operation.
+// Must not be called while a parallel operation is in progress.
+SWA_API void swa_image_destroy_pool(void);
+
+// Replaces the internal worker pool with the given function, e.g. to
+// run image operations on the task system of an application.
+// Passing NULL restores the internal worker pool.
+// Must not be called while a parallel operation is in progress.
+SWA_API void swa_image_set_parallel_for(swa_image_parallel_for fn,
+	void* userdata);
+
 // Converts the format of the given image.
 // Can also be used to create an image with a different stride.
 // If `new_stride` is zero, will tightly pack the image.
@@ -79,8 +288,24 @@ SWA_API struct swa_image swa_convert_image_new(const struct swa_image* src,
 
 // Returns the corresponding image format with reversed component order.
 // Example: argb32 will be mapped to bgra32.
+// Returns swa_image_format_none for formats whose reversed variant
+// can't be represented, e.g. rgba16f.
 SWA_API enum swa_image_format swa_image_format_reversed(enum swa_image_format);
 
+// Returns whether the given format has premultiplied alpha.
+SWA_API bool swa_image_format_is_premultiplied(enum swa_image_format);
+
+// Returns the premultiplied-alpha variant of the given format.
+// Formats without alpha component and formats that are already
+// premultiplied are returned unchanged.
+// Example: rgba32 will be mapped to rgba32_premul.
+SWA_API enum swa_image_format swa_image_format_premultiplied(enum swa_image_format);
+
+// Returns the straight (non-premultiplied) alpha variant of the given
+// format. Formats that aren't premultiplied are returned unchanged.
+// Example: bgra32_premul will be mapped to bgra32.
+SWA_API enum swa_image_format swa_image_format_straight(enum swa_image_format);
+
 // Computes the corresponding image format to the given one
 // with toggled byte/word order semantics.
 // In practice this simply means:
@@ -53,7 +53,18 @@ struct swa_window_interface {
 	bool (*gl_set_swap_interval)(struct swa_window*, int interval);
 
 	bool (*get_buffer)(struct swa_window*, struct swa_image*);
-	void (*apply_buffer)(struct swa_window*);
+	unsigned (*get_buffer_age)(struct swa_window*);
+	// Returns the data of the buffer holding the last applied frame if it
+	// isn't the active buffer and has the same layout, NULL otherwise.
+	const uint8_t* (*get_previous_buffer)(struct swa_window*);
+	// Called after `rect` of the active buffer was moved by (dx, dy)
+	// (`rect` is the destination). Returns true if the backend moves the
+	// contents on the server as well, i.e. they aren't damaged.
+	bool (*scroll_buffer)(struct swa_window*, const struct swa_rect* rect,
+		int dx, int dy);
+	// n_damage is zero if the whole buffer is damaged
+	void (*apply_buffer)(struct swa_window*, const struct swa_rect* damage,
+		unsigned n_damage);
 };
 
 struct swa_data_offer_interface {
@@ -74,6 +85,35 @@ struct swa_window {
 	const struct swa_window_interface* impl;
 	const struct swa_window_listener* listener;
 	void* userdata;
+
+	// Fallback for buffer surfaces with a preferred planar yuv format
+	// the backend doesn't support natively. swa_window_get_buffer
+	// returns `image` instead of the backend buffer (`target`), it's
+	// converted in swa_window_apply_buffer. Managed in swa.c.
+	struct {
+		enum swa_image_format format; // none if not requested
+		struct swa_image image;
+		struct swa_image target;
+		bool pending;
+		bool valid; // whether `image` holds the last applied frame
+	} yuv;
+
+	// The image returned by the last swa_window_get_buffer,
+	// data is NULL when there is no active buffer. Managed in swa.c.
+	struct swa_image buffer;
+	// Bounds of the contents moved by swa_window_scroll_buffer that
+	// have to be added to the damage, empty if there are none.
+	struct swa_rect scroll_damage;
+	// Bounds of the window contents lost on the server, e.g. because
+	// they were uncovered, see swa_window_expose. Empty if there are none.
+	struct swa_rect expose_damage;
+
+	// State of buffer surfaces with auto damage, see
+	// swa_buffer_surface_settings::auto_damage. Managed in swa.c.
+	struct {
+		bool enabled;
+		struct swa_image prev; // copy of the last applied frame
+	} auto_damage;
 };
 
 struct swa_data_offer {
@@ -81,6 +121,11 @@ struct swa_data_offer {
 	void* userdata;
 };
 
+// Called by backends when the given region of a buffer surface has to
+// be sent again, e.g. after it was uncovered. Added to the damage of the
+// next applied buffer. Implemented in swa.c.
+void swa_window_expose(struct swa_window*, struct swa_rect rect);
+
 #ifdef __cplusplus
 }
 #endif
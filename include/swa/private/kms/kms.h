@@ -34,6 +34,7 @@
 #include <pml.h>
 
 struct swa_kms_vk_surface;
+struct swa_kms_input_thread;
 
 #ifdef __cplusplus
 extern "C" {
@@ -67,6 +68,14 @@ struct swa_display_kms {
 		drmModePlanePtr* planes;
 		unsigned n_outputs;
 		struct swa_kms_output* outputs;
+
+		// Number of atomic commits and properties they contained since
+		// `since`, logged (and reset) about once per second.
+		struct {
+			struct timespec since;
+			unsigned commits;
+			unsigned props;
+		} stats;
 	} drm;
 
 	struct udev* udev;
@@ -75,7 +84,8 @@ struct swa_display_kms {
 
 	struct {
 		struct libinput* context;
-		struct pml_io* io;
+		struct pml_io* io; // not used with the input thread
+		struct swa_kms_input_thread* thread; // optional
 
 		struct {
 			bool present;
@@ -112,6 +122,16 @@ struct swa_kms_output {
 	uint32_t mode_id;
 	bool needs_modeset;
 
+	// State set by the last full commit, see pageflip. While it doesn't
+	// change, flips only have to set FB_ID (and the damage clips).
+	struct {
+		bool valid;
+		uint64_t width, height; // of the framebuffer
+		uint64_t rotation;
+	} committed;
+	// Atomic request reused for all flips on this output.
+	drmModeAtomicReq* req;
+
 	struct {
 		uint32_t id;
 		union drm_crtc_props props;
@@ -127,15 +147,21 @@ struct swa_kms_output {
 		union drm_plane_props props;
 	} primary_plane;
 
-	/*
 	struct {
-		uint32_t id;
+		uint32_t id; // 0 if the output doesn't have a cursor plane
 		union drm_plane_props props;
+		// Whether it's the plane legacy cursor ioctls (drmModeMoveCursor)
+		// on the CRTC act on, as far as we can tell. See output_init.
+		bool legacy;
 	} cursor_plane;
-	*/
+
+	// Whether a commit that only updated the cursor plane is in
+	// flight, see flush_cursor in kms.c.
+	bool cursor_pending;
 };
 
-// Dumb buffers always have linear format mod and drm XRGB8888 format
+// Dumb buffers always have linear format mod, the format of the
+// buffer surface buffers is given by swa_kms_buffer_surface::format.
 struct swa_kms_dumb_buffer {
 	void* data;
 	bool in_use;
@@ -143,18 +169,58 @@ struct swa_kms_dumb_buffer {
 	uint32_t fb_id;
 	uint64_t size;
 	uint32_t gem_handle;
+	// swa_kms_buffer_surface::frame when the buffer was last applied,
+	// 0 if its contents are undefined
+	uint64_t frame;
+	// Rows [dirty_begin, dirty_end) that changed in the shadow image
+	// since the buffer was last updated from it, see
+	// swa_buffer_surface_settings::shadow.
+	unsigned dirty_begin, dirty_end;
 };
 
 struct swa_kms_buffer_surface {
-	struct swa_kms_dumb_buffer buffers[3];
+	// Growable set of buffers, see win_get_buffer. The buffers are
+	// allocated separately so the pointers below stay valid.
+	unsigned n_bufs;
+	struct swa_kms_dumb_buffer** buffers;
 	struct swa_kms_dumb_buffer* active;
+	enum swa_image_format format; // format of all buffers
+	uint32_t drm_format; // drm fourcc of all buffers
+	unsigned bpp;
 
 	// a buffer we submitted for pageflip but the pageflip hasn't
 	// completed yet
 	struct swa_kms_dumb_buffer* pending;
+	// Mailbox: the newest buffer applied while another one was pending.
+	// Committed when the pending pageflip completes, replaced (and
+	// made available again) when another buffer is applied before that.
+	struct swa_kms_dumb_buffer* queued;
+	// Bounds of the damage of `queued` relative to `pending`, including
+	// the damage of the frames it replaced. Unused if queued_full is set.
+	struct swa_rect queued_damage;
+	bool queued_full;
 	// the currently active buffer, i.e. the last one for which the pageflip
 	// has completed
 	struct swa_kms_dumb_buffer* last;
+
+	// Size of the dumb buffers. Only differs from the mode size when
+	// the primary plane rotates them by 90 or 270 degrees.
+	unsigned width, height;
+
+	// See swa_buffer_surface_settings::rotation.
+	enum swa_image_rotation rotation;
+	// DRM_MODE_ROTATE_* value when the primary plane rotates the buffers,
+	// zero otherwise.
+	uint64_t plane_rotation;
+	// When the plane can't rotate the buffers or a shadow buffer was
+	// requested (see swa_buffer_surface_settings::shadow), the
+	// application draws into this image in system memory instead.
+	// win_apply_buffer rotates it into the dumb buffer or copies the
+	// changed rows. Data is NULL otherwise.
+	struct swa_image shadow;
+	bool rotate_shadow; // whether the shadow is rotated in software
+
+	uint64_t frame; // number of applied buffers
 };
 
 struct swa_kms_gl_surface {
@@ -169,6 +235,10 @@ struct swa_kms_gl_surface {
 
 	// The buffer that was rendered (and queued for pageflip) last.
 	struct gbm_bo* pending;
+
+	// Mailbox: the newest buffer swapped while another one was pending,
+	// see swa_kms_buffer_surface::queued.
+	struct gbm_bo* queued;
 };
 
 struct swa_kms_buffer_cursor {
@@ -177,7 +247,11 @@ struct swa_kms_buffer_cursor {
 	int hx;
 	int hy;
 	struct swa_kms_dumb_buffer buffer;
+	bool visible;
+	// Changes to the cursor plane not yet committed. `update` means
+	// the image or visibility changed, `moved` only the position.
 	bool update;
+	bool moved;
 };
 
 enum swa_kms_defer {
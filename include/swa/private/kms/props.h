@@ -41,6 +41,7 @@ union drm_plane_props {
 		uint32_t type;
 		uint32_t rotation; // Not guaranteed to exist
 		uint32_t in_formats; // Not guaranteed to exist
+		uint32_t fb_damage_clips; // Not guaranteed to exist
 
 		// atomic-modesetting only
 		uint32_t src_x;
@@ -54,7 +55,7 @@ union drm_plane_props {
 		uint32_t fb_id;
 		uint32_t crtc_id;
 	};
-	uint32_t props[13];
+	uint32_t props[14];
 };
 
 bool get_drm_connector_props(int fd, uint32_t id, union drm_connector_props *out);
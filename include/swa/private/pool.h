@@ -0,0 +1,17 @@
+#pragma once
+
+#include <swa/image.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Runs task(data, i) for all i in [0, count) on the image worker pool
+// (or the function set via swa_image_set_parallel_for) and waits
+// until all tasks have finished. The calling thread participates.
+// Concurrent calls are serialized, tasks must not call it themselves.
+void swa_parallel_for(unsigned count, swa_image_task task, void* data);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Shared memory arena used for the buffers and cursors of all windows
+// of a display, shared with the display server.
+// Backed by a single (on linux sealed memfd) file that is mapped once
+// with its maximum size, growing the arena just extends the file.
+// Pointers into `data` therefore stay valid until the arena is finished.
+// Backends share the file once and check `size` after allocating to
+// notice when it has grown, e.g. to resize their wl_shm_pool.
+struct swa_shm {
+	int fd;
+	uint8_t* data;
+	uint64_t size; // current size of the file
+	uint64_t max_size; // size of the mapping
+
+	// free blocks inside [0, size), sorted by offset
+	struct swa_shm_block {
+		uint64_t offset;
+		uint64_t size;
+	}* free;
+	unsigned n_free;
+	unsigned cap_free;
+};
+
+bool swa_shm_init(struct swa_shm*);
+void swa_shm_finish(struct swa_shm*);
+
+// Allocates `size` bytes from the arena, growing it if needed.
+// Returns false if the arena is full (or can't grow).
+// The memory is available at shm->data + *offset.
+bool swa_shm_alloc(struct swa_shm*, uint64_t size, uint64_t* offset);
+
+// Frees an allocation. `size` must be the size passed to swa_shm_alloc.
+void swa_shm_free(struct swa_shm*, uint64_t offset, uint64_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -2,6 +2,7 @@
 
 #include <swa/private/impl.h>
 #include <swa/private/xkb.h>
+#include <swa/private/shm.h>
 #include <stdint.h>
 #include <time.h>
 
@@ -34,6 +35,26 @@ struct swa_display_wl {
 
 	struct swa_xkb_context xkb;
 
+	// Shared memory arena for all buffers and cursor images, created
+	// on first use. Shared with the compositor through a single
+	// wl_shm_pool that is resized when the arena grows.
+	struct swa_shm shm_arena;
+	struct wl_shm_pool* shm_pool;
+	uint64_t shm_pool_size;
+	// Buffers that were destroyed while the compositor still used them.
+	// They are only freed on release, see buffer_finish.
+	struct swa_wl_buffer* orphans;
+
+	// optional wl_shm formats supported by the compositor.
+	// ARGB8888 and XRGB8888 are always supported.
+	struct {
+		bool rgb565;
+		bool xrgb2101010;
+		bool xbgr16161616f;
+		bool nv12;
+		bool yuv420;
+	} shm_formats;
+
 	const char* appname;
 	int wakeup_pipe_w, wakeup_pipe_r;
 	struct pml_io* wakeup_io;
@@ -80,6 +101,11 @@ struct swa_display_wl {
 	// and roundtripping) without dispatching normal events.
 	struct wl_event_queue* wl_queue;
 
+	// queue for the release events of all buffers. Allows to wait for
+	// buffers to be released in get_buffer without dispatching (and
+	// calling application listeners for) any other events.
+	struct wl_event_queue* buffer_queue;
+
 	struct swa_data_offer_wl* data_offer_list;
 	struct swa_data_offer_wl* selection;
 
@@ -95,15 +121,38 @@ struct swa_wl_touch_point {
 struct swa_wl_buffer {
 	struct wl_buffer* buffer;
 	uint32_t width, height;
+	uint32_t format; // wl_shm format
+	uint64_t offset; // in swa_display_wl::shm_arena
 	uint64_t size;
 	bool busy;
 	void* data;
+	// swa_wl_buffer_surface::frame when the buffer was last applied,
+	// 0 if its contents are undefined
+	uint64_t frame;
+	// window whose buffer surface uses this buffer, NULL for cursors
+	struct swa_window_wl* window;
+	struct swa_display_wl* dpy;
+	// whether this is a heap-allocated entry in swa_display_wl::orphans
+	bool orphan;
+	struct swa_wl_buffer* next_orphan;
 };
 
 struct swa_wl_buffer_surface {
+	// Fixed array of buffer slots, allocated once on window creation
+	// so the release listeners can reference the buffers.
+	// Slots without wl_buffer are unused.
 	unsigned n_bufs;
-	struct swa_wl_buffer* buffers; // list of all buffers
+	struct swa_wl_buffer* buffers;
 	int active; // index of active
+	bool wait; // see swa_buffer_surface_settings::nonblocking
+	// frees buffers left with an outdated size after a resize
+	struct pml_timer* stale_timer;
+	bool stale_pending; // whether stale_timer is armed
+	// emits buffer_available after a release, outside of get_buffer
+	struct pml_defer* defer_available;
+	uint32_t shm_format; // wl_shm format of the buffers, see win_get_buffer
+	enum swa_image_format format; // matching shm_format
+	uint64_t frame; // number of applied buffers
 };
 
 struct swa_wl_gl_surface {
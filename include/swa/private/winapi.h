@@ -45,6 +45,7 @@ struct swa_win_buffer_surface {
 	unsigned height;
 	HBITMAP bitmap;
 	bool active;
+	bool valid; // whether the bitmap holds the last applied frame
 	HDC wdc; // only set when buffer is active
 };
 
@@ -3,8 +3,10 @@
 #include <swa/swa.h>
 #include <swa/private/impl.h>
 #include <swa/private/xkb.h>
+#include <swa/private/shm.h>
 #include <xcb/xcb_ewmh.h>
 #include <xcb/present.h>
+#include <xcb/xfixes.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -54,8 +56,38 @@ struct swa_display_x11 {
 		uint8_t xinput;
 		uint8_t xkb;
 		bool shm;
+		bool shm_pixmaps; // shm supports pixmaps, for the present buffers
+		bool xv;
+		bool xfixes;
 	} ext;
 
+	// in bytes, only queried when shm isn't available
+	uint64_t max_request_size;
+
+	// Shared memory arena for the buffers of all windows, created on
+	// first use. The server only maps the size the file had when it
+	// was attached, so it gets attached as a new segment every time it
+	// grows. Older segments stay valid for the buffers allocated before.
+	struct {
+		struct swa_shm arena;
+		uint32_t* segs; // the last one covers the whole arena
+		unsigned n_segs;
+
+		// Allocations of destroyed windows the server might still
+		// read, see free_shm_orphans.
+		struct swa_x11_shm_orphan* orphans;
+		unsigned n_orphans;
+	} shm;
+
+	// Unchecked requests whose errors are reported with the request
+	// name when they arrive in the event loop, see track_request.
+	// Ring buffer, the oldest entry gets replaced.
+	struct {
+		uint32_t sequence;
+		const char* name;
+	} tracked[32];
+	unsigned n_tracked; // total number of tracked requests
+
 	struct {
 		xcb_atom_t clipboard;
 		xcb_atom_t targets;
@@ -92,9 +124,64 @@ struct swa_display_x11 {
 	} atoms;
 };
 
+// Allocation from swa_display_x11::shm.
+struct swa_x11_shm_alloc {
+	uint8_t* data;
+	uint64_t offset;
+	uint64_t size; // 0 if there is no allocation
+	uint32_t seg; // segment to use with offset
+};
+
+// Allocation that is freed when the server has processed the request
+// with the sequence number `sync` (that has a reply).
+struct swa_x11_shm_orphan {
+	struct swa_x11_shm_alloc alloc;
+	uint32_t sync;
+};
+
+// Buffer of the present pixmap ring, see swa_x11_buffer_surface.
+struct swa_x11_present_buffer {
+	struct swa_x11_shm_alloc shm;
+
+	xcb_pixmap_t pixmap; // 0 if not created yet
+	unsigned width, height; // size of the pixmap
+	uint32_t serial; // serial of the last xcb_present_pixmap
+	bool busy; // presented, waiting for the IdleNotify
+	// swa_x11_buffer_surface::frame when the pixmap was last presented,
+	// 0 if its contents are undefined
+	uint64_t frame;
+};
+
 struct swa_x11_buffer_surface {
+	// when using shm, bytes points into shm.data
 	void* bytes;
 	uint64_t n_bytes;
+	struct swa_x11_shm_alloc shm;
+
+	// rows of a partial update without shm, see put_image_rect
+	uint8_t* scratch;
+	uint64_t scratch_size;
+
+	// Number of applied buffers and what `bytes` holds, for the
+	// buffer age. contents.frame is 0 if the contents are undefined.
+	uint64_t frame;
+	struct {
+		uint64_t frame;
+		unsigned width, height;
+		bool xv;
+	} contents;
+
+	// Move of the window contents (with xcb_copy_area) for
+	// swa_window_scroll_buffer, done in the next apply_buffer.
+	struct {
+		bool pending;
+		xcb_rectangle_t rect; // destination
+		int dx, dy;
+
+		// Bounds of the scroll exposures received while the buffer was
+		// active, sent in the next apply_buffer. Empty if there are none.
+		struct swa_rect exposed;
+	} scroll;
 
 	enum swa_image_format format;
 	unsigned bytes_per_pixel;
@@ -102,9 +189,37 @@ struct swa_x11_buffer_surface {
 	xcb_gc_t gc;
 	bool active;
 
- 	// when using shm
-	unsigned int shmid;
-	uint32_t shmseg;
+	// XVideo port for presenting a preferred yuv format, requires shm.
+	// Only used when the layout of the xv image matches swa's,
+	// see query_xv_layout.
+	struct {
+		uint32_t port; // 0 if not used
+		uint32_t id; // fourcc of the xv image format
+		enum swa_image_format format;
+		bool active; // whether the active buffer uses xv
+
+		// layout for the current size
+		unsigned width, height;
+		unsigned stride; // 0 if not usable
+		uint64_t size;
+	} xv;
+
+	// When shm and present are available, buffers are shm pixmaps that
+	// are presented with xcb_present_pixmap instead of copying the
+	// single shm segment above into the window. A buffer is only reused
+	// after the server sent the IdleNotify for it. Those are received
+	// on their own special event queue so win_get_buffer can wait for them,
+	// display_dispatch polls it to emit buffer_available.
+	struct {
+		bool enabled;
+		xcb_present_event_t context;
+		xcb_special_event_t* events;
+		uint32_t serial;
+		struct swa_x11_present_buffer buffers[3];
+		struct swa_x11_present_buffer* active;
+		// region of the damage passed to apply_buffer, created on first use
+		xcb_xfixes_region_t update;
+	} present;
 };
 
 struct swa_x11_vk_surface {
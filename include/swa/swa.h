@@ -217,7 +217,49 @@ struct swa_buffer_surface_settings {
 	// images with this format.
 	// Applications can use swa_write_pixel or swa_convert_image to modify
 	// the returned buffer regardless which image format it has.
+	// Whether the backend expects premultiplied alpha is given by
+	// the returned format, see swa_image_format_is_premultiplied.
+	// rgb565 (to save memory bandwidth), xrgb2101010 and rgba16f
+	// are only used when requested here and supported by the backend.
+	// The planar yuv formats (nv12, i420) are an exception: when
+	// requested, swa_window_get_buffer always returns images with that
+	// format. Backends that can't present it natively get the
+	// buffer converted in swa_window_apply_buffer.
 	enum swa_image_format preferred_format;
+	// Clockwise rotation of the window contents on the output, e.g. for
+	// displays mounted in portrait orientation. The buffers returned by
+	// swa_window_get_buffer, the window size and all input positions are
+	// given in the rotated space, i.e. how the application sees it.
+	// Only implemented by the kms backend, the other backends ignore it
+	// since the compositor handles output transforms there.
+	enum swa_image_rotation rotation;
+	// For applications that can't track which parts of their buffers
+	// changed. When set, swa keeps a copy of the last applied frame and
+	// swa_window_apply_buffer only passes the 64x64 tiles that differ
+	// from it as damage to the backend (see swa_image_diff). This costs
+	// reading the whole buffer (and copying the changed parts) every
+	// frame but can save a lot of copying and compositing on mostly
+	// static contents. Damage passed to swa_window_apply_buffer_damage
+	// is used as is. Not supported for the planar yuv formats.
+	bool auto_damage;
+	// Maximum number of buffers the backend allocates for the window.
+	// 0 chooses the default of 3 (allowing triple buffering). Only
+	// used by the wayland backend, where the compositor can hold on
+	// to buffers for an arbitrary amount of time.
+	unsigned max_buffers;
+	// Lets the application render into a buffer in regular (cached)
+	// system memory instead of directly into the buffers that are shown.
+	// Those are often write-combined or uncached, making reading them
+	// (e.g. for blending) very slow. Applying the buffer then copies the
+	// damaged rows into them. Only used by the kms backend, the other
+	// backends always return system memory buffers.
+	// Not supported for the planar yuv formats.
+	bool shadow;
+	// When all buffers are still in use by the compositor,
+	// swa_window_get_buffer usually waits (for a short time) until one
+	// of them is released. When this is set, it fails immediately
+	// instead and applications can simply try again later.
+	bool nonblocking;
 };
 
 struct swa_window_settings {
@@ -392,6 +434,15 @@ struct swa_window_listener {
 
 	void (*surface_destroyed)(struct swa_window*);
 	void (*surface_created)(struct swa_window*);
+
+	// Called for windows with a buffer surface when the system released
+	// a buffer it was still using, i.e. a following call to
+	// `swa_window_get_buffer` will succeed without waiting.
+	// Allows fully event-driven rendering when `get_buffer` failed
+	// because all buffers were in use (see
+	// `swa_buffer_surface_settings::nonblocking`).
+	// Not emitted by backends that always have a buffer available.
+	void (*buffer_available)(struct swa_window*);
 };
 
 struct swa_exchange_data {
@@ -674,7 +725,11 @@ SWA_API bool swa_window_gl_set_swap_interval(struct swa_window*, int interval);
 // Only valid if the window was created with surface set to `swa_surface_buffer`.
 // Implementations might use multiple buffers to avoid flickering, i.e.
 // the caller should not expect two calls to `get_buffer` ever to
-// return the same image.
+// return the same image. See `get_buffer_age` to find out what the
+// returned image already contains.
+// The format of the returned image also defines the alpha convention
+// (straight or premultiplied) the backend expects. Applications
+// drawing with straight alpha can let swa_convert_image premultiply.
 // Returns false on error, in this case no valid image is returned
 // and `swa_window_apply_buffer` must not be called.
 // The returned image data is only valid until events are dispatched the
@@ -683,6 +738,16 @@ SWA_API bool swa_window_gl_set_swap_interval(struct swa_window*, int interval);
 // events again.
 SWA_API bool swa_window_get_buffer(struct swa_window*, struct swa_image*);
 
+// Returns the age of the image returned by the last call to `get_buffer`,
+// i.e. the number of frames since its current contents were applied.
+// 1 means it holds the contents of the previously applied buffer, 2 the
+// ones of the buffer applied before that and so on. 0 means the contents
+// are undefined and the whole image has to be redrawn.
+// Combined with the damage of previous frames (see
+// `apply_buffer_damage`) applications can only redraw what changed.
+// Must only be called between `get_buffer` and `apply_buffer`.
+SWA_API unsigned swa_window_get_buffer_age(struct swa_window*);
+
 // Only valid if the window was created with surface set to `buffer`.
 // Sets the window contents to the image data stored in the image
 // returned by the last call to `get_buffer`.
@@ -690,6 +755,35 @@ SWA_API bool swa_window_get_buffer(struct swa_window*, struct swa_image*);
 // call to `get_buffer`.
 SWA_API void swa_window_apply_buffer(struct swa_window*);
 
+// Moves the contents of `rect` in the image returned by the last call to
+// `get_buffer` by (dx, dy), e.g. to scroll a text or list view without
+// redrawing it. Contents moved outside of `rect` are discarded.
+// The contents that are moved are the ones of the previously applied
+// frame, even if the buffer holds an older one (see `get_buffer_age`).
+// Stores the parts of `rect` the application has to draw in `exposed`
+// and returns their number (at most 2). If the contents can't be moved,
+// e.g. because there is no previous frame, that is the whole `rect`.
+// The moved contents don't have to be included in the damage passed to
+// `apply_buffer_damage`, the exposed parts do. Backends may move them
+// on the server as well, e.g. with xcb_copy_area on x11.
+// Must only be called between `get_buffer` and `apply_buffer`.
+SWA_API unsigned swa_window_scroll_buffer(struct swa_window*,
+	const struct swa_rect* rect, int dx, int dy, struct swa_rect exposed[2]);
+
+// Like `apply_buffer` but additionally passes the regions of the buffer
+// that changed since the previously applied buffer, in buffer coordinates.
+// The buffer must still hold the complete contents, the damage allows
+// the backend to only copy (or the compositor to only recomposite) the
+// changed regions. Rectangles are clipped against the buffer size,
+// an empty rectangle can be passed if nothing changed.
+// If `n_rects` is zero, the whole buffer is considered damaged.
+// Backends without support for damage ignore it.
+// Parts of the window whose contents the system lost (e.g. because they
+// were uncovered, signaled via the `draw` listener callback) are added
+// to the damage automatically, they don't have to be passed.
+SWA_API void swa_window_apply_buffer_damage(struct swa_window*,
+	const struct swa_rect* rects, unsigned n_rects);
+
 // data offers
 typedef void (*swa_formats_handler)(struct swa_data_offer*,
 	const char** formats, unsigned n_formats);
@@ -635,7 +635,9 @@ static bool win_get_buffer(struct swa_window* base, struct swa_image* img) {
 	return true;
 }
 
-static void win_apply_buffer(struct swa_window* base) {
+// ANativeWindow has no damage api, the whole buffer is always posted.
+static void win_apply_buffer(struct swa_window* base,
+		const struct swa_rect* damage, unsigned n_damage) {
 	struct swa_window_android* win = get_window_android(base);
 	if(win->surface_type != swa_surface_buffer) {
 		dlg_error("Window doesn't have buffer surface");
@@ -663,6 +665,20 @@ static void win_apply_buffer(struct swa_window* base) {
 	win->buffer.active = false;
 }
 
+static unsigned win_get_buffer_age(struct swa_window* base) {
+	// ANativeWindow_lock doesn't tell us what the buffer contains
+	return 0u;
+}
+
+static const uint8_t* win_get_previous_buffer(struct swa_window* base) {
+	return NULL;
+}
+
+static bool win_scroll_buffer(struct swa_window* base,
+		const struct swa_rect* rect, int dx, int dy) {
+	return false;
+}
+
 static const struct swa_window_interface window_impl = {
 	.destroy = win_destroy,
 	.get_capabilities = win_get_capabilities,
@@ -684,6 +700,9 @@ static const struct swa_window_interface window_impl = {
 	.gl_swap_buffers = win_gl_swap_buffers,
 	.gl_set_swap_interval = win_gl_set_swap_interval,
 	.get_buffer = win_get_buffer,
+	.get_buffer_age = win_get_buffer_age,
+	.get_previous_buffer = win_get_previous_buffer,
+	.scroll_buffer = win_scroll_buffer,
 	.apply_buffer = win_apply_buffer
 };
 
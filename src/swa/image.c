@@ -0,0 +1,3300 @@
+#include <swa/image.h>
+#include <swa/private/pool.h>
+#include <dlg/dlg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "srgb-data.h"
+
+// We only use compiler-specific intrinsics and cpu detection with
+// gcc/clang. Other compilers (e.g. msvc) will use the scalar kernels
+// (or neon if available since that doesn't require runtime detection).
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define SWA_IMAGE_X86
+  #include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #define SWA_IMAGE_NEON
+  #include <arm_neon.h>
+#endif
+
+unsigned swa_image_format_size(enum swa_image_format fmt) {
+	switch(fmt) {
+		case swa_image_format_rgba32:
+		case swa_image_format_argb32:
+		case swa_image_format_xrgb32:
+		case swa_image_format_bgra32:
+		case swa_image_format_bgrx32:
+		case swa_image_format_abgr32:
+		case swa_image_format_rgba32_premul:
+		case swa_image_format_argb32_premul:
+		case swa_image_format_abgr32_premul:
+		case swa_image_format_bgra32_premul:
+		case swa_image_format_xrgb2101010:
+			return 4;
+		case swa_image_format_rgba16f:
+		case swa_image_format_rgba64:
+			return 8;
+		case swa_image_format_rgb24:
+		case swa_image_format_bgr24:
+			return 3;
+		case swa_image_format_rgb565:
+			return 2;
+		case swa_image_format_a8:
+		case swa_image_format_nv12:
+		case swa_image_format_i420:
+			return 1;
+		case swa_image_format_none:
+			return 0;
+	}
+
+	// unreachable for valid formats
+	// dont' put it in default so we get warnings about unhandled enum values
+	dlg_error("Invalid image format %d", fmt);
+	return 0;
+}
+
+bool swa_image_format_is_planar(enum swa_image_format fmt) {
+	return fmt == swa_image_format_nv12 || fmt == swa_image_format_i420;
+}
+
+size_t swa_image_data_size(const struct swa_image* img) {
+	size_t luma = (size_t) img->stride * img->height;
+	size_t chroma_rows = (img->height + 1) / 2;
+	switch(img->format) {
+		case swa_image_format_nv12:
+			return luma + chroma_rows * img->stride;
+		case swa_image_format_i420:
+			return luma + 2 * chroma_rows * (img->stride / 2);
+		default:
+			return luma;
+	}
+}
+
+struct swa_image swa_convert_image_new(const struct swa_image* src,
+		enum swa_image_format format, unsigned new_stride) {
+	dlg_assert(src);
+	dlg_assert(!src->width || !src->height || src->data);
+	if(new_stride == 0) {
+		new_stride = src->width * swa_image_format_size(format);
+	}
+
+	struct swa_image dst = {
+		.width = src->width,
+		.height = src->height,
+		.format = format,
+		.stride = new_stride,
+	};
+	dst.data = malloc(swa_image_data_size(&dst));
+	swa_convert_image(src, &dst);
+	return dst;
+}
+
+// Rounded a * b / 255 for a, b in [0, 255].
+static inline uint8_t mul_div255(unsigned a, unsigned b) {
+	unsigned t = a * b + 128;
+	return (uint8_t) ((t + (t >> 8)) >> 8);
+}
+
+// unpremul_factor[a] = ceil(255 * 2^16 / a).
+// With this, (c * unpremul_factor[a] + 2^15) >> 16 is exactly the rounded
+// value of c * 255 / a for all c < a.
+static const uint32_t unpremul_factor[256] = {
+	0u, 16711680u, 8355840u, 5570560u, 4177920u, 3342336u, 2785280u, 2387383u,
+	2088960u, 1856854u, 1671168u, 1519244u, 1392640u, 1285514u, 1193692u, 1114112u,
+	1044480u, 983040u, 928427u, 879563u, 835584u, 795795u, 759622u, 726595u,
+	696320u, 668468u, 642757u, 618952u, 596846u, 576265u, 557056u, 539087u,
+	522240u, 506415u, 491520u, 477477u, 464214u, 451668u, 439782u, 428505u,
+	417792u, 407602u, 397898u, 388644u, 379811u, 371371u, 363298u, 355568u,
+	348160u, 341055u, 334234u, 327680u, 321379u, 315315u, 309476u, 303849u,
+	298423u, 293188u, 288133u, 283249u, 278528u, 273962u, 269544u, 265265u,
+	261120u, 257103u, 253208u, 249429u, 245760u, 242199u, 238739u, 235376u,
+	232107u, 228928u, 225834u, 222823u, 219891u, 217035u, 214253u, 211541u,
+	208896u, 206318u, 203801u, 201346u, 198949u, 196608u, 194322u, 192089u,
+	189906u, 187772u, 185686u, 183645u, 181649u, 179696u, 177784u, 175913u,
+	174080u, 172286u, 170528u, 168805u, 167117u, 165463u, 163840u, 162250u,
+	160690u, 159159u, 157658u, 156184u, 154738u, 153319u, 151925u, 150556u,
+	149212u, 147891u, 146594u, 145319u, 144067u, 142835u, 141625u, 140435u,
+	139264u, 138114u, 136981u, 135868u, 134772u, 133694u, 132633u, 131589u,
+	130560u, 129548u, 128552u, 127571u, 126604u, 125652u, 124715u, 123791u,
+	122880u, 121984u, 121100u, 120228u, 119370u, 118523u, 117688u, 116865u,
+	116054u, 115253u, 114464u, 113685u, 112917u, 112159u, 111412u, 110674u,
+	109946u, 109227u, 108518u, 107818u, 107127u, 106444u, 105771u, 105105u,
+	104448u, 103800u, 103159u, 102526u, 101901u, 101283u, 100673u, 100070u,
+	99475u, 98886u, 98304u, 97730u, 97161u, 96600u, 96045u, 95496u,
+	94953u, 94417u, 93886u, 93362u, 92843u, 92330u, 91823u, 91321u,
+	90825u, 90334u, 89848u, 89368u, 88892u, 88422u, 87957u, 87496u,
+	87040u, 86590u, 86143u, 85701u, 85264u, 84831u, 84403u, 83979u,
+	83559u, 83143u, 82732u, 82324u, 81920u, 81521u, 81125u, 80733u,
+	80345u, 79961u, 79580u, 79203u, 78829u, 78459u, 78092u, 77729u,
+	77369u, 77013u, 76660u, 76310u, 75963u, 75619u, 75278u, 74941u,
+	74606u, 74275u, 73946u, 73620u, 73297u, 72977u, 72660u, 72345u,
+	72034u, 71724u, 71418u, 71114u, 70813u, 70514u, 70218u, 69924u,
+	69632u, 69344u, 69057u, 68773u, 68491u, 68211u, 67934u, 67659u,
+	67386u, 67116u, 66847u, 66581u, 66317u, 66055u, 65795u, 65536u
+};
+
+// Rounded c * 255 / a, i.e. the straight alpha value for a
+// premultiplied color component.
+static inline uint8_t unpremul(unsigned c, unsigned a) {
+	if(c >= a) {
+		return a ? 255 : 0;
+	}
+
+	return (uint8_t) ((c * unpremul_factor[a] + 0x8000u) >> 16);
+}
+
+static struct swa_pixel premultiply_pixel(struct swa_pixel p) {
+	p.r = mul_div255(p.r, p.a);
+	p.g = mul_div255(p.g, p.a);
+	p.b = mul_div255(p.b, p.a);
+	return p;
+}
+
+static struct swa_pixel unpremultiply_pixel(struct swa_pixel p) {
+	p.r = unpremul(p.r, p.a);
+	p.g = unpremul(p.g, p.a);
+	p.b = unpremul(p.b, p.a);
+	return p;
+}
+
+// The packed and half float formats don't fit the byte swizzles used
+// for the other formats. They are converted through an intermediate
+// row of straight rgba with 16 bits per component instead.
+static bool is_wide_format(enum swa_image_format fmt) {
+	return fmt == swa_image_format_rgb565 ||
+		fmt == swa_image_format_xrgb2101010 ||
+		fmt == swa_image_format_rgba16f ||
+		fmt == swa_image_format_rgba64;
+}
+
+// Ordered dithering thresholds, (bayer4x4[y][x] + 0.5) / 16 scaled
+// to [0, 65536).
+static const uint16_t dither_thresholds[4][4] = {
+	{2048, 34816, 10240, 43008},
+	{51200, 18432, 59392, 26624},
+	{14336, 47104, 6144, 38912},
+	{63488, 30720, 55296, 22528},
+};
+
+// Rounded (or dithered, when t is a threshold from above) v * max / 65535.
+// Uses an exact replacement for the division (for max <= 1023) that
+// the compiler can vectorize.
+static inline unsigned quantize(unsigned v, unsigned max, unsigned t) {
+	uint32_t x = v * max + t;
+	return (x + 1u + (x >> 16)) >> 16;
+}
+
+static inline unsigned expand(unsigned v, unsigned max) {
+	return (v * 65535u + max / 2) / max;
+}
+
+static float half_to_float(uint16_t h) {
+	uint32_t sign = (uint32_t) (h & 0x8000u) << 16;
+	uint32_t exp = (h >> 10) & 0x1Fu;
+	uint32_t mant = h & 0x3FFu;
+
+	float f;
+	if(exp == 0) { // zero or subnormal, mant * 2^-24
+		f = (float) mant * (1.f / 16777216.f);
+		return sign ? -f : f;
+	}
+
+	uint32_t bits = sign | (mant << 13);
+	bits |= (exp == 31) ? 0x7F800000u : (exp + 112) << 23;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+// Rounds to nearest even, like the f16c instructions.
+static uint16_t float_to_half(float f) {
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	uint16_t sign = (bits >> 16) & 0x8000u;
+	uint32_t abs = bits & 0x7FFFFFFFu;
+
+	if(abs > 0x7F800000u) { // nan
+		return sign | 0x7E00u;
+	} else if(abs >= 0x477FF000u) { // rounds to inf
+		return sign | 0x7C00u;
+	} else if(abs < 0x38800000u) { // subnormal in half precision
+		float a;
+		memcpy(&a, &abs, sizeof(a));
+		return sign | (uint16_t) (a * 16777216.f + 0.5f);
+	}
+
+	uint32_t h = (abs >> 13) - (112u << 10);
+	uint32_t rest = abs & 0x1FFFu;
+	if(rest > 0x1000u || (rest == 0x1000u && (h & 1u))) {
+		++h;
+	}
+
+	return sign | (uint16_t) h;
+}
+
+static inline uint16_t float_to_unorm16(float f) {
+	// written like this so that nan maps to 0
+	f = f > 0.f ? f : 0.f;
+	f = f < 1.f ? f : 1.f;
+	return (uint16_t) (f * 65535.f + 0.5f);
+}
+
+static void half_to_unorm16_scalar(const uint8_t* src, uint16_t* dst,
+		unsigned count) {
+	for(unsigned i = 0u; i < count; ++i) {
+		uint16_t h;
+		memcpy(&h, src + 2 * i, 2);
+		dst[i] = float_to_unorm16(half_to_float(h));
+	}
+}
+
+static void unorm16_to_half_scalar(const uint16_t* src, uint8_t* dst,
+		unsigned count) {
+	for(unsigned i = 0u; i < count; ++i) {
+		uint16_t h = float_to_half(src[i] * (1.f / 65535.f));
+		memcpy(dst + 2 * i, &h, 2);
+	}
+}
+
+#ifdef SWA_IMAGE_X86
+
+__attribute__((target("avx,f16c")))
+static void half_to_unorm16_f16c(const uint8_t* src, uint16_t* dst,
+		unsigned count) {
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 scale = _mm256_set1_ps(65535.f);
+
+	unsigned i = 0u;
+	for(; i + 8 <= count; i += 8) {
+		__m128i h = _mm_loadu_si128((const __m128i*) (src + 2 * i));
+		__m256 f = _mm256_cvtph_ps(h);
+		// max returns the second operand for nan
+		f = _mm256_min_ps(_mm256_max_ps(f, zero), one);
+		__m256i v = _mm256_cvtps_epi32(_mm256_mul_ps(f, scale));
+		__m128i lo = _mm256_castsi256_si128(v);
+		__m128i hi = _mm256_extractf128_si256(v, 1);
+		_mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi32(lo, hi));
+	}
+
+	_mm256_zeroupper(); // see row_swizzle_avx2
+	half_to_unorm16_scalar(src + 2 * i, dst + i, count - i);
+}
+
+__attribute__((target("avx,f16c")))
+static void unorm16_to_half_f16c(const uint16_t* src, uint8_t* dst,
+		unsigned count) {
+	const __m256 scale = _mm256_set1_ps(1.f / 65535.f);
+
+	unsigned i = 0u;
+	for(; i + 8 <= count; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+		__m128i lo = _mm_cvtepu16_epi32(v);
+		__m128i hi = _mm_cvtepu16_epi32(_mm_srli_si128(v, 8));
+		__m256 f = _mm256_cvtepi32_ps(_mm256_set_m128i(hi, lo));
+		__m128i h = _mm256_cvtps_ph(_mm256_mul_ps(f, scale),
+			_MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128((__m128i*) (dst + 2 * i), h);
+	}
+
+	_mm256_zeroupper(); // see row_swizzle_avx2
+	unorm16_to_half_scalar(src + i, dst + 2 * i, count - i);
+}
+
+// Rounded v / 257, i.e. quantize(v, 255, 32767), for `count` values.
+// (min(v + 128, 65535) * 0xFF01) >> 24 is exact for all 16-bit v.
+__attribute__((target("sse2")))
+static void unorm16_to_unorm8_sse2(const uint16_t* src, uint8_t* dst,
+		unsigned count) {
+	const __m128i half = _mm_set1_epi16(128);
+	const __m128i mul = _mm_set1_epi16((short) 0xFF01);
+
+	unsigned i = 0u;
+	for(; i + 16 <= count; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*) (src + i));
+		__m128i b = _mm_loadu_si128((const __m128i*) (src + i + 8));
+		a = _mm_srli_epi16(_mm_mulhi_epu16(_mm_adds_epu16(a, half), mul), 8);
+		b = _mm_srli_epi16(_mm_mulhi_epu16(_mm_adds_epu16(b, half), mul), 8);
+		_mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(a, b));
+	}
+
+	for(; i < count; ++i) {
+		dst[i] = quantize(src[i], 255u, 32767u);
+	}
+}
+
+#endif // SWA_IMAGE_X86
+
+// Unpacks `count` pixels of the given wide format into straight rgba16.
+static void unpack_wide(const uint8_t* src, enum swa_image_format fmt,
+		uint16_t* dst, unsigned count) {
+	switch(fmt) {
+		case swa_image_format_rgb565:
+			for(unsigned i = 0u; i < count; ++i) {
+				uint16_t v;
+				memcpy(&v, src + 2 * i, 2);
+				dst[4 * i + 0] = expand(v >> 11, 31u);
+				dst[4 * i + 1] = expand((v >> 5) & 0x3Fu, 63u);
+				dst[4 * i + 2] = expand(v & 0x1Fu, 31u);
+				dst[4 * i + 3] = 65535u;
+			}
+			break;
+		case swa_image_format_xrgb2101010:
+			for(unsigned i = 0u; i < count; ++i) {
+				uint32_t v;
+				memcpy(&v, src + 4 * i, 4);
+				dst[4 * i + 0] = expand((v >> 20) & 0x3FFu, 1023u);
+				dst[4 * i + 1] = expand((v >> 10) & 0x3FFu, 1023u);
+				dst[4 * i + 2] = expand(v & 0x3FFu, 1023u);
+				dst[4 * i + 3] = 65535u;
+			}
+			break;
+		case swa_image_format_rgba16f:
+#ifdef SWA_IMAGE_X86
+			if(__builtin_cpu_supports("f16c")) {
+				half_to_unorm16_f16c(src, dst, 4 * count);
+				break;
+			}
+#endif
+			half_to_unorm16_scalar(src, dst, 4 * count);
+			break;
+		case swa_image_format_rgba64:
+			memcpy(dst, src, 8 * count);
+			break;
+		default:
+			dlg_error("Invalid wide image format %d", fmt);
+			break;
+	}
+}
+
+// Packs `count` pixels of straight rgba16 into the given wide
+// format or rgba32. `dither` are the thresholds for the current
+// row (or NULL to round), `x` the column of the first pixel.
+static void pack_wide(const uint16_t* src, enum swa_image_format fmt,
+		uint8_t* dst, unsigned count, unsigned x, const uint16_t* dither) {
+	switch(fmt) {
+		case swa_image_format_rgba32:
+#ifdef SWA_IMAGE_X86
+			if(!dither && __builtin_cpu_supports("sse2")) {
+				unorm16_to_unorm8_sse2(src, dst, 4 * count);
+				break;
+			}
+#endif
+			for(unsigned i = 0u; i < count; ++i) {
+				unsigned t = dither ? dither[(x + i) & 3] : 32767u;
+				for(unsigned c = 0u; c < 4; ++c) {
+					dst[4 * i + c] = quantize(src[4 * i + c], 255u, t);
+				}
+			}
+			break;
+		case swa_image_format_rgb565:
+			for(unsigned i = 0u; i < count; ++i) {
+				unsigned t = dither ? dither[(x + i) & 3] : 32767u;
+				uint16_t v = (uint16_t) (
+					(quantize(src[4 * i + 0], 31u, t) << 11) |
+					(quantize(src[4 * i + 1], 63u, t) << 5) |
+					quantize(src[4 * i + 2], 31u, t));
+				memcpy(dst + 2 * i, &v, 2);
+			}
+			break;
+		case swa_image_format_xrgb2101010:
+			for(unsigned i = 0u; i < count; ++i) {
+				unsigned t = dither ? dither[(x + i) & 3] : 32767u;
+				uint32_t v = (3u << 30) |
+					(quantize(src[4 * i + 0], 1023u, t) << 20) |
+					(quantize(src[4 * i + 1], 1023u, t) << 10) |
+					quantize(src[4 * i + 2], 1023u, t);
+				memcpy(dst + 4 * i, &v, 4);
+			}
+			break;
+		case swa_image_format_rgba16f:
+#ifdef SWA_IMAGE_X86
+			if(__builtin_cpu_supports("f16c")) {
+				unorm16_to_half_f16c(src, dst, 4 * count);
+				break;
+			}
+#endif
+			unorm16_to_half_scalar(src, dst, 4 * count);
+			break;
+		case swa_image_format_rgba64:
+			memcpy(dst, src, 8 * count);
+			break;
+		default:
+			dlg_error("Invalid wide image format %d", fmt);
+			break;
+	}
+}
+
+// The sRGB transfer function is applied on the straight rgba16
+// intermediate rows of wide conversions, see swa_convert_flags_srgb_encode.
+// Instead of evaluating pow, values are interpolated between the entries
+// of the tables in srgb-data.h. Alpha is never touched.
+enum transfer_op {
+	transfer_op_none,
+	transfer_op_srgb_encode,
+	transfer_op_srgb_decode,
+};
+
+static inline uint16_t srgb_encode(unsigned v) {
+	unsigned i = v >> 6;
+	unsigned f = v & 63u;
+	unsigned lo = srgb_encode_table[i];
+	unsigned hi = srgb_encode_table[i + 1];
+	return (uint16_t) (lo + (((hi - lo) * f) >> 6));
+}
+
+static inline uint16_t srgb_decode(unsigned v) {
+	// the table has an entry for every 8-bit value, i.e. every
+	// multiple of 257. Those are returned exactly
+	unsigned i = v / 257u;
+	unsigned f = v - 257u * i;
+	unsigned lo = srgb_decode_table[i];
+	unsigned hi = srgb_decode_table[i + 1];
+	return (uint16_t) (lo + ((hi - lo) * f + 128u) / 257u);
+}
+
+static void srgb_encode_scalar(uint16_t* px, unsigned count) {
+	for(unsigned i = 0u; i < count; ++i) {
+		px[4 * i + 0] = srgb_encode(px[4 * i + 0]);
+		px[4 * i + 1] = srgb_encode(px[4 * i + 1]);
+		px[4 * i + 2] = srgb_encode(px[4 * i + 2]);
+	}
+}
+
+static void srgb_decode_scalar(uint16_t* px, unsigned count) {
+	for(unsigned i = 0u; i < count; ++i) {
+		px[4 * i + 0] = srgb_decode(px[4 * i + 0]);
+		px[4 * i + 1] = srgb_decode(px[4 * i + 1]);
+		px[4 * i + 2] = srgb_decode(px[4 * i + 2]);
+	}
+}
+
+#ifdef SWA_IMAGE_X86
+
+// Same as srgb_encode_scalar, two pixels at a time. A single 32-bit
+// gather at 16-bit granularity loads both neighboring table entries.
+// The difference between them is at most 827, i.e. multiplying
+// it with the 6-bit fraction fits into 16 bits.
+__attribute__((target("avx2")))
+static void srgb_encode_avx2(uint16_t* px, unsigned count) {
+	const __m256i frac_mask = _mm256_set1_epi32(63);
+	const __m256i lo_mask = _mm256_set1_epi32(0xFFFF);
+	const int* table = (const int*) srgb_encode_table;
+
+	unsigned i = 0u;
+	for(; i + 2 <= count; i += 2) {
+		__m128i in = _mm_loadu_si128((const __m128i*) (px + 4 * i));
+		__m256i v = _mm256_cvtepu16_epi32(in);
+		__m256i e = _mm256_i32gather_epi32(table, _mm256_srli_epi32(v, 6), 2);
+		__m256i lo = _mm256_and_si256(e, lo_mask);
+		__m256i hi = _mm256_srli_epi32(e, 16);
+		__m256i d = _mm256_mullo_epi16(_mm256_sub_epi32(hi, lo),
+			_mm256_and_si256(v, frac_mask));
+		__m256i res = _mm256_add_epi32(lo, _mm256_srli_epi32(d, 6));
+		res = _mm256_blend_epi32(res, v, 0x88); // keep alpha
+		__m128i out = _mm_packus_epi32(_mm256_castsi256_si128(res),
+			_mm256_extracti128_si256(res, 1));
+		_mm_storeu_si128((__m128i*) (px + 4 * i), out);
+	}
+
+	_mm256_zeroupper(); // see row_swizzle_avx2
+	srgb_encode_scalar(px + 4 * i, count - i);
+}
+
+#endif // SWA_IMAGE_X86
+
+static void apply_transfer(enum transfer_op op, uint16_t* px, unsigned count) {
+	switch(op) {
+		case transfer_op_srgb_encode:
+#ifdef SWA_IMAGE_X86
+			if(__builtin_cpu_supports("avx2")) {
+				srgb_encode_avx2(px, count);
+				break;
+			}
+#endif
+			srgb_encode_scalar(px, count);
+			break;
+		case transfer_op_srgb_decode:
+			srgb_decode_scalar(px, count);
+			break;
+		case transfer_op_none:
+			break;
+	}
+}
+
+// rgb565 is converted from/to the 8-bit formats via rgba32 instead,
+// which has enough precision and is a lot faster. This is the common
+// case when rendering into a 16-bit buffer surface.
+static inline unsigned div255(unsigned x) {
+	return (x + 1u + (x >> 8)) >> 8; // exact for x < 2^16
+}
+
+// Packs 4-byte pixels with the red, green and blue components at the
+// given byte offsets into rgb565. The alpha component is ignored.
+static void pack_rgb565_scalar(const uint8_t* src, const unsigned off[3],
+		uint8_t* dst, unsigned count, const uint8_t t[4]) {
+	for(unsigned i = 0u; i < count; ++i) {
+		unsigned ti = t[i & 3];
+		const uint8_t* s = src + 4 * i;
+		uint16_t v = (uint16_t) ((div255(s[off[0]] * 31u + ti) << 11) |
+			(div255(s[off[1]] * 63u + ti) << 5) |
+			div255(s[off[2]] * 31u + ti));
+		memcpy(dst + 2 * i, &v, 2);
+	}
+}
+
+#ifdef SWA_IMAGE_X86
+
+__attribute__((target("sse2")))
+static void pack_rgb565_sse2(const uint8_t* src, const unsigned off[3],
+		uint8_t* dst, unsigned count, const uint8_t t[4]) {
+	// multipliers and shifts for the 16-bit components of 2 pixels.
+	// Since we sum up all 4 components of a pixel below, this works
+	// for any component order
+	int16_t max[8] = {0}, shift[8] = {0};
+	for(unsigned p = 0u; p < 2; ++p) {
+		max[4 * p + off[0]] = 31;
+		max[4 * p + off[1]] = 63;
+		max[4 * p + off[2]] = 31;
+		shift[4 * p + off[0]] = 1 << 11;
+		shift[4 * p + off[1]] = 1 << 5;
+		shift[4 * p + off[2]] = 1;
+	}
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i vmax = _mm_loadu_si128((const __m128i*) max);
+	const __m128i vshift = _mm_loadu_si128((const __m128i*) shift);
+	const __m128i t01 = _mm_setr_epi16(t[0], t[0], t[0], t[0],
+		t[1], t[1], t[1], t[1]);
+	const __m128i t23 = _mm_setr_epi16(t[2], t[2], t[2], t[2],
+		t[3], t[3], t[3], t[3]);
+
+	// 4 pixels per iteration, so the thresholds stay in place
+	unsigned i = 0u;
+	for(; i + 4 <= count; i += 4) {
+		__m128i px = _mm_loadu_si128((const __m128i*) (src + 4 * i));
+		__m128i lo = _mm_unpacklo_epi8(px, zero);
+		__m128i hi = _mm_unpackhi_epi8(px, zero);
+		lo = _mm_add_epi16(_mm_mullo_epi16(lo, vmax), t01);
+		hi = _mm_add_epi16(_mm_mullo_epi16(hi, vmax), t23);
+		lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, one),
+			_mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, one),
+			_mm_srli_epi16(hi, 8)), 8);
+
+		// shift the components into place and add them up
+		lo = _mm_madd_epi16(lo, vshift);
+		hi = _mm_madd_epi16(hi, vshift);
+		lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+		hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+
+		// all values fit into 16 bit, gather the low halves
+		__m128i v = _mm_unpacklo_epi64(
+			_mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 3, 2, 0)),
+			_mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 3, 2, 0)));
+		v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 2, 0));
+		v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(3, 3, 2, 0));
+		v = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 2, 0));
+		_mm_storel_epi64((__m128i*) (dst + 2 * i), v);
+	}
+
+	pack_rgb565_scalar(src + 4 * i, off, dst + 2 * i, count - i, t);
+}
+
+#endif // SWA_IMAGE_X86
+
+// Packs into rgb565, see pack_rgb565_scalar.
+// `dither` and `x` like for pack_wide.
+static void pack_rgb565(const uint8_t* src, const unsigned off[3],
+		uint8_t* dst, unsigned count, unsigned x, const uint16_t* dither) {
+	uint8_t t[4];
+	for(unsigned i = 0u; i < 4; ++i) {
+		t[i] = dither ? dither[(x + i) & 3] >> 8 : 127u;
+	}
+
+#ifdef SWA_IMAGE_X86
+	if(__builtin_cpu_supports("sse2")) {
+		pack_rgb565_sse2(src, off, dst, count, t);
+		return;
+	}
+#endif
+
+	pack_rgb565_scalar(src, off, dst, count, t);
+}
+
+// Unpacks rgb565 into rgba32, rounding like swa_read_pixel.
+static void unpack_rgb565_scalar(const uint8_t* src, uint8_t* dst,
+		unsigned count) {
+	for(unsigned i = 0u; i < count; ++i) {
+		uint16_t v;
+		memcpy(&v, src + 2 * i, 2);
+		dst[4 * i + 0] = ((v >> 11) * 527u + 23u) >> 6;
+		dst[4 * i + 1] = (((v >> 5) & 0x3Fu) * 259u + 33u) >> 6;
+		dst[4 * i + 2] = ((v & 0x1Fu) * 527u + 23u) >> 6;
+		dst[4 * i + 3] = 255u;
+	}
+}
+
+#ifdef SWA_IMAGE_X86
+
+// Same as unpack_rgb565_scalar for 8 pixels at a time. All
+// intermediate products fit into 16 bits.
+__attribute__((target("sse2")))
+static void unpack_rgb565_sse2(const uint8_t* src, uint8_t* dst,
+		unsigned count) {
+	const __m128i mask5 = _mm_set1_epi16(0x1F);
+	const __m128i mask6 = _mm_set1_epi16(0x3F);
+	const __m128i mul5 = _mm_set1_epi16(527);
+	const __m128i mul6 = _mm_set1_epi16(259);
+	const __m128i add5 = _mm_set1_epi16(23);
+	const __m128i add6 = _mm_set1_epi16(33);
+	const __m128i alpha = _mm_set1_epi16((short) 0xFF00);
+
+	unsigned i = 0u;
+	for(; i + 8 <= count; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (src + 2 * i));
+		__m128i r = _mm_srli_epi16(v, 11);
+		__m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), mask6);
+		__m128i b = _mm_and_si128(v, mask5);
+		r = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(r, mul5), add5), 6);
+		g = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(g, mul6), add6), 6);
+		b = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(b, mul5), add5), 6);
+
+		__m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+		__m128i ba = _mm_or_si128(b, alpha);
+		_mm_storeu_si128((__m128i*) (dst + 4 * i), _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i*) (dst + 4 * i + 16), _mm_unpackhi_epi16(rg, ba));
+	}
+
+	unpack_rgb565_scalar(src + 2 * i, dst + 4 * i, count - i);
+}
+
+#endif // SWA_IMAGE_X86
+
+static void unpack_rgb565(const uint8_t* src, uint8_t* dst, unsigned count) {
+#ifdef SWA_IMAGE_X86
+	if(__builtin_cpu_supports("sse2")) {
+		unpack_rgb565_sse2(src, dst, count);
+		return;
+	}
+#endif
+
+	unpack_rgb565_scalar(src, dst, count);
+}
+
+void swa_write_pixel(uint8_t* data, enum swa_image_format fmt,
+		struct swa_pixel pixel) {
+	switch(fmt) {
+		case swa_image_format_rgba32:
+			data[0] = pixel.r;
+			data[1] = pixel.g;
+			data[2] = pixel.b;
+			data[3] = pixel.a;
+			break;
+		case swa_image_format_rgb24:
+			data[0] = pixel.r;
+			data[1] = pixel.g;
+			data[2] = pixel.b;
+			break;
+		case swa_image_format_bgr24:
+			data[0] = pixel.b;
+			data[1] = pixel.g;
+			data[2] = pixel.r;
+			break;
+		case swa_image_format_xrgb32:
+			data[0] = 255;
+			data[1] = pixel.r;
+			data[2] = pixel.g;
+			data[3] = pixel.b;
+			break;
+		case swa_image_format_argb32:
+			data[0] = pixel.a;
+			data[1] = pixel.r;
+			data[2] = pixel.g;
+			data[3] = pixel.b;
+			break;
+		case swa_image_format_abgr32:
+			data[0] = pixel.a;
+			data[1] = pixel.b;
+			data[2] = pixel.g;
+			data[3] = pixel.r;
+			break;
+		case swa_image_format_bgra32:
+			data[0] = pixel.b;
+			data[1] = pixel.g;
+			data[2] = pixel.r;
+			data[3] = pixel.a;
+			break;
+		case swa_image_format_bgrx32:
+			data[0] = pixel.b;
+			data[1] = pixel.g;
+			data[2] = pixel.r;
+			data[3] = 255;
+			break;
+		case swa_image_format_a8:
+			data[0] = pixel.a;
+			break;
+		case swa_image_format_rgba32_premul:
+		case swa_image_format_argb32_premul:
+		case swa_image_format_abgr32_premul:
+		case swa_image_format_bgra32_premul:
+			swa_write_pixel(data, swa_image_format_straight(fmt),
+				premultiply_pixel(pixel));
+			break;
+		case swa_image_format_rgb565:
+		case swa_image_format_xrgb2101010:
+		case swa_image_format_rgba16f:
+		case swa_image_format_rgba64: {
+			uint16_t wide[4] = {pixel.r * 257u, pixel.g * 257u,
+				pixel.b * 257u, pixel.a * 257u};
+			pack_wide(wide, fmt, data, 1u, 0u, NULL);
+			break;
+		} case swa_image_format_nv12:
+		case swa_image_format_i420:
+			dlg_warn("Can't write single pixels of planar formats");
+			break;
+		case swa_image_format_none:
+			break;
+	}
+}
+
+struct swa_pixel swa_read_pixel(const uint8_t* data, enum swa_image_format fmt) {
+	switch(fmt) {
+		case swa_image_format_rgba32:
+			return (struct swa_pixel){data[0], data[1], data[2], data[3]};
+		case swa_image_format_rgb24:
+			return (struct swa_pixel){data[0], data[1], data[2], 255};
+		case swa_image_format_bgr24:
+			return (struct swa_pixel){data[2], data[1], data[0], 255};
+		case swa_image_format_xrgb32:
+			return (struct swa_pixel){data[1], data[2], data[3], 255};
+		case swa_image_format_argb32:
+			return (struct swa_pixel){data[1], data[2], data[3], data[0]};
+		case swa_image_format_abgr32:
+			return (struct swa_pixel){data[3], data[2], data[1], data[0]};
+		case swa_image_format_bgra32:
+			return (struct swa_pixel){data[2], data[1], data[0], data[3]};
+		case swa_image_format_bgrx32:
+			return (struct swa_pixel){data[2], data[1], data[0], 255};
+		case swa_image_format_a8:
+			return (struct swa_pixel){data[0], data[0], data[0], data[0]};
+		case swa_image_format_rgba32_premul:
+		case swa_image_format_argb32_premul:
+		case swa_image_format_abgr32_premul:
+		case swa_image_format_bgra32_premul:
+			return unpremultiply_pixel(swa_read_pixel(data,
+				swa_image_format_straight(fmt)));
+		case swa_image_format_rgb565:
+		case swa_image_format_xrgb2101010:
+		case swa_image_format_rgba16f:
+		case swa_image_format_rgba64: {
+			uint16_t wide[4];
+			uint8_t rgba[4];
+			unpack_wide(data, fmt, wide, 1u);
+			pack_wide(wide, swa_image_format_rgba32, rgba, 1u, 0u, NULL);
+			return (struct swa_pixel){rgba[0], rgba[1], rgba[2], rgba[3]};
+		} case swa_image_format_nv12:
+		case swa_image_format_i420:
+			dlg_warn("Can't read single pixels of planar formats");
+			return (struct swa_pixel){0, 0, 0, 0};
+		case swa_image_format_none:
+			return (struct swa_pixel){0, 0, 0, 0};
+	}
+
+	// unreachable for valid formats
+	// dont' put it in default so we get warnings about unhandled enum values
+	dlg_error("Invalid image format %d", fmt);
+	return (struct swa_pixel){0, 0, 0, 0};
+}
+
+// Conversion between two formats is described as a swizzle: for
+// every byte of a destination pixel we store the offset of the source
+// byte it is copied from (or -1 if the byte is filled with 255).
+// This covers all formats swa_read_pixel and swa_write_pixel support
+// with the exact same semantics, e.g. a8 expands into all channels
+// and missing alpha or padding bytes are filled with 255.
+// When converting between straight and premultiplied alpha, the
+// kernels additionally (un-)premultiply the color bytes in the
+// same pass.
+enum channel {
+	channel_r,
+	channel_g,
+	channel_b,
+	channel_a,
+	channel_x, // padding
+};
+
+struct format_layout {
+	unsigned size;
+	enum channel bytes[4];
+	bool premul;
+};
+
+enum alpha_op {
+	alpha_op_none,
+	alpha_op_premultiply, // multiply dst color bytes with dst[alpha]
+	alpha_op_unpremultiply, // divide dst color bytes by src[alpha]
+};
+
+struct swizzle {
+	unsigned src_size;
+	unsigned dst_size;
+	int map[4];
+
+	enum alpha_op alpha_op;
+	int alpha; // offset of the alpha byte, see alpha_op
+	unsigned color_mask; // bit i set if dst byte i holds a color value
+
+	// pshufb masks for 4 pixels used by the x86 kernels, built once
+	// in init_swizzle since conversions may call the kernels per chunk
+	uint8_t shuffle[16];
+	uint8_t fill[16];
+	uint8_t alpha_shuffle[16];
+	uint8_t alpha_fill[16];
+};
+
+typedef void (*row_kernel)(const uint8_t* src, uint8_t* dst,
+	unsigned width, const struct swizzle*);
+
+static bool format_layout(enum swa_image_format fmt, struct format_layout* out) {
+	switch(fmt) {
+		case swa_image_format_rgba32:
+			*out = (struct format_layout){4, {channel_r, channel_g, channel_b, channel_a}, false};
+			return true;
+		case swa_image_format_rgb24:
+			*out = (struct format_layout){3, {channel_r, channel_g, channel_b}, false};
+			return true;
+		case swa_image_format_bgr24:
+			*out = (struct format_layout){3, {channel_b, channel_g, channel_r}, false};
+			return true;
+		case swa_image_format_xrgb32:
+			*out = (struct format_layout){4, {channel_x, channel_r, channel_g, channel_b}, false};
+			return true;
+		case swa_image_format_argb32:
+			*out = (struct format_layout){4, {channel_a, channel_r, channel_g, channel_b}, false};
+			return true;
+		case swa_image_format_abgr32:
+			*out = (struct format_layout){4, {channel_a, channel_b, channel_g, channel_r}, false};
+			return true;
+		case swa_image_format_bgra32:
+			*out = (struct format_layout){4, {channel_b, channel_g, channel_r, channel_a}, false};
+			return true;
+		case swa_image_format_bgrx32:
+			*out = (struct format_layout){4, {channel_b, channel_g, channel_r, channel_x}, false};
+			return true;
+		case swa_image_format_a8:
+			*out = (struct format_layout){1, {channel_a}, false};
+			return true;
+		case swa_image_format_rgba32_premul:
+		case swa_image_format_argb32_premul:
+		case swa_image_format_abgr32_premul:
+		case swa_image_format_bgra32_premul:
+			format_layout(swa_image_format_straight(fmt), out);
+			out->premul = true;
+			return true;
+		case swa_image_format_rgb565:
+		case swa_image_format_xrgb2101010:
+		case swa_image_format_rgba16f:
+		case swa_image_format_rgba64:
+		case swa_image_format_nv12:
+		case swa_image_format_i420:
+		case swa_image_format_none:
+			return false;
+	}
+
+	dlg_error("Invalid image format %d", fmt);
+	return false;
+}
+
+static int channel_offset(const struct format_layout* layout, enum channel c) {
+	for(unsigned i = 0u; i < layout->size; ++i) {
+		if(layout->bytes[i] == c) {
+			return i;
+		}
+	}
+
+	// a8 expands into all channels, see swa_read_pixel
+	if(layout->size == 1 && layout->bytes[0] == channel_a) {
+		return 0;
+	}
+
+	return -1;
+}
+
+// Builds a pshufb mask (and the bytes that have to be or'ed
+// afterwards) for `count` consecutive pixels.
+static void build_shuffle(const struct swizzle* swz, unsigned count,
+		uint8_t shuffle[16], uint8_t fill[16]) {
+	memset(shuffle, 0x80, 16);
+	memset(fill, 0, 16);
+	for(unsigned p = 0u; p < count; ++p) {
+		for(unsigned i = 0u; i < swz->dst_size; ++i) {
+			unsigned d = p * swz->dst_size + i;
+			int m = swz->map[i];
+			if(m < 0) {
+				fill[d] = 0xFF;
+			} else {
+				shuffle[d] = (uint8_t) (p * swz->src_size + m);
+			}
+		}
+	}
+}
+
+// Builds a pshufb mask that broadcasts the alpha byte of each of
+// the 4 destination pixels to its color bytes. The alpha byte
+// itself is set to 0xFF via `alpha_fill`, i.e. multiplied with 255.
+// Only used for alpha_op_premultiply, where dst_size is always 4.
+static void build_alpha_shuffle(const struct swizzle* swz,
+		uint8_t shuffle[16], uint8_t alpha_fill[16]) {
+	memset(alpha_fill, 0, 16);
+	for(unsigned p = 0u; p < 4; ++p) {
+		for(unsigned i = 0u; i < 4; ++i) {
+			shuffle[4 * p + i] = (uint8_t) (4 * p + swz->alpha);
+		}
+
+		shuffle[4 * p + swz->alpha] = 0x80;
+		alpha_fill[4 * p + swz->alpha] = 0xFF;
+	}
+}
+
+static bool init_swizzle(enum swa_image_format src, enum swa_image_format dst,
+		struct swizzle* swz) {
+	struct format_layout src_layout, dst_layout;
+	if(!format_layout(src, &src_layout) || !format_layout(dst, &dst_layout)) {
+		return false;
+	}
+
+	swz->src_size = src_layout.size;
+	swz->dst_size = dst_layout.size;
+	swz->color_mask = 0u;
+	for(unsigned i = 0u; i < 4; ++i) {
+		swz->map[i] = -1;
+		if(i < dst_layout.size && dst_layout.bytes[i] != channel_x) {
+			swz->map[i] = channel_offset(&src_layout, dst_layout.bytes[i]);
+			if(dst_layout.bytes[i] != channel_a) {
+				swz->color_mask |= (1u << i);
+			}
+		}
+	}
+
+	// formats without alpha are treated as opaque and never need
+	// (un-)premultiplication. Premultiplied formats always have alpha
+	swz->alpha_op = alpha_op_none;
+	int src_alpha = channel_offset(&src_layout, channel_a);
+	if(swz->color_mask && src_alpha >= 0) {
+		if(dst_layout.premul && !src_layout.premul) {
+			swz->alpha_op = alpha_op_premultiply;
+			swz->alpha = channel_offset(&dst_layout, channel_a);
+		} else if(src_layout.premul && !dst_layout.premul) {
+			swz->alpha_op = alpha_op_unpremultiply;
+			swz->alpha = src_alpha;
+		}
+	}
+
+	build_shuffle(swz, 4, swz->shuffle, swz->fill);
+	memset(swz->alpha_shuffle, 0, 16);
+	memset(swz->alpha_fill, 0, 16);
+	if(swz->alpha_op == alpha_op_premultiply) {
+		build_alpha_shuffle(swz, swz->alpha_shuffle, swz->alpha_fill);
+	}
+
+	return true;
+}
+
+static void row_copy(const uint8_t* src, uint8_t* dst, unsigned width,
+		const struct swizzle* swz) {
+	memcpy(dst, src, width * swz->src_size);
+}
+
+static void row_swizzle_alpha_scalar(const uint8_t* src, uint8_t* dst,
+		unsigned width, const struct swizzle* swz) {
+	const unsigned src_size = swz->src_size;
+	const unsigned dst_size = swz->dst_size;
+	const unsigned alpha = (unsigned) swz->alpha;
+	const bool premul = swz->alpha_op == alpha_op_premultiply;
+	int map[4];
+	memcpy(map, swz->map, sizeof(map));
+
+	for(unsigned x = 0u; x < width; ++x) {
+		for(unsigned i = 0u; i < dst_size; ++i) {
+			dst[i] = map[i] < 0 ? 255 : src[map[i]];
+		}
+
+		unsigned a = premul ? dst[alpha] : src[alpha];
+		for(unsigned i = 0u; i < dst_size; ++i) {
+			if(swz->color_mask & (1u << i)) {
+				dst[i] = premul ? mul_div255(dst[i], a) : unpremul(dst[i], a);
+			}
+		}
+
+		src += src_size;
+		dst += dst_size;
+	}
+}
+
+static void row_swizzle_scalar(const uint8_t* src, uint8_t* dst,
+		unsigned width, const struct swizzle* swz) {
+	if(swz->alpha_op != alpha_op_none) {
+		row_swizzle_alpha_scalar(src, dst, width, swz);
+		return;
+	}
+
+	const unsigned src_size = swz->src_size;
+	const unsigned dst_size = swz->dst_size;
+	int map[4];
+	memcpy(map, swz->map, sizeof(map));
+
+	for(unsigned x = 0u; x < width; ++x) {
+		for(unsigned i = 0u; i < dst_size; ++i) {
+			dst[i] = map[i] < 0 ? 255 : src[map[i]];
+		}
+
+		src += src_size;
+		dst += dst_size;
+	}
+}
+
+#ifdef SWA_IMAGE_X86
+
+// Rounded division by 255 of 16-bit products, see mul_div255.
+__attribute__((target("sse2")))
+static inline __m128i div255_epu16(__m128i t) {
+	t = _mm_add_epi16(t, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i premultiply_ssse3(__m128i px, __m128i alpha_shuffle,
+		__m128i alpha_fill) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = _mm_or_si128(_mm_shuffle_epi8(px, alpha_shuffle), alpha_fill);
+	__m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(px, zero),
+		_mm_unpacklo_epi8(a, zero));
+	__m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(px, zero),
+		_mm_unpackhi_epi8(a, zero));
+	return _mm_packus_epi16(div255_epu16(lo), div255_epu16(hi));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i div255_epu16_avx2(__m256i t) {
+	t = _mm256_add_epi16(t, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i premultiply_avx2(__m256i px, __m256i alpha_shuffle,
+		__m256i alpha_fill) {
+	// unpack and pack both work per 128-bit lane, so this
+	// keeps the pixel order intact
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i a = _mm256_or_si256(_mm256_shuffle_epi8(px, alpha_shuffle), alpha_fill);
+	__m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(px, zero),
+		_mm256_unpacklo_epi8(a, zero));
+	__m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(px, zero),
+		_mm256_unpackhi_epi8(a, zero));
+	return _mm256_packus_epi16(div255_epu16_avx2(lo), div255_epu16_avx2(hi));
+}
+
+// Stores the lower 4 * dst_size bytes of the given vector.
+__attribute__((target("sse2")))
+static inline void store_4px(uint8_t* dst, __m128i v, unsigned dst_size) {
+	switch(dst_size) {
+		case 4:
+			_mm_storeu_si128((__m128i*) dst, v);
+			break;
+		case 3: {
+			_mm_storel_epi64((__m128i*) dst, v);
+			uint32_t rest = (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+			memcpy(dst + 8, &rest, 4);
+			break;
+		} case 1: {
+			uint32_t val = (uint32_t) _mm_cvtsi128_si32(v);
+			memcpy(dst, &val, 4);
+			break;
+		}
+	}
+}
+
+// sse2 has no byte shuffle so we only handle 32-bit to 32-bit
+// conversions here, using per-byte shifts.
+__attribute__((target("sse2")))
+static void row_swizzle44_sse2(const uint8_t* src, uint8_t* dst,
+		unsigned width, const struct swizzle* swz) {
+	uint32_t keep = 0u;
+	uint32_t fill = 0u;
+	unsigned n_moves = 0u;
+	__m128i counts[4];
+	__m128i masks[4];
+	bool right[4];
+
+	for(unsigned i = 0u; i < 4; ++i) {
+		int m = swz->map[i];
+		if(m < 0) {
+			fill |= 0xFFu << (8 * i);
+		} else if(m == (int) i) {
+			keep |= 0xFFu << (8 * i);
+		} else {
+			right[n_moves] = m > (int) i;
+			int shift = 8 * (right[n_moves] ? m - (int) i : (int) i - m);
+			counts[n_moves] = _mm_cvtsi32_si128(shift);
+			masks[n_moves] = _mm_set1_epi32((int) (0xFFu << (8 * i)));
+			++n_moves;
+		}
+	}
+
+	const __m128i vkeep = _mm_set1_epi32((int) keep);
+	const __m128i vfill = _mm_set1_epi32((int) fill);
+
+	unsigned x = 0u;
+	for(; x + 4 <= width; x += 4) {
+		__m128i in = _mm_loadu_si128((const __m128i*) (src + 4 * x));
+		__m128i out = _mm_or_si128(_mm_and_si128(in, vkeep), vfill);
+		for(unsigned i = 0u; i < n_moves; ++i) {
+			__m128i moved = right[i] ?
+				_mm_srl_epi32(in, counts[i]) :
+				_mm_sll_epi32(in, counts[i]);
+			out = _mm_or_si128(out, _mm_and_si128(moved, masks[i]));
+		}
+		_mm_storeu_si128((__m128i*) (dst + 4 * x), out);
+	}
+
+	row_swizzle_scalar(src + 4 * x, dst + 4 * x, width - x, swz);
+}
+
+__attribute__((target("ssse3")))
+static void row_swizzle_ssse3(const uint8_t* src, uint8_t* dst,
+		unsigned width, const struct swizzle* swz) {
+	const __m128i vshuffle = _mm_loadu_si128((const __m128i*) swz->shuffle);
+	const __m128i vfill = _mm_loadu_si128((const __m128i*) swz->fill);
+
+	const bool premul = swz->alpha_op == alpha_op_premultiply;
+	const __m128i valpha_shuffle = _mm_loadu_si128(
+		(const __m128i*) swz->alpha_shuffle);
+	const __m128i valpha_fill = _mm_loadu_si128((const __m128i*) swz->alpha_fill);
+
+	const unsigned src_size = swz->src_size;
+	const unsigned dst_size = swz->dst_size;
+
+	// we always load 16 bytes, make sure to not read past the row
+	unsigned x = 0u;
+	for(; x * src_size + 16 <= width * src_size; x += 4) {
+		__m128i in = _mm_loadu_si128((const __m128i*) (src + src_size * x));
+		__m128i out = _mm_or_si128(_mm_shuffle_epi8(in, vshuffle), vfill);
+		if(premul) {
+			out = premultiply_ssse3(out, valpha_shuffle, valpha_fill);
+		}
+		store_4px(dst + dst_size * x, out, dst_size);
+	}
+
+	row_swizzle_scalar(src + src_size * x, dst + dst_size * x, width - x, swz);
+}
+
+__attribute__((target("avx2")))
+static void row_swizzle_avx2(const uint8_t* src, uint8_t* dst,
+		unsigned width, const struct swizzle* swz) {
+	// vpshufb shuffles both 128-bit lanes independently
+	const __m256i vshuffle = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i*) swz->shuffle));
+	const __m256i vfill = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i*) swz->fill));
+
+	const bool premul = swz->alpha_op == alpha_op_premultiply;
+	const __m256i valpha_shuffle = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i*) swz->alpha_shuffle));
+	const __m256i valpha_fill = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i*) swz->alpha_fill));
+
+	const unsigned src_size = swz->src_size;
+	const unsigned dst_size = swz->dst_size;
+
+	unsigned x = 0u;
+	if(src_size == 4 && dst_size == 4) {
+		for(; x + 8 <= width; x += 8) {
+			__m256i in = _mm256_loadu_si256((const __m256i*) (src + 4 * x));
+			__m256i out = _mm256_or_si256(_mm256_shuffle_epi8(in, vshuffle), vfill);
+			if(premul) {
+				out = premultiply_avx2(out, valpha_shuffle, valpha_fill);
+			}
+			_mm256_storeu_si256((__m256i*) (dst + 4 * x), out);
+		}
+	} else {
+		// we need 4 source pixels in each lane, load them separately
+		for(; (x + 4) * src_size + 16 <= width * src_size; x += 8) {
+			const uint8_t* s = src + src_size * x;
+			__m256i in = _mm256_inserti128_si256(
+				_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) s)),
+				_mm_loadu_si128((const __m128i*) (s + 4 * src_size)), 1);
+			__m256i out = _mm256_or_si256(_mm256_shuffle_epi8(in, vshuffle), vfill);
+			if(premul) {
+				out = premultiply_avx2(out, valpha_shuffle, valpha_fill);
+			}
+
+			uint8_t* d = dst + dst_size * x;
+			store_4px(d, _mm256_castsi256_si128(out), dst_size);
+			store_4px(d + 4 * dst_size, _mm256_extracti128_si256(out, 1), dst_size);
+		}
+	}
+
+	// The scalar kernels are compiled without avx, gcc doesn't clear the
+	// upper register halves before the tail call. Executing sse code with
+	// dirty upper halves is very slow on most cpus.
+	_mm256_zeroupper();
+	row_swizzle_scalar(src + src_size * x, dst + dst_size * x, width - x, swz);
+}
+
+// Unpremultiplies two 4-byte pixels, given as 8 32-bit integers.
+// Uses a float division (instead of gathering from the lookup table,
+// gathers are really slow on many cpus). Since both c * 255 and a are
+// exact and the division is correctly rounded, rounding the quotient
+// gives exactly the same results as unpremul.
+__attribute__((target("avx2")))
+static inline __m256i unpremultiply_2px_avx2(__m256i c, __m256i alpha_idx,
+		__m256i alpha_mask) {
+	__m256i a = _mm256_permutevar8x32_epi32(c, alpha_idx);
+	__m256 q = _mm256_div_ps(
+		_mm256_mul_ps(_mm256_cvtepi32_ps(c), _mm256_set1_ps(255.f)),
+		_mm256_cvtepi32_ps(a));
+
+	// c >= a gives q >= 255 (or nan/inf if a is 0, min returns 255
+	// for nan as well). Alpha itself stays the same
+	q = _mm256_min_ps(_mm256_add_ps(q, _mm256_set1_ps(0.5f)), _mm256_set1_ps(255.f));
+	__m256i r = _mm256_cvttps_epi32(q);
+	r = _mm256_andnot_si256(_mm256_cmpeq_epi32(a, _mm256_setzero_si256()), r);
+	return _mm256_blendv_epi8(r, c, alpha_mask);
+}
+
+// Unpremultiplies `width` 4-byte pixels, with alpha at byte `alpha`.
+__attribute__((target("avx2")))
+static void unpremultiply_avx2(const uint8_t* src, uint8_t* dst,
+		unsigned width, unsigned alpha) {
+	const __m256i alpha_idx = _mm256_setr_epi32(alpha, alpha, alpha, alpha,
+		4 + alpha, 4 + alpha, 4 + alpha, 4 + alpha);
+	const __m256i alpha_mask = _mm256_setr_epi32(
+		alpha == 0 ? -1 : 0, alpha == 1 ? -1 : 0, alpha == 2 ? -1 : 0,
+		alpha == 3 ? -1 : 0, alpha == 0 ? -1 : 0, alpha == 1 ? -1 : 0,
+		alpha == 2 ? -1 : 0, alpha == 3 ? -1 : 0);
+
+	unsigned x = 0u;
+	for(; x + 8 <= width; x += 8) {
+		__m256i in = _mm256_loadu_si256((const __m256i*) (src + 4 * x));
+		__m128i lo = _mm256_castsi256_si128(in);
+		__m128i hi = _mm256_extracti128_si256(in, 1);
+
+		__m256i r0 = unpremultiply_2px_avx2(_mm256_cvtepu8_epi32(lo),
+			alpha_idx, alpha_mask);
+		__m256i r1 = unpremultiply_2px_avx2(_mm256_cvtepu8_epi32(
+			_mm_srli_si128(lo, 8)), alpha_idx, alpha_mask);
+		__m256i r2 = unpremultiply_2px_avx2(_mm256_cvtepu8_epi32(hi),
+			alpha_idx, alpha_mask);
+		__m256i r3 = unpremultiply_2px_avx2(_mm256_cvtepu8_epi32(
+			_mm_srli_si128(hi, 8)), alpha_idx, alpha_mask);
+
+		// packing works per 128-bit lane, restore the order afterwards
+		__m256i r01 = _mm256_permute4x64_epi64(_mm256_packus_epi32(r0, r1), 0xD8);
+		__m256i r23 = _mm256_permute4x64_epi64(_mm256_packus_epi32(r2, r3), 0xD8);
+		__m256i out = _mm256_permute4x64_epi64(_mm256_packus_epi16(r01, r23), 0xD8);
+		_mm256_storeu_si256((__m256i*) (dst + 4 * x), out);
+	}
+
+	for(; x < width; ++x) {
+		const uint8_t* s = src + 4 * x;
+		uint8_t* d = dst + 4 * x;
+		for(unsigned i = 0u; i < 4; ++i) {
+			d[i] = i == alpha ? s[i] : unpremul(s[i], s[alpha]);
+		}
+	}
+}
+
+// Unpremultiplies chunks of the source row into a small buffer that
+// stays in the L1 cache and swizzles from there.
+__attribute__((target("avx2")))
+static void row_swizzle_unpremul_avx2(const uint8_t* src, uint8_t* dst,
+		unsigned width, const struct swizzle* swz) {
+	enum { chunk = 256 };
+	uint8_t tmp[4 * chunk];
+
+	struct swizzle plain = *swz;
+	plain.alpha_op = alpha_op_none;
+
+	for(unsigned x = 0u; x < width; x += chunk) {
+		unsigned count = width - x < chunk ? width - x : chunk;
+		unpremultiply_avx2(src + 4 * x, tmp, count, (unsigned) swz->alpha);
+		row_swizzle_avx2(tmp, dst + swz->dst_size * x, count, &plain);
+	}
+}
+
+#endif // SWA_IMAGE_X86
+
+#ifdef SWA_IMAGE_NEON
+
+// Rounded c * a / 255, see mul_div255.
+static inline uint8x16_t premultiply_neon(uint8x16_t c, uint8x16_t a) {
+	uint16x8_t lo = vmull_u8(vget_low_u8(c), vget_low_u8(a));
+	uint16x8_t hi = vmull_u8(vget_high_u8(c), vget_high_u8(a));
+	return vcombine_u8(
+		vraddhn_u16(lo, vrshrq_n_u16(lo, 8)),
+		vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+}
+
+// neon has interleaved loads/stores for 1, 3 and 4 byte pixels,
+// so every conversion is just a permutation of the loaded planes.
+static void row_swizzle_neon(const uint8_t* src, uint8_t* dst,
+		unsigned width, const struct swizzle* swz) {
+	const unsigned src_size = swz->src_size;
+	const unsigned dst_size = swz->dst_size;
+	const uint8x16_t ff = vdupq_n_u8(255);
+
+	unsigned x = 0u;
+	for(; x + 16 <= width; x += 16) {
+		const uint8_t* s = src + src_size * x;
+		uint8_t* d = dst + dst_size * x;
+
+		uint8x16_t in[4];
+		if(src_size == 4) {
+			uint8x16x4_t v = vld4q_u8(s);
+			in[0] = v.val[0];
+			in[1] = v.val[1];
+			in[2] = v.val[2];
+			in[3] = v.val[3];
+		} else if(src_size == 3) {
+			uint8x16x3_t v = vld3q_u8(s);
+			in[0] = v.val[0];
+			in[1] = v.val[1];
+			in[2] = v.val[2];
+		} else {
+			in[0] = vld1q_u8(s);
+		}
+
+		uint8x16_t out[4];
+		for(unsigned i = 0u; i < dst_size; ++i) {
+			out[i] = swz->map[i] < 0 ? ff : in[swz->map[i]];
+		}
+
+		if(swz->alpha_op == alpha_op_premultiply) {
+			uint8x16_t a = out[swz->alpha];
+			for(unsigned i = 0u; i < dst_size; ++i) {
+				if(swz->color_mask & (1u << i)) {
+					out[i] = premultiply_neon(out[i], a);
+				}
+			}
+		}
+
+		if(dst_size == 4) {
+			uint8x16x4_t v = {{out[0], out[1], out[2], out[3]}};
+			vst4q_u8(d, v);
+		} else if(dst_size == 3) {
+			uint8x16x3_t v = {{out[0], out[1], out[2]}};
+			vst3q_u8(d, v);
+		} else {
+			vst1q_u8(d, out[0]);
+		}
+	}
+
+	row_swizzle_scalar(src + src_size * x, dst + dst_size * x, width - x, swz);
+}
+
+#endif // SWA_IMAGE_NEON
+
+// Selects the fastest row kernel for the given conversion on
+// the current cpu. Returns NULL if no conversion is possible.
+static row_kernel select_row_kernel(enum swa_image_format src,
+		enum swa_image_format dst, struct swizzle* swz) {
+	if(!init_swizzle(src, dst, swz)) {
+		return NULL;
+	}
+
+	if(src == dst) {
+		return row_copy;
+	}
+
+	// unpremultiplying needs a division per component, we only
+	// vectorized it for avx2, using float divisions
+	if(swz->alpha_op == alpha_op_unpremultiply) {
+#ifdef SWA_IMAGE_X86
+		if(__builtin_cpu_supports("avx2")) {
+			return row_swizzle_unpremul_avx2;
+		}
+#endif
+		return row_swizzle_scalar;
+	}
+
+#ifdef SWA_IMAGE_X86
+	if(__builtin_cpu_supports("avx2")) {
+		return row_swizzle_avx2;
+	} else if(__builtin_cpu_supports("ssse3")) {
+		return row_swizzle_ssse3;
+	} else if(swz->src_size == 4 && swz->dst_size == 4 &&
+			swz->alpha_op == alpha_op_none &&
+			__builtin_cpu_supports("sse2")) {
+		return row_swizzle44_sse2;
+	}
+#elif defined(SWA_IMAGE_NEON)
+	return row_swizzle_neon;
+#endif
+
+	return row_swizzle_scalar;
+}
+
+// Parallel conversions are split into bands of rows with roughly this
+// many bytes (read and written) so that each band fits into the
+// per-core caches.
+static const size_t band_size = 256 * 1024;
+
+// Images smaller than this are always converted serially, the
+// synchronization overhead would dominate otherwise.
+static const size_t parallel_min_size = 2 * 1024 * 1024;
+
+struct convert_job {
+	const uint8_t* src;
+	uint8_t* dst;
+	unsigned src_stride;
+	unsigned dst_stride;
+	unsigned width;
+	unsigned height;
+	enum swa_image_format src_format;
+	enum swa_image_format dst_format;
+	unsigned src_size;
+	unsigned dst_size;
+	row_kernel kernel;
+	struct swizzle swz;
+	unsigned band_rows;
+	bool inplace; // src and dst are the same, with equal format size
+
+	// Conversions from/to wide formats, see is_wide_format.
+	// When the source isn't a wide format, kernel and swz are used to
+	// convert it to rgba32 first. When the destination isn't a wide
+	// format, pack_kernel and pack_swz convert from rgba32 to it.
+	// A transfer function is applied on the rgba16 intermediate, such
+	// conversions are always wide. When `narrow` is set, rgb565 is
+	// converted from/to rgba32 directly instead of using the rgba16
+	// intermediate. Straight 4-byte sources are packed directly, using
+	// rgb565_offsets.
+	bool wide;
+	bool narrow;
+	bool dither;
+	enum transfer_op transfer;
+	unsigned rgb565_offsets[3];
+	row_kernel pack_kernel;
+	struct swizzle pack_swz;
+};
+
+// Number of pixels converted at once via the intermediate rgba16 row.
+enum { wide_chunk = 128 };
+
+// Converts `count` <= wide_chunk pixels starting at column x of row y
+// of a wide job.
+static void convert_span_wide(const struct convert_job* job,
+		const uint8_t* src, uint8_t* dst, unsigned x, unsigned y,
+		unsigned count) {
+	uint16_t wide[4 * wide_chunk];
+	uint8_t tmp[4 * wide_chunk];
+	const uint16_t* dither = job->dither ? dither_thresholds[y & 3] : NULL;
+
+	if(job->narrow) {
+		if(job->dst_format == swa_image_format_rgb565) {
+			if(job->kernel) {
+				job->kernel(src, tmp, count, &job->swz);
+				src = tmp;
+			}
+
+			pack_rgb565(src, job->rgb565_offsets, dst, count, x, dither);
+		} else {
+			unpack_rgb565(src, tmp, count);
+			job->pack_kernel(tmp, dst, count, &job->pack_swz);
+		}
+
+		return;
+	}
+
+	if(job->kernel) {
+		job->kernel(src, tmp, count, &job->swz);
+		for(unsigned i = 0u; i < 4 * count; ++i) {
+			wide[i] = tmp[i] * 257u;
+		}
+	} else {
+		unpack_wide(src, job->src_format, wide, count);
+	}
+
+	apply_transfer(job->transfer, wide, count);
+	if(job->pack_kernel) {
+		pack_wide(wide, swa_image_format_rgba32, tmp, count, x, dither);
+		job->pack_kernel(tmp, dst, count, &job->pack_swz);
+	} else {
+		pack_wide(wide, job->dst_format, dst, count, x, dither);
+	}
+}
+
+// Converts `count` <= wide_chunk pixels starting at column x of row y.
+static void convert_span(const struct convert_job* job,
+		const uint8_t* src, uint8_t* dst, unsigned x, unsigned y,
+		unsigned count) {
+	if(job->wide) {
+		convert_span_wide(job, src, dst, x, y, count);
+	} else {
+		job->kernel(src, dst, count, &job->swz);
+	}
+}
+
+static void convert_row_wide(const struct convert_job* job,
+		const uint8_t* src, uint8_t* dst, unsigned y) {
+	for(unsigned x = 0u; x < job->width; x += wide_chunk) {
+		unsigned count = job->width - x;
+		count = count < wide_chunk ? count : wide_chunk;
+		convert_span_wide(job, src + x * job->src_size,
+			dst + x * job->dst_size, x, y, count);
+	}
+}
+
+// The kernels don't support overlapping src and dst, so in-place
+// conversions go through a small buffer. It stays in the L1 cache,
+// copying it back is cheap compared to the conversion itself.
+static void convert_row_inplace(const struct convert_job* job,
+		uint8_t* row, unsigned y) {
+	uint8_t tmp[8 * wide_chunk];
+	for(unsigned x = 0u; x < job->width; x += wide_chunk) {
+		unsigned count = job->width - x;
+		count = count < wide_chunk ? count : wide_chunk;
+
+		uint8_t* px = row + x * job->src_size;
+		convert_span(job, px, tmp, x, y, count);
+		memcpy(px, tmp, count * job->dst_size);
+	}
+}
+
+static void convert_rows(const struct convert_job* job,
+		unsigned y0, unsigned y1) {
+	const uint8_t* src = job->src + (size_t) y0 * job->src_stride;
+	uint8_t* dst = job->dst + (size_t) y0 * job->dst_stride;
+	for(unsigned y = y0; y < y1; ++y) {
+		if(job->inplace) {
+			convert_row_inplace(job, dst, y);
+		} else if(job->wide) {
+			convert_row_wide(job, src, dst, y);
+		} else {
+			job->kernel(src, dst, job->width, &job->swz);
+		}
+
+		src += job->src_stride;
+		dst += job->dst_stride;
+	}
+}
+
+static void convert_band(void* data, unsigned index) {
+	const struct convert_job* job = data;
+	unsigned y0 = index * job->band_rows;
+	unsigned y1 = y0 + job->band_rows;
+	convert_rows(job, y0, y1 < job->height ? y1 : job->height);
+}
+
+// Initializes the kernels of the given job. Returns false if
+// no conversion between the formats is possible.
+static bool init_convert_job(struct convert_job* job,
+		enum swa_image_format src, enum swa_image_format dst,
+		enum swa_convert_flags flags) {
+	job->src_format = src;
+	job->dst_format = dst;
+	job->src_size = swa_image_format_size(src);
+	job->dst_size = swa_image_format_size(dst);
+	if(!job->src_size || !job->dst_size) {
+		return false;
+	}
+
+	// planar sources are handled by convert_yuv
+	if(swa_image_format_is_planar(src) || swa_image_format_is_planar(dst)) {
+		return false;
+	}
+
+	enum swa_convert_flags transfer_flags = flags &
+		(swa_convert_flags_srgb_encode | swa_convert_flags_srgb_decode);
+	if(transfer_flags == swa_convert_flags_srgb_encode) {
+		job->transfer = transfer_op_srgb_encode;
+	} else if(transfer_flags == swa_convert_flags_srgb_decode) {
+		job->transfer = transfer_op_srgb_decode;
+	} else if(transfer_flags) {
+		dlg_warn("Can't both encode and decode sRGB, ignoring both");
+	}
+
+	if(src == dst && !job->transfer) {
+		job->swz.src_size = job->dst_size;
+		job->kernel = row_copy;
+		return true;
+	}
+
+	if(!is_wide_format(src) && !is_wide_format(dst) && !job->transfer) {
+		job->kernel = select_row_kernel(src, dst, &job->swz);
+		return job->kernel != NULL;
+	}
+
+	job->wide = true;
+	job->dither = (flags & swa_convert_flags_dither);
+
+	struct format_layout layout;
+	if(dst == swa_image_format_rgb565 && !job->transfer &&
+			format_layout(src, &layout)) {
+		job->narrow = true;
+		if(layout.size == 4 && !layout.premul) {
+			job->rgb565_offsets[0] = channel_offset(&layout, channel_r);
+			job->rgb565_offsets[1] = channel_offset(&layout, channel_g);
+			job->rgb565_offsets[2] = channel_offset(&layout, channel_b);
+			return true;
+		}
+
+		job->kernel = select_row_kernel(src, swa_image_format_rgba32, &job->swz);
+		job->rgb565_offsets[0] = 0u;
+		job->rgb565_offsets[1] = 1u;
+		job->rgb565_offsets[2] = 2u;
+		return true;
+	}
+
+	if(!is_wide_format(src)) {
+		job->kernel = select_row_kernel(src, swa_image_format_rgba32, &job->swz);
+	}
+
+	if(!is_wide_format(dst)) {
+		job->pack_kernel = select_row_kernel(swa_image_format_rgba32, dst,
+			&job->pack_swz);
+	}
+
+	job->narrow = (src == swa_image_format_rgb565 && job->pack_kernel &&
+		!job->transfer);
+	return true;
+}
+
+static void run_convert_job(struct convert_job* job,
+		enum swa_convert_flags flags) {
+	size_t row_bytes = (size_t) job->width * (job->src_size + job->dst_size);
+	size_t total = row_bytes * job->height;
+	if(!(flags & swa_convert_flags_parallel) || total < parallel_min_size) {
+		convert_rows(job, 0, job->height);
+		return;
+	}
+
+	size_t rows = band_size / row_bytes;
+	job->band_rows = rows ? (unsigned) rows : 1u;
+	unsigned n_bands = (job->height + job->band_rows - 1) / job->band_rows;
+	swa_parallel_for(n_bands, convert_band, job);
+}
+
+// Conversion from the planar yuv formats. Each row is converted to
+// rgba32 in chunks of wide_chunk pixels which are then converted
+// to the destination format using a regular job.
+// We use the integer approximation of BT.601 (limited range) from
+// https://docs.microsoft.com/en-us/windows/win32/medfound/recommended-8-bit-yuv-formats-for-video-rendering
+// The vectorized kernels use slightly different rounding, results
+// may differ by 1.
+typedef void (*yuv_kernel)(const uint8_t* y, const uint8_t* u,
+	const uint8_t* v, uint8_t* dst, unsigned count);
+
+static inline uint8_t clamp_yuv(int v) {
+	v >>= 8;
+	return v < 0 ? 0u : v > 255 ? 255u : (uint8_t) v;
+}
+
+static inline void yuv_to_rgba(unsigned y, unsigned u, unsigned v,
+		uint8_t* dst) {
+	int c = 298 * ((int) y - 16) + 128;
+	int d = (int) u - 128;
+	int e = (int) v - 128;
+	dst[0] = clamp_yuv(c + 409 * e);
+	dst[1] = clamp_yuv(c - 100 * d - 208 * e);
+	dst[2] = clamp_yuv(c + 516 * d);
+	dst[3] = 255u;
+}
+
+static void nv12_to_rgba32_scalar(const uint8_t* y, const uint8_t* uv,
+		const uint8_t* unused, uint8_t* dst, unsigned count) {
+	(void) unused;
+	for(unsigned i = 0u; i < count; ++i) {
+		yuv_to_rgba(y[i], uv[i & ~1u], uv[i | 1u], dst + 4 * i);
+	}
+}
+
+static void i420_to_rgba32_scalar(const uint8_t* y, const uint8_t* u,
+		const uint8_t* v, uint8_t* dst, unsigned count) {
+	for(unsigned i = 0u; i < count; ++i) {
+		yuv_to_rgba(y[i], u[i / 2], v[i / 2], dst + 4 * i);
+	}
+}
+
+#ifdef SWA_IMAGE_X86
+
+// The vectorized kernels compute the formula above with 16-bit lanes:
+// samples are shifted left by 7 and multiplied with the coefficients
+// (scaled by 4) using mulhrs, the final sum is then divided by 4.
+// E.g. 1192 = 298 * 4, 1636 = 409 * 4.
+__attribute__((target("ssse3")))
+static inline void yuv_to_rgba32_8px_ssse3(__m128i y8, __m128i u8,
+		__m128i v8, uint8_t* dst) {
+	const __m128i cy = _mm_set1_epi16(1192), crv = _mm_set1_epi16(1636),
+		cgu = _mm_set1_epi16(400), cgv = _mm_set1_epi16(832),
+		cbu = _mm_set1_epi16(2064), c16 = _mm_set1_epi16(16 << 7),
+		c128 = _mm_set1_epi16(128 << 7), two = _mm_set1_epi16(2);
+	const __m128i zero = _mm_setzero_si128();
+
+	__m128i y = _mm_sub_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(y8, zero), 7), c16);
+	__m128i u = _mm_sub_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(u8, zero), 7), c128);
+	__m128i v = _mm_sub_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(v8, zero), 7), c128);
+
+	y = _mm_add_epi16(_mm_mulhrs_epi16(y, cy), two);
+	__m128i r = _mm_add_epi16(y, _mm_mulhrs_epi16(v, crv));
+	__m128i g = _mm_sub_epi16(y, _mm_add_epi16(_mm_mulhrs_epi16(u, cgu),
+		_mm_mulhrs_epi16(v, cgv)));
+	__m128i b = _mm_add_epi16(y, _mm_mulhrs_epi16(u, cbu));
+
+	r = _mm_srai_epi16(r, 2);
+	g = _mm_srai_epi16(g, 2);
+	b = _mm_srai_epi16(b, 2);
+
+	__m128i rg = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_packus_epi16(g, g));
+	__m128i ba = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_set1_epi8(-1));
+	_mm_storeu_si128((__m128i*) dst, _mm_unpacklo_epi16(rg, ba));
+	_mm_storeu_si128((__m128i*) (dst + 16), _mm_unpackhi_epi16(rg, ba));
+}
+
+__attribute__((target("ssse3")))
+static void nv12_to_rgba32_ssse3(const uint8_t* y, const uint8_t* uv,
+		const uint8_t* unused, uint8_t* dst, unsigned count) {
+	const __m128i u_dup = _mm_setr_epi8(0, 0, 2, 2, 4, 4, 6, 6,
+		-1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i v_dup = _mm_setr_epi8(1, 1, 3, 3, 5, 5, 7, 7,
+		-1, -1, -1, -1, -1, -1, -1, -1);
+
+	unsigned i = 0u;
+	for(; i + 8 <= count; i += 8) {
+		__m128i y8 = _mm_loadl_epi64((const __m128i*) (y + i));
+		__m128i uv8 = _mm_loadl_epi64((const __m128i*) (uv + i));
+		yuv_to_rgba32_8px_ssse3(y8, _mm_shuffle_epi8(uv8, u_dup),
+			_mm_shuffle_epi8(uv8, v_dup), dst + 4 * i);
+	}
+
+	nv12_to_rgba32_scalar(y + i, uv + i, unused, dst + 4 * i, count - i);
+}
+
+__attribute__((target("ssse3")))
+static void i420_to_rgba32_ssse3(const uint8_t* y, const uint8_t* u,
+		const uint8_t* v, uint8_t* dst, unsigned count) {
+	unsigned i = 0u;
+	for(; i + 8 <= count; i += 8) {
+		int32_t u4, v4;
+		memcpy(&u4, u + i / 2, 4);
+		memcpy(&v4, v + i / 2, 4);
+		__m128i u8 = _mm_cvtsi32_si128(u4);
+		__m128i v8 = _mm_cvtsi32_si128(v4);
+		__m128i y8 = _mm_loadl_epi64((const __m128i*) (y + i));
+		yuv_to_rgba32_8px_ssse3(y8, _mm_unpacklo_epi8(u8, u8),
+			_mm_unpacklo_epi8(v8, v8), dst + 4 * i);
+	}
+
+	i420_to_rgba32_scalar(y + i, u + i / 2, v + i / 2, dst + 4 * i, count - i);
+}
+
+// Same as the ssse3 version but for 16 pixels. The packs and unpacks
+// work per 128-bit lane, the permutes at the end restore the order.
+__attribute__((target("avx2")))
+static inline void yuv_to_rgba32_16px_avx2(__m128i y8, __m128i u8,
+		__m128i v8, uint8_t* dst) {
+	const __m256i cy = _mm256_set1_epi16(1192), crv = _mm256_set1_epi16(1636),
+		cgu = _mm256_set1_epi16(400), cgv = _mm256_set1_epi16(832),
+		cbu = _mm256_set1_epi16(2064), c16 = _mm256_set1_epi16(16 << 7),
+		c128 = _mm256_set1_epi16(128 << 7), two = _mm256_set1_epi16(2);
+
+	__m256i y = _mm256_sub_epi16(_mm256_slli_epi16(_mm256_cvtepu8_epi16(y8), 7), c16);
+	__m256i u = _mm256_sub_epi16(_mm256_slli_epi16(_mm256_cvtepu8_epi16(u8), 7), c128);
+	__m256i v = _mm256_sub_epi16(_mm256_slli_epi16(_mm256_cvtepu8_epi16(v8), 7), c128);
+
+	y = _mm256_add_epi16(_mm256_mulhrs_epi16(y, cy), two);
+	__m256i r = _mm256_add_epi16(y, _mm256_mulhrs_epi16(v, crv));
+	__m256i g = _mm256_sub_epi16(y, _mm256_add_epi16(
+		_mm256_mulhrs_epi16(u, cgu), _mm256_mulhrs_epi16(v, cgv)));
+	__m256i b = _mm256_add_epi16(y, _mm256_mulhrs_epi16(u, cbu));
+
+	r = _mm256_srai_epi16(r, 2);
+	g = _mm256_srai_epi16(g, 2);
+	b = _mm256_srai_epi16(b, 2);
+
+	__m256i rg = _mm256_unpacklo_epi8(_mm256_packus_epi16(r, r),
+		_mm256_packus_epi16(g, g));
+	__m256i ba = _mm256_unpacklo_epi8(_mm256_packus_epi16(b, b),
+		_mm256_set1_epi8(-1));
+	__m256i lo = _mm256_unpacklo_epi16(rg, ba);
+	__m256i hi = _mm256_unpackhi_epi16(rg, ba);
+	_mm256_storeu_si256((__m256i*) dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+	_mm256_storeu_si256((__m256i*) (dst + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+__attribute__((target("avx2")))
+static void nv12_to_rgba32_avx2(const uint8_t* y, const uint8_t* uv,
+		const uint8_t* unused, uint8_t* dst, unsigned count) {
+	const __m128i u_dup = _mm_setr_epi8(0, 0, 2, 2, 4, 4, 6, 6,
+		8, 8, 10, 10, 12, 12, 14, 14);
+	const __m128i v_dup = _mm_setr_epi8(1, 1, 3, 3, 5, 5, 7, 7,
+		9, 9, 11, 11, 13, 13, 15, 15);
+
+	unsigned i = 0u;
+	for(; i + 16 <= count; i += 16) {
+		__m128i y8 = _mm_loadu_si128((const __m128i*) (y + i));
+		__m128i uv8 = _mm_loadu_si128((const __m128i*) (uv + i));
+		yuv_to_rgba32_16px_avx2(y8, _mm_shuffle_epi8(uv8, u_dup),
+			_mm_shuffle_epi8(uv8, v_dup), dst + 4 * i);
+	}
+
+	_mm256_zeroupper(); // see row_swizzle_avx2
+	nv12_to_rgba32_ssse3(y + i, uv + i, unused, dst + 4 * i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void i420_to_rgba32_avx2(const uint8_t* y, const uint8_t* u,
+		const uint8_t* v, uint8_t* dst, unsigned count) {
+	unsigned i = 0u;
+	for(; i + 16 <= count; i += 16) {
+		__m128i u8 = _mm_loadl_epi64((const __m128i*) (u + i / 2));
+		__m128i v8 = _mm_loadl_epi64((const __m128i*) (v + i / 2));
+		__m128i y8 = _mm_loadu_si128((const __m128i*) (y + i));
+		yuv_to_rgba32_16px_avx2(y8, _mm_unpacklo_epi8(u8, u8),
+			_mm_unpacklo_epi8(v8, v8), dst + 4 * i);
+	}
+
+	_mm256_zeroupper(); // see row_swizzle_avx2
+	i420_to_rgba32_ssse3(y + i, u + i / 2, v + i / 2, dst + 4 * i, count - i);
+}
+
+#endif // SWA_IMAGE_X86
+
+static yuv_kernel select_yuv_kernel(enum swa_image_format fmt) {
+	bool nv12 = (fmt == swa_image_format_nv12);
+#ifdef SWA_IMAGE_X86
+	if(__builtin_cpu_supports("avx2")) {
+		return nv12 ? nv12_to_rgba32_avx2 : i420_to_rgba32_avx2;
+	} else if(__builtin_cpu_supports("ssse3")) {
+		return nv12 ? nv12_to_rgba32_ssse3 : i420_to_rgba32_ssse3;
+	}
+#endif
+	return nv12 ? nv12_to_rgba32_scalar : i420_to_rgba32_scalar;
+}
+
+struct yuv_job {
+	const struct swa_image* src;
+	struct swa_rect rect; // converted part of src
+	uint8_t* dst;
+	unsigned dst_stride;
+	yuv_kernel kernel;
+	struct convert_job pack; // rgba32 to the destination format
+	bool direct; // destination is rgba32, pack isn't needed
+	unsigned band_rows;
+};
+
+static void convert_yuv_rows(const struct yuv_job* job,
+		unsigned y0, unsigned y1) {
+	const struct swa_image* src = job->src;
+	const uint8_t* chroma = src->data + (size_t) src->stride * src->height;
+	bool nv12 = (src->format == swa_image_format_nv12);
+	unsigned chroma_stride = nv12 ? src->stride : src->stride / 2;
+	size_t v_offset = (size_t) chroma_stride * ((src->height + 1) / 2);
+
+	// Spans always start at an even column since two pixels share their
+	// chroma samples, i.e. we might have to convert one more pixel.
+	uint8_t tmp[4 * (wide_chunk + 1)];
+	for(unsigned y = y0; y < y1; ++y) {
+		unsigned sy = job->rect.y + y;
+		const uint8_t* luma_row = src->data + (size_t) sy * src->stride;
+		const uint8_t* u_row = chroma + (size_t) (sy / 2) * chroma_stride;
+		uint8_t* dst = job->dst + (size_t) y * job->dst_stride;
+
+		for(unsigned x = 0u; x < job->rect.width; x += wide_chunk) {
+			unsigned count = job->rect.width - x;
+			count = count < wide_chunk ? count : wide_chunk;
+
+			unsigned sx = job->rect.x + x;
+			unsigned skip = sx & 1u;
+			unsigned start = sx - skip;
+			unsigned n = skip + count;
+
+			unsigned coff = nv12 ? start : start / 2;
+			uint8_t* out = tmp;
+			if(job->direct && !skip) {
+				out = dst + 4 * x;
+			}
+
+			job->kernel(luma_row + start, u_row + coff, u_row + coff + v_offset,
+				out, n);
+
+			if(out == tmp) {
+				const uint8_t* px = tmp + 4 * skip;
+				if(job->direct) {
+					memcpy(dst + 4 * x, px, 4 * count);
+				} else {
+					convert_span(&job->pack, px, dst + x * job->pack.dst_size,
+						x, y, count);
+				}
+			}
+		}
+	}
+}
+
+static void convert_yuv_band(void* data, unsigned index) {
+	const struct yuv_job* job = data;
+	unsigned y0 = index * job->band_rows;
+	unsigned y1 = y0 + job->band_rows;
+	convert_yuv_rows(job, y0, y1 < job->rect.height ? y1 : job->rect.height);
+}
+
+// Converts the given part of the planar `src` image into `dst`,
+// which must have the size of `rect`.
+static void convert_yuv(const struct swa_image* src, struct swa_rect rect,
+		const struct swa_image* dst, enum swa_convert_flags flags) {
+	struct yuv_job job = {
+		.src = src,
+		.rect = rect,
+		.dst = dst->data,
+		.dst_stride = dst->stride,
+		.kernel = select_yuv_kernel(src->format),
+		.direct = (dst->format == swa_image_format_rgba32 &&
+			!(flags & (swa_convert_flags_srgb_encode | swa_convert_flags_srgb_decode))),
+		.pack = {
+			.width = rect.width,
+			.height = 1u,
+		},
+	};
+
+	if(!job.direct && !init_convert_job(&job.pack, swa_image_format_rgba32,
+			dst->format, flags)) {
+		dlg_warn("Can't convert to image format %d", dst->format);
+		return;
+	}
+
+	size_t row_bytes = (size_t) rect.width * (2 + swa_image_format_size(dst->format));
+	size_t total = row_bytes * rect.height;
+	if(!(flags & swa_convert_flags_parallel) || total < parallel_min_size) {
+		convert_yuv_rows(&job, 0, rect.height);
+		return;
+	}
+
+	size_t rows = band_size / row_bytes;
+	job.band_rows = rows ? (unsigned) rows : 1u;
+	unsigned n_bands = (rect.height + job.band_rows - 1) / job.band_rows;
+	swa_parallel_for(n_bands, convert_yuv_band, &job);
+}
+
+void swa_convert_image_flags(const struct swa_image* src,
+		const struct swa_image* dst, enum swa_convert_flags flags) {
+	dlg_assert(dst->width == src->width);
+	dlg_assert(dst->height == src->height);
+
+	if(swa_image_format_is_planar(src->format)) {
+		struct swa_rect rect = {0u, 0u, src->width, src->height};
+		convert_yuv(src, rect, dst, flags);
+		return;
+	}
+
+	struct convert_job job = {
+		.src = src->data,
+		.dst = dst->data,
+		.src_stride = src->stride,
+		.dst_stride = dst->stride,
+		.width = src->width,
+		.height = src->height,
+	};
+
+	if(!init_convert_job(&job, src->format, dst->format, flags)) {
+		dlg_warn("Can't convert from/to image format none");
+		return;
+	}
+
+	// fast path: both images are tightly packed
+	unsigned row_size = src->width * job.src_size;
+	if(!job.wide && job.kernel == row_copy && src->stride == row_size &&
+			dst->stride == row_size && !(flags & swa_convert_flags_parallel)) {
+		memcpy(dst->data, src->data, (size_t) row_size * src->height);
+		return;
+	}
+
+	run_convert_job(&job, flags);
+}
+
+void swa_convert_image(const struct swa_image* src, const struct swa_image* dst) {
+	swa_convert_image_flags(src, dst, swa_convert_flags_none);
+}
+
+// Clips `r` against an image of the given size. Returns false
+// if nothing is left.
+static bool clip_rect(struct swa_rect* r, unsigned width, unsigned height) {
+	if(r->x >= width || r->y >= height) {
+		return false;
+	}
+
+	r->width = r->width < width - r->x ? r->width : width - r->x;
+	r->height = r->height < height - r->y ? r->height : height - r->y;
+	return r->width && r->height;
+}
+
+void swa_convert_image_region(const struct swa_image* src,
+		const struct swa_image* dst, const struct swa_rect* rects,
+		unsigned n_rects) {
+	dlg_assert(dst->width == src->width);
+	dlg_assert(dst->height == src->height);
+
+	if(swa_image_format_is_planar(src->format)) {
+		for(unsigned i = 0u; i < n_rects; ++i) {
+			struct swa_rect r = rects[i];
+			if(clip_rect(&r, src->width, src->height)) {
+				struct swa_image d = *dst;
+				d.data += (size_t) r.y * dst->stride +
+					r.x * swa_image_format_size(dst->format);
+				convert_yuv(src, r, &d, swa_convert_flags_none);
+			}
+		}
+		return;
+	}
+
+	struct convert_job job = {
+		.src_stride = src->stride,
+		.dst_stride = dst->stride,
+	};
+
+	if(!init_convert_job(&job, src->format, dst->format,
+			swa_convert_flags_none)) {
+		dlg_warn("Can't convert from/to image format none");
+		return;
+	}
+
+	for(unsigned i = 0u; i < n_rects; ++i) {
+		struct swa_rect r = rects[i];
+		if(!clip_rect(&r, src->width, src->height)) {
+			continue;
+		}
+
+		job.src = src->data + (size_t) r.y * src->stride + r.x * job.src_size;
+		job.dst = dst->data + (size_t) r.y * dst->stride + r.x * job.dst_size;
+		job.width = r.width;
+		job.height = r.height;
+		convert_rows(&job, 0, r.height);
+	}
+}
+
+bool swa_convert_image_inplace(struct swa_image* img,
+		enum swa_image_format format) {
+	unsigned size = swa_image_format_size(img->format);
+	if(!size || size != swa_image_format_size(format)) {
+		dlg_warn("In-place conversion needs formats of equal size");
+		return false;
+	}
+
+	if(format == img->format) {
+		return true;
+	}
+
+	struct convert_job job = {
+		.src = img->data,
+		.dst = img->data,
+		.src_stride = img->stride,
+		.dst_stride = img->stride,
+		.width = img->width,
+		.height = img->height,
+		.inplace = true,
+	};
+
+	if(!init_convert_job(&job, img->format, format, swa_convert_flags_none)) {
+		return false;
+	}
+
+	convert_rows(&job, 0, job.height);
+	img->format = format;
+	return true;
+}
+
+// Images are scaled separably: every needed source row is converted to
+// premultiplied rgba32, expanded to float and filtered horizontally.
+// The vertical pass then combines those rows into destination rows.
+// Filtering premultiplied values avoids color bleeding from transparent
+// pixels. Since the needed source rows only move forward, a ring
+// buffer of horizontally filtered rows is enough.
+
+// Filter taps for one destination pixel.
+struct scale_contrib {
+	unsigned first; // first source pixel
+	unsigned count; // number of weights
+	const float* weights;
+};
+
+struct scale_axis {
+	struct scale_contrib* contribs; // one per destination pixel
+	float* weights;
+	unsigned max_count; // maximum count of all contribs
+};
+
+// Operations on one float rgba pixel
+#if defined(SWA_IMAGE_X86) && defined(__SSE__)
+typedef __m128 pixf;
+static inline pixf pixf_zero(void) { return _mm_setzero_ps(); }
+static inline pixf pixf_load(const float* p) { return _mm_loadu_ps(p); }
+static inline void pixf_store(float* p, pixf v) { _mm_storeu_ps(p, v); }
+static inline pixf pixf_madd(pixf acc, pixf v, float w) {
+	return _mm_add_ps(acc, _mm_mul_ps(v, _mm_set1_ps(w)));
+}
+#elif defined(SWA_IMAGE_NEON)
+typedef float32x4_t pixf;
+static inline pixf pixf_zero(void) { return vdupq_n_f32(0.f); }
+static inline pixf pixf_load(const float* p) { return vld1q_f32(p); }
+static inline void pixf_store(float* p, pixf v) { vst1q_f32(p, v); }
+static inline pixf pixf_madd(pixf acc, pixf v, float w) {
+	return vmlaq_n_f32(acc, v, w);
+}
+#else
+typedef struct { float v[4]; } pixf;
+static inline pixf pixf_zero(void) { return (pixf) {{0.f, 0.f, 0.f, 0.f}}; }
+static inline pixf pixf_load(const float* p) {
+	return (pixf) {{p[0], p[1], p[2], p[3]}};
+}
+static inline void pixf_store(float* p, pixf v) { memcpy(p, v.v, sizeof(v.v)); }
+static inline pixf pixf_madd(pixf acc, pixf v, float w) {
+	for(unsigned i = 0u; i < 4; ++i) {
+		acc.v[i] += w * v.v[i];
+	}
+	return acc;
+}
+#endif
+
+static float filter_support(enum swa_scale_filter filter) {
+	switch(filter) {
+		case swa_scale_filter_box: return 0.5f;
+		case swa_scale_filter_bilinear: return 1.f;
+		case swa_scale_filter_lanczos: return 3.f;
+	}
+
+	dlg_error("Invalid scale filter %d", filter);
+	return 0.5f;
+}
+
+static float filter_eval(enum swa_scale_filter filter, float x) {
+	switch(filter) {
+		case swa_scale_filter_box:
+			return (x >= -0.5f && x < 0.5f) ? 1.f : 0.f;
+		case swa_scale_filter_bilinear:
+			x = fabsf(x);
+			return x < 1.f ? 1.f - x : 0.f;
+		case swa_scale_filter_lanczos: {
+			const float pi = 3.14159265358979f;
+			x = fabsf(x);
+			if(x < 1e-5f) {
+				return 1.f;
+			} else if(x >= 3.f) {
+				return 0.f;
+			}
+
+			float px = pi * x;
+			return 3.f * sinf(px) * sinf(px / 3.f) / (px * px);
+		}
+	}
+
+	dlg_error("Invalid scale filter %d", filter);
+	return 0.f;
+}
+
+static void finish_scale_axis(struct scale_axis* axis) {
+	free(axis->contribs);
+	free(axis->weights);
+}
+
+static bool init_scale_axis(struct scale_axis* axis, unsigned src_size,
+		unsigned dst_size, enum swa_scale_filter filter) {
+	// when downscaling, the filter is stretched to cover all source pixels
+	float scale = (float) src_size / dst_size;
+	float fscale = scale > 1.f ? scale : 1.f;
+	float support = filter_support(filter) * fscale;
+	unsigned stride = (unsigned) ceilf(2 * support) + 2;
+
+	*axis = (struct scale_axis) {0};
+	axis->contribs = malloc(dst_size * sizeof(*axis->contribs));
+	axis->weights = malloc(dst_size * stride * sizeof(*axis->weights));
+	if(!axis->contribs || !axis->weights) {
+		dlg_error("Allocation failed");
+		finish_scale_axis(axis);
+		return false;
+	}
+
+	for(unsigned x = 0u; x < dst_size; ++x) {
+		float center = (x + 0.5f) * scale;
+		int first = (int) floorf(center - support);
+		int last = (int) ceilf(center + support);
+		first = first < 0 ? 0 : first;
+		last = last < (int) src_size ? last : (int) src_size - 1;
+
+		float* w = axis->weights + x * stride;
+		unsigned start = 0u;
+		unsigned count = 0u;
+		float sum = 0.f;
+		for(int i = first; i <= last && count < stride; ++i) {
+			float wi = filter_eval(filter, (i + 0.5f - center) / fscale);
+			if(count == 0u && wi == 0.f) {
+				continue;
+			}
+
+			if(count == 0u) {
+				start = (unsigned) i;
+			}
+
+			w[count++] = wi;
+			sum += wi;
+		}
+
+		while(count > 0u && w[count - 1] == 0.f) {
+			--count;
+		}
+
+		if(count == 0u || sum == 0.f) { // fall back to nearest
+			unsigned nearest = (unsigned) center;
+			start = nearest < src_size ? nearest : src_size - 1;
+			count = 1u;
+			w[0] = 1.f;
+			sum = 1.f;
+		}
+
+		for(unsigned i = 0u; i < count; ++i) {
+			w[i] /= sum;
+		}
+
+		axis->contribs[x] = (struct scale_contrib) {start, count, w};
+		if(count > axis->max_count) {
+			axis->max_count = count;
+		}
+	}
+
+	return true;
+}
+
+struct scale_state {
+	const struct swa_image* src;
+	struct scale_axis h, v;
+	struct convert_job unpack; // src format to rgba32_premul
+	struct convert_job pack; // rgba32_premul to dst format
+
+	uint8_t* bytes; // one premultiplied rgba32 row of max(src, dst) width
+	float* src_row; // one float row of src width
+	float* acc; // one float row of dst width
+	float* ring; // max_count horizontally filtered rows
+	int* ring_rows; // source row stored in ring slot, -1 for none
+};
+
+static const float* scaled_src_row(struct scale_state* state, unsigned y) {
+	unsigned slot = y % state->v.max_count;
+	unsigned dst_width = state->pack.width;
+	float* row = state->ring + (size_t) slot * 4 * dst_width;
+	if(state->ring_rows[slot] == (int) y) {
+		return row;
+	}
+
+	const struct swa_image* src = state->src;
+	state->unpack.src = src->data + (size_t) y * src->stride;
+	state->unpack.dst = state->bytes;
+	convert_rows(&state->unpack, 0, 1);
+	for(unsigned i = 0u; i < 4 * src->width; ++i) {
+		state->src_row[i] = state->bytes[i];
+	}
+
+	for(unsigned x = 0u; x < dst_width; ++x) {
+		const struct scale_contrib* c = &state->h.contribs[x];
+		const float* s = state->src_row + 4 * c->first;
+		pixf acc = pixf_zero();
+		for(unsigned i = 0u; i < c->count; ++i) {
+			acc = pixf_madd(acc, pixf_load(s + 4 * i), c->weights[i]);
+		}
+		pixf_store(row + 4 * x, acc);
+	}
+
+	state->ring_rows[slot] = (int) y;
+	return row;
+}
+
+static inline uint8_t clamp_byte(float f, float max) {
+	f = f > 0.f ? f : 0.f;
+	f = f < max ? f : max;
+	return (uint8_t) (f + 0.5f);
+}
+
+void swa_scale_image(const struct swa_image* src, const struct swa_image* dst,
+		enum swa_scale_filter filter) {
+	if(!src->width || !src->height || !dst->width || !dst->height) {
+		return;
+	}
+
+	if(src->width == dst->width && src->height == dst->height) {
+		swa_convert_image(src, dst);
+		return;
+	}
+
+	struct scale_state state = {
+		.src = src,
+		.unpack = {
+			.width = src->width,
+			.height = 1u,
+		},
+		.pack = {
+			.width = dst->width,
+			.height = 1u,
+		},
+	};
+
+	if(!init_convert_job(&state.unpack, src->format,
+				swa_image_format_rgba32_premul, swa_convert_flags_none) ||
+			!init_convert_job(&state.pack, swa_image_format_rgba32_premul,
+				dst->format, swa_convert_flags_none)) {
+		dlg_warn("Can't scale from/to image format none");
+		return;
+	}
+
+	if(!init_scale_axis(&state.h, src->width, dst->width, filter)) {
+		return;
+	}
+
+	if(!init_scale_axis(&state.v, src->height, dst->height, filter)) {
+		finish_scale_axis(&state.h);
+		return;
+	}
+
+	unsigned max_width = src->width > dst->width ? src->width : dst->width;
+	unsigned ring_size = state.v.max_count;
+	state.bytes = malloc(4 * max_width);
+	state.src_row = malloc(4 * src->width * sizeof(float));
+	state.acc = malloc(4 * dst->width * sizeof(float));
+	state.ring = malloc((size_t) ring_size * 4 * dst->width * sizeof(float));
+	state.ring_rows = malloc(ring_size * sizeof(int));
+	if(!state.bytes || !state.src_row || !state.acc || !state.ring ||
+			!state.ring_rows) {
+		dlg_error("Allocation failed");
+		goto cleanup;
+	}
+
+	for(unsigned i = 0u; i < ring_size; ++i) {
+		state.ring_rows[i] = -1;
+	}
+
+	for(unsigned y = 0u; y < dst->height; ++y) {
+		const struct scale_contrib* c = &state.v.contribs[y];
+		for(unsigned x = 0u; x < dst->width; ++x) {
+			pixf_store(state.acc + 4 * x, pixf_zero());
+		}
+
+		for(unsigned i = 0u; i < c->count; ++i) {
+			const float* row = scaled_src_row(&state, c->first + i);
+			float w = c->weights[i];
+			for(unsigned x = 0u; x < dst->width; ++x) {
+				pixf acc = pixf_load(state.acc + 4 * x);
+				acc = pixf_madd(acc, pixf_load(row + 4 * x), w);
+				pixf_store(state.acc + 4 * x, acc);
+			}
+		}
+
+		// filters with negative lobes may overshoot, make sure
+		// the result is valid premultiplied data
+		for(unsigned x = 0u; x < dst->width; ++x) {
+			const float* p = state.acc + 4 * x;
+			uint8_t a = clamp_byte(p[3], 255.f);
+			state.bytes[4 * x + 0] = clamp_byte(p[0], a);
+			state.bytes[4 * x + 1] = clamp_byte(p[1], a);
+			state.bytes[4 * x + 2] = clamp_byte(p[2], a);
+			state.bytes[4 * x + 3] = a;
+		}
+
+		state.pack.src = state.bytes;
+		state.pack.dst = dst->data + (size_t) y * dst->stride;
+		convert_rows(&state.pack, 0, 1);
+	}
+
+cleanup:
+	free(state.bytes);
+	free(state.src_row);
+	free(state.acc);
+	free(state.ring);
+	free(state.ring_rows);
+	finish_scale_axis(&state.h);
+	finish_scale_axis(&state.v);
+}
+
+// Blending composites in a premultiplied 4-byte format, in which the
+// operation is the same for all bytes of a pixel:
+// dst = src + dst * (255 - src_alpha) / 255
+typedef void (*blend_kernel)(const uint8_t* src, uint8_t* dst,
+	unsigned count, unsigned alpha);
+
+static void blend_over_scalar(const uint8_t* src, uint8_t* dst,
+		unsigned count, unsigned alpha) {
+	for(unsigned i = 0u; i < count; ++i) {
+		unsigned ia = 255u - src[4 * i + alpha];
+		for(unsigned c = 0u; c < 4; ++c) {
+			dst[4 * i + c] = src[4 * i + c] + mul_div255(dst[4 * i + c], ia);
+		}
+	}
+}
+
+#ifdef SWA_IMAGE_X86
+
+// Builds a pshufb mask that broadcasts the alpha byte of each of
+// 4 pixels to all its bytes.
+static void build_blend_shuffle(unsigned alpha, uint8_t shuffle[16]) {
+	for(unsigned i = 0u; i < 16; ++i) {
+		shuffle[i] = (uint8_t) ((i & ~3u) + alpha);
+	}
+}
+
+__attribute__((target("ssse3")))
+static void blend_over_ssse3(const uint8_t* src, uint8_t* dst,
+		unsigned count, unsigned alpha) {
+	uint8_t shuffle[16];
+	build_blend_shuffle(alpha, shuffle);
+	const __m128i vshuffle = _mm_loadu_si128((const __m128i*) shuffle);
+	const __m128i ones = _mm_set1_epi8((char) 0xFF);
+	const __m128i zero = _mm_setzero_si128();
+
+	unsigned i = 0u;
+	for(; i + 4 <= count; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i*) (src + 4 * i));
+		__m128i d = _mm_loadu_si128((const __m128i*) (dst + 4 * i));
+		__m128i ia = _mm_xor_si128(_mm_shuffle_epi8(s, vshuffle), ones);
+		__m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero),
+			_mm_unpacklo_epi8(ia, zero));
+		__m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero),
+			_mm_unpackhi_epi8(ia, zero));
+		d = _mm_packus_epi16(div255_epu16(lo), div255_epu16(hi));
+		// can't overflow since premultiplied colors are <= alpha
+		_mm_storeu_si128((__m128i*) (dst + 4 * i), _mm_add_epi8(s, d));
+	}
+
+	blend_over_scalar(src + 4 * i, dst + 4 * i, count - i, alpha);
+}
+
+__attribute__((target("avx2")))
+static void blend_over_avx2(const uint8_t* src, uint8_t* dst,
+		unsigned count, unsigned alpha) {
+	uint8_t shuffle[16];
+	build_blend_shuffle(alpha, shuffle);
+	const __m256i vshuffle = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i*) shuffle));
+	const __m256i ones = _mm256_set1_epi8((char) 0xFF);
+	const __m256i zero = _mm256_setzero_si256();
+
+	unsigned i = 0u;
+	for(; i + 8 <= count; i += 8) {
+		__m256i s = _mm256_loadu_si256((const __m256i*) (src + 4 * i));
+		// fully transparent pixels are common, e.g. around cursors
+		// and decorations. They don't change dst
+		if(_mm256_testz_si256(s, s)) {
+			continue;
+		}
+
+		__m256i d = _mm256_loadu_si256((const __m256i*) (dst + 4 * i));
+		__m256i ia = _mm256_xor_si256(_mm256_shuffle_epi8(s, vshuffle), ones);
+		__m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero),
+			_mm256_unpacklo_epi8(ia, zero));
+		__m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero),
+			_mm256_unpackhi_epi8(ia, zero));
+		d = _mm256_packus_epi16(div255_epu16_avx2(lo), div255_epu16_avx2(hi));
+		_mm256_storeu_si256((__m256i*) (dst + 4 * i), _mm256_add_epi8(s, d));
+	}
+
+	_mm256_zeroupper(); // see row_swizzle_avx2
+	blend_over_scalar(src + 4 * i, dst + 4 * i, count - i, alpha);
+}
+
+#endif // SWA_IMAGE_X86
+
+#ifdef SWA_IMAGE_NEON
+
+static void blend_over_neon(const uint8_t* src, uint8_t* dst,
+		unsigned count, unsigned alpha) {
+	unsigned i = 0u;
+	for(; i + 16 <= count; i += 16) {
+		uint8x16x4_t s = vld4q_u8(src + 4 * i);
+		uint8x16x4_t d = vld4q_u8(dst + 4 * i);
+		uint8x16_t ia = vmvnq_u8(s.val[alpha]);
+		for(unsigned c = 0u; c < 4; ++c) {
+			d.val[c] = vaddq_u8(s.val[c], premultiply_neon(d.val[c], ia));
+		}
+		vst4q_u8(dst + 4 * i, d);
+	}
+
+	blend_over_scalar(src + 4 * i, dst + 4 * i, count - i, alpha);
+}
+
+#endif // SWA_IMAGE_NEON
+
+static blend_kernel select_blend_kernel(void) {
+#ifdef SWA_IMAGE_X86
+	if(__builtin_cpu_supports("avx2")) {
+		return blend_over_avx2;
+	} else if(__builtin_cpu_supports("ssse3")) {
+		return blend_over_ssse3;
+	}
+#elif defined(SWA_IMAGE_NEON)
+	return blend_over_neon;
+#endif
+
+	return blend_over_scalar;
+}
+
+// Returns the format pixels are composited in when blending onto
+// an image with the given format. `dst_fmt` is set to the format the
+// destination pixels have to be converted to (and back from) for that,
+// or to swa_image_format_none if they can be blended directly.
+static enum swa_image_format blend_format(enum swa_image_format fmt,
+		enum swa_image_format* dst_fmt) {
+	*dst_fmt = swa_image_format_none;
+	switch(fmt) {
+		case swa_image_format_rgba32_premul:
+		case swa_image_format_argb32_premul:
+		case swa_image_format_abgr32_premul:
+		case swa_image_format_bgra32_premul:
+			return fmt;
+		// the padding byte simply takes the role of alpha. The value
+		// it ends up with doesn't matter, the colors don't depend on it
+		case swa_image_format_xrgb32:
+			return swa_image_format_argb32_premul;
+		case swa_image_format_bgrx32:
+			return swa_image_format_bgra32_premul;
+		case swa_image_format_rgba32:
+		case swa_image_format_argb32:
+		case swa_image_format_abgr32:
+		case swa_image_format_bgra32:
+			*dst_fmt = swa_image_format_premultiplied(fmt);
+			return *dst_fmt;
+		case swa_image_format_a8:
+		case swa_image_format_rgba16f:
+		case swa_image_format_rgba64:
+			*dst_fmt = swa_image_format_rgba32_premul;
+			return swa_image_format_rgba32_premul;
+		// opaque formats stay opaque, their premultiplied and straight
+		// values are the same. Converting from/to straight rgba32
+		// avoids the (un-)premultiplication
+		case swa_image_format_rgb24:
+		case swa_image_format_bgr24:
+		case swa_image_format_rgb565:
+		case swa_image_format_xrgb2101010:
+			*dst_fmt = swa_image_format_rgba32;
+			return swa_image_format_rgba32_premul;
+		case swa_image_format_nv12:
+		case swa_image_format_i420:
+		case swa_image_format_none:
+			return swa_image_format_none;
+	}
+
+	dlg_error("Invalid image format %d", fmt);
+	return swa_image_format_none;
+}
+
+// Computes the part of `src` that is visible when placing it at (x, y)
+// in `dst`. Returns false if nothing is visible.
+static bool clip_blit(const struct swa_image* src, const struct swa_image* dst,
+		int x, int y, struct swa_rect* src_rect, unsigned* dst_x,
+		unsigned* dst_y) {
+	int64_t sx = x < 0 ? -(int64_t) x : 0;
+	int64_t sy = y < 0 ? -(int64_t) y : 0;
+	int64_t dx = x < 0 ? 0 : x;
+	int64_t dy = y < 0 ? 0 : y;
+
+	int64_t w = src->width - sx;
+	int64_t h = src->height - sy;
+	w = w < dst->width - dx ? w : dst->width - dx;
+	h = h < dst->height - dy ? h : dst->height - dy;
+	if(w <= 0 || h <= 0) {
+		return false;
+	}
+
+	*src_rect = (struct swa_rect){(unsigned) sx, (unsigned) sy,
+		(unsigned) w, (unsigned) h};
+	*dst_x = (unsigned) dx;
+	*dst_y = (unsigned) dy;
+	return true;
+}
+
+void swa_image_fill_rect(const struct swa_image* img,
+		const struct swa_rect* rect, struct swa_pixel color) {
+	struct swa_rect r = {0u, 0u, img->width, img->height};
+	if(rect) {
+		r = *rect;
+	}
+
+	if(swa_image_format_is_planar(img->format)) {
+		dlg_warn("Filling planar images isn't supported");
+		return;
+	}
+
+	unsigned size = swa_image_format_size(img->format);
+	if(!size || !clip_rect(&r, img->width, img->height)) {
+		return;
+	}
+
+	// Write the pixel once and then double the filled part of the first
+	// row until it's complete. All other rows are copied from it, which
+	// lets memcpy use its widest stores for every format.
+	uint8_t* first = img->data + (size_t) r.y * img->stride + r.x * size;
+	size_t row_size = (size_t) r.width * size;
+	swa_write_pixel(first, img->format, color);
+	for(size_t n = size; n < row_size; n *= 2) {
+		memcpy(first + n, first, n < row_size - n ? n : row_size - n);
+	}
+
+	uint8_t* row = first;
+	for(unsigned y = 1u; y < r.height; ++y) {
+		row += img->stride;
+		memcpy(row, first, row_size);
+	}
+}
+
+void swa_image_blit(const struct swa_image* src, const struct swa_image* dst,
+		int x, int y) {
+	struct swa_rect r;
+	unsigned dx, dy;
+	if(!clip_blit(src, dst, x, y, &r, &dx, &dy)) {
+		return;
+	}
+
+	struct swa_image d = *dst;
+	d.data += (size_t) dy * dst->stride + dx * swa_image_format_size(dst->format);
+	d.width = r.width;
+	d.height = r.height;
+
+	// the planes can't simply be offset
+	if(swa_image_format_is_planar(src->format)) {
+		convert_yuv(src, r, &d, swa_convert_flags_parallel);
+		return;
+	}
+
+	struct swa_image s = *src;
+	s.data += (size_t) r.y * src->stride + r.x * swa_image_format_size(src->format);
+	s.width = r.width;
+	s.height = r.height;
+
+	swa_convert_image_flags(&s, &d, swa_convert_flags_parallel);
+}
+
+void swa_image_blend_over(const struct swa_image* src,
+		const struct swa_image* dst, int x, int y) {
+	struct swa_rect r;
+	unsigned dx, dy;
+	if(!clip_blit(src, dst, x, y, &r, &dx, &dy)) {
+		return;
+	}
+
+	enum swa_image_format dst_fmt;
+	enum swa_image_format compose = blend_format(dst->format, &dst_fmt);
+	bool direct = (dst_fmt == swa_image_format_none);
+
+	struct convert_job src_job = {0}, to_compose = {0}, from_compose = {0};
+	if(!init_convert_job(&src_job, src->format, compose, swa_convert_flags_none) ||
+			(!direct && (!init_convert_job(&to_compose, dst->format, dst_fmt,
+				swa_convert_flags_none) ||
+			!init_convert_job(&from_compose, dst_fmt, dst->format,
+				swa_convert_flags_none)))) {
+		dlg_warn("Can't blend from/to image format none");
+		return;
+	}
+
+	struct format_layout layout;
+	format_layout(compose, &layout);
+	unsigned alpha = (unsigned) channel_offset(&layout, channel_a);
+	blend_kernel blend = select_blend_kernel();
+
+	unsigned src_size = src_job.src_size;
+	unsigned dst_size = swa_image_format_size(dst->format);
+	uint8_t src_tmp[4 * wide_chunk];
+	uint8_t dst_tmp[4 * wide_chunk];
+
+	for(unsigned y = 0u; y < r.height; ++y) {
+		const uint8_t* src_row = src->data +
+			(size_t) (r.y + y) * src->stride + r.x * src_size;
+		uint8_t* dst_row = dst->data +
+			(size_t) (dy + y) * dst->stride + dx * dst_size;
+
+		for(unsigned x = 0u; x < r.width; x += wide_chunk) {
+			unsigned count = r.width - x;
+			count = count < wide_chunk ? count : wide_chunk;
+
+			const uint8_t* s = src_row + x * src_size;
+			uint8_t* d = dst_row + x * dst_size;
+			if(src->format != compose) {
+				convert_span(&src_job, s, src_tmp, x, y, count);
+				s = src_tmp;
+			}
+
+			if(direct) {
+				blend(s, d, count, alpha);
+			} else {
+				convert_span(&to_compose, d, dst_tmp, x, y, count);
+				blend(s, dst_tmp, count, alpha);
+				convert_span(&from_compose, dst_tmp, d, x, y, count);
+			}
+		}
+	}
+}
+
+// Rotation is done in square tiles of the destination so that both the
+// source columns and destination rows of a tile stay in the cache.
+// With 32-bit pixels, every row of a tile is a single cache line.
+// Larger tiles were measurably slower, the rows of a tile are a full
+// stride apart and start to compete for the same cache sets.
+enum { rotate_tile = 16 };
+
+struct rotate_job {
+	const struct swa_image* src;
+	const struct swa_image* dst;
+	enum swa_image_rotation rotation;
+	unsigned size; // pixel size
+	unsigned band_rows; // multiple of rotate_tile
+};
+
+// Returns the source pixel for the destination pixel (x, y).
+static inline const uint8_t* rotated_src(const struct rotate_job* job,
+		unsigned x, unsigned y) {
+	const struct swa_image* src = job->src;
+	unsigned sx = x, sy = y;
+	switch(job->rotation) {
+		case swa_image_rotation_none:
+			break;
+		case swa_image_rotation_90:
+			sx = y;
+			sy = src->height - 1 - x;
+			break;
+		case swa_image_rotation_180:
+			sx = src->width - 1 - x;
+			sy = src->height - 1 - y;
+			break;
+		case swa_image_rotation_270:
+			sx = src->width - 1 - y;
+			sy = x;
+			break;
+	}
+
+	return src->data + (size_t) sy * src->stride + sx * job->size;
+}
+
+static void rotate_rect_scalar(const struct rotate_job* job,
+		unsigned x0, unsigned y0, unsigned w, unsigned h) {
+	const struct swa_image* dst = job->dst;
+	for(unsigned y = y0; y < y0 + h; ++y) {
+		uint8_t* row = dst->data + (size_t) y * dst->stride;
+		for(unsigned x = x0; x < x0 + w; ++x) {
+			memcpy(row + x * job->size, rotated_src(job, x, y), job->size);
+		}
+	}
+}
+
+// transpose_4x4 transposes a block of 4x4 32-bit pixels: the pixel i
+// of the output row j is the pixel j of the input row i.
+#ifdef SWA_IMAGE_X86
+
+// Reverses the order of 4 32-bit pixels.
+__attribute__((target("sse2")))
+static void reverse_4(const uint8_t* src, uint8_t* dst) {
+	__m128i v = _mm_loadu_si128((const __m128i*) src);
+	_mm_storeu_si128((__m128i*) dst, _mm_shuffle_epi32(v, 0x1B));
+}
+
+__attribute__((target("sse2")))
+static void transpose_4x4(const uint8_t* rows[4], uint8_t* out[4]) {
+	__m128i r0 = _mm_loadu_si128((const __m128i*) rows[0]);
+	__m128i r1 = _mm_loadu_si128((const __m128i*) rows[1]);
+	__m128i r2 = _mm_loadu_si128((const __m128i*) rows[2]);
+	__m128i r3 = _mm_loadu_si128((const __m128i*) rows[3]);
+
+	__m128i t0 = _mm_unpacklo_epi32(r0, r1); // 00 10 01 11
+	__m128i t1 = _mm_unpacklo_epi32(r2, r3); // 20 30 21 31
+	__m128i t2 = _mm_unpackhi_epi32(r0, r1); // 02 12 03 13
+	__m128i t3 = _mm_unpackhi_epi32(r2, r3); // 22 32 23 33
+
+	_mm_storeu_si128((__m128i*) out[0], _mm_unpacklo_epi64(t0, t1));
+	_mm_storeu_si128((__m128i*) out[1], _mm_unpackhi_epi64(t0, t1));
+	_mm_storeu_si128((__m128i*) out[2], _mm_unpacklo_epi64(t2, t3));
+	_mm_storeu_si128((__m128i*) out[3], _mm_unpackhi_epi64(t2, t3));
+}
+
+#elif defined(SWA_IMAGE_NEON)
+
+static void reverse_4(const uint8_t* src, uint8_t* dst) {
+	uint32x4_t v = vrev64q_u32(vld1q_u32((const uint32_t*) src));
+	vst1q_u32((uint32_t*) dst, vextq_u32(v, v, 2));
+}
+
+static void transpose_4x4(const uint8_t* rows[4], uint8_t* out[4]) {
+	uint32x4x2_t t01 = vtrnq_u32(vld1q_u32((const uint32_t*) rows[0]),
+		vld1q_u32((const uint32_t*) rows[1]));
+	uint32x4x2_t t23 = vtrnq_u32(vld1q_u32((const uint32_t*) rows[2]),
+		vld1q_u32((const uint32_t*) rows[3]));
+
+	vst1q_u32((uint32_t*) out[0], vcombine_u32(vget_low_u32(t01.val[0]),
+		vget_low_u32(t23.val[0])));
+	vst1q_u32((uint32_t*) out[1], vcombine_u32(vget_low_u32(t01.val[1]),
+		vget_low_u32(t23.val[1])));
+	vst1q_u32((uint32_t*) out[2], vcombine_u32(vget_high_u32(t01.val[0]),
+		vget_high_u32(t23.val[0])));
+	vst1q_u32((uint32_t*) out[3], vcombine_u32(vget_high_u32(t01.val[1]),
+		vget_high_u32(t23.val[1])));
+}
+
+#else
+
+static void reverse_4(const uint8_t* src, uint8_t* dst) {
+	for(unsigned i = 0u; i < 4u; ++i) {
+		memcpy(dst + 4 * i, src + 4 * (3 - i), 4);
+	}
+}
+
+static void transpose_4x4(const uint8_t* rows[4], uint8_t* out[4]) {
+	for(unsigned i = 0u; i < 4u; ++i) {
+		for(unsigned j = 0u; j < 4u; ++j) {
+			memcpy(out[j] + 4 * i, rows[i] + 4 * j, 4);
+		}
+	}
+}
+
+#endif
+
+// Rotates a tile of a job with 32-bit pixels by 90 or 270 degrees,
+// using 4x4 transposes. Unaligned edges are handled by the caller.
+static void rotate_tile_4x4(const struct rotate_job* job,
+		unsigned x0, unsigned y0, unsigned w, unsigned h) {
+	const struct swa_image* dst = job->dst;
+	bool r90 = (job->rotation == swa_image_rotation_90);
+	for(unsigned y = y0; y + 4 <= y0 + h; y += 4) {
+		uint8_t* out[4];
+		for(unsigned j = 0u; j < 4u; ++j) {
+			// 270: the source columns are reversed
+			unsigned row = r90 ? y + j : y + 3 - j;
+			out[j] = dst->data + (size_t) row * dst->stride + 4 * x0;
+		}
+
+		for(unsigned x = x0; x + 4 <= x0 + w; x += 4) {
+			// 90: the source rows are reversed, which the order
+			// of the input rows already accounts for
+			const uint8_t* rows[4];
+			for(unsigned i = 0u; i < 4u; ++i) {
+				rows[i] = r90 ?
+					rotated_src(job, x + i, y) :
+					rotated_src(job, x + i, y + 3);
+			}
+
+			transpose_4x4(rows, out);
+			for(unsigned j = 0u; j < 4u; ++j) {
+				out[j] += 16;
+			}
+		}
+	}
+}
+
+static void rotate_rows(const struct rotate_job* job, unsigned y0, unsigned y1) {
+	const struct swa_image* dst = job->dst;
+	if(job->rotation == swa_image_rotation_none ||
+			job->rotation == swa_image_rotation_180) {
+		size_t row_size = (size_t) dst->width * job->size;
+		unsigned w4 = job->size == 4 ? dst->width & ~3u : 0u;
+		for(unsigned y = y0; y < y1; ++y) {
+			uint8_t* row = dst->data + (size_t) y * dst->stride;
+			if(job->rotation == swa_image_rotation_none) {
+				memcpy(row, rotated_src(job, 0, y), row_size);
+				continue;
+			}
+
+			for(unsigned x = 0u; x < w4; x += 4) {
+				reverse_4(rotated_src(job, x + 3, y), row + 4 * x);
+			}
+			rotate_rect_scalar(job, w4, y, dst->width - w4, 1);
+		}
+		return;
+	}
+
+	for(unsigned ty = y0; ty < y1; ty += rotate_tile) {
+		unsigned th = y1 - ty < rotate_tile ? y1 - ty : rotate_tile;
+		for(unsigned tx = 0u; tx < dst->width; tx += rotate_tile) {
+			unsigned tw = dst->width - tx;
+			tw = tw < rotate_tile ? tw : rotate_tile;
+			if(job->size != 4) {
+				rotate_rect_scalar(job, tx, ty, tw, th);
+				continue;
+			}
+
+			unsigned w4 = tw & ~3u;
+			unsigned h4 = th & ~3u;
+			rotate_tile_4x4(job, tx, ty, w4, h4);
+			rotate_rect_scalar(job, tx + w4, ty, tw - w4, th);
+			rotate_rect_scalar(job, tx, ty + h4, w4, th - h4);
+		}
+	}
+}
+
+static void rotate_band(void* data, unsigned index) {
+	const struct rotate_job* job = data;
+	unsigned y0 = index * job->band_rows;
+	unsigned y1 = y0 + job->band_rows;
+	rotate_rows(job, y0, y1 < job->dst->height ? y1 : job->dst->height);
+}
+
+void swa_rotate_image(const struct swa_image* src, const struct swa_image* dst,
+		enum swa_image_rotation rotation) {
+	bool swap = (rotation == swa_image_rotation_90 ||
+		rotation == swa_image_rotation_270);
+	dlg_assert(dst->width == (swap ? src->height : src->width));
+	dlg_assert(dst->height == (swap ? src->width : src->height));
+
+	struct rotate_job job = {
+		.src = src,
+		.dst = dst,
+		.rotation = rotation,
+		.size = swa_image_format_size(src->format),
+	};
+
+	if(src->format != dst->format || !job.size ||
+			swa_image_format_is_planar(src->format)) {
+		dlg_warn("Can't rotate from format %d to %d", src->format, dst->format);
+		return;
+	}
+
+	size_t total = (size_t) dst->width * dst->height * 2 * job.size;
+	if(total < parallel_min_size) {
+		rotate_rows(&job, 0, dst->height);
+		return;
+	}
+
+	size_t row_bytes = (size_t) dst->width * 2 * job.size;
+	size_t rows = band_size / row_bytes;
+	rows = rows < rotate_tile ? rotate_tile : rows / rotate_tile * rotate_tile;
+	job.band_rows = (unsigned) rows;
+	unsigned n_bands = (dst->height + job.band_rows - 1) / job.band_rows;
+	swa_parallel_for(n_bands, rotate_band, &job);
+}
+
+#ifdef SWA_IMAGE_X86
+
+// Copies `height` rows of `row_size` bytes with non-temporal stores.
+// They bypass the cache and are combined into full cache line writes,
+// the only efficient way to write write-combined or uncached memory.
+__attribute__((target("sse2")))
+static void copy_rows_stream_sse2(const uint8_t* src, size_t src_stride,
+		uint8_t* dst, size_t dst_stride, size_t row_size, unsigned height) {
+	for(unsigned r = 0u; r < height; ++r) {
+		const uint8_t* s = src + r * src_stride;
+		uint8_t* d = dst + r * dst_stride;
+
+		// streaming stores need 16-byte aligned destinations
+		size_t head = (16u - ((uintptr_t) d & 15u)) & 15u;
+		head = head < row_size ? head : row_size;
+		memcpy(d, s, head);
+
+		size_t i = head;
+		for(; i + 64 <= row_size; i += 64) {
+			__m128i a = _mm_loadu_si128((const __m128i*) (s + i));
+			__m128i b = _mm_loadu_si128((const __m128i*) (s + i + 16));
+			__m128i c = _mm_loadu_si128((const __m128i*) (s + i + 32));
+			__m128i e = _mm_loadu_si128((const __m128i*) (s + i + 48));
+			_mm_stream_si128((__m128i*) (d + i), a);
+			_mm_stream_si128((__m128i*) (d + i + 16), b);
+			_mm_stream_si128((__m128i*) (d + i + 32), c);
+			_mm_stream_si128((__m128i*) (d + i + 48), e);
+		}
+		for(; i + 16 <= row_size; i += 16) {
+			__m128i a = _mm_loadu_si128((const __m128i*) (s + i));
+			_mm_stream_si128((__m128i*) (d + i), a);
+		}
+
+		memcpy(d + i, s + i, row_size - i);
+	}
+
+	// make the stores visible before e.g. the buffer is committed
+	_mm_sfence();
+}
+
+#endif // SWA_IMAGE_X86
+
+void swa_image_copy_rows(const struct swa_image* src,
+		const struct swa_image* dst, unsigned y, unsigned height) {
+	dlg_assert(src->width == dst->width && src->height == dst->height);
+	if(src->format != dst->format || swa_image_format_is_planar(src->format)) {
+		dlg_warn("Can't copy rows from format %d to %d",
+			src->format, dst->format);
+		return;
+	}
+
+	if(y >= src->height) {
+		return;
+	}
+
+	height = y + height > src->height ? src->height - y : height;
+	size_t row_size = (size_t) src->width * swa_image_format_size(src->format);
+	const uint8_t* s = src->data + (size_t) y * src->stride;
+	uint8_t* d = dst->data + (size_t) y * dst->stride;
+
+	// tightly packed rows can be copied at once
+	if(src->stride == row_size && dst->stride == row_size) {
+		row_size *= height;
+		height = 1u;
+	}
+
+#ifdef SWA_IMAGE_X86
+	if(__builtin_cpu_supports("sse2")) {
+		copy_rows_stream_sse2(s, src->stride, d, dst->stride,
+			row_size, height);
+		return;
+	}
+#endif // SWA_IMAGE_X86
+
+	// Neon has no streaming stores, plain sequential stores still
+	// fill the write-combining buffers on arm.
+	for(unsigned r = 0u; r < height; ++r) {
+		memcpy(d + (size_t) r * dst->stride, s + (size_t) r * src->stride,
+			row_size);
+	}
+}
+
+// Returns whether the first n bytes of a and b are equal. Unlike memcmp
+// this doesn't find the first difference, which allows checking 64 bytes
+// with a single branch.
+#ifdef SWA_IMAGE_X86
+
+__attribute__((target("sse2")))
+static bool bytes_equal(const uint8_t* a, const uint8_t* b, size_t n) {
+	size_t i = 0u;
+	for(; i + 64 <= n; i += 64) {
+		__m128i d0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (a + i)),
+			_mm_loadu_si128((const __m128i*) (b + i)));
+		__m128i d1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (a + i + 16)),
+			_mm_loadu_si128((const __m128i*) (b + i + 16)));
+		__m128i d2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (a + i + 32)),
+			_mm_loadu_si128((const __m128i*) (b + i + 32)));
+		__m128i d3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (a + i + 48)),
+			_mm_loadu_si128((const __m128i*) (b + i + 48)));
+		__m128i d = _mm_or_si128(_mm_or_si128(d0, d1), _mm_or_si128(d2, d3));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(d, _mm_setzero_si128())) != 0xFFFF) {
+			return false;
+		}
+	}
+
+	for(; i + 16 <= n; i += 16) {
+		__m128i d = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (a + i)),
+			_mm_loadu_si128((const __m128i*) (b + i)));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(d, _mm_setzero_si128())) != 0xFFFF) {
+			return false;
+		}
+	}
+
+	return memcmp(a + i, b + i, n - i) == 0;
+}
+
+#elif defined(SWA_IMAGE_NEON)
+
+static bool bytes_equal(const uint8_t* a, const uint8_t* b, size_t n) {
+	size_t i = 0u;
+	for(; i + 64 <= n; i += 64) {
+		uint8x16_t d0 = veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+		uint8x16_t d1 = veorq_u8(vld1q_u8(a + i + 16), vld1q_u8(b + i + 16));
+		uint8x16_t d2 = veorq_u8(vld1q_u8(a + i + 32), vld1q_u8(b + i + 32));
+		uint8x16_t d3 = veorq_u8(vld1q_u8(a + i + 48), vld1q_u8(b + i + 48));
+		uint64x2_t d = vreinterpretq_u64_u8(
+			vorrq_u8(vorrq_u8(d0, d1), vorrq_u8(d2, d3)));
+		if(vgetq_lane_u64(d, 0) | vgetq_lane_u64(d, 1)) {
+			return false;
+		}
+	}
+
+	return memcmp(a + i, b + i, n - i) == 0;
+}
+
+#else
+
+static bool bytes_equal(const uint8_t* a, const uint8_t* b, size_t n) {
+	return memcmp(a, b, n) == 0;
+}
+
+#endif
+
+static bool tile_equal(const struct swa_image* a, const struct swa_image* b,
+		unsigned x, unsigned y, unsigned w, unsigned h, unsigned size) {
+	for(unsigned r = y; r < y + h; ++r) {
+		const uint8_t* ra = a->data + (size_t) r * a->stride + x * size;
+		const uint8_t* rb = b->data + (size_t) r * b->stride + x * size;
+		if(!bytes_equal(ra, rb, (size_t) w * size)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+unsigned swa_image_diff(const struct swa_image* a, const struct swa_image* b,
+		unsigned tile_size, struct swa_rect* rects, unsigned max_rects) {
+	dlg_assert(a->width == b->width && a->height == b->height);
+	dlg_assert(tile_size > 0 && max_rects > 0);
+
+	unsigned size = swa_image_format_size(a->format);
+	if(a->format != b->format || !size ||
+			swa_image_format_is_planar(a->format)) {
+		dlg_warn("Can't diff formats %d and %d", a->format, b->format);
+		return 0u;
+	}
+
+	unsigned count = 0u;
+	bool overflow = false;
+	unsigned x1 = a->width, y1 = a->height, x2 = 0u, y2 = 0u;
+	for(unsigned ty = 0u; ty < a->height; ty += tile_size) {
+		unsigned th = a->height - ty < tile_size ? a->height - ty : tile_size;
+		unsigned tx = 0u;
+		while(tx < a->width) {
+			unsigned tw = a->width - tx < tile_size ? a->width - tx : tile_size;
+			if(tile_equal(a, b, tx, ty, tw, th, size)) {
+				tx += tw;
+				continue;
+			}
+
+			// extend the run over all following changed tiles
+			unsigned rx = tx;
+			tx += tw;
+			while(tx < a->width) {
+				tw = a->width - tx < tile_size ? a->width - tx : tile_size;
+				if(tile_equal(a, b, tx, ty, tw, th, size)) {
+					break;
+				}
+				tx += tw;
+			}
+
+			x1 = rx < x1 ? rx : x1;
+			y1 = ty < y1 ? ty : y1;
+			x2 = tx > x2 ? tx : x2;
+			y2 = ty + th;
+			if(overflow) {
+				continue;
+			}
+
+			// merge with a run of the previous row with the same extent
+			bool merged = false;
+			for(unsigned i = 0u; i < count; ++i) {
+				struct swa_rect* r = &rects[i];
+				if(r->y + r->height == ty && r->x == rx && r->width == tx - rx) {
+					r->height += th;
+					merged = true;
+					break;
+				}
+			}
+
+			if(merged) {
+				continue;
+			} else if(count == max_rects) {
+				overflow = true;
+				continue;
+			}
+
+			rects[count++] = (struct swa_rect) {rx, ty, tx - rx, th};
+		}
+	}
+
+	if(overflow) {
+		rects[0] = (struct swa_rect) {x1, y1, x2 - x1, y2 - y1};
+		return 1u;
+	}
+
+	return count;
+}
+
+enum swa_image_format swa_image_format_reversed(enum swa_image_format fmt) {
+	switch(fmt) {
+		case swa_image_format_rgba32:
+			return swa_image_format_abgr32;
+		case swa_image_format_argb32:
+			return swa_image_format_bgra32;
+		case swa_image_format_xrgb32:
+			return swa_image_format_bgrx32;
+		case swa_image_format_bgra32:
+			return swa_image_format_argb32;
+		case swa_image_format_bgrx32:
+			return swa_image_format_xrgb32;
+		case swa_image_format_abgr32:
+			return swa_image_format_rgba32;
+		case swa_image_format_rgb24:
+			return swa_image_format_bgr24;
+		case swa_image_format_bgr24:
+			return swa_image_format_rgb24;
+		case swa_image_format_rgba32_premul:
+			return swa_image_format_abgr32_premul;
+		case swa_image_format_argb32_premul:
+			return swa_image_format_bgra32_premul;
+		case swa_image_format_abgr32_premul:
+			return swa_image_format_rgba32_premul;
+		case swa_image_format_bgra32_premul:
+			return swa_image_format_argb32_premul;
+		case swa_image_format_rgb565:
+		case swa_image_format_xrgb2101010:
+		case swa_image_format_rgba16f:
+		case swa_image_format_rgba64:
+		case swa_image_format_nv12:
+		case swa_image_format_i420:
+			// bgr565 and friends aren't supported
+			return swa_image_format_none;
+		case swa_image_format_a8:
+		case swa_image_format_none:
+			return fmt;
+	}
+
+	// unreachable for valid formats
+	// dont' put it in default so we get warnings about unhandled enum values
+	dlg_error("Invalid image format %d", fmt);
+	return swa_image_format_none;
+}
+
+bool swa_image_format_is_premultiplied(enum swa_image_format fmt) {
+	return swa_image_format_straight(fmt) != fmt;
+}
+
+enum swa_image_format swa_image_format_premultiplied(enum swa_image_format fmt) {
+	switch(fmt) {
+		case swa_image_format_rgba32:
+			return swa_image_format_rgba32_premul;
+		case swa_image_format_argb32:
+			return swa_image_format_argb32_premul;
+		case swa_image_format_abgr32:
+			return swa_image_format_abgr32_premul;
+		case swa_image_format_bgra32:
+			return swa_image_format_bgra32_premul;
+		default:
+			return fmt;
+	}
+}
+
+enum swa_image_format swa_image_format_straight(enum swa_image_format fmt) {
+	switch(fmt) {
+		case swa_image_format_rgba32_premul:
+			return swa_image_format_rgba32;
+		case swa_image_format_argb32_premul:
+			return swa_image_format_argb32;
+		case swa_image_format_abgr32_premul:
+			return swa_image_format_abgr32;
+		case swa_image_format_bgra32_premul:
+			return swa_image_format_bgra32;
+		default:
+			return fmt;
+	}
+}
+
+// 1: big
+// 2: little
+// other: something weird, no clue.
+static int endianess(void) {
+	union {
+		uint32_t i;
+		char c[4];
+	} v = { 0x01000002 };
+	return v.c[0];
+}
+
+enum swa_image_format swa_image_format_toggle_byte_word(enum swa_image_format fmt) {
+	// packed formats are already defined in word order and
+	// that definition is the same for both semantics. The planar
+	// formats only consist of single bytes
+	if(fmt == swa_image_format_rgb565 || fmt == swa_image_format_xrgb2101010 ||
+			swa_image_format_is_planar(fmt)) {
+		return fmt;
+	}
+
+	switch(endianess()) {
+		case 1: return fmt;
+		case 2: return swa_image_format_reversed(fmt);
+		default:
+			dlg_error("Invalid endianess");
+			return swa_image_format_none;
+	}
+}
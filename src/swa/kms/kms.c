@@ -13,6 +13,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include <signal.h>
 #include <termios.h>
@@ -51,6 +53,9 @@ static const struct swa_window_interface window_impl;
 // from xcursor.c
 const char* const* swa_get_xcursor_names(enum swa_cursor_type type);
 
+static void update_cursor(struct swa_window_kms* win, bool image);
+static void stop_input_thread(struct swa_display_kms* dpy);
+
 static struct swa_display_kms* get_display_kms(struct swa_display* base) {
 	dlg_assert(base->impl == &display_impl);
 	return (struct swa_display_kms*) base;
@@ -111,13 +116,15 @@ static void finish_dumb_buffer(struct swa_display_kms* dpy,
 }
 
 static bool init_dumb_buffer(struct swa_display_kms* dpy,
-		unsigned width, unsigned height, unsigned format,
+		unsigned width, unsigned height, unsigned format, unsigned bpp,
 		struct swa_kms_dumb_buffer* buf) {
 	// The create ioctl uses the combination of depth and bpp to infer
 	// a format; 24/32 refers to DRM_FORMAT_XRGB8888 as defined in
 	// the drm_fourcc.h header. These arguments are the same as given
 	// to drmModeAddFB, which has since been superseded by
 	// drmModeAddFB2 as the latter takes an explicit format token.
+	// We therefore only pass the bpp of `format` here, the
+	// framebuffer below gets the real format.
 	//
 	// We only specify these arguments; the driver calculates the
 	// pitch (also known as stride or row length) and total buffer size
@@ -127,10 +134,16 @@ static bool init_dumb_buffer(struct swa_display_kms* dpy,
 	// is the Pixel Format Guide to the Galaxy, which covers most of the
 	// pixel formats used across the low-level graphics stack:
 	// https://afrantzis.com/pixel-format-guide/
+	//
+	// Dumb buffers only have a single plane, for the yuv 4:2:0 formats
+	// we allocate additional rows for the chroma planes. They directly
+	// follow the luma plane, see swa_image_format_nv12.
+	bool yuv = (format == DRM_FORMAT_NV12 || format == DRM_FORMAT_YUV420);
+	unsigned chroma_rows = yuv ? (height + 1) / 2 : 0u;
 	struct drm_mode_create_dumb create = {
-		.width = width,
-		.height = height,
-		.bpp = 32,
+		.width = yuv ? (width + 1) & ~1u : width,
+		.height = height + chroma_rows,
+		.bpp = bpp,
 	};
 	int err = drmIoctl(dpy->drm.fd, DRM_IOCTL_MODE_CREATE_DUMB, &create);
 	if(err != 0) {
@@ -142,6 +155,7 @@ static bool init_dumb_buffer(struct swa_display_kms* dpy,
 	assert(create.handle > 0);
 	assert(create.pitch >= create.width * (create.bpp / 8));
 	assert(create.size >= create.pitch * create.height);
+	assert(!yuv || create.pitch % 2 == 0);
 
 	buf->gem_handle = create.handle;
 	buf->stride = create.pitch;
@@ -162,7 +176,8 @@ static bool init_dumb_buffer(struct swa_display_kms* dpy,
 		goto err;
 	}
 
-	buf->data = mmap(NULL, create.size, PROT_WRITE, MAP_SHARED,
+	// Applications may read the buffer, e.g. for blending.
+	buf->data = mmap(NULL, create.size, PROT_READ | PROT_WRITE, MAP_SHARED,
 		dpy->drm.fd, map.offset);
 	if(buf->data == MAP_FAILED) {
 		dlg_error("failed to mmap %u x %u dumb buffer: %s",
@@ -177,6 +192,20 @@ static bool init_dumb_buffer(struct swa_display_kms* dpy,
 	uint32_t pitches[4] = {buf->stride, 0, 0, 0};
 	uint32_t gem_handles[4] = {buf->gem_handle, 0, 0, 0};
 	uint32_t offsets[4] = {0, 0, 0, 0};
+	if(format == DRM_FORMAT_NV12) {
+		gem_handles[1] = buf->gem_handle;
+		pitches[1] = buf->stride;
+		offsets[1] = buf->stride * height;
+	} else if(format == DRM_FORMAT_YUV420) {
+		for(unsigned i = 1u; i < 3u; ++i) {
+			gem_handles[i] = buf->gem_handle;
+			pitches[i] = buf->stride / 2;
+		}
+
+		offsets[1] = buf->stride * height;
+		offsets[2] = offsets[1] + pitches[1] * chroma_rows;
+	}
+
 	err = drmModeAddFB2(dpy->drm.fd, width, height,
 		format, gem_handles, pitches, offsets, &buf->fb_id, 0);
 
@@ -194,6 +223,230 @@ err:
 	return false;
 }
 
+static bool plane_supports_format(struct swa_display_kms* dpy,
+		uint32_t plane_id, uint32_t format) {
+	for(unsigned p = 0u; p < dpy->drm.n_planes; ++p) {
+		drmModePlanePtr plane = dpy->drm.planes[p];
+		if(plane->plane_id != plane_id) {
+			continue;
+		}
+
+		for(unsigned i = 0u; i < plane->count_formats; ++i) {
+			if(plane->formats[i] == format) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	return false;
+}
+
+// Chooses the format of the dumb buffers for the given window.
+// Falls back to XRGB8888 (which every driver supports) when the
+// preferred format isn't supported by the primary plane.
+static void choose_buffer_format(struct swa_window_kms* win,
+		enum swa_image_format pref, uint32_t* drm_format, unsigned* bpp) {
+	// drm formats are little endian, the packed swa formats
+	// are in native word order
+	static const struct {
+		enum swa_image_format format;
+		uint32_t drm_format;
+		unsigned bpp;
+	} formats[] = {
+		{swa_image_format_rgb565, DRM_FORMAT_RGB565, 16},
+		{swa_image_format_xrgb2101010, DRM_FORMAT_XRGB2101010, 32},
+#ifdef DRM_FORMAT_XBGR16161616F
+		{swa_image_format_rgba16f, DRM_FORMAT_XBGR16161616F, 64},
+#endif
+		// bpp of the luma plane, see init_dumb_buffer
+		{swa_image_format_nv12, DRM_FORMAT_NV12, 8},
+		{swa_image_format_i420, DRM_FORMAT_YUV420, 8},
+	};
+
+	for(unsigned i = 0u; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+		if(formats[i].format == pref && plane_supports_format(win->dpy,
+				win->output->primary_plane.id, formats[i].drm_format)) {
+			win->buffer.format = formats[i].format;
+			*drm_format = formats[i].drm_format;
+			*bpp = formats[i].bpp;
+			return;
+		}
+	}
+
+	// DRM_FORMAT_XRGB8888 but drm formats are little endian and
+	// we want byte order.
+	win->buffer.format = swa_image_format_bgrx32;
+	*drm_format = DRM_FORMAT_XRGB8888;
+	*bpp = 32;
+}
+
+static bool rotation_swaps_size(enum swa_image_rotation rotation) {
+	return rotation == swa_image_rotation_90 ||
+		rotation == swa_image_rotation_270;
+}
+
+// The DRM_MODE_ROTATE_* flags rotate counter-clockwise while
+// swa_image_rotation is clockwise.
+static uint64_t drm_rotation(enum swa_image_rotation rotation) {
+	switch(rotation) {
+		case swa_image_rotation_none: return DRM_MODE_ROTATE_0;
+		case swa_image_rotation_90: return DRM_MODE_ROTATE_270;
+		case swa_image_rotation_180: return DRM_MODE_ROTATE_180;
+		case swa_image_rotation_270: return DRM_MODE_ROTATE_90;
+	}
+
+	dlg_error("invalid rotation %d", rotation);
+	return DRM_MODE_ROTATE_0;
+}
+
+// Input positions are tracked on the output, this maps the output
+// position (ox, oy) into the (possibly rotated) window,
+// see swa_buffer_surface_settings::rotation.
+static void output_to_window(struct swa_window_kms* win, int ox, int oy,
+		int* x, int* y) {
+	*x = ox;
+	*y = oy;
+	if(!win || !win->output || win->surface_type != swa_surface_buffer) {
+		return;
+	}
+
+	// inverse of the mapping done by swa_rotate_image
+	int ow = win->output->mode.hdisplay;
+	int oh = win->output->mode.vdisplay;
+	switch(win->buffer.rotation) {
+		case swa_image_rotation_none:
+			return;
+		case swa_image_rotation_90:
+			*x = oy;
+			*y = ow - 1 - ox;
+			return;
+		case swa_image_rotation_180:
+			*x = ow - 1 - ox;
+			*y = oh - 1 - oy;
+			return;
+		case swa_image_rotation_270:
+			*x = oh - 1 - oy;
+			*y = ox;
+			return;
+	}
+
+	dlg_error("invalid rotation %d", win->buffer.rotation);
+}
+
+// Maps the point (x, y) of an image with the given size like
+// swa_rotate_image, e.g. the cursor hotspot.
+static void rotate_point(enum swa_image_rotation rotation,
+		unsigned width, unsigned height, int* x, int* y) {
+	int ox = *x;
+	int oy = *y;
+	switch(rotation) {
+		case swa_image_rotation_none:
+			return;
+		case swa_image_rotation_90:
+			*x = (int) height - 1 - oy;
+			*y = ox;
+			return;
+		case swa_image_rotation_180:
+			*x = (int) width - 1 - ox;
+			*y = (int) height - 1 - oy;
+			return;
+		case swa_image_rotation_270:
+			*x = oy;
+			*y = (int) width - 1 - ox;
+			return;
+	}
+
+	dlg_error("invalid rotation %d", rotation);
+}
+
+static void finish_buffers(struct swa_window_kms* win) {
+	for(unsigned i = 0u; i < win->buffer.n_bufs; ++i) {
+		finish_dumb_buffer(win->dpy, win->buffer.buffers[i]);
+		free(win->buffer.buffers[i]);
+	}
+
+	free(win->buffer.buffers);
+	win->buffer.buffers = NULL;
+	win->buffer.n_bufs = 0u;
+	win->buffer.active = NULL;
+	win->buffer.pending = NULL;
+	win->buffer.queued = NULL;
+	win->buffer.last = NULL;
+}
+
+// Creates a new buffer with the size and format of the surface.
+static struct swa_kms_dumb_buffer* add_buffer(struct swa_window_kms* win) {
+	struct swa_kms_dumb_buffer* buf = calloc(1, sizeof(*buf));
+	if(!buf) {
+		dlg_error("failed to allocate buffer");
+		return NULL;
+	}
+
+	if(!init_dumb_buffer(win->dpy, win->buffer.width, win->buffer.height,
+			win->buffer.drm_format, win->buffer.bpp, buf)) {
+		free(buf);
+		return NULL;
+	}
+
+	unsigned size = (win->buffer.n_bufs + 1) * sizeof(*win->buffer.buffers);
+	struct swa_kms_dumb_buffer** bufs = realloc(win->buffer.buffers, size);
+	if(!bufs) {
+		dlg_error("failed to allocate buffer list");
+		finish_dumb_buffer(win->dpy, buf);
+		free(buf);
+		return NULL;
+	}
+
+	// new buffers have to be filled completely from the shadow image
+	buf->dirty_end = win->buffer.height;
+
+	win->buffer.buffers = bufs;
+	win->buffer.buffers[win->buffer.n_bufs++] = buf;
+	return buf;
+}
+
+// Usually, one buffer is shown, one is waiting for its pageflip and
+// the application renders into the third one. The mailbox
+// (see swa_kms_buffer_surface::queued) allocates a fourth one on demand.
+static bool init_buffers(struct swa_window_kms* win, unsigned width,
+		unsigned height, uint32_t drm_format, unsigned bpp) {
+	win->buffer.width = width;
+	win->buffer.height = height;
+	win->buffer.drm_format = drm_format;
+	win->buffer.bpp = bpp;
+	for(unsigned i = 0u; i < 3u; ++i) {
+		if(!add_buffer(win)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Allocates the shadow image of a buffer surface. Rows start at
+// cache line boundaries, which is what the simd image operations and
+// the streaming copies into the dumb buffers work best with.
+static bool init_shadow(struct swa_window_kms* win, unsigned width,
+		unsigned height, enum swa_image_format format) {
+	unsigned stride = width * swa_image_format_size(format);
+	stride = (stride + 63u) & ~63u;
+	win->buffer.shadow = (struct swa_image) {
+		.width = width,
+		.height = height,
+		.stride = stride,
+		.format = format,
+		.data = aligned_alloc(64u, (size_t) stride * height),
+	};
+	if(!win->buffer.shadow.data) {
+		dlg_error("failed to allocate shadow buffer");
+		return false;
+	}
+
+	return true;
+}
+
 struct atomic {
 	drmModeAtomicReq *req;
 	bool failed;
@@ -206,6 +459,103 @@ static void atomic_add(struct atomic* atom, uint32_t id, uint32_t prop, uint64_t
 	}
 }
 
+enum swa_kms_input_type {
+	swa_kms_input_device_added,
+	swa_kms_input_key,
+	swa_kms_input_motion,
+	swa_kms_input_motion_abs,
+	swa_kms_input_button,
+};
+
+// Input read from a libinput event, see read_input_event.
+struct swa_kms_input_event {
+	enum swa_kms_input_type type;
+	union {
+		struct {
+			bool keyboard;
+			bool pointer;
+			bool touch;
+		} device;
+		struct {
+			uint32_t keycode;
+			bool pressed;
+		} key;
+		struct {
+			uint32_t button; // linux button code
+			bool pressed;
+		} button;
+		struct {
+			double x; // relative for swa_kms_input_motion
+			double y;
+		} motion;
+	};
+};
+
+// Number of events the input thread can queue until the main
+// thread handles them.
+enum { input_queue_size = 512 };
+
+// Optional thread reading libinput, enabled via the SWA_KMS_INPUT_THREAD
+// environment variable. It moves the cursor directly on pointer motion,
+// independent of how often the application dispatches events. The events
+// are passed to the main thread via a lock-free single-producer,
+// single-consumer ring buffer and handled there in display_dispatch.
+struct swa_kms_input_thread {
+	pthread_t thread;
+	bool running;
+	struct libinput* context;
+	int stop_pipe_r, stop_pipe_w;
+
+	// The input thread writes to this pipe when it queued an event
+	// and `notified` wasn't set yet.
+	int event_pipe_r, event_pipe_w;
+	struct pml_io* event_io;
+	atomic_bool notified;
+
+	atomic_uint head; // next event to handle, written by the main thread
+	atomic_uint tail; // next free slot, written by the input thread
+	struct swa_kms_input_event events[input_queue_size];
+
+	// Motion that didn't fit into the full queue, further motion is
+	// merged into it. Only used by the input thread, see push_input_event.
+	bool motion_pending;
+	struct swa_kms_input_event motion;
+
+	// The cursor moved by the input thread, see update_thread_cursor.
+	pthread_mutex_t mutex;
+	struct {
+		bool visible;
+		int drm_fd;
+		uint32_t crtc_id;
+		int hx, hy;
+		// Pointer position on the output, only written by the input
+		// thread. Ahead of swa_display_kms::input.pointer until the
+		// main thread handled all queued events.
+		double x, y;
+	} cursor;
+};
+
+// Passes the cursor of the window under the pointer to the input
+// thread. Must be called whenever it changes.
+static void update_thread_cursor(struct swa_display_kms* dpy) {
+	struct swa_kms_input_thread* thread = dpy->input.thread;
+	if(!thread) {
+		return;
+	}
+
+	struct swa_window_kms* win = dpy->input.pointer.over;
+	pthread_mutex_lock(&thread->mutex);
+	thread->cursor.visible = dpy->session.active && win && win->output &&
+		win->output->cursor_plane.id && win->cursor.buffer.visible;
+	if(thread->cursor.visible) {
+		thread->cursor.drm_fd = dpy->drm.fd;
+		thread->cursor.crtc_id = win->output->crtc.id;
+		thread->cursor.hx = win->cursor.buffer.hx;
+		thread->cursor.hy = win->cursor.buffer.hy;
+	}
+	pthread_mutex_unlock(&thread->mutex);
+}
+
 
 // window
 static void win_destroy(struct swa_window* base) {
@@ -213,11 +563,17 @@ static void win_destroy(struct swa_window* base) {
 	if(win->output) win->output->window = NULL;
 	if(win->dpy->input.pointer.over == win) {
 		win->dpy->input.pointer.over = NULL;
+		update_thread_cursor(win->dpy);
 	}
 	if(win->dpy->input.keyboard.focus == win) {
 		win->dpy->input.keyboard.focus = NULL;
 	}
 
+	if(win->surface_type == swa_surface_buffer) {
+		finish_buffers(win);
+		free(win->buffer.shadow.data);
+	}
+
 	// TODO: full cleanup
 	free(win);
 }
@@ -267,12 +623,10 @@ static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
 		return;
 	}
 
-	/*
 	if(!win->output->cursor_plane.id) {
-		dlg_error("No cursor plane");
+		dlg_warn("Output has no cursor plane");
 		return;
 	}
-	*/
 
 	enum swa_cursor_type type = cursor.type;
 	if(type == swa_cursor_default) {
@@ -281,6 +635,7 @@ static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
 
 	struct swa_image cursor_image = {0};
 	bool valid = false;
+	unsigned nominal_size = 0u; // size the image should be scaled to
 	if(type == swa_cursor_image) {
 		cursor_image = cursor.image;
 		valid = cursor_image.width > 0 && cursor_image.height > 0;
@@ -336,18 +691,21 @@ static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
 		cursor_image.width = img->width;
 		cursor_image.height = img->height;
 		cursor_image.stride = 4 * img->width;
-		cursor_image.format = swa_image_format_bgra32;
+		cursor_image.format = swa_image_format_bgra32_premul;
 		cursor_image.data = img->buffer;
 		valid = true;
 
 		win->cursor.buffer.hx = img->hotspot_x;
 		win->cursor.buffer.hy = img->hotspot_y;
+
+		// themes usually only contain a few sizes, we scale the
+		// closest one to the configured (e.g. HiDPI) size
+		nominal_size = win->dpy->cursor_theme->size;
 	}
 
-	// create buffer if needed
-	if(!valid) {
-		finish_dumb_buffer(win->dpy, &win->cursor.buffer.buffer);
-	} else if(!win->cursor.buffer.buffer.data) {
+	// create buffer if needed. When the cursor is hidden, it is kept
+	// for the next image.
+	if(valid && !win->cursor.buffer.buffer.data) {
 		int err;
 		uint64_t w, h;
 		err = drmGetCap(win->dpy->drm.fd, DRM_CAP_CURSOR_WIDTH, &w);
@@ -360,7 +718,7 @@ static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
 		// TODO: we don't really need a drm framebuffer for this
 		// buffer. Maybe add an additional function that doesn't
 		// create one?
-		if(!init_dumb_buffer(win->dpy, w, h, DRM_FORMAT_ARGB8888,
+		if(!init_dumb_buffer(win->dpy, w, h, DRM_FORMAT_ARGB8888, 32,
 				&win->cursor.buffer.buffer)) {
 			dlg_warn("failed to create cursor dumb buffer");
 			return;
@@ -370,31 +728,96 @@ static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
 		win->cursor.buffer.height = h;
 	}
 
-	if(cursor_image.width > win->cursor.buffer.width ||
-			cursor_image.height > win->cursor.buffer.height) {
-		dlg_error("cursor image too large");
-		return;
-	}
-
-	// clear first (important for overflow)
 	if(valid) {
-		memset(win->cursor.buffer.buffer.data, 0x0, win->cursor.buffer.buffer.size);
-		if(valid) {
-			struct swa_image dst = {
-				.width = cursor_image.width,
-				.height = cursor_image.height,
-				.stride = win->cursor.buffer.buffer.stride,
-				.format = swa_image_format_bgra32,
-				.data = win->cursor.buffer.buffer.data,
-			};
-			swa_convert_image(&cursor_image, &dst);
+		// the cursor is rotated with the contents of buffer surfaces,
+		// see swa_buffer_surface_settings::rotation. The image is drawn
+		// into a temporary image first and then rotated into the buffer.
+		enum swa_image_rotation rotation = swa_image_rotation_none;
+		if(win->surface_type == swa_surface_buffer) {
+			rotation = win->buffer.rotation;
+		}
+
+		unsigned max_width = win->cursor.buffer.width;
+		unsigned max_height = win->cursor.buffer.height;
+		if(rotation_swaps_size(rotation)) {
+			max_width = win->cursor.buffer.height;
+			max_height = win->cursor.buffer.width;
+		}
+
+		// the hardware cursor has a fixed size, downscale images
+		// that are too large for it
+		unsigned max_dim = cursor_image.width > cursor_image.height ?
+			cursor_image.width : cursor_image.height;
+		float scale = nominal_size ? (float) nominal_size / max_dim : 1.f;
+		if(cursor_image.width * scale > max_width) {
+			scale = (float) max_width / cursor_image.width;
+		}
+		if(cursor_image.height * scale > max_height) {
+			scale = (float) max_height / cursor_image.height;
 		}
 
-		int err = drmModeSetCursor(win->dpy->drm.fd, win->output->crtc.id,
-			win->cursor.buffer.buffer.gem_handle,
-			win->cursor.buffer.width, win->cursor.buffer.height);
-		dlg_assertm(!err, "drmModeSetCursor: %s", strerror(errno));
+		struct swa_image dst = {
+			.width = cursor_image.width,
+			.height = cursor_image.height,
+			.stride = win->cursor.buffer.buffer.stride,
+			// the default plane blend mode is premultiplied
+			.format = swa_image_format_bgra32_premul,
+			.data = win->cursor.buffer.buffer.data,
+		};
+
+		if(scale != 1.f) {
+			dst.width = (unsigned) (cursor_image.width * scale + 0.5f);
+			dst.height = (unsigned) (cursor_image.height * scale + 0.5f);
+			dst.width = dst.width ? dst.width : 1u;
+			dst.height = dst.height ? dst.height : 1u;
+			win->cursor.buffer.hx = (int) (win->cursor.buffer.hx * scale);
+			win->cursor.buffer.hy = (int) (win->cursor.buffer.hy * scale);
+		}
+
+		struct swa_image rotated = dst;
+		if(rotation_swaps_size(rotation)) {
+			rotated.width = dst.height;
+			rotated.height = dst.width;
+		}
+
+		if(rotation != swa_image_rotation_none) {
+			dst.stride = 4 * dst.width;
+			dst.data = malloc((size_t) dst.stride * dst.height);
+			if(!dst.data) {
+				dlg_error("Allocating rotated cursor image failed");
+				return;
+			}
+		}
+
+		// clear the parts of the buffer not covered by the image
+		struct swa_image full = rotated;
+		full.width = win->cursor.buffer.width;
+		full.height = win->cursor.buffer.height;
+		struct swa_rect right = {rotated.width, 0,
+			full.width - rotated.width, rotated.height};
+		struct swa_rect bottom = {0, rotated.height,
+			full.width, full.height - rotated.height};
+		struct swa_pixel transparent = {0, 0, 0, 0};
+		swa_image_fill_rect(&full, &right, transparent);
+		swa_image_fill_rect(&full, &bottom, transparent);
+
+		if(scale != 1.f) {
+			swa_scale_image(&cursor_image, &dst, swa_scale_filter_lanczos);
+		} else {
+			swa_convert_image_flags(&cursor_image, &dst, swa_convert_flags_parallel);
+		}
+
+		if(rotation != swa_image_rotation_none) {
+			swa_rotate_image(&dst, &rotated, rotation);
+			free(dst.data);
+			rotate_point(rotation, dst.width, dst.height,
+				&win->cursor.buffer.hx, &win->cursor.buffer.hy);
+		}
 	}
+
+	win->cursor.buffer.visible = valid;
+	update_cursor(win, true);
+	update_thread_cursor(win->dpy);
 }
 
 static void win_refresh(struct swa_window* base) {
@@ -552,53 +975,362 @@ static uint32_t fb_for_bo(struct gbm_bo* bo, uint32_t drm_format) {
 }
 #endif // SWA_WITH_GL
 
-static bool pageflip(struct swa_window_kms* win, uint32_t fb_id,
-		uint64_t width, uint64_t height) {
-	drmModeAtomicReq* req = drmModeAtomicAlloc();
-	struct atomic atom = {req, false};
-
+// Adds the state needed to show the framebuffer `fb_id` (with the given
+// size) on the output of the window to the atomic request.
+// The plane always covers the whole mode, `rotation` is the
+// DRM_MODE_ROTATE_* value for the plane or zero.
+static void add_output_state(struct swa_window_kms* win, struct atomic* atom,
+		uint32_t fb_id, uint64_t width, uint64_t height, uint64_t rotation) {
 	uint32_t plane_id = win->output->primary_plane.id;
 	union drm_plane_props* pprops = &win->output->primary_plane.props;
-	atomic_add(&atom, plane_id, pprops->crtc_id, win->output->crtc.id);
-	atomic_add(&atom, plane_id, pprops->fb_id, fb_id);
-	atomic_add(&atom, plane_id, pprops->src_x, 0);
-	atomic_add(&atom, plane_id, pprops->src_y, 0);
-	atomic_add(&atom, plane_id, pprops->src_w, width << 16);
-	atomic_add(&atom, plane_id, pprops->src_h, height << 16);
-
-	atomic_add(&atom, plane_id, pprops->crtc_x, 0);
-	atomic_add(&atom, plane_id, pprops->crtc_y, 0);
-	atomic_add(&atom, plane_id, pprops->crtc_w, width);
-	atomic_add(&atom, plane_id, pprops->crtc_h, height);
+	atomic_add(atom, plane_id, pprops->crtc_id, win->output->crtc.id);
+	atomic_add(atom, plane_id, pprops->fb_id, fb_id);
+	atomic_add(atom, plane_id, pprops->src_x, 0);
+	atomic_add(atom, plane_id, pprops->src_y, 0);
+	atomic_add(atom, plane_id, pprops->src_w, width << 16);
+	atomic_add(atom, plane_id, pprops->src_h, height << 16);
+
+	atomic_add(atom, plane_id, pprops->crtc_x, 0);
+	atomic_add(atom, plane_id, pprops->crtc_y, 0);
+	atomic_add(atom, plane_id, pprops->crtc_w, win->output->mode.hdisplay);
+	atomic_add(atom, plane_id, pprops->crtc_h, win->output->mode.vdisplay);
+	if(rotation) {
+		atomic_add(atom, plane_id, pprops->rotation, rotation);
+	}
 
 	union drm_connector_props* conn_props = &win->output->connector.props;
 	uint32_t conn_id = win->output->connector.id;
-	atomic_add(&atom, conn_id, conn_props->crtc_id, win->output->crtc.id);
+	atomic_add(atom, conn_id, conn_props->crtc_id, win->output->crtc.id);
 
 	union drm_crtc_props* crtc_props = &win->output->crtc.props;
 	uint32_t crtc_id = win->output->crtc.id;
-	atomic_add(&atom, crtc_id, crtc_props->mode_id, win->output->mode_id);
-	atomic_add(&atom, crtc_id, crtc_props->active, 1);
+	atomic_add(atom, crtc_id, crtc_props->mode_id, win->output->mode_id);
+	atomic_add(atom, crtc_id, crtc_props->active, 1);
+}
+
+static void count_commit(struct swa_display_kms* dpy, unsigned props) {
+	++dpy->drm.stats.commits;
+	dpy->drm.stats.props += props;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	struct timespec* since = &dpy->drm.stats.since;
+	if(!since->tv_sec && !since->tv_nsec) {
+		*since = now;
+		return;
+	}
+
+	int64_t ms = (now.tv_sec - since->tv_sec) * 1000 +
+		(now.tv_nsec - since->tv_nsec) / (1000 * 1000);
+	if(ms < 1000) {
+		return;
+	}
+
+	double secs = ms / 1000.0;
+	dlg_debug("atomic commits: %.1f/s, properties: %.1f/s",
+		dpy->drm.stats.commits / secs, dpy->drm.stats.props / secs);
+	dpy->drm.stats.commits = 0u;
+	dpy->drm.stats.props = 0u;
+	*since = now;
+}
+
+// Returns the atomic request reused for commits on the output, emptied.
+static drmModeAtomicReq* output_request(struct swa_kms_output* output) {
+	if(!output->req) {
+		output->req = drmModeAtomicAlloc();
+		if(!output->req) {
+			dlg_error("drmModeAtomicAlloc failed");
+			return NULL;
+		}
+	}
+
+	drmModeAtomicSetCursor(output->req, 0);
+	return output->req;
+}
+
+// Adds the position of the visible cursor of the window to the request.
+// The pointer position is tracked on the output, the image and hotspot
+// were already rotated with the window contents in win_set_cursor.
+// CRTC_X and CRTC_Y are signed.
+static void add_cursor_position(struct swa_window_kms* win,
+		struct atomic* atom, double px, double py) {
+	struct swa_kms_output* output = win->output;
+	struct swa_kms_buffer_cursor* cursor = &win->cursor.buffer;
+	uint32_t plane_id = output->cursor_plane.id;
+	union drm_plane_props* props = &output->cursor_plane.props;
+	int32_t x = px - cursor->hx;
+	int32_t y = py - cursor->hy;
+	atomic_add(atom, plane_id, props->crtc_x, (uint64_t) (int64_t) x);
+	atomic_add(atom, plane_id, props->crtc_y, (uint64_t) (int64_t) y);
+}
+
+// Commits the request for the output of the window. With `cursor`, the
+// request updates the visible cursor and its position is added here.
+// The input thread moves the cursor at any time, its mutex stays locked
+// until the commit was issued. Otherwise, the commit could override a
+// position set by the input thread in the meantime with an older one.
+static bool commit_request(struct swa_window_kms* win, struct atomic* atom,
+		bool cursor, uint32_t flags) {
+	struct swa_display_kms* dpy = win->dpy;
+	struct swa_kms_input_thread* thread = dpy->input.thread;
+	if(cursor && thread) {
+		pthread_mutex_lock(&thread->mutex);
+		add_cursor_position(win, atom, thread->cursor.x, thread->cursor.y);
+	} else if(cursor) {
+		add_cursor_position(win, atom,
+			dpy->input.pointer.x, dpy->input.pointer.y);
+	}
+
+	bool ok = !atom->failed;
+	if(ok && drmModeAtomicCommit(dpy->drm.fd, atom->req, flags, dpy) != 0) {
+		dlg_error("drmModeAtomicCommit: %s", strerror(errno));
+		ok = false;
+	}
+
+	if(cursor && thread) {
+		pthread_mutex_unlock(&thread->mutex);
+	}
+
+	return ok;
+}
+
+// Adds the state of the cursor plane to the atomic request. Without
+// `image`, only its position is updated. The position of a visible
+// cursor is added by commit_request.
+static void add_cursor_state(struct swa_window_kms* win, struct atomic* atom,
+		bool image) {
+	struct swa_kms_output* output = win->output;
+	struct swa_kms_buffer_cursor* cursor = &win->cursor.buffer;
+	uint32_t plane_id = output->cursor_plane.id;
+	union drm_plane_props* props = &output->cursor_plane.props;
+	if(!cursor->visible) {
+		if(image) {
+			atomic_add(atom, plane_id, props->crtc_id, 0);
+			atomic_add(atom, plane_id, props->fb_id, 0);
+		}
+		return;
+	}
+
+	// the position is added in commit_request
+	if(!image) {
+		return;
+	}
+
+	atomic_add(atom, plane_id, props->crtc_id, output->crtc.id);
+	atomic_add(atom, plane_id, props->fb_id, cursor->buffer.fb_id);
+	atomic_add(atom, plane_id, props->src_x, 0);
+	atomic_add(atom, plane_id, props->src_y, 0);
+	atomic_add(atom, plane_id, props->src_w, (uint64_t) cursor->width << 16);
+	atomic_add(atom, plane_id, props->src_h, (uint64_t) cursor->height << 16);
+	atomic_add(atom, plane_id, props->crtc_w, cursor->width);
+	atomic_add(atom, plane_id, props->crtc_h, cursor->height);
+}
+
+// `damage` is an optional FB_DAMAGE_CLIPS blob, see create_damage_blob.
+// The full output state is only committed after a modeset or when the
+// framebuffer geometry changed, the kernel keeps it for later commits.
+// Otherwise, only FB_ID is set. Pending cursor changes are included.
+static bool pageflip(struct swa_window_kms* win, uint32_t fb_id,
+		uint64_t width, uint64_t height, uint32_t damage) {
+	struct swa_kms_output* output = win->output;
+	drmModeAtomicReq* req = output_request(output);
+	if(!req) {
+		return false;
+	}
+
+	struct atomic atom = {req, false};
+
+	uint64_t rotation = 0u;
+	if(win->surface_type == swa_surface_buffer) {
+		rotation = win->buffer.plane_rotation;
+	}
+
+	bool full = output->needs_modeset || !output->committed.valid ||
+		output->committed.width != width ||
+		output->committed.height != height ||
+		output->committed.rotation != rotation;
+
+	uint32_t plane_id = output->primary_plane.id;
+	union drm_plane_props* pprops = &output->primary_plane.props;
+	if(full) {
+		add_output_state(win, &atom, fb_id, width, height, rotation);
+	} else {
+		atomic_add(&atom, plane_id, pprops->fb_id, fb_id);
+	}
+
+	// Damage clips aren't kept by the kernel, without them the whole
+	// plane counts as damaged.
+	if(damage) {
+		atomic_add(&atom, plane_id, pprops->fb_damage_clips, damage);
+	}
+
+	// cursor changes are merged into the flip
+	struct swa_kms_buffer_cursor* cursor = &win->cursor.buffer;
+	bool cursor_image = full || cursor->update;
+	bool cursor_state = output->cursor_plane.id &&
+		(cursor_image || cursor->moved);
+	if(cursor_state) {
+		add_cursor_state(win, &atom, cursor_image);
+	}
 
 	uint32_t flags = (DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT);
-	if(win->output->needs_modeset) {
-		win->output->needs_modeset = false;
+	if(output->needs_modeset) {
 		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
 	}
 
-	if(atom.failed) {
+	// a failed full commit leaves needs_modeset set, so it is retried
+	if(!commit_request(win, &atom, cursor_state && cursor->visible, flags)) {
 		return false;
 	}
 
-	int err = drmModeAtomicCommit(win->dpy->drm.fd, req, flags, win->dpy);
-	if(err != 0) {
-		dlg_error("drmModeAtomicCommit: %s", strerror(errno));
+	output->needs_modeset = false;
+	cursor->update = false;
+	cursor->moved = false;
+	if(full) {
+		output->committed.valid = true;
+		output->committed.width = width;
+		output->committed.height = height;
+		output->committed.rotation = rotation;
+	}
+
+	count_commit(win->dpy, drmModeAtomicGetCursor(req));
+	return true;
+}
+
+// Whether a commit on the output of the window is in flight. No other
+// commit can be issued until its page flip completed.
+static bool commit_pending(struct swa_window_kms* win) {
+	return win->output->cursor_pending ||
+		(win->surface_type == swa_surface_buffer && win->buffer.pending) ||
+		(win->surface_type == swa_surface_gl && win->gl.pending);
+}
+
+// Commits the cursor changes of the window on their own, if there are
+// any. While a commit is in flight, this is delayed until its page flip
+// completed, a frame committed in the meantime includes them.
+static void flush_cursor(struct swa_window_kms* win) {
+	struct swa_kms_output* output = win->output;
+	struct swa_kms_buffer_cursor* cursor = &win->cursor.buffer;
+	if(!output->cursor_plane.id || (!cursor->update && !cursor->moved)) {
+		return;
+	}
+
+	// Until the first frame (or the first one after reacquiring the vt)
+	// is committed, the output isn't ours. That commit includes the
+	// cursor state.
+	if(!win->dpy->session.active || output->needs_modeset ||
+			!output->committed.valid || commit_pending(win)) {
+		return;
+	}
+
+	drmModeAtomicReq* req = output_request(output);
+	if(!req) {
+		return;
+	}
+
+	struct atomic atom = {req, false};
+	add_cursor_state(win, &atom, cursor->update);
+
+	uint32_t flags = (DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT);
+	if(!commit_request(win, &atom, cursor->visible, flags)) {
+		return;
+	}
+
+	cursor->update = false;
+	cursor->moved = false;
+	output->cursor_pending = true;
+	count_commit(win->dpy, drmModeAtomicGetCursor(req));
+}
+
+static void update_cursor(struct swa_window_kms* win, bool image) {
+	if(image) {
+		win->cursor.buffer.update = true;
+	} else {
+		win->cursor.buffer.moved = true;
+	}
+
+	flush_cursor(win);
+}
+
+// Checks via a TEST_ONLY commit whether the primary plane of the window
+// can show the given framebuffer with the given DRM_MODE_ROTATE_* value.
+static bool test_plane_rotation(struct swa_window_kms* win, uint32_t fb_id,
+		uint64_t width, uint64_t height, uint64_t rotation) {
+	if(!win->output->primary_plane.props.rotation) {
+		return false;
+	}
+
+	drmModeAtomicReq* req = drmModeAtomicAlloc();
+	struct atomic atom = {req, false};
+	add_output_state(win, &atom, fb_id, width, height, rotation);
+
+	uint32_t flags = DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET;
+	bool ok = !atom.failed &&
+		drmModeAtomicCommit(win->dpy->drm.fd, req, flags, NULL) == 0;
+	if(!ok) {
+		dlg_debug("plane rotation %" PRIu64 " not supported: %s",
+			rotation, strerror(errno));
 	}
 
 	drmModeAtomicFree(req);
-	return err == 0;
+	return ok;
+}
+
+// Sets up the rotation of a buffer surface whose buffers were created
+// with the rotated (window) size. Prefers rotation by the primary plane,
+// otherwise recreates the buffers with the mode size and creates the
+// shadow image that is rotated in software on apply.
+static bool init_buffer_rotation(struct swa_window_kms* win,
+		uint32_t drm_format, unsigned bpp) {
+	uint64_t rotation = drm_rotation(win->buffer.rotation);
+	struct swa_kms_dumb_buffer* buf = win->buffer.buffers[0];
+	if(test_plane_rotation(win, buf->fb_id, win->buffer.width,
+			win->buffer.height, rotation)) {
+		win->buffer.plane_rotation = rotation;
+		return true;
+	}
+
+	dlg_info("primary plane can't rotate buffers, rotating them in software");
+	unsigned width = win->buffer.width;
+	unsigned height = win->buffer.height;
+	enum swa_image_format format = win->buffer.format;
+
+	// swa_rotate_image doesn't support the planar formats, the
+	// application still gets them converted in swa_window_apply_buffer.
+	if(swa_image_format_is_planar(format)) {
+		win->buffer.format = format = swa_image_format_bgrx32;
+		drm_format = DRM_FORMAT_XRGB8888;
+		bpp = 32;
+	}
+
+	finish_buffers(win);
+	if(!init_buffers(win, win->output->mode.hdisplay,
+			win->output->mode.vdisplay, drm_format, bpp)) {
+		return false;
+	}
+
+	win->buffer.rotate_shadow = true;
+	return init_shadow(win, width, height, format);
 }
 
+#ifdef SWA_WITH_GL
+// Commits the pageflip to the given locked buffer of the gbm surface,
+// making it the pending one. Releases it on failure.
+static bool commit_gl_buffer(struct swa_window_kms* win, struct gbm_bo* bo) {
+	dlg_assert(!win->gl.pending);
+	uint32_t fb_id = fb_for_bo(bo, DRM_FORMAT_ARGB8888);
+	uint64_t width = win->output->mode.hdisplay;
+	uint64_t height = win->output->mode.vdisplay;
+	if(!fb_id || !pageflip(win, fb_id, width, height, 0)) {
+		gbm_surface_release_buffer(win->gl.gbm_surface, bo);
+		return false;
+	}
+
+	win->gl.pending = bo;
+	return true;
+}
+#endif // SWA_WITH_GL
+
 static bool win_gl_swap_buffers(struct swa_window* base) {
 #ifdef SWA_WITH_GL
 	struct swa_window_kms* win = get_window_kms(base);
@@ -610,29 +1342,32 @@ static bool win_gl_swap_buffers(struct swa_window* base) {
 	dlg_assert(win->dpy->egl && win->dpy->egl->display);
 	dlg_assert(win->gl.context && win->gl.surface);
 
-	// This happens when swap_buffers is called before the previous
-	// page flipping completes.
-	// TODO: we probably want to allow this. Not sure if supported by
-	// gbm_surface though. But this requires some
-	// modifications, we e.g. have to track a list/array of pending
-	// buffers.
-	if(win->gl.pending) {
-		dlg_error("Can't swap buffers before buffers were flipped");
+	if(!eglSwapBuffers(win->dpy->egl->display, win->gl.surface)) {
+		dlg_error("eglSwapBuffers: %d", eglGetError());
 		return false;
 	}
 
-	if(!eglSwapBuffers(win->dpy->egl->display, win->gl.surface)) {
-		dlg_error("eglSwapBuffers: %d", eglGetError());
+	struct gbm_bo* bo = gbm_surface_lock_front_buffer(win->gl.gbm_surface);
+	if(!bo) {
+		dlg_error("gbm_surface_lock_front_buffer failed");
 		return false;
 	}
 
-	win->gl.pending = gbm_surface_lock_front_buffer(win->gl.gbm_surface);
+	// This happens when swap_buffers is called before the previous
+	// page flipping completes. The frame is shown once it does,
+	// unless a newer one replaces it until then. Since at most three
+	// buffers are locked that way, the gbm surface always has a free
+	// one for rendering the next frame.
+	if(commit_pending(win)) {
+		if(win->gl.queued) {
+			gbm_surface_release_buffer(win->gl.gbm_surface, win->gl.queued);
+		}
 
-	uint32_t fb_id = fb_for_bo(win->gl.pending, DRM_FORMAT_ARGB8888);
-	uint64_t width = win->output->mode.hdisplay;
-	uint64_t height = win->output->mode.vdisplay;
-	return pageflip(win, fb_id, width, height);
+		win->gl.queued = bo;
+		return true;
+	}
 
+	return commit_gl_buffer(win, bo);
 #else
 	dlg_warn("swa was compiled without gl suport");
 	return false;
@@ -656,40 +1391,235 @@ static bool win_get_buffer(struct swa_window* base, struct swa_image* img) {
 		return false;
 	}
 
-	// TODO: we could fix this by using a dynamically growing set of
-	// buffers instead of a fixed number of 3. This case happens
-	// when a new drawing is started (i.e. this function called)
-	// before the presentation of the old one is completed.
-	if(win->buffer.pending) {
-		dlg_error("Constant (non-timed) redrawing not supported, "
-			"applying the previous buffer hasn't completed");
-		return false;
+	// prefer the most recently applied buffer, it has the lowest age
+	for(unsigned i = 0u; i < win->buffer.n_bufs; ++i) {
+		struct swa_kms_dumb_buffer* buf = win->buffer.buffers[i];
+		if(!buf->in_use && (!win->buffer.active ||
+				buf->frame > win->buffer.active->frame)) {
+			win->buffer.active = buf;
+		}
+	}
+
+	// When rendering faster than the pageflips complete, one buffer is
+	// shown, one pending and one queued.
+	if(!win->buffer.active) {
+		win->buffer.active = add_buffer(win);
+		if(!win->buffer.active) {
+			return false;
+		}
+
+		dlg_debug("using %u buffers", win->buffer.n_bufs);
+	}
+
+	if(win->buffer.shadow.data) {
+		*img = win->buffer.shadow;
+		return true;
+	}
+
+	img->width = win->buffer.width;
+	img->height = win->buffer.height;
+	img->format = win->buffer.format;
+	img->stride = win->buffer.active->stride;
+	img->data = win->buffer.active->data;
+
+	return true;
+}
+
+// Maps a rectangle of the window to the output, like swa_rotate_image
+// maps the shadow image of a buffer surface.
+static struct swa_rect window_to_output_rect(struct swa_window_kms* win,
+		struct swa_rect r) {
+	unsigned w = win->buffer.shadow.width;
+	unsigned h = win->buffer.shadow.height;
+	switch(win->buffer.rotation) {
+		case swa_image_rotation_none:
+			return r;
+		case swa_image_rotation_90:
+			return (struct swa_rect) {h - r.y - r.height, r.x, r.height, r.width};
+		case swa_image_rotation_180:
+			return (struct swa_rect) {w - r.x - r.width, h - r.y - r.height,
+				r.width, r.height};
+		case swa_image_rotation_270:
+			return (struct swa_rect) {r.y, w - r.x - r.width, r.height, r.width};
+	}
+
+	dlg_error("invalid rotation %d", win->buffer.rotation);
+	return r;
+}
+
+// Creates the FB_DAMAGE_CLIPS blob for the given damage of the window,
+// in framebuffer coordinates. Returns 0 if the plane doesn't support
+// damage clips or on error, the whole framebuffer is considered
+// damaged then.
+// If there are more than 32 rectangles, their bounding box is used.
+static uint32_t create_damage_blob(struct swa_window_kms* win,
+		const struct swa_rect* damage, unsigned n_damage) {
+	if(!win->output->primary_plane.props.fb_damage_clips) {
+		return 0;
+	}
+
+	// with software rotation, damage is given relative to the shadow image
+	bool shadow = win->buffer.rotate_shadow;
+	unsigned width = shadow ? win->buffer.shadow.width : win->buffer.width;
+	unsigned height = shadow ? win->buffer.shadow.height : win->buffer.height;
+
+	struct drm_mode_rect clips[32];
+	unsigned count = 0u;
+	struct drm_mode_rect bounds = {INT32_MAX, INT32_MAX, 0, 0};
+	for(unsigned i = 0u; i < n_damage; ++i) {
+		struct swa_rect r = damage[i];
+		if(r.x >= width || r.y >= height || !r.width || !r.height) {
+			continue;
+		}
+
+		// r.x + r.width might overflow
+		r.width = r.width > width - r.x ? width - r.x : r.width;
+		r.height = r.height > height - r.y ? height - r.y : r.height;
+		if(shadow) {
+			r = window_to_output_rect(win, r);
+		}
+
+		struct drm_mode_rect clip = {r.x, r.y, r.x + r.width, r.y + r.height};
+		bounds.x1 = clip.x1 < bounds.x1 ? clip.x1 : bounds.x1;
+		bounds.y1 = clip.y1 < bounds.y1 ? clip.y1 : bounds.y1;
+		bounds.x2 = clip.x2 > bounds.x2 ? clip.x2 : bounds.x2;
+		bounds.y2 = clip.y2 > bounds.y2 ? clip.y2 : bounds.y2;
+		if(count < 32u) {
+			clips[count] = clip;
+		}
+		++count;
+	}
+
+	if(count > 32u) {
+		clips[0] = bounds;
+		count = 1u;
+	}
+
+	// Nothing changed. Blobs can't be empty and no blob means a full
+	// update, so just damage a single pixel. Still committing keeps the
+	// frame and buffer bookkeeping the same as for any other frame.
+	if(count == 0u) {
+		clips[0] = (struct drm_mode_rect) {0, 0, 1, 1};
+		count = 1u;
+	}
+
+	uint32_t blob = 0u;
+	int err = drmModeCreatePropertyBlob(win->dpy->drm.fd, clips,
+		count * sizeof(clips[0]), &blob);
+	if(err) {
+		dlg_warn("drmModeCreatePropertyBlob: %s", strerror(-err));
+		return 0;
+	}
+
+	return blob;
+}
+
+// Commits the pageflip to the given buffer, making it the pending one.
+static void commit_buffer(struct swa_window_kms* win,
+		struct swa_kms_dumb_buffer* buf, const struct swa_rect* damage,
+		unsigned n_damage) {
+	dlg_assert(!win->buffer.pending);
+	uint32_t damage_blob = 0u;
+	if(n_damage) {
+		damage_blob = create_damage_blob(win, damage, n_damage);
+	}
+
+	uint64_t width = win->buffer.width;
+	uint64_t height = win->buffer.height;
+	if(pageflip(win, buf->fb_id, width, height, damage_blob)) {
+		buf->in_use = true;
+		win->buffer.pending = buf;
+	}
+
+	// the committed state keeps its own reference
+	if(damage_blob) {
+		drmModeDestroyPropertyBlob(win->dpy->drm.fd, damage_blob);
+	}
+}
+
+// Puts the active buffer into the mailbox while another pageflip is
+// pending. A frame queued before is dropped, its damage is kept.
+static void queue_buffer(struct swa_window_kms* win,
+		const struct swa_rect* damage, unsigned n_damage) {
+	struct swa_kms_buffer_surface* bs = &win->buffer;
+	if(bs->queued) {
+		bs->queued->in_use = false;
+	} else {
+		bs->queued_full = false;
+		bs->queued_damage = (struct swa_rect) {0};
+	}
+
+	bs->queued = bs->active;
+	bs->queued->in_use = true;
+	bs->queued_full |= (n_damage == 0);
+	for(unsigned i = 0u; i < n_damage && !bs->queued_full; ++i) {
+		struct swa_rect r = damage[i];
+		if(!r.width || !r.height) {
+			continue;
+		}
+
+		struct swa_rect* b = &bs->queued_damage;
+		if(!b->width) {
+			*b = r;
+			continue;
+		}
+
+		unsigned x2 = b->x + b->width > r.x + r.width ?
+			b->x + b->width : r.x + r.width;
+		unsigned y2 = b->y + b->height > r.y + r.height ?
+			b->y + b->height : r.y + r.height;
+		b->x = b->x < r.x ? b->x : r.x;
+		b->y = b->y < r.y ? b->y : r.y;
+		b->width = x2 - b->x;
+		b->height = y2 - b->y;
+	}
+}
+
+// Copies the rows of the shadow image that changed since the active
+// buffer was last updated into it.
+static void update_from_shadow(struct swa_window_kms* win,
+		const struct swa_image* dst, const struct swa_rect* damage,
+		unsigned n_damage) {
+	unsigned height = win->buffer.height;
+	unsigned begin = n_damage ? height : 0u;
+	unsigned end = n_damage ? 0u : height;
+	for(unsigned i = 0u; i < n_damage; ++i) {
+		const struct swa_rect* r = &damage[i];
+		if(!r->width || !r->height || r->y >= height) {
+			continue;
+		}
+
+		unsigned rend = r->y + r->height > height ? height : r->y + r->height;
+		begin = r->y < begin ? r->y : begin;
+		end = rend > end ? rend : end;
 	}
 
-	for(unsigned i = 0u; i < 3u; ++i) {
-		if(!win->buffer.buffers[i].in_use) {
-			win->buffer.active = &win->buffer.buffers[i];
-			break;
+	// the other buffers have to catch up when they are used next
+	if(begin < end) {
+		for(unsigned i = 0u; i < win->buffer.n_bufs; ++i) {
+			struct swa_kms_dumb_buffer* buf = win->buffer.buffers[i];
+			if(buf->dirty_begin >= buf->dirty_end) {
+				buf->dirty_begin = begin;
+				buf->dirty_end = end;
+				continue;
+			}
+
+			buf->dirty_begin = begin < buf->dirty_begin ? begin : buf->dirty_begin;
+			buf->dirty_end = end > buf->dirty_end ? end : buf->dirty_end;
 		}
 	}
 
-	if(!win->buffer.active) {
-		dlg_error("Couldn't find unused buffer");
-		return false;
+	struct swa_kms_dumb_buffer* active = win->buffer.active;
+	if(active->dirty_begin < active->dirty_end) {
+		swa_image_copy_rows(&win->buffer.shadow, dst, active->dirty_begin,
+			active->dirty_end - active->dirty_begin);
 	}
 
-	img->width = win->output->mode.hdisplay;
-	img->height = win->output->mode.vdisplay;
-	// DRM_FORMAT_XRGB8888 but drm formats are little endian and
-	// we want byte order.
-	img->format = swa_image_format_bgrx32;
-	img->stride = win->buffer.active->stride;
-	img->data = win->buffer.active->data;
-
-	return true;
+	active->dirty_begin = active->dirty_end = 0u;
 }
 
-static void win_apply_buffer(struct swa_window* base) {
+static void win_apply_buffer(struct swa_window* base,
+		const struct swa_rect* damage, unsigned n_damage) {
 	struct swa_window_kms* win = get_window_kms(base);
 	if(win->surface_type != swa_surface_buffer) {
 		dlg_error("Cannot apply buffer for non-buffer-surface window");
@@ -701,16 +1631,71 @@ static void win_apply_buffer(struct swa_window* base) {
 		return;
 	}
 
-	uint64_t width = win->output->mode.hdisplay;
-	uint64_t height = win->output->mode.vdisplay;
-	if(pageflip(win, win->buffer.active->fb_id, width, height)) {
-		dlg_assert(!win->buffer.pending);
-		win->buffer.active->in_use = true;
-		win->buffer.pending = win->buffer.active;
+	win->buffer.active->frame = ++win->buffer.frame;
+
+	struct swa_image dst = {
+		.width = win->buffer.width,
+		.height = win->buffer.height,
+		.stride = win->buffer.active->stride,
+		.format = win->buffer.format,
+		.data = win->buffer.active->data,
+	};
+	if(win->buffer.rotate_shadow) {
+		// The dumb buffers hold the content of older frames, the
+		// whole image has to be rotated even if only parts changed.
+		swa_rotate_image(&win->buffer.shadow, &dst, win->buffer.rotation);
+	} else if(win->buffer.shadow.data) {
+		update_from_shadow(win, &dst, damage, n_damage);
 	}
+
+	if(commit_pending(win)) {
+		queue_buffer(win, damage, n_damage);
+	} else {
+		commit_buffer(win, win->buffer.active, damage, n_damage);
+	}
+
 	win->buffer.active = NULL;
 }
 
+static unsigned win_get_buffer_age(struct swa_window* base) {
+	struct swa_window_kms* win = get_window_kms(base);
+	if(win->surface_type != swa_surface_buffer || !win->buffer.active) {
+		return 0u;
+	}
+
+	// the shadow image always holds the last applied frame
+	uint64_t frame = win->buffer.active->frame;
+	if(win->buffer.shadow.data) {
+		frame = win->buffer.frame;
+	}
+
+	return frame ? win->buffer.frame - frame + 1 : 0u;
+}
+
+static const uint8_t* win_get_previous_buffer(struct swa_window* base) {
+	struct swa_window_kms* win = get_window_kms(base);
+	if(win->surface_type != swa_surface_buffer || !win->buffer.active ||
+			!win->buffer.frame || win->buffer.shadow.data) {
+		return NULL;
+	}
+
+	// All dumb buffers have the same layout. They are usually mapped
+	// write-combined, reading them is slow but still avoids a redraw.
+	for(unsigned i = 0u; i < win->buffer.n_bufs; ++i) {
+		struct swa_kms_dumb_buffer* buf = win->buffer.buffers[i];
+		if(buf != win->buffer.active && buf->frame == win->buffer.frame) {
+			return buf->data;
+		}
+	}
+
+	return NULL;
+}
+
+static bool win_scroll_buffer(struct swa_window* base,
+		const struct swa_rect* rect, int dx, int dy) {
+	return false;
+}
+
 static const struct swa_window_interface window_impl = {
 	.destroy = win_destroy,
 	.get_capabilities = win_get_capabilities,
@@ -732,12 +1717,20 @@ static const struct swa_window_interface window_impl = {
 	.gl_swap_buffers = win_gl_swap_buffers,
 	.gl_set_swap_interval = win_gl_set_swap_interval,
 	.get_buffer = win_get_buffer,
+	.get_buffer_age = win_get_buffer_age,
+	.get_previous_buffer = win_get_previous_buffer,
+	.scroll_buffer = win_scroll_buffer,
 	.apply_buffer = win_apply_buffer
 };
 
 // display
 static void drm_finish(struct swa_display_kms* dpy) {
 	// TODO: cleanup output data
+	for(unsigned i = 0u; i < dpy->drm.n_outputs; ++i) {
+		if(dpy->drm.outputs[i].req) {
+			drmModeAtomicFree(dpy->drm.outputs[i].req);
+		}
+	}
 	free(dpy->drm.outputs);
 	for(unsigned i = 0u; i < dpy->drm.n_planes; ++i) {
 		drmModeFreePlane(dpy->drm.planes[i]);
@@ -769,6 +1762,7 @@ static void display_destroy(struct swa_display* base) {
 	if(dpy->wakeup_io) pml_io_destroy(dpy->wakeup_io);
 
 	// TODO: cleanup libinput, udev stuff
+	stop_input_thread(dpy);
 	drm_finish(dpy);
 	free(dpy);
 }
@@ -897,8 +1891,8 @@ static void display_mouse_position(struct swa_display* base, int* x, int* y) {
 		return;
 	}
 
-	*x = (int) dpy->input.pointer.x;
-	*y = (int) dpy->input.pointer.y;
+	output_to_window(dpy->input.pointer.over, (int) dpy->input.pointer.x,
+		(int) dpy->input.pointer.y, x, y);
 }
 
 static struct swa_window* display_get_mouse_over(struct swa_display* base) {
@@ -937,6 +1931,11 @@ static void win_get_size(struct swa_window_kms* win, unsigned* width,
 	} else if(win->output) {
 		*width = win->output->mode.hdisplay;
 		*height = win->output->mode.vdisplay;
+		if(win->surface_type == swa_surface_buffer &&
+				rotation_swaps_size(win->buffer.rotation)) {
+			*width = win->output->mode.vdisplay;
+			*height = win->output->mode.hdisplay;
+		}
 	} else {
 		dlg_error("Invalid window: neither vulkan window nor bound to drm output");
 		return;
@@ -989,37 +1988,82 @@ static void page_flip_handler(int fd, unsigned seq,
 		return;
 	}
 
-	// manage buffers
+	// manage buffers. A commit that only updated the cursor plane
+	// doesn't change them.
 	struct swa_window_kms* win = output->window;
+	bool cursor_only = output->cursor_pending;
+	output->cursor_pending = false;
 	if(win->surface_type == swa_surface_buffer) {
-		dlg_assert(win->buffer.pending);
-		dlg_assert(win->buffer.pending->in_use);
-		if(win->buffer.last) {
-			dlg_assert(win->buffer.last->in_use);
-			win->buffer.last->in_use = false;
-		}
-		win->buffer.last = win->buffer.pending;
-		win->buffer.pending = NULL;
+		if(!cursor_only) {
+			dlg_assert(win->buffer.pending);
+			dlg_assert(win->buffer.pending->in_use);
+			if(win->buffer.last) {
+				dlg_assert(win->buffer.last->in_use);
+				win->buffer.last->in_use = false;
+			}
+			win->buffer.last = win->buffer.pending;
+			win->buffer.pending = NULL;
+		}
+
+		// show the newest frame applied in the meantime
+		struct swa_kms_dumb_buffer* queued = win->buffer.queued;
+		if(queued) {
+			win->buffer.queued = NULL;
+			queued->in_use = false;
+			if(win->buffer.queued_full) {
+				commit_buffer(win, queued, NULL, 0u);
+			} else {
+				commit_buffer(win, queued, &win->buffer.queued_damage, 1u);
+			}
+		}
+
+		if(!cursor_only && win->base.listener->buffer_available) {
+			win->base.listener->buffer_available(&win->base);
+		}
+
+		// the window might have been destroyed in the listener
+		if(!output->window) {
+			return;
+		}
 	} else if(win->surface_type == swa_surface_gl) {
-		dlg_assert(win->gl.pending);
+		if(!cursor_only) {
+			dlg_assert(win->gl.pending);
 #ifdef SWA_WITH_GL
-		if(win->gl.front) {
-			gbm_surface_release_buffer(win->gl.gbm_surface, win->gl.front);
-		}
+			if(win->gl.front) {
+				gbm_surface_release_buffer(win->gl.gbm_surface, win->gl.front);
+			}
 #endif // SWA_WITH_GL
 
-		output->window->gl.front = output->window->gl.pending;
-		output->window->gl.pending = NULL;
+			output->window->gl.front = output->window->gl.pending;
+			output->window->gl.pending = NULL;
+		}
+
+#ifdef SWA_WITH_GL
+		// show the newest frame swapped in the meantime
+		struct gbm_bo* queued = win->gl.queued;
+		if(queued) {
+			win->gl.queued = NULL;
+			commit_gl_buffer(win, queued);
+		}
+#endif // SWA_WITH_GL
 	}
 
-	// redraw, if requested
-	if(output->window->redraw) {
+	// redraw, if requested. Delayed until the next pageflip if a new
+	// frame is already pending, from the mailbox or applied by the
+	// buffer_available listener.
+	if(output->window->redraw && !commit_pending(output->window)) {
 		output->window->redraw = false;
 		struct swa_window* base = &output->window->base;
 		if(base->listener->draw) {
 			base->listener->draw(base);
 		}
 	}
+
+	// cursor changes not included in a frame committed until now.
+	// The window might have been destroyed in the draw listener.
+	if(output->window) {
+		flush_cursor(output->window);
+	}
 }
 
 static void drm_io(struct pml_io* io, unsigned revents) {
@@ -1036,6 +2080,18 @@ static void drm_io(struct pml_io* io, unsigned revents) {
 	}
 }
 
+// Whether the cursor plane is already used by one of the initialized
+// outputs.
+static bool cursor_plane_used(struct swa_display_kms* dpy, uint32_t plane_id) {
+	for(unsigned i = 0u; i < dpy->drm.n_outputs; ++i) {
+		if(dpy->drm.outputs[i].cursor_plane.id == plane_id) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
 static bool output_init(struct swa_display_kms* dpy,
 		struct swa_kms_output* output, drmModeConnectorPtr connector) {
 	bool success = false;
@@ -1063,9 +2119,11 @@ static bool output_init(struct swa_display_kms* dpy,
 	}
 
 	drmModeCrtcPtr crtc = NULL;
+	int crtc_index = 0;
 	for(int c = 0; c < dpy->drm.res->count_crtcs; c++) {
 		if(dpy->drm.res->crtcs[c] == encoder->crtc_id) {
 			crtc = drmModeGetCrtc(dpy->drm.fd, dpy->drm.res->crtcs[c]);
+			crtc_index = c;
 			break;
 		}
 	}
@@ -1100,12 +2158,23 @@ static bool output_init(struct swa_display_kms* dpy,
 			dpy->drm.planes[p]->crtc_id,
 			dpy->drm.planes[p]->fb_id,
 			type);
-		/*
-		if(type == DRM_PLANE_TYPE_CURSOR && !output->cursor_plane.id) {
+		// The kernel doesn't tell us which cursor plane legacy cursor
+		// ioctls (used by the input thread) act on either. Drivers
+		// create it for a single CRTC, so we prefer a cursor plane that
+		// can only be used with this CRTC and assume it's that one.
+		if(type == DRM_PLANE_TYPE_CURSOR) {
+			uint32_t crtcs = dpy->drm.planes[p]->possible_crtcs;
+			bool legacy = crtcs == (1u << crtc_index);
+			if((crtcs & (1u << crtc_index)) &&
+					!cursor_plane_used(dpy, plane_id) &&
+					(!output->cursor_plane.id ||
+					 (legacy && !output->cursor_plane.legacy))) {
 				dlg_debug("  used as cursor plane");
-				output->cursor_plane.id = dpy->drm.planes[p]->plane_id;
+				output->cursor_plane.id = plane_id;
 				output->cursor_plane.props = props;
-		} else */ if(type == DRM_PLANE_TYPE_PRIMARY && !output->primary_plane.id) {
+				output->cursor_plane.legacy = legacy;
+			}
+		} else if(type == DRM_PLANE_TYPE_PRIMARY && !output->primary_plane.id) {
 			if(dpy->drm.planes[p]->crtc_id == crtc->crtc_id &&
 					dpy->drm.planes[p]->fb_id == crtc->buffer_id) {
 				dlg_debug("  used as primary plane");
@@ -1326,6 +2395,7 @@ static void sigusr_handler(struct pml_io* io, unsigned revents) {
 	if(dpy->session.active) {
 		dlg_trace("releasing vt");
 		dpy->session.active = false;
+		update_thread_cursor(dpy);
 
 		if(dpy->drm.fd) {
 			for(unsigned i = 0u; i < dpy->drm.n_outputs; ++i) {
@@ -1353,6 +2423,9 @@ static void sigusr_handler(struct pml_io* io, unsigned revents) {
 			drmSetMaster(dpy->drm.fd);
 
 			for(unsigned i = 0u; i < dpy->drm.n_outputs; ++i) {
+				// the state might have been changed by another master,
+				// the next commit has to restore all of it.
+				dpy->drm.outputs[i].needs_modeset = true;
 				if(!dpy->drm.outputs[i].window) {
 					continue;
 				}
@@ -1367,6 +2440,7 @@ static void sigusr_handler(struct pml_io* io, unsigned revents) {
 		}
 
 		dpy->session.active = true;
+		update_thread_cursor(dpy);
 	}
 }
 
@@ -1611,9 +2685,33 @@ static struct swa_window* display_create_window(struct swa_display* base,
 		unsigned width = output->mode.hdisplay;
 		unsigned height = output->mode.vdisplay;
 		if(win->surface_type == swa_surface_buffer) {
-			for(unsigned i = 0u; i < 3u; ++i) {
-				if(!init_dumb_buffer(dpy, width, height,
-						DRM_FORMAT_XRGB8888, &win->buffer.buffers[i])) {
+			uint32_t drm_format;
+			unsigned bpp;
+			const struct swa_buffer_surface_settings* bs =
+				&settings->surface_settings.buffer;
+			choose_buffer_format(win, bs->preferred_format, &drm_format, &bpp);
+
+			win->buffer.rotation = bs->rotation;
+			if(rotation_swaps_size(bs->rotation)) {
+				width = output->mode.vdisplay;
+				height = output->mode.hdisplay;
+			}
+
+			if(!init_buffers(win, width, height, drm_format, bpp)) {
+				goto error;
+			}
+
+			if(bs->rotation != swa_image_rotation_none &&
+					!init_buffer_rotation(win, drm_format, bpp)) {
+				goto error;
+			}
+
+			// with software rotation, there already is a shadow image
+			if(bs->shadow && !win->buffer.rotate_shadow) {
+				if(swa_image_format_is_planar(win->buffer.format)) {
+					dlg_debug("shadow buffer not supported for planar formats");
+				} else if(!init_shadow(win, win->buffer.width,
+						win->buffer.height, win->buffer.format)) {
 					goto error;
 				}
 			}
@@ -1681,6 +2779,7 @@ static struct swa_window* display_create_window(struct swa_display* base,
 		dpy->input.keyboard.focus = win;
 	}
 
+	update_thread_cursor(dpy);
 	return &win->base;
 
 error:
@@ -1794,23 +2893,18 @@ static bool init_xkb(struct swa_display_kms* dpy) {
 }
 
 static void handle_device_added(struct swa_display_kms* dpy,
-		struct libinput_device* dev) {
-	int vendor = libinput_device_get_id_vendor(dev);
-	int product = libinput_device_get_id_product(dev);
-	const char *name = libinput_device_get_name(dev);
-	dlg_info("Added libinput device %s [%d:%d]", name, vendor, product);
-
-	if(libinput_device_has_capability(dev, LIBINPUT_DEVICE_CAP_KEYBOARD)) {
+		const struct swa_kms_input_event* ev) {
+	if(ev->device.keyboard) {
 		if(!dpy->input.keyboard.keymap) {
 			if(init_xkb(dpy)) {
 				dpy->input.keyboard.present = true;
 			}
 		}
 	}
-	if(libinput_device_has_capability(dev, LIBINPUT_DEVICE_CAP_POINTER)) {
+	if(ev->device.pointer) {
 		dpy->input.pointer.present = true;
 	}
-	if(libinput_device_has_capability(dev, LIBINPUT_DEVICE_CAP_TOUCH)) {
+	if(ev->device.touch) {
 		dpy->input.touch.present = true;
 	}
 }
@@ -1835,26 +2929,12 @@ static bool check_binding(struct swa_display_kms* dpy, xkb_keysym_t sym) {
 }
 
 static void handle_keyboard_key(struct swa_display_kms* dpy,
-		struct libinput_event* event) {
-	struct libinput_event_keyboard* kbevent = libinput_event_get_keyboard_event(event);
-	uint32_t keycode = libinput_event_keyboard_get_key(kbevent);
-	enum libinput_key_state state = libinput_event_keyboard_get_key_state(kbevent);
-
+		uint32_t keycode, bool pressed) {
 	uint32_t xkb_keycode = keycode + 8;
 	const xkb_keysym_t* syms;
 	int nsyms = xkb_state_key_get_syms(dpy->input.keyboard.state,
 		xkb_keycode, &syms);
 
-	bool pressed = false;
-	switch(state) {
-	case LIBINPUT_KEY_STATE_RELEASED:
-		pressed = false;
-		break;
-	case LIBINPUT_KEY_STATE_PRESSED:
-		pressed = true;
-		break;
-	}
-
 	// check for internal keyboard binding handlers
 	// mainly for switching vts
 	if(pressed) {
@@ -1901,31 +2981,46 @@ static void handle_keyboard_key(struct swa_display_kms* dpy,
 	// TODO: manually trigger repeat events via a timer
 }
 
+// Sends a mouse move event to the window under the pointer,
+// (ox, oy) is the previous pointer position on the output.
+static void send_mouse_move(struct swa_display_kms* dpy, int ox, int oy) {
+	struct swa_window_kms* over = dpy->input.pointer.over;
+	if(!over || !over->base.listener->mouse_move) {
+		return;
+	}
+
+	int x, y, px, py;
+	output_to_window(over, (int) dpy->input.pointer.x,
+		(int) dpy->input.pointer.y, &x, &y);
+	output_to_window(over, ox, oy, &px, &py);
+	struct swa_mouse_move_event ev = {
+		.x = x,
+		.y = y,
+		.dx = x - px,
+		.dy = y - py,
+	};
+	over->base.listener->mouse_move(&over->base, &ev);
+}
+
 static void update_cursor_position(struct swa_display_kms* dpy) {
+	// the input thread already moved the cursor
+	if(dpy->input.thread) {
+		return;
+	}
+
 	// TODO: fix for vulkan
 	if(!dpy->input.pointer.over ||
 			!dpy->input.pointer.over->output ||
-			// !dpy->input.pointer.over->output->cursor_plane.id ||
-			!dpy->input.pointer.over->cursor.buffer.buffer.fb_id) {
+			!dpy->input.pointer.over->cursor.buffer.visible) {
 		return;
 	}
 
-	struct swa_window_kms* win = dpy->input.pointer.over;
-	struct swa_kms_output* output = win->output;
-
-	int32_t x = win->dpy->input.pointer.x - win->cursor.buffer.hx;
-	int32_t y = win->dpy->input.pointer.y - win->cursor.buffer.hy;
-	int err = drmModeMoveCursor(dpy->drm.fd, output->crtc.id, x, y);
-	dlg_assertm(!err, "drmModeMoveCursor: %s", strerror(errno));
+	// committed with the next frame or on its own, see flush_cursor
+	update_cursor(dpy->input.pointer.over, false);
 }
 
 static void handle_pointer_motion(struct swa_display_kms* dpy,
-		struct libinput_event* base_ev) {
-	struct libinput_event_pointer* ev =
-		libinput_event_get_pointer_event(base_ev);
-
-	double dx = libinput_event_pointer_get_dx(ev);
-	double dy = libinput_event_pointer_get_dy(ev);
+		double dx, double dy) {
 	int ox = dpy->input.pointer.x;
 	int oy = dpy->input.pointer.y;
 	dpy->input.pointer.x += dx;
@@ -1935,29 +3030,12 @@ static void handle_pointer_motion(struct swa_display_kms* dpy,
 		return;
 	}
 
-	struct swa_window_kms* over = dpy->input.pointer.over;
-	if(over && over->base.listener->mouse_move) {
-		struct swa_mouse_move_event ev = {
-			.x = (int) dpy->input.pointer.x,
-			.y = (int) dpy->input.pointer.y,
-			.dx = (int) dpy->input.pointer.x - ox,
-			.dy = (int) dpy->input.pointer.y - oy,
-		};
-		over->base.listener->mouse_move(&over->base, &ev);
-	}
-
+	send_mouse_move(dpy, ox, oy);
 	update_cursor_position(dpy);
 }
 
 static void handle_pointer_motion_abs(struct swa_display_kms* dpy,
-		struct libinput_event* base_ev) {
-	struct libinput_event_pointer* ev =
-		libinput_event_get_pointer_event(base_ev);
-
-	// TODO: real width/height of current output here?
-	double x = libinput_event_pointer_get_absolute_x_transformed(ev, 1);
-	double y = libinput_event_pointer_get_absolute_y_transformed(ev, 1);
-
+		double x, double y) {
 	int ox = dpy->input.pointer.x;
 	int oy = dpy->input.pointer.y;
 	dpy->input.pointer.x = x;
@@ -1967,17 +3045,7 @@ static void handle_pointer_motion_abs(struct swa_display_kms* dpy,
 		return;
 	}
 
-	struct swa_window_kms* over = dpy->input.pointer.over;
-	if(over && over->base.listener->mouse_move) {
-		struct swa_mouse_move_event ev = {
-			.x = (int) dpy->input.pointer.x,
-			.y = (int) dpy->input.pointer.y,
-			.dx = (int) dpy->input.pointer.x - ox,
-			.dy = (int) dpy->input.pointer.y - oy,
-		};
-		over->base.listener->mouse_move(&over->base, &ev);
-	}
-
+	send_mouse_move(dpy, ox, oy);
 	update_cursor_position(dpy);
 }
 
@@ -1996,25 +3064,8 @@ static enum swa_mouse_button linux_to_button(uint32_t buttoncode) {
 }
 
 static void handle_pointer_button(struct swa_display_kms* dpy,
-		struct libinput_event* base_ev) {
-	struct libinput_event_pointer* ev =
-		libinput_event_get_pointer_event(base_ev);
-
-	bool pressed = false;
-	switch(libinput_event_pointer_get_button_state(ev)) {
-	case LIBINPUT_BUTTON_STATE_PRESSED:
-		pressed = true;
-		break;
-	case LIBINPUT_BUTTON_STATE_RELEASED:
-		pressed = false;
-		break;
-	default:
-		dlg_error("Invalid libinput pointer button state");
-		return;
-	}
-
+		uint32_t linux_button, bool pressed) {
 	struct swa_window_kms* over = dpy->input.pointer.over;
-	uint32_t linux_button = libinput_event_pointer_get_button(ev);
 	enum swa_mouse_button button = linux_to_button(linux_button);
 
 	if(pressed) {
@@ -2024,9 +3075,12 @@ static void handle_pointer_button(struct swa_display_kms* dpy,
 	}
 
 	if(over && over->base.listener->mouse_button) {
+		int x, y;
+		output_to_window(over, (int) dpy->input.pointer.x,
+			(int) dpy->input.pointer.y, &x, &y);
 		struct swa_mouse_button_event ev = {
-			.x = (int) dpy->input.pointer.x,
-			.y = (int) dpy->input.pointer.y,
+			.x = x,
+			.y = y,
 			.button = button,
 			.pressed = pressed,
 		};
@@ -2034,28 +3088,70 @@ static void handle_pointer_button(struct swa_display_kms* dpy,
 	}
 }
 
-static void handle_libinput_event(struct swa_display_kms* dpy,
-		struct libinput_event* event) {
-	struct libinput_device* libinput_dev = libinput_event_get_device(event);
-	enum libinput_event_type event_type = libinput_event_get_type(event);
-	switch (event_type) {
+// Reads the libinput event. Returns false for events that aren't
+// handled. Called on the input thread if there is one.
+static bool read_input_event(struct libinput_event* event,
+		struct swa_kms_input_event* out) {
+	struct libinput_device* dev = libinput_event_get_device(event);
+	struct libinput_event_keyboard* kbev;
+	struct libinput_event_pointer* pev;
+	switch(libinput_event_get_type(event)) {
 	case LIBINPUT_EVENT_DEVICE_ADDED:
-		handle_device_added(dpy, libinput_dev);
-		break;
+		dlg_info("Added libinput device %s [%d:%d]",
+			libinput_device_get_name(dev),
+			libinput_device_get_id_vendor(dev),
+			libinput_device_get_id_product(dev));
+		out->type = swa_kms_input_device_added;
+		out->device.keyboard = libinput_device_has_capability(dev,
+			LIBINPUT_DEVICE_CAP_KEYBOARD);
+		out->device.pointer = libinput_device_has_capability(dev,
+			LIBINPUT_DEVICE_CAP_POINTER);
+		out->device.touch = libinput_device_has_capability(dev,
+			LIBINPUT_DEVICE_CAP_TOUCH);
+		return true;
 	case LIBINPUT_EVENT_DEVICE_REMOVED:
 		// handle_device_removed(dpy, libinput_dev);
 		break;
 	case LIBINPUT_EVENT_KEYBOARD_KEY:
-		handle_keyboard_key(dpy, event);
-		break;
+		kbev = libinput_event_get_keyboard_event(event);
+		out->type = swa_kms_input_key;
+		out->key.keycode = libinput_event_keyboard_get_key(kbev);
+		out->key.pressed = false;
+		switch(libinput_event_keyboard_get_key_state(kbev)) {
+		case LIBINPUT_KEY_STATE_RELEASED:
+			out->key.pressed = false;
+			break;
+		case LIBINPUT_KEY_STATE_PRESSED:
+			out->key.pressed = true;
+			break;
+		}
+		return true;
 	case LIBINPUT_EVENT_POINTER_MOTION:
-		handle_pointer_motion(dpy, event);
-		break;
+		pev = libinput_event_get_pointer_event(event);
+		out->type = swa_kms_input_motion;
+		out->motion.x = libinput_event_pointer_get_dx(pev);
+		out->motion.y = libinput_event_pointer_get_dy(pev);
+		return true;
 	case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
-		handle_pointer_motion_abs(dpy, event);
-		break;
+		pev = libinput_event_get_pointer_event(event);
+		out->type = swa_kms_input_motion_abs;
+		// TODO: real width/height of current output here?
+		out->motion.x = libinput_event_pointer_get_absolute_x_transformed(pev, 1);
+		out->motion.y = libinput_event_pointer_get_absolute_y_transformed(pev, 1);
+		return true;
 	case LIBINPUT_EVENT_POINTER_BUTTON:
-		handle_pointer_button(dpy, event);
+		pev = libinput_event_get_pointer_event(event);
+		out->type = swa_kms_input_button;
+		out->button.button = libinput_event_pointer_get_button(pev);
+		switch(libinput_event_pointer_get_button_state(pev)) {
+		case LIBINPUT_BUTTON_STATE_PRESSED:
+			out->button.pressed = true;
+			return true;
+		case LIBINPUT_BUTTON_STATE_RELEASED:
+			out->button.pressed = false;
+			return true;
+		}
+		dlg_error("Invalid libinput pointer button state");
 		break;
 	case LIBINPUT_EVENT_POINTER_AXIS:
 		// handle_pointer_axis(event, libinput_dev);
@@ -2075,6 +3171,29 @@ static void handle_libinput_event(struct swa_display_kms* dpy,
 	default:
 		break;
 	}
+
+	return false;
+}
+
+static void handle_input_event(struct swa_display_kms* dpy,
+		const struct swa_kms_input_event* ev) {
+	switch(ev->type) {
+	case swa_kms_input_device_added:
+		handle_device_added(dpy, ev);
+		break;
+	case swa_kms_input_key:
+		handle_keyboard_key(dpy, ev->key.keycode, ev->key.pressed);
+		break;
+	case swa_kms_input_motion:
+		handle_pointer_motion(dpy, ev->motion.x, ev->motion.y);
+		break;
+	case swa_kms_input_motion_abs:
+		handle_pointer_motion_abs(dpy, ev->motion.x, ev->motion.y);
+		break;
+	case swa_kms_input_button:
+		handle_pointer_button(dpy, ev->button.button, ev->button.pressed);
+		break;
+	}
 }
 
 static void libinput_io(struct pml_io* io, unsigned revents) {
@@ -2086,11 +3205,311 @@ static void libinput_io(struct pml_io* io, unsigned revents) {
 
 	struct libinput_event* event;
 	while((event = libinput_get_event(dpy->input.context))) {
-		handle_libinput_event(dpy, event);
+		struct swa_kms_input_event ev;
+		if(read_input_event(event, &ev)) {
+			handle_input_event(dpy, &ev);
+		}
 		libinput_event_destroy(event);
 	}
 }
 
+static bool is_motion_event(const struct swa_kms_input_event* ev) {
+	return ev->type == swa_kms_input_motion ||
+		ev->type == swa_kms_input_motion_abs;
+}
+
+// Moves the cursor for a motion event, on the input thread.
+// This uses the legacy cursor ioctl: unlike atomic commits, it's not
+// synchronized with (and doesn't fail because of) pending page flips
+// committed by the main thread. If the driver blocks on it, only the
+// input thread is blocked.
+static void move_thread_cursor(struct swa_kms_input_thread* thread,
+		const struct swa_kms_input_event* ev) {
+	if(!is_motion_event(ev)) {
+		return;
+	}
+
+	pthread_mutex_lock(&thread->mutex);
+	if(ev->type == swa_kms_input_motion) {
+		thread->cursor.x += ev->motion.x;
+		thread->cursor.y += ev->motion.y;
+	} else {
+		thread->cursor.x = ev->motion.x;
+		thread->cursor.y = ev->motion.y;
+	}
+
+	// don't hold the mutex during the ioctl, the main thread might
+	// wait for it in commit_request
+	bool visible = thread->cursor.visible;
+	int fd = thread->cursor.drm_fd;
+	uint32_t crtc_id = thread->cursor.crtc_id;
+	int32_t x = thread->cursor.x - thread->cursor.hx;
+	int32_t y = thread->cursor.y - thread->cursor.hy;
+	pthread_mutex_unlock(&thread->mutex);
+
+	if(visible) {
+		int err = drmModeMoveCursor(fd, crtc_id, x, y);
+		if(err) {
+			dlg_debug("drmModeMoveCursor: %s", strerror(errno));
+		}
+	}
+}
+
+// Queues the event for the main thread. Returns false if the queue is full.
+static bool try_push_input_event(struct swa_kms_input_thread* thread,
+		const struct swa_kms_input_event* ev) {
+	unsigned tail = atomic_load_explicit(&thread->tail, memory_order_relaxed);
+	if(tail - atomic_load_explicit(&thread->head, memory_order_acquire) ==
+			input_queue_size) {
+		return false;
+	}
+
+	thread->events[tail % input_queue_size] = *ev;
+	atomic_store_explicit(&thread->tail, tail + 1, memory_order_release);
+
+	// wake up the main thread, if not already done
+	if(!atomic_exchange(&thread->notified, true)) {
+		if(write(thread->event_pipe_w, " ", 1) < 0) {
+			dlg_warn("Writing to input event pipe failed: %s", strerror(errno));
+		}
+	}
+
+	return true;
+}
+
+// Queues the event, waiting until there is space.
+// Returns false if the thread should stop.
+static bool wait_push_input_event(struct swa_kms_input_thread* thread,
+		const struct swa_kms_input_event* ev) {
+	while(!try_push_input_event(thread, ev)) {
+		// Only happens if the application doesn't dispatch events for
+		// a long time, polling is fine.
+		struct pollfd pfd = {.fd = thread->stop_pipe_r, .events = POLLIN};
+		if(poll(&pfd, 1, 10) > 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Tries to queue the pending motion, see push_input_event.
+static void flush_pending_motion(struct swa_kms_input_thread* thread) {
+	if(thread->motion_pending &&
+			try_push_input_event(thread, &thread->motion)) {
+		thread->motion_pending = false;
+	}
+}
+
+// Queues the event for the main thread. Motion never blocks the input
+// thread (so that it keeps moving the cursor): if the queue is full, it
+// is merged into a pending motion event that is queued as soon as there
+// is space again. Other events wait until there is space, after the
+// pending motion. Returns false if the thread should stop.
+static bool push_input_event(struct swa_kms_input_thread* thread,
+		const struct swa_kms_input_event* ev) {
+	if(is_motion_event(ev)) {
+		if(!thread->motion_pending) {
+			if(try_push_input_event(thread, ev)) {
+				return true;
+			}
+
+			thread->motion = *ev;
+			thread->motion_pending = true;
+			return true;
+		}
+
+		// An absolute position replaces the pending motion. Relative
+		// motion is added, the pending event keeps its type.
+		if(ev->type == swa_kms_input_motion_abs) {
+			thread->motion = *ev;
+		} else {
+			thread->motion.motion.x += ev->motion.x;
+			thread->motion.motion.y += ev->motion.y;
+		}
+
+		flush_pending_motion(thread);
+		return true;
+	}
+
+	if(thread->motion_pending) {
+		if(!wait_push_input_event(thread, &thread->motion)) {
+			return false;
+		}
+
+		thread->motion_pending = false;
+	}
+
+	return wait_push_input_event(thread, ev);
+}
+
+static void* input_thread_main(void* data) {
+	struct swa_kms_input_thread* thread = data;
+	struct pollfd fds[2] = {
+		{.fd = libinput_get_fd(thread->context), .events = POLLIN},
+		{.fd = thread->stop_pipe_r, .events = POLLIN},
+	};
+
+	while(true) {
+		// retry queuing the pending motion regularly
+		int timeout = thread->motion_pending ? 10 : -1;
+		int ret = poll(fds, 2, timeout);
+		if(ret < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+
+			dlg_error("poll: %s", strerror(errno));
+			return NULL;
+		}
+
+		if(fds[1].revents) {
+			return NULL;
+		}
+
+		flush_pending_motion(thread);
+		if(ret == 0) {
+			continue;
+		}
+
+		if(libinput_dispatch(thread->context) != 0) {
+			dlg_error("Failed to dispatch libinput");
+			continue;
+		}
+
+		struct libinput_event* event;
+		while((event = libinput_get_event(thread->context))) {
+			struct swa_kms_input_event ev;
+			bool handled = read_input_event(event, &ev);
+			libinput_event_destroy(event);
+			if(!handled) {
+				continue;
+			}
+
+			move_thread_cursor(thread, &ev);
+			if(!push_input_event(thread, &ev)) {
+				return NULL;
+			}
+		}
+	}
+}
+
+// Handles the events queued by the input thread, on the main thread.
+static void input_queue_io(struct pml_io* io, unsigned revents) {
+	struct swa_display_kms* dpy = pml_io_get_data(io);
+	struct swa_kms_input_thread* thread = dpy->input.thread;
+
+	char buf[8];
+	if(read(thread->event_pipe_r, buf, sizeof(buf)) < 0 && errno != EAGAIN) {
+		dlg_warn("Reading from input event pipe failed: %s", strerror(errno));
+	}
+
+	// Reset before reading the queue. Events queued from now on will
+	// write to the pipe again.
+	atomic_store(&thread->notified, false);
+
+	unsigned head = atomic_load_explicit(&thread->head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&thread->tail, memory_order_acquire);
+	for(; head != tail; ++head) {
+		struct swa_kms_input_event ev = thread->events[head % input_queue_size];
+		atomic_store_explicit(&thread->head, head + 1, memory_order_release);
+		handle_input_event(dpy, &ev);
+	}
+}
+
+static void stop_input_thread(struct swa_display_kms* dpy) {
+	struct swa_kms_input_thread* thread = dpy->input.thread;
+	if(!thread) {
+		return;
+	}
+
+	if(thread->running) {
+		if(write(thread->stop_pipe_w, " ", 1) < 0) {
+			dlg_error("Writing to input stop pipe failed: %s", strerror(errno));
+		}
+		pthread_join(thread->thread, NULL);
+	}
+
+	if(thread->event_io) pml_io_destroy(thread->event_io);
+	if(thread->event_pipe_r) close(thread->event_pipe_r);
+	if(thread->event_pipe_w) close(thread->event_pipe_w);
+	if(thread->stop_pipe_r) close(thread->stop_pipe_r);
+	if(thread->stop_pipe_w) close(thread->stop_pipe_w);
+	pthread_mutex_destroy(&thread->mutex);
+	free(thread);
+	dpy->input.thread = NULL;
+}
+
+// From now on, libinput is only used by the input thread. Must be
+// called after the initial libinput events were handled. On failure,
+// input is still read on the main thread.
+static bool start_input_thread(struct swa_display_kms* dpy) {
+	// The input thread moves the cursor with legacy ioctls, they must
+	// act on the cursor plane that the atomic commits use.
+	for(unsigned i = 0u; i < dpy->drm.n_outputs; ++i) {
+		struct swa_kms_output* output = &dpy->drm.outputs[i];
+		if(output->cursor_plane.id && !output->cursor_plane.legacy) {
+			dlg_warn("Cursor plane %" PRIu32 " might not be the legacy "
+				"cursor plane of CRTC %" PRIu32 ", can't use an input thread",
+				output->cursor_plane.id, output->crtc.id);
+			return false;
+		}
+	}
+
+	struct swa_kms_input_thread* thread = calloc(1, sizeof(*thread));
+	if(!thread) {
+		dlg_error("Failed to allocate input thread");
+		return false;
+	}
+
+	dpy->input.thread = thread;
+	pthread_mutex_init(&thread->mutex, NULL);
+	thread->context = dpy->input.context;
+	thread->cursor.x = dpy->input.pointer.x;
+	thread->cursor.y = dpy->input.pointer.y;
+	atomic_init(&thread->head, 0u);
+	atomic_init(&thread->tail, 0u);
+	atomic_init(&thread->notified, false);
+
+	int fds[2];
+	if(!swa_pipe(fds)) {
+		goto error;
+	}
+
+	thread->stop_pipe_r = fds[0];
+	thread->stop_pipe_w = fds[1];
+	if(!swa_pipe(fds)) {
+		goto error;
+	}
+
+	thread->event_pipe_r = fds[0];
+	thread->event_pipe_w = fds[1];
+	thread->event_io = pml_io_new(dpy->pml, thread->event_pipe_r,
+		POLLIN, input_queue_io);
+	if(!thread->event_io) {
+		goto error;
+	}
+
+	pml_io_set_data(thread->event_io, dpy);
+
+	int err = pthread_create(&thread->thread, NULL, input_thread_main, thread);
+	if(err) {
+		dlg_error("pthread_create: %s", strerror(err));
+		goto error;
+	}
+
+	// the thread reads libinput now
+	thread->running = true;
+	pml_io_destroy(dpy->input.io);
+	dpy->input.io = NULL;
+	dlg_debug("Started input thread");
+	return true;
+
+error:
+	stop_input_thread(dpy);
+	return false;
+}
+
 static void log_libinput(struct libinput *libinput_context,
 		enum libinput_log_priority priority, const char *fmt, va_list args) {
 	char buf[256];
@@ -2209,6 +3628,12 @@ struct swa_display* swa_display_kms_create(const char* appname) {
 		goto error;
 	}
 
+	const char* input_thread = getenv("SWA_KMS_INPUT_THREAD");
+	if(input_thread && strcmp(input_thread, "0") != 0 &&
+			!start_input_thread(dpy)) {
+		dlg_warn("Reading input on the main thread instead");
+	}
+
 	return &dpy->base;
 
 error:
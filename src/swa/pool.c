@@ -0,0 +1,301 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <swa/private/pool.h>
+#include <dlg/dlg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Minimal threading abstraction over pthreads and the winapi
+// (slim reader/writer locks and condition variables).
+#ifdef _WIN32
+  #include <windows.h>
+
+  typedef SRWLOCK pool_mutex;
+  typedef CONDITION_VARIABLE pool_cond;
+  typedef HANDLE pool_thread;
+
+  #define POOL_MUTEX_INIT SRWLOCK_INIT
+  #define POOL_COND_INIT CONDITION_VARIABLE_INIT
+#else
+  #include <pthread.h>
+  #include <unistd.h>
+
+  typedef pthread_mutex_t pool_mutex;
+  typedef pthread_cond_t pool_cond;
+  typedef pthread_t pool_thread;
+
+  #define POOL_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+  #define POOL_COND_INIT PTHREAD_COND_INITIALIZER
+#endif
+
+// We don't need more than that for memory bound image operations.
+static const unsigned max_threads = 16u;
+
+static struct {
+	swa_image_parallel_for custom;
+	void* custom_data;
+
+	// serializes swa_parallel_for calls and pool (re-)creation
+	pool_mutex job_mutex;
+
+	// protects all fields below
+	pool_mutex mutex;
+	pool_cond work_cond; // signaled when a new job is available
+	pool_cond done_cond; // signaled when all tasks of a job are done
+
+	unsigned thread_count; // requested count, 0 for auto
+	bool created;
+	bool quit;
+	unsigned n_threads;
+	pool_thread* threads;
+
+	// current job
+	swa_image_task task;
+	void* data;
+	unsigned count;
+	unsigned next;
+	unsigned done;
+} pool = {
+	.job_mutex = POOL_MUTEX_INIT,
+	.mutex = POOL_MUTEX_INIT,
+	.work_cond = POOL_COND_INIT,
+	.done_cond = POOL_COND_INIT,
+};
+
+#ifdef _WIN32
+
+static void mutex_lock(pool_mutex* mutex) {
+	AcquireSRWLockExclusive(mutex);
+}
+
+static void mutex_unlock(pool_mutex* mutex) {
+	ReleaseSRWLockExclusive(mutex);
+}
+
+static void cond_wait(pool_cond* cond, pool_mutex* mutex) {
+	SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+}
+
+static void cond_broadcast(pool_cond* cond) {
+	WakeAllConditionVariable(cond);
+}
+
+static void* worker_main(void* arg);
+static DWORD WINAPI worker_main_win(LPVOID arg) {
+	worker_main(arg);
+	return 0;
+}
+
+static bool thread_create(pool_thread* thread) {
+	*thread = CreateThread(NULL, 0, worker_main_win, NULL, 0, NULL);
+	if(!*thread) {
+		dlg_warn("CreateThread: %lu", (unsigned long) GetLastError());
+		return false;
+	}
+
+	return true;
+}
+
+static void thread_join(pool_thread thread) {
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+static unsigned default_thread_count(void) {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ?
+		(unsigned) info.dwNumberOfProcessors : 1u;
+}
+
+#else // _WIN32
+
+static void mutex_lock(pool_mutex* mutex) {
+	pthread_mutex_lock(mutex);
+}
+
+static void mutex_unlock(pool_mutex* mutex) {
+	pthread_mutex_unlock(mutex);
+}
+
+static void cond_wait(pool_cond* cond, pool_mutex* mutex) {
+	pthread_cond_wait(cond, mutex);
+}
+
+static void cond_broadcast(pool_cond* cond) {
+	pthread_cond_broadcast(cond);
+}
+
+static void* worker_main(void* arg);
+static bool thread_create(pool_thread* thread) {
+	int err = pthread_create(thread, NULL, worker_main, NULL);
+	if(err) {
+		dlg_warn("pthread_create: %s", strerror(err));
+		return false;
+	}
+
+	return true;
+}
+
+static void thread_join(pool_thread thread) {
+	pthread_join(thread, NULL);
+}
+
+static unsigned default_thread_count(void) {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned) n : 1u;
+}
+
+#endif // _WIN32
+
+// Executes tasks of the current job until there are none left.
+// Must be called with the mutex locked.
+static void run_tasks_locked(void) {
+	while(pool.next < pool.count) {
+		unsigned i = pool.next++;
+		swa_image_task task = pool.task;
+		void* data = pool.data;
+
+		mutex_unlock(&pool.mutex);
+		task(data, i);
+		mutex_lock(&pool.mutex);
+
+		if(++pool.done == pool.count) {
+			cond_broadcast(&pool.done_cond);
+		}
+	}
+}
+
+static void* worker_main(void* arg) {
+	(void) arg;
+	mutex_lock(&pool.mutex);
+	while(true) {
+		while(!pool.quit && pool.next >= pool.count) {
+			cond_wait(&pool.work_cond, &pool.mutex);
+		}
+
+		if(pool.quit) {
+			break;
+		}
+
+		run_tasks_locked();
+	}
+
+	mutex_unlock(&pool.mutex);
+	return NULL;
+}
+
+// Must be called with job_mutex locked.
+static void create_workers(void) {
+	pool.created = true;
+
+	unsigned count = pool.thread_count;
+	if(count == 0) {
+		count = default_thread_count();
+	}
+
+	if(count > max_threads) {
+		count = max_threads;
+	}
+
+	// the calling thread participates
+	if(count <= 1) {
+		return;
+	}
+
+	pool.threads = calloc(count - 1, sizeof(*pool.threads));
+	if(!pool.threads) {
+		dlg_warn("Allocating image worker pool failed");
+		return;
+	}
+
+	for(unsigned i = 0u; i < count - 1; ++i) {
+		if(!thread_create(&pool.threads[i])) {
+			break;
+		}
+
+		++pool.n_threads;
+	}
+
+	dlg_debug("Created image worker pool with %u threads", pool.n_threads);
+}
+
+// Must be called with job_mutex locked.
+static void destroy_workers(void) {
+	mutex_lock(&pool.mutex);
+	pool.quit = true;
+	cond_broadcast(&pool.work_cond);
+	mutex_unlock(&pool.mutex);
+
+	for(unsigned i = 0u; i < pool.n_threads; ++i) {
+		thread_join(pool.threads[i]);
+	}
+
+	free(pool.threads);
+	pool.threads = NULL;
+	pool.n_threads = 0u;
+	pool.quit = false;
+	pool.created = false;
+}
+
+void swa_image_set_thread_count(unsigned count) {
+	mutex_lock(&pool.job_mutex);
+	if(pool.created) {
+		destroy_workers();
+	}
+
+	pool.thread_count = count;
+	mutex_unlock(&pool.job_mutex);
+}
+
+void swa_image_destroy_pool(void) {
+	mutex_lock(&pool.job_mutex);
+	if(pool.created) {
+		destroy_workers();
+	}
+	mutex_unlock(&pool.job_mutex);
+}
+
+void swa_image_set_parallel_for(swa_image_parallel_for fn, void* userdata) {
+	pool.custom = fn;
+	pool.custom_data = userdata;
+}
+
+void swa_parallel_for(unsigned count, swa_image_task task, void* data) {
+	if(pool.custom) {
+		pool.custom(pool.custom_data, count, task, data);
+		return;
+	}
+
+	mutex_lock(&pool.job_mutex);
+	if(!pool.created) {
+		create_workers();
+	}
+
+	if(pool.n_threads > 0 && count > 1) {
+		mutex_lock(&pool.mutex);
+		pool.task = task;
+		pool.data = data;
+		pool.count = count;
+		pool.next = 0u;
+		pool.done = 0u;
+		cond_broadcast(&pool.work_cond);
+
+		run_tasks_locked();
+		while(pool.done < pool.count) {
+			cond_wait(&pool.done_cond, &pool.mutex);
+		}
+
+		pool.count = pool.next = pool.done = 0u;
+		mutex_unlock(&pool.mutex);
+		mutex_unlock(&pool.job_mutex);
+		return;
+	}
+
+	mutex_unlock(&pool.job_mutex);
+
+	for(unsigned i = 0u; i < count; ++i) {
+		task(data, i);
+	}
+}
@@ -0,0 +1,239 @@
+#define _GNU_SOURCE
+
+#include <swa/private/shm.h>
+#include <dlg/dlg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Allocations are aligned to cache lines so that every buffer
+// starts suitably aligned for simd loads and stores.
+static const uint64_t shm_align = 64u;
+
+// The file grows by at least this size and at least doubles.
+static const uint64_t shm_min_grow = 1024u * 1024u;
+
+// Size of the mapping, the maximum size of the arena. wl_shm_pool
+// sizes are int32_t, on 32-bit we can't reserve that much address
+// space in the first place.
+static const uint64_t shm_max_size_64 = 1024u * 1024u * 1024u;
+static const uint64_t shm_max_size_32 = 256u * 1024u * 1024u;
+
+static uint64_t align_up(uint64_t val, uint64_t align) {
+	return (val + align - 1) & ~(align - 1);
+}
+
+static int create_file(void) {
+#ifdef __linux__
+	int fd = memfd_create("swa-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(fd < 0) {
+		dlg_error("memfd_create: %s", strerror(errno));
+		return -1;
+	}
+
+	// The server can rely on the file never shrinking, i.e. that
+	// accessing buffers it got from us never raises SIGBUS.
+	if(fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) < 0) {
+		dlg_warn("Sealing shm file failed: %s", strerror(errno));
+	}
+
+	return fd;
+#else // __linux__
+	static unsigned counter = 0u;
+	char name[64];
+	for(unsigned i = 0u; i < 16u; ++i) {
+		snprintf(name, sizeof(name), "/swa-shm-%ld-%u", (long) getpid(),
+			counter++);
+		int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+		if(fd >= 0) {
+			shm_unlink(name);
+			return fd;
+		}
+
+		if(errno != EEXIST) {
+			break;
+		}
+	}
+
+	dlg_error("shm_open: %s", strerror(errno));
+	return -1;
+#endif // __linux__
+}
+
+bool swa_shm_init(struct swa_shm* shm) {
+	memset(shm, 0x0, sizeof(*shm));
+	shm->fd = create_file();
+	if(shm->fd < 0) {
+		return false;
+	}
+
+	// Reserve the whole range once. Pages behind the end of the file
+	// are never accessed, extending the file makes them usable.
+	shm->max_size = sizeof(void*) >= 8 ? shm_max_size_64 : shm_max_size_32;
+	void* data = mmap(NULL, shm->max_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED, shm->fd, 0);
+	if(data == MAP_FAILED) {
+		dlg_error("mmap: %s", strerror(errno));
+		close(shm->fd);
+		shm->fd = -1;
+		return false;
+	}
+
+	shm->data = data;
+	return true;
+}
+
+void swa_shm_finish(struct swa_shm* shm) {
+	if(shm->data) munmap(shm->data, shm->max_size);
+	if(shm->fd >= 0) close(shm->fd);
+	free(shm->free);
+	memset(shm, 0x0, sizeof(*shm));
+	shm->fd = -1;
+}
+
+static void remove_block(struct swa_shm* shm, unsigned i) {
+	memmove(&shm->free[i], &shm->free[i + 1],
+		(shm->n_free - i - 1) * sizeof(*shm->free));
+	--shm->n_free;
+}
+
+static bool insert_block(struct swa_shm* shm, uint64_t offset, uint64_t size) {
+	unsigned i = 0u;
+	while(i < shm->n_free && shm->free[i].offset < offset) {
+		++i;
+	}
+
+	struct swa_shm_block* prev = i > 0 ? &shm->free[i - 1] : NULL;
+	struct swa_shm_block* next = i < shm->n_free ? &shm->free[i] : NULL;
+	bool merge_prev = prev && prev->offset + prev->size == offset;
+	bool merge_next = next && offset + size == next->offset;
+	if(merge_prev && merge_next) {
+		prev->size += size + next->size;
+		remove_block(shm, i);
+		return true;
+	} else if(merge_prev) {
+		prev->size += size;
+		return true;
+	} else if(merge_next) {
+		next->offset = offset;
+		next->size += size;
+		return true;
+	}
+
+	if(shm->n_free == shm->cap_free) {
+		unsigned cap = shm->cap_free ? 2 * shm->cap_free : 16u;
+		void* blocks = realloc(shm->free, cap * sizeof(*shm->free));
+		if(!blocks) {
+			dlg_error("Failed to allocate shm block list");
+			return false;
+		}
+
+		shm->free = blocks;
+		shm->cap_free = cap;
+	}
+
+	memmove(&shm->free[i + 1], &shm->free[i],
+		(shm->n_free - i) * sizeof(*shm->free));
+	shm->free[i].offset = offset;
+	shm->free[i].size = size;
+	++shm->n_free;
+	return true;
+}
+
+// Grows the file so that an allocation of `size` fits at its end.
+static bool grow(struct swa_shm* shm, uint64_t size) {
+	// a free block at the end of the file is extended
+	uint64_t tail = 0u;
+	if(shm->n_free) {
+		struct swa_shm_block* last = &shm->free[shm->n_free - 1];
+		if(last->offset + last->size == shm->size) {
+			tail = last->size;
+		}
+	}
+
+	uint64_t needed = shm->size + size - tail;
+	if(needed > shm->max_size) {
+		dlg_error("shm arena is full (%" PRIu64 " bytes needed)", needed);
+		return false;
+	}
+
+	uint64_t new_size = 2 * shm->size;
+	if(new_size < shm->size + shm_min_grow) {
+		new_size = shm->size + shm_min_grow;
+	}
+	if(new_size < needed) {
+		new_size = align_up(needed, shm_min_grow);
+	}
+	if(new_size > shm->max_size) {
+		new_size = shm->max_size;
+	}
+
+	if(ftruncate(shm->fd, new_size) < 0) {
+		dlg_error("ftruncate: %s", strerror(errno));
+		return false;
+	}
+
+	if(!insert_block(shm, shm->size, new_size - shm->size)) {
+		return false;
+	}
+
+	shm->size = new_size;
+	return true;
+}
+
+bool swa_shm_alloc(struct swa_shm* shm, uint64_t size, uint64_t* offset) {
+	dlg_assert(shm->data && size > 0);
+	size = align_up(size, shm_align);
+	for(unsigned r = 0u; r < 2u; ++r) {
+		// first fit
+		for(unsigned i = 0u; i < shm->n_free; ++i) {
+			struct swa_shm_block* block = &shm->free[i];
+			if(block->size < size) {
+				continue;
+			}
+
+			*offset = block->offset;
+			block->offset += size;
+			block->size -= size;
+			if(block->size == 0u) {
+				remove_block(shm, i);
+			}
+
+			return true;
+		}
+
+		if(r == 0u && !grow(shm, size)) {
+			return false;
+		}
+	}
+
+	dlg_error("unreachable");
+	return false;
+}
+
+void swa_shm_free(struct swa_shm* shm, uint64_t offset, uint64_t size) {
+	size = align_up(size, shm_align);
+	dlg_assert(offset + size <= shm->size);
+	if(!insert_block(shm, offset, size)) {
+		// the memory is leaked but stays valid
+		return;
+	}
+
+#ifdef __linux__
+	// Give the pages fully covered by the allocation back to the
+	// system, the arena itself never shrinks.
+	uint64_t page = (uint64_t) sysconf(_SC_PAGESIZE);
+	uint64_t start = align_up(offset, page);
+	uint64_t end = (offset + size) & ~(page - 1);
+	if(end > start && fallocate(shm->fd,
+			FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			start, end - start) < 0) {
+		dlg_debug("fallocate: %s", strerror(errno));
+	}
+#endif // __linux__
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+// Lookup tables for the sRGB transfer function, used by image.c.
+// Generated with the exact piecewise sRGB definition.
+
+#include <stdint.h>
+
+// srgb_encode_table[i] = round(65535 * srgb(min(64 * i, 65535) / 65535)),
+// linear 16-bit values are interpolated between the entries.
+static const uint16_t srgb_encode_table[1025] = {
+	0u, 827u, 1654u, 2481u, 3255u, 3923u, 4518u, 5056u, 5552u, 6013u, 6444u, 6851u,
+	7237u, 7605u, 7956u, 8294u, 8618u, 8931u, 9233u, 9525u, 9809u, 10084u, 10352u, 10613u,
+	10867u, 11116u, 11358u, 11595u, 11827u, 12055u, 12278u, 12496u, 12710u, 12921u, 13128u, 13331u,
+	13531u, 13728u, 13921u, 14112u, 14300u, 14485u, 14668u, 14848u, 15025u, 15201u, 15374u, 15544u,
+	15713u, 15880u, 16045u, 16207u, 16368u, 16527u, 16685u, 16841u, 16995u, 17147u, 17298u, 17448u,
+	17595u, 17742u, 17887u, 18031u, 18173u, 18314u, 18454u, 18593u, 18730u, 18867u, 19002u, 19136u,
+	19269u, 19401u, 19531u, 19661u, 19790u, 19918u, 20044u, 20170u, 20295u, 20419u, 20542u, 20665u,
+	20786u, 20907u, 21026u, 21145u, 21263u, 21381u, 21497u, 21613u, 21728u, 21843u, 21956u, 22069u,
+	22182u, 22293u, 22404u, 22514u, 22624u, 22733u, 22841u, 22949u, 23056u, 23163u, 23268u, 23374u,
+	23479u, 23583u, 23686u, 23790u, 23892u, 23994u, 24096u, 24197u, 24297u, 24397u, 24497u, 24596u,
+	24694u, 24792u, 24890u, 24987u, 25083u, 25179u, 25275u, 25370u, 25465u, 25560u, 25654u, 25747u,
+	25840u, 25933u, 26025u, 26117u, 26209u, 26300u, 26391u, 26481u, 26571u, 26661u, 26750u, 26839u,
+	26928u, 27016u, 27104u, 27191u, 27278u, 27365u, 27451u, 27537u, 27623u, 27709u, 27794u, 27879u,
+	27963u, 28047u, 28131u, 28215u, 28298u, 28381u, 28463u, 28546u, 28628u, 28709u, 28791u, 28872u,
+	28953u, 29034u, 29114u, 29194u, 29274u, 29353u, 29432u, 29511u, 29590u, 29669u, 29747u, 29825u,
+	29902u, 29980u, 30057u, 30134u, 30211u, 30287u, 30363u, 30439u, 30515u, 30591u, 30666u, 30741u,
+	30816u, 30890u, 30965u, 31039u, 31113u, 31186u, 31260u, 31333u, 31406u, 31479u, 31552u, 31624u,
+	31696u, 31768u, 31840u, 31912u, 31983u, 32054u, 32125u, 32196u, 32267u, 32337u, 32407u, 32477u,
+	32547u, 32617u, 32686u, 32755u, 32824u, 32893u, 32962u, 33031u, 33099u, 33167u, 33235u, 33303u,
+	33371u, 33438u, 33506u, 33573u, 33640u, 33706u, 33773u, 33840u, 33906u, 33972u, 34038u, 34104u,
+	34169u, 34235u, 34300u, 34365u, 34431u, 34495u, 34560u, 34625u, 34689u, 34753u, 34817u, 34881u,
+	34945u, 35009u, 35072u, 35136u, 35199u, 35262u, 35325u, 35388u, 35450u, 35513u, 35575u, 35638u,
+	35700u, 35762u, 35824u, 35885u, 35947u, 36008u, 36069u, 36131u, 36192u, 36253u, 36313u, 36374u,
+	36434u, 36495u, 36555u, 36615u, 36675u, 36735u, 36795u, 36855u, 36914u, 36973u, 37033u, 37092u,
+	37151u, 37210u, 37269u, 37327u, 37386u, 37444u, 37502u, 37561u, 37619u, 37677u, 37735u, 37792u,
+	37850u, 37908u, 37965u, 38022u, 38079u, 38136u, 38193u, 38250u, 38307u, 38364u, 38420u, 38477u,
+	38533u, 38589u, 38645u, 38701u, 38757u, 38813u, 38869u, 38924u, 38980u, 39035u, 39091u, 39146u,
+	39201u, 39256u, 39311u, 39366u, 39420u, 39475u, 39529u, 39584u, 39638u, 39692u, 39746u, 39800u,
+	39854u, 39908u, 39962u, 40016u, 40069u, 40123u, 40176u, 40229u, 40283u, 40336u, 40389u, 40442u,
+	40495u, 40547u, 40600u, 40653u, 40705u, 40757u, 40810u, 40862u, 40914u, 40966u, 41018u, 41070u,
+	41122u, 41174u, 41225u, 41277u, 41328u, 41380u, 41431u, 41482u, 41533u, 41584u, 41635u, 41686u,
+	41737u, 41788u, 41839u, 41889u, 41940u, 41990u, 42040u, 42091u, 42141u, 42191u, 42241u, 42291u,
+	42341u, 42391u, 42440u, 42490u, 42540u, 42589u, 42639u, 42688u, 42737u, 42787u, 42836u, 42885u,
+	42934u, 42983u, 43032u, 43080u, 43129u, 43178u, 43226u, 43275u, 43323u, 43372u, 43420u, 43468u,
+	43516u, 43564u, 43612u, 43660u, 43708u, 43756u, 43804u, 43851u, 43899u, 43947u, 43994u, 44042u,
+	44089u, 44136u, 44183u, 44231u, 44278u, 44325u, 44372u, 44418u, 44465u, 44512u, 44559u, 44605u,
+	44652u, 44699u, 44745u, 44791u, 44838u, 44884u, 44930u, 44976u, 45022u, 45068u, 45114u, 45160u,
+	45206u, 45252u, 45298u, 45343u, 45389u, 45434u, 45480u, 45525u, 45571u, 45616u, 45661u, 45706u,
+	45751u, 45797u, 45842u, 45886u, 45931u, 45976u, 46021u, 46066u, 46110u, 46155u, 46200u, 46244u,
+	46289u, 46333u, 46377u, 46422u, 46466u, 46510u, 46554u, 46598u, 46642u, 46686u, 46730u, 46774u,
+	46818u, 46861u, 46905u, 46949u, 46992u, 47036u, 47079u, 47123u, 47166u, 47209u, 47253u, 47296u,
+	47339u, 47382u, 47425u, 47468u, 47511u, 47554u, 47597u, 47640u, 47683u, 47725u, 47768u, 47811u,
+	47853u, 47896u, 47938u, 47981u, 48023u, 48065u, 48108u, 48150u, 48192u, 48234u, 48276u, 48318u,
+	48360u, 48402u, 48444u, 48486u, 48528u, 48569u, 48611u, 48653u, 48694u, 48736u, 48777u, 48819u,
+	48860u, 48902u, 48943u, 48984u, 49026u, 49067u, 49108u, 49149u, 49190u, 49231u, 49272u, 49313u,
+	49354u, 49395u, 49436u, 49476u, 49517u, 49558u, 49598u, 49639u, 49679u, 49720u, 49760u, 49801u,
+	49841u, 49881u, 49922u, 49962u, 50002u, 50042u, 50082u, 50122u, 50163u, 50202u, 50242u, 50282u,
+	50322u, 50362u, 50402u, 50442u, 50481u, 50521u, 50560u, 50600u, 50640u, 50679u, 50719u, 50758u,
+	50797u, 50837u, 50876u, 50915u, 50954u, 50994u, 51033u, 51072u, 51111u, 51150u, 51189u, 51228u,
+	51267u, 51306u, 51344u, 51383u, 51422u, 51461u, 51499u, 51538u, 51577u, 51615u, 51654u, 51692u,
+	51731u, 51769u, 51807u, 51846u, 51884u, 51922u, 51960u, 51999u, 52037u, 52075u, 52113u, 52151u,
+	52189u, 52227u, 52265u, 52303u, 52341u, 52379u, 52416u, 52454u, 52492u, 52529u, 52567u, 52605u,
+	52642u, 52680u, 52717u, 52755u, 52792u, 52830u, 52867u, 52904u, 52942u, 52979u, 53016u, 53053u,
+	53090u, 53128u, 53165u, 53202u, 53239u, 53276u, 53313u, 53350u, 53387u, 53423u, 53460u, 53497u,
+	53534u, 53570u, 53607u, 53644u, 53680u, 53717u, 53754u, 53790u, 53827u, 53863u, 53900u, 53936u,
+	53972u, 54009u, 54045u, 54081u, 54117u, 54154u, 54190u, 54226u, 54262u, 54298u, 54334u, 54370u,
+	54406u, 54442u, 54478u, 54514u, 54550u, 54586u, 54621u, 54657u, 54693u, 54729u, 54764u, 54800u,
+	54836u, 54871u, 54907u, 54942u, 54978u, 55013u, 55049u, 55084u, 55119u, 55155u, 55190u, 55225u,
+	55261u, 55296u, 55331u, 55366u, 55401u, 55436u, 55472u, 55507u, 55542u, 55577u, 55612u, 55646u,
+	55681u, 55716u, 55751u, 55786u, 55821u, 55855u, 55890u, 55925u, 55960u, 55994u, 56029u, 56063u,
+	56098u, 56133u, 56167u, 56202u, 56236u, 56270u, 56305u, 56339u, 56374u, 56408u, 56442u, 56476u,
+	56511u, 56545u, 56579u, 56613u, 56647u, 56681u, 56715u, 56749u, 56783u, 56817u, 56851u, 56885u,
+	56919u, 56953u, 56987u, 57021u, 57055u, 57088u, 57122u, 57156u, 57190u, 57223u, 57257u, 57291u,
+	57324u, 57358u, 57391u, 57425u, 57458u, 57492u, 57525u, 57559u, 57592u, 57625u, 57659u, 57692u,
+	57725u, 57759u, 57792u, 57825u, 57858u, 57891u, 57924u, 57958u, 57991u, 58024u, 58057u, 58090u,
+	58123u, 58156u, 58189u, 58222u, 58254u, 58287u, 58320u, 58353u, 58386u, 58419u, 58451u, 58484u,
+	58517u, 58549u, 58582u, 58615u, 58647u, 58680u, 58712u, 58745u, 58777u, 58810u, 58842u, 58875u,
+	58907u, 58940u, 58972u, 59004u, 59037u, 59069u, 59101u, 59133u, 59166u, 59198u, 59230u, 59262u,
+	59294u, 59326u, 59358u, 59390u, 59422u, 59454u, 59486u, 59518u, 59550u, 59582u, 59614u, 59646u,
+	59678u, 59710u, 59742u, 59773u, 59805u, 59837u, 59869u, 59900u, 59932u, 59964u, 59995u, 60027u,
+	60058u, 60090u, 60122u, 60153u, 60185u, 60216u, 60248u, 60279u, 60310u, 60342u, 60373u, 60405u,
+	60436u, 60467u, 60498u, 60530u, 60561u, 60592u, 60623u, 60655u, 60686u, 60717u, 60748u, 60779u,
+	60810u, 60841u, 60872u, 60903u, 60934u, 60965u, 60996u, 61027u, 61058u, 61089u, 61120u, 61151u,
+	61181u, 61212u, 61243u, 61274u, 61305u, 61335u, 61366u, 61397u, 61427u, 61458u, 61489u, 61519u,
+	61550u, 61580u, 61611u, 61641u, 61672u, 61702u, 61733u, 61763u, 61794u, 61824u, 61854u, 61885u,
+	61915u, 61946u, 61976u, 62006u, 62036u, 62067u, 62097u, 62127u, 62157u, 62187u, 62218u, 62248u,
+	62278u, 62308u, 62338u, 62368u, 62398u, 62428u, 62458u, 62488u, 62518u, 62548u, 62578u, 62608u,
+	62638u, 62667u, 62697u, 62727u, 62757u, 62787u, 62816u, 62846u, 62876u, 62906u, 62935u, 62965u,
+	62995u, 63024u, 63054u, 63084u, 63113u, 63143u, 63172u, 63202u, 63231u, 63261u, 63290u, 63320u,
+	63349u, 63379u, 63408u, 63437u, 63467u, 63496u, 63525u, 63555u, 63584u, 63613u, 63643u, 63672u,
+	63701u, 63730u, 63759u, 63789u, 63818u, 63847u, 63876u, 63905u, 63934u, 63963u, 63992u, 64021u,
+	64050u, 64079u, 64108u, 64137u, 64166u, 64195u, 64224u, 64253u, 64282u, 64311u, 64339u, 64368u,
+	64397u, 64426u, 64455u, 64483u, 64512u, 64541u, 64569u, 64598u, 64627u, 64655u, 64684u, 64713u,
+	64741u, 64770u, 64798u, 64827u, 64856u, 64884u, 64913u, 64941u, 64970u, 64998u, 65026u, 65055u,
+	65083u, 65112u, 65140u, 65168u, 65197u, 65225u, 65253u, 65282u, 65310u, 65338u, 65366u, 65395u,
+	65423u, 65451u, 65479u, 65507u, 65535u
+};
+
+// srgb_decode_table[i] = round(65535 * linear(i / 255)). The last entry
+// duplicates the one before so that interpolation can always read i + 1.
+static const uint16_t srgb_decode_table[257] = {
+	0u, 20u, 40u, 60u, 80u, 99u, 119u, 139u, 159u, 179u, 199u, 219u,
+	241u, 264u, 288u, 313u, 340u, 367u, 396u, 427u, 458u, 491u, 526u, 562u,
+	599u, 637u, 677u, 718u, 761u, 805u, 851u, 898u, 947u, 997u, 1048u, 1101u,
+	1156u, 1212u, 1270u, 1330u, 1391u, 1453u, 1517u, 1583u, 1651u, 1720u, 1790u, 1863u,
+	1937u, 2013u, 2090u, 2170u, 2250u, 2333u, 2418u, 2504u, 2592u, 2681u, 2773u, 2866u,
+	2961u, 3058u, 3157u, 3258u, 3360u, 3464u, 3570u, 3678u, 3788u, 3900u, 4014u, 4129u,
+	4247u, 4366u, 4488u, 4611u, 4736u, 4864u, 4993u, 5124u, 5257u, 5392u, 5530u, 5669u,
+	5810u, 5953u, 6099u, 6246u, 6395u, 6547u, 6700u, 6856u, 7014u, 7174u, 7335u, 7500u,
+	7666u, 7834u, 8004u, 8177u, 8352u, 8528u, 8708u, 8889u, 9072u, 9258u, 9445u, 9635u,
+	9828u, 10022u, 10219u, 10417u, 10619u, 10822u, 11028u, 11235u, 11446u, 11658u, 11873u, 12090u,
+	12309u, 12530u, 12754u, 12980u, 13209u, 13440u, 13673u, 13909u, 14146u, 14387u, 14629u, 14874u,
+	15122u, 15371u, 15623u, 15878u, 16135u, 16394u, 16656u, 16920u, 17187u, 17456u, 17727u, 18001u,
+	18277u, 18556u, 18837u, 19121u, 19407u, 19696u, 19987u, 20281u, 20577u, 20876u, 21177u, 21481u,
+	21787u, 22096u, 22407u, 22721u, 23038u, 23357u, 23678u, 24002u, 24329u, 24658u, 24990u, 25325u,
+	25662u, 26001u, 26344u, 26688u, 27036u, 27386u, 27739u, 28094u, 28452u, 28813u, 29176u, 29542u,
+	29911u, 30282u, 30656u, 31033u, 31412u, 31794u, 32179u, 32567u, 32957u, 33350u, 33745u, 34143u,
+	34544u, 34948u, 35355u, 35764u, 36176u, 36591u, 37008u, 37429u, 37852u, 38278u, 38706u, 39138u,
+	39572u, 40009u, 40449u, 40891u, 41337u, 41785u, 42236u, 42690u, 43147u, 43606u, 44069u, 44534u,
+	45002u, 45473u, 45947u, 46423u, 46903u, 47385u, 47871u, 48359u, 48850u, 49344u, 49841u, 50341u,
+	50844u, 51349u, 51858u, 52369u, 52884u, 53401u, 53921u, 54445u, 54971u, 55500u, 56032u, 56567u,
+	57105u, 57646u, 58190u, 58737u, 59287u, 59840u, 60396u, 60955u, 61517u, 62082u, 62650u, 63221u,
+	63795u, 64372u, 64952u, 65535u, 65535u
+};
@@ -80,211 +80,6 @@ void swa_window_settings_default(struct swa_window_settings* settings) {
 	settings->width = settings->height = SWA_DEFAULT_SIZE;
 }
 
-unsigned swa_image_format_size(enum swa_image_format fmt) {
-	switch(fmt) {
-		case swa_image_format_rgba32:
-		case swa_image_format_argb32:
-		case swa_image_format_xrgb32:
-		case swa_image_format_bgra32:
-		case swa_image_format_bgrx32:
-		case swa_image_format_abgr32:
-			return 4;
-		case swa_image_format_rgb24:
-		case swa_image_format_bgr24:
-			return 3;
-		case swa_image_format_a8:
-			return 1;
-		case swa_image_format_none:
-			return 0;
-	}
-
-	// unreachable for valid formats
-	// dont' put it in default so we get warnings about unhandled enum values
-	dlg_error("Invalid image format %d", fmt);
-	return 0;
-}
-
-struct swa_image swa_convert_image_new(const struct swa_image* src,
-		enum swa_image_format format, unsigned new_stride) {
-	dlg_assert(src);
-	dlg_assert(!src->width || !src->height || src->data);
-	if(new_stride == 0) {
-		new_stride = src->width * swa_image_format_size(format);
-	}
-
-	struct swa_image dst = {
-		.width = src->width,
-		.height = src->height,
-		.format = format,
-		.stride = new_stride,
-		.data = malloc(src->height * new_stride)
-	};
-	swa_convert_image(src, &dst);
-	return dst;
-}
-
-void swa_write_pixel(uint8_t* data, enum swa_image_format fmt,
-		struct swa_pixel pixel) {
-	switch(fmt) {
-		case swa_image_format_rgba32:
-			data[0] = pixel.r;
-			data[1] = pixel.g;
-			data[2] = pixel.b;
-			data[3] = pixel.a;
-			break;
-		case swa_image_format_rgb24:
-			data[0] = pixel.r;
-			data[1] = pixel.g;
-			data[2] = pixel.b;
-			data[3] = 255;
-			break;
-		case swa_image_format_bgr24:
-			data[0] = pixel.b;
-			data[1] = pixel.g;
-			data[2] = pixel.r;
-			data[3] = 255;
-			break;
-		case swa_image_format_xrgb32:
-			data[0] = 255;
-			data[1] = pixel.r;
-			data[2] = pixel.g;
-			data[3] = pixel.b;
-			break;
-		case swa_image_format_argb32:
-			data[0] = pixel.a;
-			data[1] = pixel.r;
-			data[2] = pixel.g;
-			data[3] = pixel.b;
-			break;
-		case swa_image_format_abgr32:
-			data[0] = pixel.a;
-			data[1] = pixel.b;
-			data[2] = pixel.g;
-			data[3] = pixel.r;
-			break;
-		case swa_image_format_bgra32:
-			data[0] = pixel.b;
-			data[1] = pixel.g;
-			data[2] = pixel.r;
-			data[3] = pixel.a;
-			break;
-		case swa_image_format_bgrx32:
-			data[0] = pixel.b;
-			data[1] = pixel.g;
-			data[2] = pixel.r;
-			data[3] = 255;
-			break;
-		case swa_image_format_a8:
-			data[0] = pixel.a;
-			break;
-		case swa_image_format_none:
-			break;
-	}
-}
-
-struct swa_pixel swa_read_pixel(const uint8_t* data, enum swa_image_format fmt) {
-	switch(fmt) {
-		case swa_image_format_rgba32:
-			return (struct swa_pixel){data[0], data[1], data[2], data[3]};
-		case swa_image_format_rgb24:
-			return (struct swa_pixel){data[0], data[1], data[2], 255};
-		case swa_image_format_bgr24:
-			return (struct swa_pixel){data[2], data[1], data[0], 255};
-		case swa_image_format_xrgb32:
-			return (struct swa_pixel){data[1], data[2], data[3], 255};
-		case swa_image_format_argb32:
-			return (struct swa_pixel){data[1], data[2], data[3], data[0]};
-		case swa_image_format_abgr32:
-			return (struct swa_pixel){data[3], data[2], data[1], data[0]};
-		case swa_image_format_bgra32:
-			return (struct swa_pixel){data[2], data[1], data[0], data[3]};
-		case swa_image_format_bgrx32:
-			return (struct swa_pixel){data[2], data[1], data[0], 255};
-		case swa_image_format_a8:
-			return (struct swa_pixel){data[0], data[0], data[0], data[0]};
-		case swa_image_format_none:
-			return (struct swa_pixel){0, 0, 0, 0};
-	}
-
-	// unreachable for valid formats
-	// dont' put it in default so we get warnings about unhandled enum values
-	dlg_error("Invalid image format %d", fmt);
-	return (struct swa_pixel){0, 0, 0, 0};
-}
-
-void swa_convert_image(const struct swa_image* src, const struct swa_image* dst) {
-	dlg_assert(dst->width == src->width);
-	dlg_assert(dst->height == src->height);
-
-	unsigned src_size = swa_image_format_size(src->format);
-	unsigned dst_size = swa_image_format_size(dst->format);
-
-	const uint8_t* src_data = src->data;
-	uint8_t* dst_data = dst->data;
-	for(unsigned y = 0u; y < src->height; ++y) {
-		const uint8_t* src_row = src_data;
-		uint8_t* dst_row = dst_data;
-		for(unsigned x = 0u; x < src->width; ++x) {
-			struct swa_pixel pixel = swa_read_pixel(src_data, src->format);
-			swa_write_pixel(dst_data, dst->format, pixel);
-			src_data += src_size;
-			dst_data += dst_size;
-		}
-		src_data = src_row + src->stride;
-		dst_data = dst_row + dst->stride;
-	}
-}
-
-enum swa_image_format swa_image_format_reversed(enum swa_image_format fmt) {
-	switch(fmt) {
-		case swa_image_format_rgba32:
-			return swa_image_format_abgr32;
-		case swa_image_format_argb32:
-			return swa_image_format_bgra32;
-		case swa_image_format_xrgb32:
-			return swa_image_format_bgrx32;
-		case swa_image_format_bgra32:
-			return swa_image_format_argb32;
-		case swa_image_format_bgrx32:
-			return swa_image_format_xrgb32;
-		case swa_image_format_abgr32:
-			return swa_image_format_rgba32;
-		case swa_image_format_rgb24:
-			return swa_image_format_bgr24;
-		case swa_image_format_bgr24:
-			return swa_image_format_rgb24;
-		case swa_image_format_a8:
-		case swa_image_format_none:
-			return fmt;
-	}
-
-	// unreachable for valid formats
-	// dont' put it in default so we get warnings about unhandled enum values
-	dlg_error("Invalid image format %d", fmt);
-	return swa_image_format_none;
-}
-
-// 1: big
-// 2: little
-// other: something weird, no clue.
-static int endianess(void) {
-	union {
-		uint32_t i;
-		char c[4];
-	} v = { 0x01000002 };
-	return v.c[0];
-}
-
-enum swa_image_format swa_image_format_toggle_byte_word(enum swa_image_format fmt) {
-	switch(endianess()) {
-		case 1: return fmt;
-		case 2: return swa_image_format_reversed(fmt);
-		default:
-			dlg_error("Invalid endianess");
-			return swa_image_format_none;
-	}
-}
-
 // diplay api
 void swa_display_destroy(struct swa_display* dpy) {
 	if(dpy) {
@@ -341,12 +136,25 @@ swa_proc swa_display_get_gl_proc_addr(struct swa_display* dpy,
 }
 struct swa_window* swa_display_create_window(struct swa_display* dpy,
 		const struct swa_window_settings* settings) {
-	return dpy->impl->create_window(dpy, settings);
+	struct swa_window* win = dpy->impl->create_window(dpy, settings);
+	enum swa_image_format fmt = settings->surface_settings.buffer.preferred_format;
+	if(win && settings->surface == swa_surface_buffer &&
+			swa_image_format_is_planar(fmt)) {
+		win->yuv.format = fmt;
+	}
+
+	if(win && settings->surface == swa_surface_buffer) {
+		win->auto_damage.enabled = settings->surface_settings.buffer.auto_damage;
+	}
+
+	return win;
 }
 
 // window api
 void swa_window_destroy(struct swa_window* win) {
 	if(win) {
+		free(win->yuv.image.data);
+		free(win->auto_damage.prev.data);
 		win->impl->destroy(win);
 	}
 }
@@ -404,11 +212,278 @@ bool swa_window_gl_swap_buffers(struct swa_window* win) {
 bool swa_window_gl_set_swap_interval(struct swa_window* win, int interval) {
 	return win->impl->gl_set_swap_interval(win, interval);
 }
+static bool get_buffer(struct swa_window* win, struct swa_image* img) {
+	if(!win->impl->get_buffer(win, img)) {
+		return false;
+	}
+
+	// the shadow image isn't updated while it's not used
+	if(!win->yuv.format || img->format == win->yuv.format) {
+		win->yuv.valid = false;
+		return true;
+	}
+
+	// The backend can't present the requested yuv format. Hand out
+	// a buffer with it anyways and convert it when it's applied.
+	// Even strides keep the i420 chroma rows aligned.
+	struct swa_image* shadow = &win->yuv.image;
+	if(shadow->width != img->width || shadow->height != img->height) {
+		win->yuv.valid = false;
+		free(shadow->data);
+		shadow->width = img->width;
+		shadow->height = img->height;
+		shadow->stride = (img->width + 1) & ~1u;
+		shadow->format = win->yuv.format;
+		shadow->data = malloc(swa_image_data_size(shadow));
+		if(!shadow->data) {
+			dlg_error("Failed to allocate yuv buffer");
+			memset(shadow, 0, sizeof(*shadow));
+			return true;
+		}
+	}
+
+	win->yuv.target = *img;
+	win->yuv.pending = true;
+	*img = *shadow;
+	return true;
+}
+
+// Updates the copy of the last applied frame of a window with auto
+// damage. When no damage was passed, it is computed from the difference
+// between the copy and the applied buffer, stored in `damage`.
+static void update_auto_damage(struct swa_window* win,
+		const struct swa_rect** rects, unsigned* n_rects,
+		struct swa_rect damage[static 64]) {
+	const struct swa_image* cur = &win->buffer;
+	struct swa_image* prev = &win->auto_damage.prev;
+	if(!cur->data || swa_image_format_is_planar(cur->format)) {
+		return;
+	}
+
+	if(!prev->data || prev->width != cur->width ||
+			prev->height != cur->height || prev->format != cur->format) {
+		free(prev->data);
+		prev->width = cur->width;
+		prev->height = cur->height;
+		prev->format = cur->format;
+		prev->stride = cur->width * swa_image_format_size(cur->format);
+		prev->data = malloc((size_t) prev->stride * prev->height);
+		if(!prev->data) {
+			dlg_error("Failed to allocate auto damage buffer");
+			memset(prev, 0, sizeof(*prev));
+			return;
+		}
+
+		swa_convert_image_flags(cur, prev, swa_convert_flags_parallel);
+		return;
+	}
+
+	if(!*n_rects) {
+		unsigned count = swa_image_diff(cur, prev, 64, damage, 64);
+		if(!count) {
+			// nothing changed, an empty rect signals that to the backend
+			damage[0] = (struct swa_rect) {0, 0, 0, 0};
+			count = 1;
+		}
+
+		*rects = damage;
+		*n_rects = count;
+	}
+
+	swa_convert_image_region(cur, prev, *rects, *n_rects);
+}
+
 bool swa_window_get_buffer(struct swa_window* win, struct swa_image* img) {
-	return win->impl->get_buffer(win, img);
+	if(!get_buffer(win, img)) {
+		return false;
+	}
+
+	win->buffer = *img;
+	return true;
+}
+
+unsigned swa_window_get_buffer_age(struct swa_window* win) {
+	if(win->yuv.pending) {
+		return win->yuv.valid ? 1u : 0u;
+	}
+
+	return win->impl->get_buffer_age(win);
+}
+
+// Moves `src` of `img` to (x, y), the areas may overlap.
+static void move_rect(const struct swa_image* img, struct swa_rect src,
+		unsigned x, unsigned y) {
+	unsigned size = swa_image_format_size(img->format);
+	size_t row_size = (size_t) src.width * size;
+	for(unsigned i = 0u; i < src.height; ++i) {
+		// rows moving down are copied from the bottom
+		unsigned r = y > src.y ? src.height - 1 - i : i;
+		uint8_t* d = img->data + (size_t) (y + r) * img->stride + x * size;
+		const uint8_t* s = img->data + (size_t) (src.y + r) * img->stride +
+			src.x * size;
+		memmove(d, s, row_size);
+	}
+}
+
+// Copies `src` of the image with the layout of `img` but the given data
+// to (x, y) of `img`.
+static void copy_rect(const struct swa_image* img, const uint8_t* data,
+		struct swa_rect src, unsigned x, unsigned y) {
+	unsigned size = swa_image_format_size(img->format);
+	size_t row_size = (size_t) src.width * size;
+	for(unsigned r = 0u; r < src.height; ++r) {
+		uint8_t* d = img->data + (size_t) (y + r) * img->stride + x * size;
+		const uint8_t* s = data + (size_t) (src.y + r) * img->stride +
+			src.x * size;
+		memcpy(d, s, row_size);
+	}
+}
+
+static struct swa_rect rect_union(struct swa_rect a, struct swa_rect b) {
+	if(!a.width || !a.height) {
+		return b;
+	}
+
+	unsigned x1 = a.x < b.x ? a.x : b.x;
+	unsigned y1 = a.y < b.y ? a.y : b.y;
+	unsigned x2 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+	unsigned y2 = a.y + a.height > b.y + b.height ?
+		a.y + a.height : b.y + b.height;
+	return (struct swa_rect) {x1, y1, x2 - x1, y2 - y1};
+}
+
+unsigned swa_window_scroll_buffer(struct swa_window* win,
+		const struct swa_rect* rect, int dx, int dy,
+		struct swa_rect exposed[static 2]) {
+	const struct swa_image* img = &win->buffer;
+	if(!img->data) {
+		dlg_error("There is no active buffer");
+		return 0u;
+	}
+
+	struct swa_rect r = *rect;
+	if(r.x >= img->width || r.y >= img->height) {
+		return 0u;
+	}
+
+	r.width = r.width < img->width - r.x ? r.width : img->width - r.x;
+	r.height = r.height < img->height - r.y ? r.height : img->height - r.y;
+	unsigned adx = dx < 0 ? -dx : dx;
+	unsigned ady = dy < 0 ? -dy : dy;
+	if(!r.width || !r.height) {
+		return 0u;
+	}
+
+	exposed[0] = r;
+	if(adx >= r.width || ady >= r.height ||
+			swa_image_format_is_planar(img->format)) {
+		return 1u;
+	}
+
+	// the part of rect that stays visible, in source and destination
+	struct swa_rect src = {
+		.x = dx < 0 ? r.x + adx : r.x,
+		.y = dy < 0 ? r.y + ady : r.y,
+		.width = r.width - adx,
+		.height = r.height - ady,
+	};
+	struct swa_rect dst = src;
+	dst.x = dx < 0 ? r.x : r.x + adx;
+	dst.y = dy < 0 ? r.y : r.y + ady;
+
+	// If the buffer holds the last frame, its contents are moved.
+	// Otherwise they are copied from the buffer that holds it.
+	if(swa_window_get_buffer_age(win) == 1u) {
+		if(!dx && !dy) {
+			return 0u;
+		}
+
+		move_rect(img, src, dst.x, dst.y);
+	} else {
+		const uint8_t* prev = win->yuv.pending ?
+			NULL : win->impl->get_previous_buffer(win);
+		if(!prev) {
+			return 1u;
+		}
+
+		copy_rect(img, prev, src, dst.x, dst.y);
+	}
+
+	if((dx || dy) && !win->impl->scroll_buffer(win, &dst, dx, dy)) {
+		win->scroll_damage = rect_union(win->scroll_damage, dst);
+	}
+
+	unsigned count = 0u;
+	if(ady) {
+		exposed[count++] = (struct swa_rect) {
+			r.x, dy < 0 ? r.y + r.height - ady : r.y, r.width, ady};
+	}
+	if(adx) {
+		exposed[count++] = (struct swa_rect) {
+			dx < 0 ? r.x + r.width - adx : r.x, dst.y, adx, dst.height};
+	}
+
+	return count;
+}
+void swa_window_expose(struct swa_window* win, struct swa_rect rect) {
+	if(!rect.width || !rect.height) {
+		return;
+	}
+
+	win->expose_damage = rect_union(win->expose_damage, rect);
+}
+
+// Adds `rect` to the damage, copying it into `damage` first.
+// With too many rects we simply damage everything.
+static void add_damage(const struct swa_rect** rects, unsigned* n_rects,
+		struct swa_rect damage[static 64], struct swa_rect rect) {
+	if(!rect.width || !rect.height || !*n_rects) {
+		return;
+	}
+
+	if(*n_rects >= 64u) {
+		*n_rects = 0u;
+		return;
+	}
+
+	if(*rects != damage) {
+		memcpy(damage, *rects, *n_rects * sizeof(**rects));
+		*rects = damage;
+	}
+
+	damage[(*n_rects)++] = rect;
 }
+
 void swa_window_apply_buffer(struct swa_window* win) {
-	win->impl->apply_buffer(win);
+	swa_window_apply_buffer_damage(win, NULL, 0);
+}
+void swa_window_apply_buffer_damage(struct swa_window* win,
+		const struct swa_rect* rects, unsigned n_rects) {
+	// Contents moved by swa_window_scroll_buffer are damaged as well.
+	struct swa_rect damage[64];
+	add_damage(&rects, &n_rects, damage, win->scroll_damage);
+	win->scroll_damage = (struct swa_rect) {0};
+	if(win->auto_damage.enabled) {
+		update_auto_damage(win, &rects, &n_rects, damage);
+	}
+
+	// Contents lost on the server are in the buffer (and the copy of
+	// auto damage) unchanged, the diff doesn't include them.
+	add_damage(&rects, &n_rects, damage, win->expose_damage);
+	win->expose_damage = (struct swa_rect) {0};
+
+	win->buffer.data = NULL;
+
+	// The backend buffer might contain an older frame, it
+	// always has to be converted completely.
+	if(win->yuv.pending) {
+		swa_convert_image_flags(&win->yuv.image, &win->yuv.target,
+			swa_convert_flags_parallel);
+		win->yuv.pending = false;
+		win->yuv.valid = true;
+	}
+
+	win->impl->apply_buffer(win, rects, n_rects);
 }
 const struct swa_window_listener* swa_window_get_listener(struct swa_window* win) {
 	return win->listener;
@@ -180,6 +180,17 @@ static bool check_error(struct swa_display_wl* dpy) {
 	return true;
 }
 
+static bool print_error(struct swa_display_wl* dpy, const char* fn) {
+	// check for critical errors
+	if(check_error(dpy)) {
+		return false;
+	}
+
+	// otherwise output non-critical error
+	dlg_error("%s: %s (%d)", fn, strerror(errno), errno);
+	return true;
+}
+
 static bool add_fd_flags(int fd, int add_flags) {
 	long flags = fcntl(fd, F_GETFD);
 	if(flags == -1) {
@@ -213,105 +224,167 @@ static bool swa_pipe(int fds[static 2]) {
 	return true;
 }
 
-static int create_pool_file(size_t size, char** name) {
-	static const char template[] = "swa-buffer-XXXXXX";
-	const char *path = getenv("XDG_RUNTIME_DIR");
-	if(path == NULL) {
-		dlg_error("XDG_RUNTIME_DIR is not set");
-		return -1;
+static void destroy_orphan(struct swa_wl_buffer* orphan) {
+	struct swa_display_wl* dpy = orphan->dpy;
+	struct swa_wl_buffer** it = &dpy->orphans;
+	while(*it != orphan) {
+		it = &(*it)->next_orphan;
 	}
 
-	size_t name_size = strlen(template) + 1 + strlen(path) + 1;
-	*name = malloc(name_size);
-	snprintf(*name, name_size, "%s/%s", path, template);
-
-	int fd = mkstemp(*name);
-	if(fd < 0) {
-		dlg_error("mkstemp: %s (%d)", strerror(errno), errno);
-		free(name);
-		return -1;
-	}
-
-	if(!add_fd_flags(fd, FD_CLOEXEC)) {
-		dlg_error("set_cloexec: %s (%d)", strerror(errno), errno);
-		close(fd);
-		free(name);
-		return -1;
-	}
-
-	if(ftruncate(fd, size) < 0) {
-		dlg_error("ftruncate: %s (%d)", strerror(errno), errno);
-		close(fd);
-		free(name);
-		return -1;
-	}
-
-	return fd;
+	*it = orphan->next_orphan;
+	wl_buffer_destroy(orphan->buffer);
+	swa_shm_free(&dpy->shm_arena, orphan->offset, orphan->size);
+	free(orphan);
 }
 
 static void buffer_release(void* data, struct wl_buffer* wl_buffer) {
 	struct swa_wl_buffer* buffer = data;
 	dlg_assert(buffer->buffer == wl_buffer);
+	if(buffer->orphan) {
+		destroy_orphan(buffer);
+		return;
+	}
+
 	buffer->busy = false;
+
+	// Might be dispatched while waiting in get_buffer, so the
+	// listener isn't called directly
+	if(buffer->window && buffer->window->base.listener->buffer_available) {
+		pml_defer_enable(buffer->window->buffer.defer_available, true);
+	}
 }
 
 static const struct wl_buffer_listener buffer_listener = {
 	.release = buffer_release
 };
 
-static bool buffer_init(struct swa_wl_buffer* buf, struct wl_shm* shm,
-		int32_t width, int32_t height, uint32_t format) {
-	uint32_t stride = width * 4;
-	size_t size = stride * height;
+// Makes sure the shm arena exists and that the pool shared with the
+// compositor covers all of it.
+static bool update_shm_pool(struct swa_display_wl* dpy) {
+	struct swa_shm* arena = &dpy->shm_arena;
+	if(!dpy->shm_pool) {
+		dpy->shm_pool = wl_shm_create_pool(dpy->shm, arena->fd, arena->size);
+		if(!dpy->shm_pool) {
+			dlg_error("wl_shm_create_pool failed");
+			return false;
+		}
+	} else if(dpy->shm_pool_size != arena->size) {
+		wl_shm_pool_resize(dpy->shm_pool, arena->size);
+	}
+
+	dpy->shm_pool_size = arena->size;
+	return true;
+}
+
+static bool buffer_init(struct swa_display_wl* dpy, struct swa_wl_buffer* buf,
+		int32_t width, int32_t height, uint32_t stride, uint32_t format) {
+	size_t size = (size_t) stride * height;
+	// chroma planes of the yuv formats, see swa_image_data_size
+	if(format == WL_SHM_FORMAT_NV12 || format == WL_SHM_FORMAT_YUV420) {
+		size += (size_t) stride * ((height + 1) / 2);
+	}
 
-	char* name;
-	int fd = create_pool_file(size, &name);
-	if(fd < 0) {
+	if(!dpy->shm_arena.data && !swa_shm_init(&dpy->shm_arena)) {
 		return false;
 	}
 
-	void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if(data == MAP_FAILED) {
-		close(fd);
-		unlink(name);
-		free(name);
+	uint64_t offset;
+	if(!swa_shm_alloc(&dpy->shm_arena, size, &offset)) {
 		return false;
 	}
 
-	struct wl_shm_pool* pool = wl_shm_create_pool(shm, fd, size);
-	if(!pool) {
-		munmap(data, size);
-		unlink(name);
-		close(fd);
-		free(name);
+	if(!update_shm_pool(dpy)) {
+		swa_shm_free(&dpy->shm_arena, offset, size);
 		return false;
 	}
 
-	buf->buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride, format);
-	wl_shm_pool_destroy(pool);
-	close(fd);
-	unlink(name);
-	free(name);
+	buf->buffer = wl_shm_pool_create_buffer(dpy->shm_pool, offset,
+		width, height, stride, format);
 	if(!buf->buffer) {
-		munmap(data, size);
+		swa_shm_free(&dpy->shm_arena, offset, size);
 		return false;
 	}
 
+	buf->offset = offset;
 	buf->size = size;
-	buf->data = data;
+	buf->data = dpy->shm_arena.data + offset;
 	buf->width = width;
 	buf->height = height;
+	buf->format = format;
+	buf->busy = false;
+	buf->frame = 0u;
+	buf->dpy = dpy;
 
+	wl_proxy_set_queue((struct wl_proxy*) buf->buffer, dpy->buffer_queue);
 	wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
-	return buf;
+	return true;
 }
 
-static void buffer_finish(struct swa_wl_buffer* buf) {
+static void buffer_finish(struct swa_display_wl* dpy,
+		struct swa_wl_buffer* buf) {
+	// The compositor might still read a busy buffer, its memory can't
+	// be reused until it is released. Destroying the wl_buffer would
+	// mean we never get the release event.
+	if(buf->buffer && buf->busy) {
+		struct swa_wl_buffer* orphan = malloc(sizeof(*orphan));
+		if(orphan) {
+			*orphan = *buf;
+			orphan->window = NULL;
+			orphan->orphan = true;
+			orphan->next_orphan = dpy->orphans;
+			dpy->orphans = orphan;
+			wl_buffer_set_user_data(orphan->buffer, orphan);
+			memset(buf, 0, sizeof(*buf));
+			return;
+		}
+
+		dlg_error("Failed to allocate orphan buffer");
+	}
+
 	if(buf->buffer) wl_buffer_destroy(buf->buffer);
-	if(buf->data) munmap(buf->data, buf->size);
+	if(buf->data) swa_shm_free(&dpy->shm_arena, buf->offset, buf->size);
 	memset(buf, 0, sizeof(*buf));
 }
 
+// Not defined by all wayland versions we support.
+// Like all wl_shm formats (except argb/xrgb8888), equal to the drm fourcc.
+static const uint32_t shm_format_xbgr16161616f = 0x48344258; // 'XB4H'
+
+// Chooses the wl_shm format used for the buffers of the given window.
+// ARGB8888 is used when the preferred format isn't supported since it's
+// compatible with cairo and guaranteed to be supported by all compositors.
+// wl_shm formats are given in little endian word order.
+static void choose_buffer_format(struct swa_window_wl* win,
+		enum swa_image_format pref) {
+	struct swa_display_wl* dpy = win->dpy;
+	if(pref == swa_image_format_rgb565 && dpy->shm_formats.rgb565) {
+		win->buffer.shm_format = WL_SHM_FORMAT_RGB565;
+		win->buffer.format = swa_image_format_rgb565;
+	} else if(pref == swa_image_format_xrgb2101010 &&
+			dpy->shm_formats.xrgb2101010) {
+		win->buffer.shm_format = WL_SHM_FORMAT_XRGB2101010;
+		win->buffer.format = swa_image_format_xrgb2101010;
+	} else if(pref == swa_image_format_rgba16f &&
+			dpy->shm_formats.xbgr16161616f) {
+		// we don't use the ABGR variant since wl_shm expects
+		// premultiplied alpha and rgba16f has straight alpha
+		win->buffer.shm_format = shm_format_xbgr16161616f;
+		win->buffer.format = swa_image_format_rgba16f;
+	} else if(pref == swa_image_format_nv12 && dpy->shm_formats.nv12) {
+		// the compositor derives the plane offsets from the stride
+		// and height, matching the layout swa uses
+		win->buffer.shm_format = WL_SHM_FORMAT_NV12;
+		win->buffer.format = swa_image_format_nv12;
+	} else if(pref == swa_image_format_i420 && dpy->shm_formats.yuv420) {
+		win->buffer.shm_format = WL_SHM_FORMAT_YUV420;
+		win->buffer.format = swa_image_format_i420;
+	} else {
+		win->buffer.shm_format = WL_SHM_FORMAT_ARGB8888;
+		// wl_shm formats with alpha are always premultiplied
+		win->buffer.format = swa_image_format_bgra32_premul;
+	}
+}
+
 static void cursor_render(struct swa_display_wl* dpy) {
 	dlg_assert(dpy->cursor.timer);
 	dlg_assert(dpy->cursor.active);
@@ -404,6 +477,9 @@ static void set_cursor(struct swa_display_wl* dpy, struct swa_window_wl* win) {
 		buffer = win->cursor.buffer.buffer;
 		hx = win->cursor.hx;
 		hy = win->cursor.hy;
+
+		// the compositor releases it when it's done with it
+		win->cursor.buffer.busy = buffer != NULL;
 	}
 
 	wl_pointer_set_cursor(dpy->pointer, dpy->mouse_enter_serial,
@@ -439,12 +515,20 @@ static void win_destroy(struct swa_window* base) {
 		win->dpy->n_touch_points = out;
 	}
 
+	if(win->cursor.buffer.buffer) {
+		buffer_finish(win->dpy, &win->cursor.buffer);
+	}
+
 	// destroy surface buffer
 	if(win->surface_type == swa_surface_buffer) {
 		for(unsigned i = 0u; i < win->buffer.n_bufs; ++i) {
-			buffer_finish(&win->buffer.buffers[i]);
+			buffer_finish(win->dpy, &win->buffer.buffers[i]);
 		}
 		free(win->buffer.buffers);
+		if(win->buffer.stale_timer) pml_timer_destroy(win->buffer.stale_timer);
+		if(win->buffer.defer_available) {
+			pml_defer_destroy(win->buffer.defer_available);
+		}
 	} else if(win->surface_type == swa_surface_vk) {
 #ifdef SWA_WITH_VK
 		if(win->vk.surface) {
@@ -553,21 +637,23 @@ static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
 	}
 
 	if(type == swa_cursor_none) {
-		buffer_finish(&win->cursor.buffer);
+		buffer_finish(win->dpy, &win->cursor.buffer);
 		win->cursor.hx = win->cursor.hy = 0;
 		win->cursor.native = NULL;
 	} else if(type == swa_cursor_image) {
 		static const enum wl_shm_format wl_fmt = WL_SHM_FORMAT_ARGB8888;
-		static const enum swa_image_format swa_fmt = swa_image_format_bgra32;
+		static const enum swa_image_format swa_fmt = swa_image_format_bgra32_premul;
 
 		win->cursor.hx = cursor.hx;
 		win->cursor.hy = cursor.hy;
-		if(!win->cursor.buffer.data ||
+		// a busy buffer can't be written, the compositor might read it
+		if(!win->cursor.buffer.data || win->cursor.buffer.busy ||
 				win->cursor.buffer.width != cursor.image.width ||
 				win->cursor.buffer.height != cursor.image.height) {
-			buffer_finish(&win->cursor.buffer);
-			if(!buffer_init(&win->cursor.buffer, win->dpy->shm,
-					cursor.image.width, cursor.image.height, wl_fmt)) {
+			buffer_finish(win->dpy, &win->cursor.buffer);
+			if(!buffer_init(win->dpy, &win->cursor.buffer,
+					cursor.image.width, cursor.image.height,
+					cursor.image.width * 4, wl_fmt)) {
 				return;
 			}
 		}
@@ -579,7 +665,7 @@ static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
 			.format = swa_fmt,
 			.data = win->cursor.buffer.data,
 		};
-		swa_convert_image(&cursor.image, &dst);
+		swa_convert_image_flags(&cursor.image, &dst, swa_convert_flags_parallel);
 	} else {
 		const char* const* names = swa_get_xcursor_names(type);
 		if(!names) {
@@ -603,7 +689,7 @@ static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
 		}
 
 		win->cursor.native = cursor;
-		buffer_finish(&win->cursor.buffer);
+		buffer_finish(win->dpy, &win->cursor.buffer);
 	}
 
 	// update cursor if mouse is currently over window
@@ -803,11 +889,163 @@ static bool win_gl_set_swap_interval(struct swa_window* base, int interval) {
 #endif
 }
 
-static bool win_get_buffer(struct swa_window* base, struct swa_image* img) {
-	// We always just use this format since it's compatible with cairo
-	// and guaranteed to be supported by all compositors
-	static const enum wl_shm_format format = WL_SHM_FORMAT_ARGB8888;
+// Time after a resize until buffers that still have the old size are
+// freed. During interactive resizes they are recycled for the
+// following sizes instead.
+static const unsigned stale_buffer_timeout_ms = 1000u;
+
+// Maximum time win_get_buffer waits for the compositor to release
+// one of the buffers of the window.
+static const unsigned buffer_wait_timeout_ms = 100u;
+
+static unsigned elapsed_ms(const struct timespec* since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return 1000 * (now.tv_sec - since->tv_sec) +
+		(now.tv_nsec - since->tv_nsec) / (1000 * 1000);
+}
+
+static bool buffer_is_stale(struct swa_window_wl* win,
+		const struct swa_wl_buffer* buf, uint32_t shm_fmt) {
+	return buf->width != win->width || buf->height != win->height ||
+		buf->format != shm_fmt;
+}
+
+// The wl_shm format the window currently uses for its buffers.
+// See win_get_buffer.
+static uint32_t current_shm_format(struct swa_window_wl* win) {
+	if(win->buffer.format == swa_image_format_i420 && win->height % 2) {
+		return WL_SHM_FORMAT_ARGB8888;
+	}
+
+	return win->buffer.shm_format;
+}
+
+static void stale_buffer_cb(struct pml_timer* timer) {
+	struct swa_window_wl* win = pml_timer_get_data(timer);
+	win->buffer.stale_pending = false;
+
+	uint32_t shm_fmt = current_shm_format(win);
+	bool busy = false;
+	for(unsigned i = 0u; i < win->buffer.n_bufs; ++i) {
+		struct swa_wl_buffer* buf = &win->buffer.buffers[i];
+		if(!buf->buffer || (int) i == win->buffer.active ||
+				!buffer_is_stale(win, buf, shm_fmt)) {
+			continue;
+		}
+
+		if(buf->busy) {
+			busy = true;
+			continue;
+		}
+
+		buffer_finish(win->dpy, buf);
+	}
+
+	// try again later for the buffers the compositor still uses
+	if(busy) {
+		struct timespec next;
+		clock_gettime(CLOCK_MONOTONIC, &next);
+		next.tv_sec += stale_buffer_timeout_ms / 1000;
+		pml_timer_set_time(timer, next);
+		win->buffer.stale_pending = true;
+	}
+}
+
+// Returns the index of the buffer slot to use for the next frame,
+// or -1 if all buffers are in use. Prefers the most recently applied
+// one of the free buffers with matching layout (since it has the
+// lowest age), then unused slots and then recycles free buffers with
+// outdated layout. Sets `recreate` when the buffer in the returned
+// slot has to be (re-)created.
+static int choose_buffer(struct swa_window_wl* win, uint32_t shm_fmt,
+		bool* recreate) {
+	int match = -1;
+	int empty = -1;
+	int stale = -1;
+	for(unsigned i = 0u; i < win->buffer.n_bufs; ++i) {
+		struct swa_wl_buffer* buf = &win->buffer.buffers[i];
+		if(!buf->buffer) {
+			if(empty < 0) {
+				empty = i;
+			}
+		} else if(buf->busy) {
+			continue;
+		} else if(buffer_is_stale(win, buf, shm_fmt)) {
+			if(stale < 0) {
+				stale = i;
+			}
+		} else if(match < 0 || buf->frame > win->buffer.buffers[match].frame) {
+			match = i;
+		}
+	}
+
+	*recreate = match < 0;
+	if(match >= 0) {
+		return match;
+	}
+
+	return empty >= 0 ? empty : stale;
+}
+
+// Waits until the compositor sends events (or the timeout is reached)
+// and dispatches the buffer queue. Events for other queues are only
+// read and will be dispatched as usual.
+static bool wait_buffer_queue(struct swa_display_wl* dpy, unsigned timeout) {
+	struct wl_event_queue* queue = dpy->buffer_queue;
+	while(wl_display_prepare_read_queue(dpy->display, queue) == -1) {
+		if(wl_display_dispatch_queue_pending(dpy->display, queue) == -1) {
+			return print_error(dpy, "wl_display_dispatch_queue_pending");
+		}
+	}
+
+	// make sure the compositor has our last commit, otherwise it
+	// won't release anything
+	if(wl_display_flush(dpy->display) == -1 && errno != EAGAIN) {
+		wl_display_cancel_read(dpy->display);
+		return print_error(dpy, "wl_display_flush");
+	}
+
+	struct pollfd pfd = {
+		.fd = wl_display_get_fd(dpy->display),
+		.events = POLLIN,
+	};
+	int ret = poll(&pfd, 1, timeout);
+	if(ret <= 0) {
+		wl_display_cancel_read(dpy->display);
+		if(ret < 0 && errno != EINTR) {
+			dlg_error("poll: %s", strerror(errno));
+			return false;
+		}
+
+		return true;
+	}
+
+	if(wl_display_read_events(dpy->display) == -1) {
+		return print_error(dpy, "wl_display_read_events");
+	}
+
+	if(wl_display_dispatch_queue_pending(dpy->display, queue) == -1) {
+		return print_error(dpy, "wl_display_dispatch_queue_pending");
+	}
+
+	return true;
+}
+
+static void buffer_available_cb(struct pml_defer* defer) {
+	struct swa_window_wl* win = pml_defer_get_data(defer);
+	pml_defer_enable(defer, false);
 
+	// the released buffer might have been used already
+	bool recreate;
+	if(win->buffer.active < 0 &&
+			choose_buffer(win, current_shm_format(win), &recreate) >= 0 &&
+			win->base.listener->buffer_available) {
+		win->base.listener->buffer_available(&win->base);
+	}
+}
+
+static bool win_get_buffer(struct swa_window* base, struct swa_image* img) {
 	struct swa_window_wl* win = get_window_wl(base);
 	if(win->surface_type != swa_surface_buffer) {
 		dlg_error("Window doesn't have buffer surface");
@@ -819,52 +1057,96 @@ static bool win_get_buffer(struct swa_window* base, struct swa_image* img) {
 		return false;
 	}
 
-	// search for free buffer
-	// prefer buffers with matching dimensions
-	struct swa_wl_buffer* found = NULL;
-	bool recreate = true;
-	unsigned active;
-	for(unsigned i = 0u; i < win->buffer.n_bufs; ++i) {
-		struct swa_wl_buffer* buf = &win->buffer.buffers[i];
-		if(buf->busy) {
-			continue;
+	enum swa_image_format format = win->buffer.format;
+	uint32_t shm_fmt = win->buffer.shm_format;
+	unsigned stride = win->width * swa_image_format_size(format);
+	if(swa_image_format_is_planar(format)) {
+		stride = (stride + 1) & ~1u;
+	} else {
+		// pixman based compositors require 4-byte aligned rows,
+		// e.g. for rgb565 with odd widths
+		stride = (stride + 3) & ~3u;
+	}
+
+	// Compositors compute the offset of the v plane with the rounded
+	// down chroma height, which doesn't match swa's layout for odd
+	// heights. swa_window_get_buffer converts such frames for us.
+	if(format == swa_image_format_i420 && win->height % 2) {
+		format = swa_image_format_bgra32_premul;
+		shm_fmt = WL_SHM_FORMAT_ARGB8888;
+		stride = 4 * win->width;
+	}
+
+	// handle release events that were already read
+	struct swa_display_wl* dpy = win->dpy;
+	if(wl_display_dispatch_queue_pending(dpy->display,
+			dpy->buffer_queue) == -1) {
+		print_error(dpy, "wl_display_dispatch_queue_pending");
+		return false;
+	}
+
+	bool recreate;
+	int active = choose_buffer(win, shm_fmt, &recreate);
+	if(active < 0 && win->buffer.wait) {
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		unsigned elapsed = 0u;
+		while(active < 0 && elapsed < buffer_wait_timeout_ms) {
+			if(!wait_buffer_queue(dpy, buffer_wait_timeout_ms - elapsed)) {
+				return false;
+			}
+
+			active = choose_buffer(win, shm_fmt, &recreate);
+			elapsed = elapsed_ms(&start);
 		}
 
-		active = i;
-		found = buf;
-		if(buf->width == win->width && buf->height == win->height) {
-			recreate = false;
-			break;
+		if(active < 0) {
+			dlg_warn("Timed out waiting for the compositor to release a buffer");
+			return false;
 		}
+	} else if(active < 0) {
+		dlg_debug("All %u buffers are in use", win->buffer.n_bufs);
+		return false;
 	}
 
-	if(!found) { // create a new buffer
-		active = win->buffer.n_bufs;
-		++win->buffer.n_bufs;
-		unsigned size = win->buffer.n_bufs * sizeof(*win->buffer.buffers);
-		win->buffer.buffers = realloc(win->buffer.buffers, size);
-		found = &win->buffer.buffers[active];
-		if(!buffer_init(found, win->dpy->shm, win->width, win->height, format)) {
+	struct swa_wl_buffer* found = &win->buffer.buffers[active];
+	if(recreate) {
+		buffer_finish(dpy, found);
+		if(!buffer_init(dpy, found, win->width, win->height,
+				stride, shm_fmt)) {
 			return false;
 		}
-	} else if(recreate) {
-		buffer_finish(found);
-		if(!buffer_init(found, win->dpy->shm, win->width, win->height, format)) {
-			return false;
+
+		found->window = win;
+	}
+
+	// free the buffers with the old size if there are any left
+	if(!win->buffer.stale_pending) {
+		for(unsigned i = 0u; i < win->buffer.n_bufs; ++i) {
+			struct swa_wl_buffer* buf = &win->buffer.buffers[i];
+			if(buf->buffer && buffer_is_stale(win, buf, shm_fmt)) {
+				struct timespec next;
+				clock_gettime(CLOCK_MONOTONIC, &next);
+				next.tv_sec += stale_buffer_timeout_ms / 1000;
+				pml_timer_set_time(win->buffer.stale_timer, next);
+				win->buffer.stale_pending = true;
+				break;
+			}
 		}
 	}
 
 	img->width = win->width;
 	img->height = win->height;
-	img->stride = win->width * 4;
-	img->format = swa_image_format_bgra32;
+	img->stride = stride;
+	img->format = format;
 	img->data = found->data;
 
 	win->buffer.active = active;
 	return true;
 }
 
-static void win_apply_buffer(struct swa_window* base) {
+static void win_apply_buffer(struct swa_window* base,
+		const struct swa_rect* damage, unsigned n_damage) {
 	struct swa_window_wl* win = get_window_wl(base);
 	if(win->surface_type != swa_surface_buffer) {
 		dlg_error("Window doesn't have buffer surface");
@@ -877,14 +1159,82 @@ static void win_apply_buffer(struct swa_window* base) {
 	}
 
 	struct swa_wl_buffer* buf = &win->buffer.buffers[win->buffer.active];
+	buf->frame = ++win->buffer.frame;
+	buf->busy = true;
 	wl_surface_attach(win->wl_surface, buf->buffer, 0, 0);
-	wl_surface_damage(win->wl_surface, 0, 0, INT32_MAX, INT32_MAX);
+	if(n_damage == 0) {
+		wl_surface_damage(win->wl_surface, 0, 0, INT32_MAX, INT32_MAX);
+	} else {
+		// the protocol takes int32_t, clip to the buffer first
+		bool damage_buffer = wl_surface_get_version(win->wl_surface) >=
+			WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION;
+		for(unsigned i = 0u; i < n_damage; ++i) {
+			struct swa_rect r = damage[i];
+			if(r.x >= buf->width || r.y >= buf->height ||
+					!r.width || !r.height) {
+				continue;
+			}
+
+			r.width = r.width > buf->width - r.x ? buf->width - r.x : r.width;
+			r.height = r.height > buf->height - r.y ?
+				buf->height - r.y : r.height;
+
+			// we never set a buffer scale or transform, surface
+			// coordinates are the same as buffer coordinates
+			if(damage_buffer) {
+				wl_surface_damage_buffer(win->wl_surface, r.x, r.y,
+					r.width, r.height);
+			} else {
+				wl_surface_damage(win->wl_surface, r.x, r.y,
+					r.width, r.height);
+			}
+		}
+	}
+
 	win_surface_frame(&win->base);
 	wl_surface_commit(win->wl_surface);
 
 	win->buffer.active = -1;
 }
 
+static unsigned win_get_buffer_age(struct swa_window* base) {
+	struct swa_window_wl* win = get_window_wl(base);
+	if(win->surface_type != swa_surface_buffer || win->buffer.active < 0) {
+		return 0u;
+	}
+
+	struct swa_wl_buffer* buf = &win->buffer.buffers[win->buffer.active];
+	return buf->frame ? win->buffer.frame - buf->frame + 1 : 0u;
+}
+
+static const uint8_t* win_get_previous_buffer(struct swa_window* base) {
+	struct swa_window_wl* win = get_window_wl(base);
+	if(win->surface_type != swa_surface_buffer || win->buffer.active < 0 ||
+			!win->buffer.frame) {
+		return NULL;
+	}
+
+	// The compositor might still read the buffer but it never writes it.
+	// Buffers with the same size and format have the same layout.
+	struct swa_wl_buffer* active = &win->buffer.buffers[win->buffer.active];
+	for(unsigned i = 0u; i < win->buffer.n_bufs; ++i) {
+		struct swa_wl_buffer* buf = &win->buffer.buffers[i];
+		if(buf != active && buf->buffer && buf->frame == win->buffer.frame &&
+				buf->width == active->width &&
+				buf->height == active->height &&
+				buf->format == active->format) {
+			return buf->data;
+		}
+	}
+
+	return NULL;
+}
+
+static bool win_scroll_buffer(struct swa_window* base,
+		const struct swa_rect* rect, int dx, int dy) {
+	return false;
+}
+
 static const struct swa_window_interface window_impl = {
 	.destroy = win_destroy,
 	.get_capabilities = win_get_capabilities,
@@ -906,6 +1256,9 @@ static const struct swa_window_interface window_impl = {
 	.gl_swap_buffers = win_gl_swap_buffers,
 	.gl_set_swap_interval = win_gl_set_swap_interval,
 	.get_buffer = win_get_buffer,
+	.get_buffer_age = win_get_buffer_age,
+	.get_previous_buffer = win_get_previous_buffer,
+	.scroll_buffer = win_scroll_buffer,
 	.apply_buffer = win_apply_buffer
 };
 
@@ -1233,12 +1586,21 @@ static void display_destroy(struct swa_display* base) {
 	if(dpy->io_source) pml_io_destroy(dpy->io_source);
 	if(dpy->touch_points) free(dpy->touch_points);
 	if(dpy->wl_queue) wl_event_queue_destroy(dpy->wl_queue);
+	while(dpy->orphans) {
+		struct swa_wl_buffer* next = dpy->orphans->next_orphan;
+		wl_buffer_destroy(dpy->orphans->buffer);
+		free(dpy->orphans);
+		dpy->orphans = next;
+	}
+	if(dpy->buffer_queue) wl_event_queue_destroy(dpy->buffer_queue);
 	if(dpy->key_repeat.timer) pml_timer_destroy(dpy->key_repeat.timer);
 	if(dpy->cursor.timer) pml_timer_destroy(dpy->cursor.timer);
 	if(dpy->cursor.frame_callback) wl_callback_destroy(dpy->cursor.frame_callback);
 	if(dpy->cursor.theme) wl_cursor_theme_destroy(dpy->cursor.theme);
 	if(dpy->cursor.surface) wl_surface_destroy(dpy->cursor.surface);
 	if(dpy->data_dev) wl_data_device_destroy(dpy->data_dev);
+	if(dpy->shm_pool) wl_shm_pool_destroy(dpy->shm_pool);
+	if(dpy->shm_arena.data) swa_shm_finish(&dpy->shm_arena);
 	if(dpy->shm) wl_shm_destroy(dpy->shm);
 	if(dpy->keyboard) wl_keyboard_destroy(dpy->keyboard);
 	if(dpy->pointer) wl_pointer_destroy(dpy->pointer);
@@ -1256,17 +1618,6 @@ static void display_destroy(struct swa_display* base) {
 	free(dpy);
 }
 
-static bool print_error(struct swa_display_wl* dpy, const char* fn) {
-	// check for critical errors
-	if(check_error(dpy)) {
-		return false;
-	}
-
-	// otherwise output non-critical error
-	dlg_error("%s: %s (%d)", fn, strerror(errno), errno);
-	return true;
-}
-
 static bool display_dispatch(struct swa_display* base, bool block) {
 	struct swa_display_wl* dpy = get_display_wl(base);
 
@@ -1279,6 +1630,11 @@ static bool display_dispatch(struct swa_display* base, bool block) {
 		return print_error(dpy, "wl_display_dispatch_pending");
 	}
 
+	if(wl_display_dispatch_queue_pending(dpy->display,
+			dpy->buffer_queue) < 0) {
+		return print_error(dpy, "wl_display_dispatch_queue_pending");
+	}
+
 	if(wl_display_flush(dpy->display) == -1) {
 		return print_error(dpy, "wl_display_flush");
 	}
@@ -1532,7 +1888,38 @@ static struct swa_window* display_create_window(struct swa_display* base,
 	// initializing the surface after having commited the role seems fitting
 	win->surface_type = settings->surface;
 	if(win->surface_type == swa_surface_buffer) {
+		const struct swa_buffer_surface_settings* bs =
+			&settings->surface_settings.buffer;
 		win->buffer.active = -1;
+		win->buffer.wait = !bs->nonblocking;
+		unsigned n_bufs = bs->max_buffers ? bs->max_buffers : 3u;
+		win->buffer.buffers = calloc(n_bufs, sizeof(*win->buffer.buffers));
+		if(!win->buffer.buffers) {
+			dlg_error("Failed to allocate buffers");
+			goto err;
+		}
+
+		// only set after the allocation, win_destroy iterates them
+		win->buffer.n_bufs = n_bufs;
+		win->buffer.stale_timer = pml_timer_new(win->dpy->pml, NULL,
+			stale_buffer_cb);
+		if(!win->buffer.stale_timer) {
+			dlg_error("Failed to create stale buffer timer");
+			goto err;
+		}
+
+		pml_timer_set_data(win->buffer.stale_timer, win);
+		pml_timer_set_clock(win->buffer.stale_timer, CLOCK_MONOTONIC);
+		win->buffer.defer_available = pml_defer_new(win->dpy->pml,
+			buffer_available_cb);
+		if(!win->buffer.defer_available) {
+			dlg_error("Failed to create buffer defer event");
+			goto err;
+		}
+
+		pml_defer_set_data(win->buffer.defer_available, win);
+		pml_defer_enable(win->buffer.defer_available, false);
+		choose_buffer_format(win, bs->preferred_format);
 	} else if(win->surface_type == swa_surface_vk) {
 #ifdef SWA_WITH_VK
 		win->vk.instance = settings->surface_settings.vk.instance;
@@ -2426,6 +2813,25 @@ static const struct wl_seat_listener seat_listener = {
 	.name = seat_name,
 };
 
+static void shm_format(void* data, struct wl_shm* shm, uint32_t format) {
+	struct swa_display_wl* dpy = data;
+	if(format == WL_SHM_FORMAT_RGB565) {
+		dpy->shm_formats.rgb565 = true;
+	} else if(format == WL_SHM_FORMAT_XRGB2101010) {
+		dpy->shm_formats.xrgb2101010 = true;
+	} else if(format == shm_format_xbgr16161616f) {
+		dpy->shm_formats.xbgr16161616f = true;
+	} else if(format == WL_SHM_FORMAT_NV12) {
+		dpy->shm_formats.nv12 = true;
+	} else if(format == WL_SHM_FORMAT_YUV420) {
+		dpy->shm_formats.yuv420 = true;
+	}
+}
+
+static const struct wl_shm_listener shm_listener = {
+	.format = shm_format,
+};
+
 static unsigned min(unsigned a, unsigned b) {
 	return a < b ? a : b;
 }
@@ -2448,6 +2854,7 @@ static void handle_global(void *data, struct wl_registry *registry,
 			&wl_compositor_interface, v);
 	} else if(!dpy->shm && strcmp(interface, wl_shm_interface.name) == 0) {
 		dpy->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+		wl_shm_add_listener(dpy->shm, &shm_listener, dpy);
 	} else if(!dpy->seat && strcmp(interface, wl_seat_interface.name) == 0) {
 		unsigned v = min(v_seat, version);
 		dpy->seat = wl_registry_bind(registry, name, &wl_seat_interface, v);
@@ -2504,6 +2911,12 @@ static void dispatch_display(struct pml_io* io, unsigned revents) {
 			print_error(dpy, "wl_display_dispatch_pending");
 			return;
 		}
+
+		if(wl_display_dispatch_queue_pending(dpy->display,
+				dpy->buffer_queue) < 0) {
+			print_error(dpy, "wl_display_dispatch_queue_pending");
+			return;
+		}
 	}
 }
 
@@ -2552,6 +2965,7 @@ struct swa_display* swa_display_wl_create(const char* appname) {
 	pml_io_set_data(dpy->wakeup_io, dpy);
 
 	dpy->wl_queue = wl_display_create_queue(dpy->display);
+	dpy->buffer_queue = wl_display_create_queue(dpy->display);
 	dpy->registry = wl_display_get_registry(dpy->display);
 	wl_registry_add_listener(dpy->registry, &registry_listener, dpy);
 
@@ -394,9 +394,9 @@ static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
 
 static void win_refresh(struct swa_window* base) {
 	struct swa_window_win* win = get_window_win(base);
-	// TODO: just use InvalidateRect? use RDW_FRAME?
-	RedrawWindow(win->handle, NULL, NULL, RDW_INVALIDATE | RDW_NOERASE);
-	// InvalidateRect(win->handle, NULL, false);
+	// Only request a WM_PAINT without invalidating the window, the
+	// update region signals lost contents, see WM_PAINT.
+	RedrawWindow(win->handle, NULL, NULL, RDW_INTERNALPAINT);
 }
 
 static void win_surface_frame(struct swa_window* base) {
@@ -559,6 +559,7 @@ static bool win_get_buffer(struct swa_window* base, struct swa_image* img) {
 
 		win->buffer.width = win->width;
 		win->buffer.height = win->height;
+		win->buffer.valid = false;
 
 		BITMAPINFO bmi = {0};
 		bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
@@ -591,7 +592,8 @@ static bool win_get_buffer(struct swa_window* base, struct swa_image* img) {
 	return true;
 }
 
-static void win_apply_buffer(struct swa_window* base) {
+static void win_apply_buffer(struct swa_window* base,
+		const struct swa_rect* damage, unsigned n_damage) {
 	struct swa_window_win* win = get_window_win(base);
 	if(win->surface_type != swa_surface_buffer) {
 		dlg_error("Window doesn't have buffer surface");
@@ -605,6 +607,7 @@ static void win_apply_buffer(struct swa_window* base) {
 
 	dlg_assert(win->buffer.bitmap);
 	dlg_assert(win->buffer.wdc);
+	win->buffer.valid = true;
 
 	HDC bdc = CreateCompatibleDC(win->buffer.wdc);
 	if(!bdc) {
@@ -618,10 +621,31 @@ static void win_apply_buffer(struct swa_window* base) {
 		goto cleanup_bdc;
 	}
 
-	bool res = BitBlt(win->buffer.wdc, 0, 0,
-		win->buffer.width, win->buffer.height, bdc, 0, 0, SRCCOPY);
-	if(!res) {
-		print_winapi_error("BitBlt");
+	// the bitmap holds the previous contents, only the
+	// damaged parts have to be copied
+	struct swa_rect full = {0, 0, win->buffer.width, win->buffer.height};
+	if(n_damage == 0) {
+		damage = &full;
+		n_damage = 1;
+	}
+
+	for(unsigned i = 0u; i < n_damage; ++i) {
+		struct swa_rect r = damage[i];
+		if(r.x >= win->buffer.width || r.y >= win->buffer.height ||
+				!r.width || !r.height) {
+			continue;
+		}
+
+		unsigned max_width = win->buffer.width - r.x;
+		unsigned max_height = win->buffer.height - r.y;
+		r.width = r.width > max_width ? max_width : r.width;
+		r.height = r.height > max_height ? max_height : r.height;
+		bool res = BitBlt(win->buffer.wdc, r.x, r.y, r.width, r.height,
+			bdc, r.x, r.y, SRCCOPY);
+		if(!res) {
+			print_winapi_error("BitBlt");
+			break;
+		}
 	}
 
 	SelectObject(bdc, prev);
@@ -635,6 +659,26 @@ cleanup:
 	win->buffer.wdc = NULL;
 }
 
+static unsigned win_get_buffer_age(struct swa_window* base) {
+	struct swa_window_win* win = get_window_win(base);
+	if(win->surface_type != swa_surface_buffer || !win->buffer.active) {
+		return 0u;
+	}
+
+	// there is only a single bitmap
+	return win->buffer.valid ? 1u : 0u;
+}
+
+static const uint8_t* win_get_previous_buffer(struct swa_window* base) {
+	// there is only a single bitmap
+	return NULL;
+}
+
+static bool win_scroll_buffer(struct swa_window* base,
+		const struct swa_rect* rect, int dx, int dy) {
+	return false;
+}
+
 static const struct swa_window_interface window_impl = {
 	.destroy = win_destroy,
 	.get_capabilities = win_get_capabilities,
@@ -656,6 +700,9 @@ static const struct swa_window_interface window_impl = {
 	.gl_swap_buffers = win_gl_swap_buffers,
 	.gl_set_swap_interval = win_gl_set_swap_interval,
 	.get_buffer = win_get_buffer,
+	.get_buffer_age = win_get_buffer_age,
+	.get_previous_buffer = win_get_previous_buffer,
+	.scroll_buffer = win_scroll_buffer,
 	.apply_buffer = win_apply_buffer
 };
 
@@ -894,6 +941,15 @@ static LRESULT CALLBACK win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lpar
 				break;
 			}
 
+			// the invalidated parts have to be sent again
+			RECT update;
+			if(win->surface_type == swa_surface_buffer &&
+					GetUpdateRect(hwnd, &update, false)) {
+				swa_window_expose(&win->base, (struct swa_rect) {
+					update.left, update.top,
+					update.right - update.left, update.bottom - update.top});
+			}
+
 			if(win->base.listener->draw) {
 				win->base.listener->draw(&win->base);
 			}
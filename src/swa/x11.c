@@ -1,9 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <swa/private/x11.h>
 #include <dlg/dlg.h>
+#include <errno.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -12,11 +16,14 @@
 #include <X11/cursorfont.h>
 
 #include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 #include <xcb/xcb_icccm.h>
 #include <xcb/present.h>
 #include <xcb/xinput.h>
 #include <xcb/shm.h>
+#include <xcb/xfixes.h>
 #include <xcb/xkb.h>
+#include <xcb/xv.h>
 
 #include <xkbcommon/xkbcommon-x11.h>
 
@@ -37,6 +44,8 @@ static const struct swa_display_interface display_impl;
 static const struct swa_window_interface window_impl;
 static const unsigned max_prop_length = 0x1fffffff;
 
+static void finish_present_buffers(struct swa_window_x11* win);
+
 // from xcursor.c
 const char* const* swa_get_xcursor_names(enum swa_cursor_type type);
 
@@ -60,6 +69,132 @@ static struct swa_window_x11* get_window_x11(struct swa_window* base) {
 } while(0)
 
 
+// Remembers an unchecked request so that its error can be reported
+// with context after the fact, see handle_event. Checking it
+// via xcb_request_check would mean a roundtrip instead.
+static void track_request(struct swa_display_x11* dpy,
+		xcb_void_cookie_t cookie, const char* name) {
+	const unsigned count = sizeof(dpy->tracked) / sizeof(dpy->tracked[0]);
+	unsigned i = dpy->n_tracked++ % count;
+	dpy->tracked[i].sequence = cookie.sequence;
+	dpy->tracked[i].name = name;
+}
+
+static const char* tracked_request_name(struct swa_display_x11* dpy,
+		uint32_t sequence) {
+	const unsigned count = sizeof(dpy->tracked) / sizeof(dpy->tracked[0]);
+	unsigned n = dpy->n_tracked < count ? dpy->n_tracked : count;
+	for(unsigned i = 0u; i < n; ++i) {
+		if(dpy->tracked[i].sequence == sequence) {
+			return dpy->tracked[i].name;
+		}
+	}
+
+	return NULL;
+}
+
+static void shm_free(struct swa_display_x11* dpy,
+		struct swa_x11_shm_alloc* alloc) {
+	if(alloc->size) {
+		swa_shm_free(&dpy->shm.arena, alloc->offset, alloc->size);
+	}
+
+	memset(alloc, 0x0, sizeof(*alloc));
+}
+
+// Frees the allocation once the server has processed the request with
+// the given sequence number, see free_shm_orphans.
+static void shm_free_deferred(struct swa_display_x11* dpy,
+		struct swa_x11_shm_alloc* alloc, uint32_t sync) {
+	if(!alloc->size) {
+		return;
+	}
+
+	unsigned n = dpy->shm.n_orphans + 1;
+	struct swa_x11_shm_orphan* orphans = realloc(dpy->shm.orphans,
+		n * sizeof(*orphans));
+	if(!orphans) {
+		// leaking it is better than the server reading reused memory
+		dlg_error("Failed to allocate shm orphan");
+		memset(alloc, 0x0, sizeof(*alloc));
+		return;
+	}
+
+	orphans[n - 1].alloc = *alloc;
+	orphans[n - 1].sync = sync;
+	dpy->shm.orphans = orphans;
+	dpy->shm.n_orphans = n;
+	memset(alloc, 0x0, sizeof(*alloc));
+}
+
+// Frees the deferred allocations whose sync request was processed.
+// The server doesn't send IdleNotify events for the pixmaps of destroyed
+// windows, their memory can be reused once the server has handled the
+// window destruction.
+static void free_shm_orphans(struct swa_display_x11* dpy) {
+	unsigned i = 0u;
+	while(i < dpy->shm.n_orphans) {
+		struct swa_x11_shm_orphan* orphan = &dpy->shm.orphans[i];
+		void* reply = NULL;
+		xcb_generic_error_t* err = NULL;
+		if(!xcb_poll_for_reply(dpy->conn, orphan->sync, &reply, &err)) {
+			++i;
+			continue;
+		}
+
+		free(reply);
+		free(err);
+		shm_free(dpy, &orphan->alloc);
+		*orphan = dpy->shm.orphans[--dpy->shm.n_orphans];
+	}
+}
+
+// Allocates `size` bytes from the shm arena of the display,
+// attaching it to the server (again) if needed.
+static bool shm_alloc(struct swa_display_x11* dpy, uint64_t size,
+		struct swa_x11_shm_alloc* alloc) {
+	struct swa_shm* arena = &dpy->shm.arena;
+	if(!arena->data && !swa_shm_init(arena)) {
+		return false;
+	}
+
+	free_shm_orphans(dpy);
+	uint64_t old_size = arena->size;
+	if(!swa_shm_alloc(arena, size, &alloc->offset)) {
+		return false;
+	}
+
+	if(arena->size != old_size || !dpy->shm.n_segs) {
+		// xcb closes the fd after sending it
+		int fd = fcntl(arena->fd, F_DUPFD_CLOEXEC, 0);
+		if(fd < 0) {
+			dlg_error("fcntl: %s", strerror(errno));
+			swa_shm_free(arena, alloc->offset, size);
+			return false;
+		}
+
+		unsigned n = dpy->shm.n_segs + 1;
+		uint32_t* segs = realloc(dpy->shm.segs, n * sizeof(*segs));
+		if(!segs) {
+			close(fd);
+			swa_shm_free(arena, alloc->offset, size);
+			return false;
+		}
+
+		segs[n - 1] = xcb_generate_id(dpy->conn);
+		xcb_void_cookie_t cookie = xcb_shm_attach_fd(dpy->conn, segs[n - 1],
+			fd, 0);
+		track_request(dpy, cookie, "xcb_shm_attach_fd");
+		dpy->shm.segs = segs;
+		dpy->shm.n_segs = n;
+	}
+
+	alloc->data = arena->data + alloc->offset;
+	alloc->size = size;
+	alloc->seg = dpy->shm.segs[dpy->shm.n_segs - 1];
+	return true;
+}
+
 // window api
 static void win_destroy(struct swa_window* base) {
 	struct swa_window_x11* win = get_window_x11(base);
@@ -68,12 +203,20 @@ static void win_destroy(struct swa_window* base) {
 		return;
 	}
 
-	// destroy surface buffer
+	// destroy surface buffer, the shm allocations are freed below
 	if(win->surface_type == swa_surface_buffer) {
-		if(win->buffer.shmseg) xcb_shm_detach(win->dpy->conn, win->buffer.shmseg);
-		if(win->buffer.bytes) shmdt(win->buffer.bytes);
-		if(win->buffer.shmid) shmctl(win->buffer.shmid, IPC_RMID, 0);
+		if(!win->dpy->ext.shm) {
+			free(win->buffer.bytes);
+		}
+		free(win->buffer.scratch);
 		if(win->buffer.gc) xcb_free_gc(win->dpy->conn, win->buffer.gc);
+		if(win->buffer.xv.port) {
+			xcb_xv_ungrab_port(win->dpy->conn, win->buffer.xv.port,
+				XCB_CURRENT_TIME);
+		}
+		if(win->buffer.present.enabled) {
+			finish_present_buffers(win);
+		}
 	} else if(win->surface_type == swa_surface_vk) {
 #ifdef SWA_WITH_VK
 		if(win->vk.surface) {
@@ -108,6 +251,18 @@ static void win_destroy(struct swa_window* base) {
 	if(win->window) xcb_destroy_window(dpy->conn, win->window);
 	if(win->cursor) xcb_free_cursor(dpy->conn, win->cursor);
 	if(win->colormap) xcb_free_colormap(dpy->conn, win->colormap);
+
+	// The server might not have read the shm memory yet (queued
+	// put_image requests, presented pixmaps). It's freed once the
+	// server has processed the requests above.
+	if(win->surface_type == swa_surface_buffer && dpy->ext.shm) {
+		uint32_t sync = xcb_get_input_focus(dpy->conn).sequence;
+		shm_free_deferred(dpy, &win->buffer.shm, sync);
+		for(unsigned i = 0u; i < 3u; ++i) {
+			shm_free_deferred(dpy, &win->buffer.present.buffers[i].shm, sync);
+		}
+	}
+
 	xcb_flush(win->dpy->conn);
 
 	free(win);
@@ -235,10 +390,11 @@ static void win_set_cursor(struct swa_window* base, struct swa_cursor cursor) {
 			.height = img->height,
 			.stride = 4 * img->width,
 			.data = (uint8_t*) xcimage->pixels,
-			.format = swa_image_format_toggle_byte_word(swa_image_format_argb32),
+			// xcursor images use premultiplied alpha
+			.format = swa_image_format_toggle_byte_word(swa_image_format_argb32_premul),
 		};
 
-		swa_convert_image(img, &dst);
+		swa_convert_image_flags(img, &dst, swa_convert_flags_parallel);
 		xcursor = XcursorImageLoadCursor(win->dpy->display, xcimage);
 		if(!xcursor) {
 			dlg_warn("XcursorImageLoadCursor failed");
@@ -397,21 +553,59 @@ static void win_set_title(struct swa_window* base, const char* title) {
 
 static void win_set_icon(struct swa_window* base, const struct swa_image* img) {
 	struct swa_window_x11* win = get_window_x11(base);
-	if(img && img->data) {
-		size_t count = 2 + img->width * img->height * 4;
-		uint32_t* data = malloc(count);
-		data[0] = img->width;
-		data[1] = img->height;
+	if(img && img->data && img->width && img->height) {
+		// _NET_WM_ICON can contain multiple sizes and window managers,
+		// taskbars and switchers choose the one they need. We add
+		// downscaled versions in the common sizes so that they don't
+		// have to scale (often with low quality) themselves.
+		static const unsigned sizes[] = {16, 24, 32, 48, 64, 128, 256};
+		unsigned max_dim = img->width > img->height ? img->width : img->height;
+
+		struct { unsigned width, height; } icons[sizeof(sizes) / sizeof(sizes[0]) + 1];
+		unsigned n_icons = 0u;
+		size_t count = 0u;
+		for(unsigned i = 0u; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+			if(sizes[i] >= max_dim) {
+				break;
+			}
 
-		struct swa_image dst = {
-			.width = img->width,
-			.height = img->height,
-			.stride = 4 * img->width,
-			.data = (uint8_t*) (data + 2),
-			.format = swa_image_format_toggle_byte_word(swa_image_format_rgba32),
-		};
+			unsigned w = (unsigned) ((uint64_t) img->width * sizes[i] / max_dim);
+			unsigned h = (unsigned) ((uint64_t) img->height * sizes[i] / max_dim);
+			icons[n_icons].width = w ? w : 1u;
+			icons[n_icons].height = h ? h : 1u;
+			count += 2 + icons[n_icons].width * icons[n_icons].height;
+			++n_icons;
+		}
+
+		icons[n_icons].width = img->width;
+		icons[n_icons].height = img->height;
+		count += 2 + img->width * img->height;
+		++n_icons;
+
+		uint32_t* data = malloc(count * 4);
+		uint32_t* it = data;
+		for(unsigned i = 0u; i < n_icons; ++i) {
+			it[0] = icons[i].width;
+			it[1] = icons[i].height;
+
+			struct swa_image dst = {
+				.width = icons[i].width,
+				.height = icons[i].height,
+				.stride = 4 * icons[i].width,
+				.data = (uint8_t*) (it + 2),
+				// cardinals with argb in word order, straight alpha
+				.format = swa_image_format_toggle_byte_word(swa_image_format_argb32),
+			};
+
+			if(i + 1 == n_icons) {
+				swa_convert_image_flags(img, &dst, swa_convert_flags_parallel);
+			} else {
+				swa_scale_image(img, &dst, swa_scale_filter_bilinear);
+			}
+
+			it += 2 + icons[i].width * icons[i].height;
+		}
 
-		swa_convert_image(img, &dst);
 		xcb_ewmh_set_wm_icon(&win->dpy->ewmh, XCB_PROP_MODE_REPLACE,
 			win->window, count, data);
 		free(data);
@@ -489,6 +683,440 @@ static bool win_gl_set_swap_interval(struct swa_window* base, int interval) {
 #endif
 }
 
+// Grabs an XVideo port that supports the given yuv format for
+// the buffer surface of the window. Returns false if there is none.
+static bool init_xv_port(struct swa_window_x11* win,
+		enum swa_image_format format) {
+	xcb_connection_t* conn = win->dpy->conn;
+	uint32_t id = format == swa_image_format_nv12 ?
+		0x3231564E : // 'NV12'
+		0x30323449; // 'I420'
+
+	xcb_generic_error_t* err;
+	xcb_xv_query_adaptors_cookie_t c = xcb_xv_query_adaptors(conn, win->window);
+	xcb_xv_query_adaptors_reply_t* reply =
+		xcb_xv_query_adaptors_reply(conn, c, &err);
+	if(!reply) {
+		handle_error(win->dpy, err, "xcb_xv_query_adaptors");
+		return false;
+	}
+
+	const uint8_t type = XCB_XV_TYPE_INPUT_MASK | XCB_XV_TYPE_IMAGE_MASK;
+	xcb_xv_adaptor_info_iterator_t it =
+		xcb_xv_query_adaptors_info_iterator(reply);
+	for(; it.rem && !win->buffer.xv.port; xcb_xv_adaptor_info_next(&it)) {
+		if((it.data->type & type) != type) {
+			continue;
+		}
+
+		for(unsigned i = 0u; i < it.data->num_ports; ++i) {
+			xcb_xv_port_t port = it.data->base_id + i;
+			xcb_xv_list_image_formats_reply_t* formats =
+				xcb_xv_list_image_formats_reply(conn,
+					xcb_xv_list_image_formats(conn, port), NULL);
+			if(!formats) {
+				continue;
+			}
+
+			bool supported = false;
+			xcb_xv_image_format_info_t* infos =
+				xcb_xv_list_image_formats_format(formats);
+			for(unsigned f = 0u; f < formats->num_formats; ++f) {
+				supported |= (infos[f].id == id);
+			}
+			free(formats);
+
+			if(!supported) {
+				// all ports of an adaptor support the same formats
+				break;
+			}
+
+			xcb_xv_grab_port_reply_t* grab = xcb_xv_grab_port_reply(conn,
+				xcb_xv_grab_port(conn, port, XCB_CURRENT_TIME), NULL);
+			bool grabbed = grab && grab->result == XCB_XV_GRAB_PORT_STATUS_SUCCESS;
+			free(grab);
+			if(grabbed) {
+				win->buffer.xv.port = port;
+				win->buffer.xv.id = id;
+				win->buffer.xv.format = format;
+				break;
+			}
+		}
+	}
+
+	free(reply);
+	return win->buffer.xv.port != 0;
+}
+
+// Queries the layout the xv port expects for images with the current
+// window size. Sets xv.stride to 0 if it doesn't match swa's layout
+// (e.g. because the server pads the chroma planes to even heights).
+static void query_xv_layout(struct swa_window_x11* win) {
+	struct swa_x11_buffer_surface* buf = &win->buffer;
+	if(buf->xv.width == win->width && buf->xv.height == win->height) {
+		return;
+	}
+
+	buf->xv.width = win->width;
+	buf->xv.height = win->height;
+	buf->xv.stride = 0u;
+
+	xcb_connection_t* conn = win->dpy->conn;
+	xcb_generic_error_t* err;
+	xcb_xv_query_image_attributes_cookie_t c = xcb_xv_query_image_attributes(
+		conn, buf->xv.port, buf->xv.id, win->width, win->height);
+	xcb_xv_query_image_attributes_reply_t* reply =
+		xcb_xv_query_image_attributes_reply(conn, c, &err);
+	if(!reply) {
+		handle_error(win->dpy, err, "xcb_xv_query_image_attributes");
+		return;
+	}
+
+	const uint32_t* pitches = xcb_xv_query_image_attributes_pitches(reply);
+	const uint32_t* offsets = xcb_xv_query_image_attributes_offsets(reply);
+	uint32_t p = pitches[0];
+	uint32_t h = win->height;
+	uint32_t chroma_rows = (h + 1) / 2;
+
+	bool nv12 = (buf->xv.format == swa_image_format_nv12);
+	bool match = reply->width == win->width && reply->height == win->height &&
+		p % 2 == 0 && offsets[0] == 0 && offsets[1] == p * h;
+	if(nv12) {
+		match = match && reply->num_planes == 2 && pitches[1] == p;
+	} else {
+		match = match && reply->num_planes == 3 &&
+			pitches[1] == p / 2 && pitches[2] == p / 2 &&
+			offsets[2] == offsets[1] + (p / 2) * chroma_rows;
+	}
+
+	if(match) {
+		struct swa_image img = {win->width, win->height, p, buf->xv.format, NULL};
+		uint64_t size = swa_image_data_size(&img);
+		buf->xv.stride = p;
+		buf->xv.size = reply->data_size > size ? reply->data_size : size;
+	} else {
+		dlg_debug("xv image layout doesn't match, converting");
+	}
+
+	free(reply);
+}
+
+static void finish_present_buffer(struct swa_window_x11* win,
+		struct swa_x11_present_buffer* pb) {
+	if(pb->pixmap) xcb_free_pixmap(win->dpy->conn, pb->pixmap);
+
+	// the server might still read a busy pixmap, we have to wait for
+	// its IdleNotify before reusing (or freeing) its memory
+	bool busy = pb->busy;
+	uint32_t serial = pb->serial;
+	struct swa_x11_shm_alloc shm = pb->shm;
+	if(!busy) {
+		shm_free(win->dpy, &shm);
+	}
+
+	memset(pb, 0x0, sizeof(*pb));
+	pb->busy = busy;
+	pb->serial = serial;
+	pb->shm = shm;
+}
+
+static void finish_present_buffers(struct swa_window_x11* win) {
+	struct swa_x11_buffer_surface* buf = &win->buffer;
+	for(unsigned i = 0u; i < 3u; ++i) {
+		finish_present_buffer(win, &buf->present.buffers[i]);
+	}
+
+	if(buf->present.update) {
+		xcb_xfixes_destroy_region(win->dpy->conn, buf->present.update);
+		buf->present.update = XCB_NONE;
+	}
+
+	if(buf->present.events) {
+		xcb_present_select_input(win->dpy->conn, buf->present.context,
+			win->window, XCB_PRESENT_EVENT_MASK_NO_EVENT);
+		xcb_unregister_for_special_event(win->dpy->conn, buf->present.events);
+		buf->present.events = NULL;
+	}
+}
+
+static bool init_present_buffers(struct swa_window_x11* win) {
+	struct swa_x11_buffer_surface* buf = &win->buffer;
+	xcb_connection_t* conn = win->dpy->conn;
+	buf->present.context = xcb_generate_id(conn);
+	buf->present.events = xcb_register_for_special_xge(conn,
+		&xcb_present_id, buf->present.context, NULL);
+	if(!buf->present.events) {
+		dlg_warn("xcb_register_for_special_xge failed");
+		return false;
+	}
+
+	xcb_present_select_input(conn, buf->present.context, win->window,
+		XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY);
+	buf->present.enabled = true;
+	return true;
+}
+
+// Returns whether the event made a buffer available again.
+static bool handle_present_idle(struct swa_window_x11* win,
+		xcb_generic_event_t* gev) {
+	bool released = false;
+	xcb_present_generic_event_t* pev = (xcb_present_generic_event_t*) gev;
+	if(pev->evtype == XCB_PRESENT_EVENT_IDLE_NOTIFY) {
+		xcb_present_idle_notify_event_t* ev =
+			(xcb_present_idle_notify_event_t*) gev;
+		for(unsigned i = 0u; i < 3u; ++i) {
+			struct swa_x11_present_buffer* pb = &win->buffer.present.buffers[i];
+			if(pb->busy && pb->serial == ev->serial) {
+				pb->busy = false;
+				released = true;
+			}
+		}
+	}
+
+	free(gev);
+	return released;
+}
+
+// How long win_get_buffer waits for an IdleNotify, e.g. when the server
+// stalls. After that, the single buffer is sent with put_image instead.
+static const int present_idle_timeout = 100; // ms
+
+// Returns a present buffer that the server doesn't use anymore.
+// Waits at most present_idle_timeout for an IdleNotify if needed,
+// returns NULL on timeout or error.
+static struct swa_x11_present_buffer* acquire_present_buffer(
+		struct swa_window_x11* win) {
+	struct swa_x11_buffer_surface* buf = &win->buffer;
+	xcb_connection_t* conn = win->dpy->conn;
+	xcb_generic_event_t* ev;
+	while((ev = xcb_poll_for_special_event(conn, buf->present.events))) {
+		handle_present_idle(win, ev);
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while(true) {
+		for(unsigned i = 0u; i < 3u; ++i) {
+			if(!buf->present.buffers[i].busy) {
+				return &buf->present.buffers[i];
+			}
+		}
+
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		int64_t elapsed = 1000 * (int64_t) (now.tv_sec - start.tv_sec) +
+			(now.tv_nsec - start.tv_nsec) / 1000000;
+		if(elapsed >= present_idle_timeout) {
+			dlg_debug("Timed out waiting for present IdleNotify");
+			return NULL;
+		}
+
+		// there is no timed wait for special events, we wait for the
+		// connection ourselves like display_dispatch. Polling the
+		// special event queue reads everything the server sent so far.
+		xcb_flush(conn);
+		struct pollfd pfd = {
+			.fd = xcb_get_file_descriptor(conn),
+			.events = POLLIN,
+		};
+		if(poll(&pfd, 1, present_idle_timeout - (int) elapsed) < 0 &&
+				errno != EINTR) {
+			dlg_warn("poll: %s", strerror(errno));
+			return NULL;
+		}
+
+		while((ev = xcb_poll_for_special_event(conn, buf->present.events))) {
+			handle_present_idle(win, ev);
+		}
+
+		if(xcb_connection_has_error(conn)) {
+			dlg_error("Waiting for present IdleNotify failed");
+			return NULL;
+		}
+	}
+}
+
+// Makes sure the given present buffer has a pixmap with the
+// current window size and the given layout.
+static bool init_present_buffer(struct swa_window_x11* win,
+		struct swa_x11_present_buffer* pb, uint64_t n_bytes) {
+	if(pb->pixmap && pb->width == win->width && pb->height == win->height) {
+		return true;
+	}
+
+	xcb_connection_t* conn = win->dpy->conn;
+	if(n_bytes > pb->shm.size) {
+		finish_present_buffer(win, pb);
+		if(!shm_alloc(win->dpy, n_bytes, &pb->shm)) {
+			return false;
+		}
+	} else if(pb->pixmap) {
+		xcb_free_pixmap(conn, pb->pixmap);
+	}
+
+	pb->width = win->width;
+	pb->height = win->height;
+	pb->frame = 0u;
+	pb->pixmap = xcb_generate_id(conn);
+	xcb_void_cookie_t cookie = xcb_shm_create_pixmap(conn, pb->pixmap,
+		win->window, win->width, win->height, win->depth, pb->shm.seg,
+		pb->shm.offset);
+	track_request(win->dpy, cookie, "xcb_shm_create_pixmap");
+	return true;
+}
+
+// Returns the number of bytes a row of `width` pixels in the buffer
+// format occupies, padded like the server expects for images.
+static unsigned row_stride(struct swa_window_x11* win, unsigned width) {
+	unsigned stride = width * swa_image_format_size(win->buffer.format);
+	unsigned m = stride % win->buffer.scanline_align;
+	if(m) {
+		stride += (win->buffer.scanline_align - m);
+	}
+
+	return stride;
+}
+
+// Sends the given rectangle of the active buffer with core put_image
+// requests, for servers without shm (e.g. remote displays).
+// The rectangle is split into strips of rows that each fit into a
+// single request. They aren't flushed in between, xcb writes them
+// out as its buffer fills up.
+static void put_image_rect(struct swa_window_x11* win, unsigned x, unsigned y,
+		unsigned width, unsigned height) {
+	// Strips larger than this don't reduce the overhead any further
+	// but delay the server handling the first one.
+	static const uint64_t max_strip_size = 256 * 1024;
+	static const uint64_t put_image_header_size = 24;
+
+	struct swa_x11_buffer_surface* buf = &win->buffer;
+	struct swa_display_x11* dpy = win->dpy;
+	if(x >= win->width || y >= win->height || !width || !height) {
+		return;
+	}
+
+	width = x + width > win->width ? win->width - x : width;
+	height = y + height > win->height ? win->height - y : height;
+
+	unsigned src_stride = row_stride(win, win->width);
+	unsigned stride = row_stride(win, width);
+	uint64_t max_size = dpy->max_request_size - put_image_header_size;
+	if(max_size > max_strip_size) {
+		max_size = max_strip_size;
+	}
+
+	unsigned max_rows = max_size / stride;
+	if(max_rows == 0) {
+		dlg_error("Image row doesn't fit into a single request");
+		return;
+	}
+
+	// Full rows are contiguous in the buffer, otherwise the rows
+	// are packed into the scratch buffer.
+	bool contiguous = (stride == src_stride);
+	unsigned fmt_size = swa_image_format_size(buf->format);
+	if(!contiguous) {
+		uint64_t scratch_size = (uint64_t) max_rows * stride;
+		if(height < max_rows) {
+			scratch_size = (uint64_t) height * stride;
+		}
+
+		if(scratch_size > buf->scratch_size) {
+			free(buf->scratch);
+			buf->scratch_size = 0u;
+			if(!(buf->scratch = malloc(scratch_size))) {
+				dlg_error("Failed to allocate put_image buffer");
+				return;
+			}
+
+			buf->scratch_size = scratch_size;
+		}
+	}
+
+	for(unsigned r = 0u; r < height; r += max_rows) {
+		unsigned rows = height - r < max_rows ? height - r : max_rows;
+		const uint8_t* src = (const uint8_t*) buf->bytes +
+			(uint64_t)(y + r) * src_stride + x * fmt_size;
+		const uint8_t* data = src;
+		if(!contiguous) {
+			for(unsigned i = 0u; i < rows; ++i) {
+				memcpy(buf->scratch + i * stride, src + i * src_stride,
+					width * fmt_size);
+			}
+
+			data = buf->scratch;
+		}
+
+		xcb_void_cookie_t cookie = xcb_put_image(dpy->conn,
+			XCB_IMAGE_FORMAT_Z_PIXMAP, win->window, buf->gc, width, rows,
+			x, y + r, 0, win->depth, rows * stride, data);
+		track_request(dpy, cookie, "xcb_put_image");
+	}
+}
+
+// Sends the given rects of the single buffer to the window.
+static void put_rects(struct swa_window_x11* win, const xcb_rectangle_t* rects,
+		unsigned n_rects) {
+	struct swa_x11_buffer_surface* buf = &win->buffer;
+	for(unsigned i = 0u; i < n_rects; ++i) {
+		const xcb_rectangle_t* r = &rects[i];
+		if(!win->dpy->ext.shm) {
+			put_image_rect(win, r->x, r->y, r->width, r->height);
+			continue;
+		}
+
+		xcb_void_cookie_t cookie = xcb_shm_put_image(win->dpy->conn,
+			win->window, buf->gc, win->width, win->height, r->x, r->y,
+			r->width, r->height, r->x, r->y, win->depth,
+			XCB_IMAGE_FORMAT_Z_PIXMAP, 0, buf->shm.seg, buf->shm.offset);
+		track_request(win->dpy, cookie, "xcb_shm_put_image");
+	}
+}
+
+// Clips the given damage against the window size and stores it in `rects`.
+// If there are more than `max_rects` rectangles, their bounding box is
+// used instead. Returns the number of rectangles stored.
+static unsigned clip_damage(struct swa_window_x11* win,
+		const struct swa_rect* damage, unsigned n_damage,
+		xcb_rectangle_t* rects, unsigned max_rects) {
+	unsigned count = 0u;
+	unsigned x1 = win->width, y1 = win->height;
+	unsigned x2 = 0u, y2 = 0u;
+	for(unsigned i = 0u; i < n_damage; ++i) {
+		struct swa_rect r = damage[i];
+		if(r.x >= win->width || r.y >= win->height ||
+				!r.width || !r.height) {
+			continue;
+		}
+
+		// r.x + r.width might overflow
+		r.width = r.width > win->width - r.x ? win->width - r.x : r.width;
+		r.height = r.height > win->height - r.y ? win->height - r.y : r.height;
+		x1 = r.x < x1 ? r.x : x1;
+		y1 = r.y < y1 ? r.y : y1;
+		x2 = r.x + r.width > x2 ? r.x + r.width : x2;
+		y2 = r.y + r.height > y2 ? r.y + r.height : y2;
+
+		if(count < max_rects) {
+			rects[count].x = r.x;
+			rects[count].y = r.y;
+			rects[count].width = r.width;
+			rects[count].height = r.height;
+		}
+		++count;
+	}
+
+	if(count > max_rects) {
+		rects[0].x = x1;
+		rects[0].y = y1;
+		rects[0].width = x2 - x1;
+		rects[0].height = y2 - y1;
+		count = 1u;
+	}
+
+	return count;
+}
+
 static bool win_get_buffer(struct swa_window* base, struct swa_image* img) {
 	struct swa_window_x11* win = get_window_x11(base);
 	if(win->surface_type != swa_surface_buffer) {
@@ -502,37 +1130,75 @@ static bool win_get_buffer(struct swa_window* base, struct swa_image* img) {
 		return false;
 	}
 
-	xcb_connection_t* conn = win->dpy->conn;
-
 	// check if we have to recreate the buffer
-	unsigned fmt_size = swa_image_format_size(win->buffer.format);
-	unsigned stride = win->width * fmt_size;
-	unsigned m = stride % win->buffer.scanline_align;
-	if(m) {
-		stride += (win->buffer.scanline_align - m);
-	}
+	enum swa_image_format format = buf->format;
+	unsigned stride = row_stride(win, win->width);
 	uint64_t n_bytes = win->height * stride;
+
+	buf->xv.active = false;
+	if(buf->xv.port) {
+		query_xv_layout(win);
+		if(buf->xv.stride) {
+			buf->xv.active = true;
+			format = buf->xv.format;
+			stride = buf->xv.stride;
+			n_bytes = buf->xv.size;
+		}
+	}
+
+	// When all pixmaps are still used by the server, the single
+	// buffer below is used for this frame and sent with put_image.
+	struct swa_x11_present_buffer* pb = NULL;
+	if(buf->present.enabled && !buf->xv.active) {
+		pb = acquire_present_buffer(win);
+	}
+
+	if(pb) {
+		if(!init_present_buffer(win, pb, n_bytes)) {
+			return false;
+		}
+
+		buf->present.active = pb;
+		buf->active = true;
+		img->data = pb->shm.data;
+		img->format = format;
+		img->width = win->width;
+		img->height = win->height;
+		img->stride = stride;
+		return true;
+	}
+
+	if(buf->contents.width != win->width ||
+			buf->contents.height != win->height ||
+			buf->contents.xv != buf->xv.active) {
+		buf->contents.frame = 0u;
+	}
+
 	if(n_bytes > win->buffer.n_bytes) {
-		buf->n_bytes = n_bytes * 4; // overallocate for resizing
+		buf->contents.frame = 0u;
+		buf->n_bytes = 0u;
 		if(win->dpy->ext.shm) {
-			if(buf->shmseg) {
-				xcb_shm_detach(conn, buf->shmseg);
-				shmdt(win->buffer.bytes);
-				shmctl(win->buffer.shmid, IPC_RMID, 0);
+			shm_free(win->dpy, &buf->shm);
+			if(!shm_alloc(win->dpy, n_bytes, &buf->shm)) {
+				buf->bytes = NULL;
+				return false;
 			}
 
-			buf->shmid = shmget(IPC_PRIVATE, buf->n_bytes, IPC_CREAT | 0777);
-			buf->bytes = shmat(buf->shmid, 0, 0);
-			buf->shmseg = xcb_generate_id(conn);
-			xcb_shm_attach(conn, buf->shmseg, buf->shmid, 0);
+			buf->bytes = buf->shm.data;
 		} else {
-			buf->bytes = malloc(n_bytes);
+			free(buf->bytes);
+			if(!(buf->bytes = malloc(n_bytes))) {
+				dlg_error("Failed to allocate buffer");
+				return false;
+			}
 		}
+
+		buf->n_bytes = n_bytes;
 	}
 
 	buf->active = true;
 	img->data = buf->bytes;
-	img->format = buf->format;
+	img->format = format;
 	img->width = win->width;
 	img->height = win->height;
 	img->stride = stride;
@@ -540,7 +1206,8 @@ static bool win_get_buffer(struct swa_window* base, struct swa_image* img) {
 	return true;
 }
 
-static void win_apply_buffer(struct swa_window* base) {
+static void win_apply_buffer(struct swa_window* base,
+		const struct swa_rect* damage, unsigned n_damage) {
 	struct swa_window_x11* win = get_window_x11(base);
 	if(win->surface_type != swa_surface_buffer) {
 		dlg_error("Window doesn't have buffer surface");
@@ -555,16 +1222,186 @@ static void win_apply_buffer(struct swa_window* base) {
 
 	win_surface_frame(base);
 
+	xcb_connection_t* conn = win->dpy->conn;
+	xcb_rectangle_t rects[32];
+	unsigned n_rects = 0u;
+	if(n_damage) {
+		n_rects = clip_damage(win, damage, n_damage, rects, 31u);
+		n_rects += clip_damage(win, &buf->scroll.exposed, 1u,
+			rects + n_rects, 1u);
+	}
+
+	buf->scroll.exposed = (struct swa_rect) {0};
 	buf->active = false;
-	xcb_void_cookie_t cookie = xcb_shm_put_image_checked(win->dpy->conn,
-		win->window, buf->gc, win->width, win->height, 0, 0,
-		win->width, win->height, 0, 0, win->depth,
-		XCB_IMAGE_FORMAT_Z_PIXMAP, 0, buf->shmseg, 0);
-	xcb_generic_error_t* err = xcb_request_check(win->dpy->conn, cookie);
-	if(err) {
-		handle_error(win->dpy, err, "xcb_shm_put_image");
+	if(buf->present.active) {
+		struct swa_x11_present_buffer* pb = buf->present.active;
+		pb->serial = ++buf->present.serial;
+		pb->busy = true;
+		pb->frame = ++buf->frame;
+		buf->present.active = NULL;
+
+		// The update region allows the server to only copy the damaged
+		// parts of the pixmap. It's reused for all presents of the window.
+		xcb_xfixes_region_t update = XCB_NONE;
+		if(n_damage && win->dpy->ext.xfixes) {
+			if(!buf->present.update) {
+				buf->present.update = xcb_generate_id(conn);
+				xcb_xfixes_create_region(conn, buf->present.update,
+					n_rects, rects);
+			} else {
+				xcb_xfixes_set_region(conn, buf->present.update,
+					n_rects, rects);
+			}
+
+			update = buf->present.update;
+		}
+
+		xcb_void_cookie_t cookie = xcb_present_pixmap(conn,
+			win->window, pb->pixmap, pb->serial, 0, update, 0, 0, 0, 0, 0,
+			XCB_PRESENT_OPTION_NONE, win->present.target_msc, 0, 0, 0, NULL);
+		track_request(win->dpy, cookie, "xcb_present_pixmap");
+		xcb_flush(win->dpy->conn);
+		return;
+	}
+
+	buf->contents.frame = ++buf->frame;
+	buf->contents.width = win->width;
+	buf->contents.height = win->height;
+	buf->contents.xv = buf->xv.active;
+
+	if(buf->xv.active) {
+		xcb_void_cookie_t cookie = xcb_xv_shm_put_image(win->dpy->conn,
+			buf->xv.port, win->window, buf->gc, buf->shm.seg, buf->xv.id,
+			buf->shm.offset,
+			0, 0, win->width, win->height, 0, 0, win->width, win->height,
+			win->width, win->height, 0);
+		track_request(win->dpy, cookie, "xcb_xv_shm_put_image");
+		xcb_flush(win->dpy->conn);
+		return;
+	}
+
+	// the single buffer holds the previous contents, only the
+	// damaged parts have to be copied into the window
+	if(!n_damage) {
+		rects[0].x = 0;
+		rects[0].y = 0;
+		rects[0].width = win->width;
+		rects[0].height = win->height;
+		n_rects = 1u;
+	}
+
+	// The scrolled contents are moved on the server, they are in the
+	// damage only if the application damaged them again.
+	if(buf->scroll.pending && n_damage) {
+		const xcb_rectangle_t* r = &buf->scroll.rect;
+		xcb_void_cookie_t cookie = xcb_copy_area(conn, win->window,
+			win->window, buf->gc, r->x - buf->scroll.dx, r->y - buf->scroll.dy,
+			r->x, r->y, r->width, r->height);
+		track_request(win->dpy, cookie, "xcb_copy_area");
+	}
+
+	buf->scroll.pending = false;
+	put_rects(win, rects, n_rects);
+	xcb_flush(conn);
+}
+
+static unsigned win_get_buffer_age(struct swa_window* base) {
+	struct swa_window_x11* win = get_window_x11(base);
+	struct swa_x11_buffer_surface* buf = &win->buffer;
+	if(win->surface_type != swa_surface_buffer || !buf->active) {
+		return 0u;
+	}
+
+	uint64_t frame = buf->present.active ?
+		buf->present.active->frame : buf->contents.frame;
+	return frame ? buf->frame - frame + 1 : 0u;
+}
+
+// Called for the parts of a scroll whose source wasn't available
+// on the server (e.g. because it was obscured). The single buffer still
+// holds the contents of the window, we send them again. While the buffer
+// is active the application might be drawing into it, the exposed
+// region is sent with the next apply_buffer instead.
+static void handle_scroll_exposure(struct swa_window_x11* win,
+		xcb_rectangle_t rect) {
+	struct swa_x11_buffer_surface* buf = &win->buffer;
+	if(win->surface_type != swa_surface_buffer || !buf->contents.frame ||
+			buf->contents.xv || buf->contents.width != win->width ||
+			buf->contents.height != win->height) {
 		return;
 	}
+
+	if(buf->active) {
+		// exposures are inside the window, no overflow possible
+		struct swa_rect r = {rect.x, rect.y, rect.width, rect.height};
+		struct swa_rect* e = &buf->scroll.exposed;
+		if(e->width && e->height) {
+			unsigned x2 = r.x + r.width > e->x + e->width ?
+				r.x + r.width : e->x + e->width;
+			unsigned y2 = r.y + r.height > e->y + e->height ?
+				r.y + r.height : e->y + e->height;
+			r.x = r.x < e->x ? r.x : e->x;
+			r.y = r.y < e->y ? r.y : e->y;
+			r.width = x2 - r.x;
+			r.height = y2 - r.y;
+		}
+
+		*e = r;
+		return;
+	}
+
+	put_rects(win, &rect, 1u);
+
+	// the pending scroll would move the contents sent above
+	if(buf->scroll.pending) {
+		put_rects(win, &buf->scroll.rect, 1u);
+		buf->scroll.pending = false;
+	}
+
+	xcb_flush(win->dpy->conn);
+}
+
+static const uint8_t* win_get_previous_buffer(struct swa_window* base) {
+	struct swa_window_x11* win = get_window_x11(base);
+	struct swa_x11_buffer_surface* buf = &win->buffer;
+	if(win->surface_type != swa_surface_buffer || !buf->present.active ||
+			!buf->frame) {
+		return NULL;
+	}
+
+	// The server only reads the pixmaps. Pixmaps with the
+	// same size have the same layout.
+	struct swa_x11_present_buffer* active = buf->present.active;
+	for(unsigned i = 0u; i < 3u; ++i) {
+		struct swa_x11_present_buffer* pb = &buf->present.buffers[i];
+		if(pb != active && pb->frame == buf->frame &&
+				pb->width == active->width && pb->height == active->height) {
+			return pb->shm.data;
+		}
+	}
+
+	return NULL;
+}
+
+static bool win_scroll_buffer(struct swa_window* base,
+		const struct swa_rect* rect, int dx, int dy) {
+	struct swa_window_x11* win = get_window_x11(base);
+	struct swa_x11_buffer_surface* buf = &win->buffer;
+
+	// Only the single buffer is shown by copying it into the window,
+	// i.e. only then the window contents match the previous frame.
+	// A second scroll in the same frame is simply damaged.
+	if(buf->present.active || buf->xv.active || buf->scroll.pending ||
+			!buf->contents.frame || buf->contents.frame != buf->frame) {
+		return false;
+	}
+
+	buf->scroll.pending = true;
+	buf->scroll.rect = (xcb_rectangle_t) {
+		rect->x, rect->y, rect->width, rect->height};
+	buf->scroll.dx = dx;
+	buf->scroll.dy = dy;
+	return true;
 }
 
 static const struct swa_window_interface window_impl = {
@@ -588,6 +1425,9 @@ static const struct swa_window_interface window_impl = {
 	.gl_swap_buffers = win_gl_swap_buffers,
 	.gl_set_swap_interval = win_gl_set_swap_interval,
 	.get_buffer = win_get_buffer,
+	.get_buffer_age = win_get_buffer_age,
+	.get_previous_buffer = win_get_previous_buffer,
+	.scroll_buffer = win_scroll_buffer,
 	.apply_buffer = win_apply_buffer
 };
 
@@ -608,6 +1448,13 @@ static void display_destroy(struct swa_display* base) {
 	}
 
 	free(dpy->cursors);
+	for(unsigned i = 0u; i < dpy->shm.n_segs; ++i) {
+		xcb_shm_detach(dpy->conn, dpy->shm.segs[i]);
+	}
+	free(dpy->shm.segs);
+	free(dpy->shm.orphans);
+	if(dpy->shm.arena.data) swa_shm_finish(&dpy->shm.arena);
+
 	swa_xkb_finish(&dpy->keyboard.xkb);
 	if(dpy->next_event) free(dpy->next_event);
 	xcb_ewmh_connection_wipe(&dpy->ewmh);
@@ -638,7 +1485,10 @@ static void handle_present_event(struct swa_display_x11* dpy,
 			(xcb_present_complete_notify_event_t*) ev;
 		struct swa_window_x11* win = find_window(dpy, complete->window);
 		if(win) {
-			if(win->present.context != complete->event) {
+			// completions of the buffer surface pixmaps aren't frame
+			// callbacks, see swa_x11_buffer_surface::present
+			if(win->present.context != complete->event ||
+					complete->kind != XCB_PRESENT_COMPLETE_KIND_NOTIFY_MSC) {
 				break;
 			}
 
@@ -769,6 +1619,13 @@ static void handle_event(struct swa_display_x11* dpy,
 				}
 			}
 
+			// the server lost the contents, they have to be sent again.
+			// Synthetic events sent by win_refresh are empty.
+			if(win->surface_type == swa_surface_buffer) {
+				swa_window_expose(&win->base, (struct swa_rect) {
+					expose->x, expose->y, expose->width, expose->height});
+			}
+
 			if(win->base.listener->draw) {
 				if(win->present.pending) {
 					win->present.redraw = true;
@@ -797,6 +1654,15 @@ static void handle_event(struct swa_display_x11* dpy,
 		}
 		// we don't have to draw, the xserver will send an expose event
 		break;
+	} case XCB_GRAPHICS_EXPOSURE: {
+		xcb_graphics_exposure_event_t* gexp =
+			(xcb_graphics_exposure_event_t*) ev;
+		if((win = find_window(dpy, gexp->drawable))) {
+			xcb_rectangle_t rect = {gexp->x, gexp->y,
+				gexp->width, gexp->height};
+			handle_scroll_exposure(win, rect);
+		}
+		break;
 	} case XCB_CLIENT_MESSAGE: {
 		xcb_client_message_event_t* client = (xcb_client_message_event_t*) ev;
 		unsigned protocol = client->data.data32[0];
@@ -1030,7 +1896,12 @@ static void handle_event(struct swa_display_x11* dpy,
 		int code = eev->error_code;
 		char buf[256];
 		XGetErrorText(dpy->display, code, buf, sizeof(buf));
-		dlg_error("retrieved x11 error code: %s (%d)", buf, code);
+		const char* name = tracked_request_name(dpy, eev->full_sequence);
+		if(name) {
+			dlg_error("%s failed: %s (%d)", name, buf, code);
+		} else {
+			dlg_error("retrieved x11 error code: %s (%d)", buf, code);
+		}
 		break;
 	} default:
 		break;
@@ -1096,6 +1967,50 @@ static bool check_error(struct swa_display_x11* dpy) {
 	return dpy->error = true;
 }
 
+// Handles the IdleNotify events the server sent for the present
+// buffers of all windows. They are received on special event queues
+// (see swa_x11_buffer_surface::present) and are therefore never
+// returned by xcb_poll_for_event.
+// Returns whether a buffer_available event was emitted.
+static bool dispatch_present_idle(struct swa_display_x11* dpy) {
+	bool emitted = false;
+	struct swa_window_x11* win = dpy->window_list;
+	while(win) {
+		// the listener might destroy the window
+		struct swa_window_x11* next = win->next;
+		struct swa_x11_buffer_surface* buf = &win->buffer;
+		if(win->surface_type == swa_surface_buffer && buf->present.events) {
+			bool released = false;
+			xcb_generic_event_t* ev;
+			while((ev = xcb_poll_for_special_event(dpy->conn,
+					buf->present.events))) {
+				released |= handle_present_idle(win, ev);
+			}
+
+			if(released && !buf->active &&
+					win->base.listener->buffer_available) {
+				win->base.listener->buffer_available(&win->base);
+				emitted = true;
+			}
+		}
+
+		win = next;
+	}
+
+	return emitted;
+}
+
+static bool uses_present_buffers(struct swa_display_x11* dpy) {
+	for(struct swa_window_x11* win = dpy->window_list; win; win = win->next) {
+		if(win->surface_type == swa_surface_buffer &&
+				win->buffer.present.events) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
 static bool display_dispatch(struct swa_display* base, bool block) {
 	struct swa_display_x11* dpy = get_display_x11(base);
 	if(check_error(dpy)) {
@@ -1107,8 +2022,31 @@ static bool display_dispatch(struct swa_display* base, bool block) {
 	// in some cases, e.g. the only way to determine whether
 	// a key press is a repeat
 
+	free_shm_orphans(dpy);
 	xcb_flush(dpy->conn);
-	if(block && !dpy->next_event) {
+	if(block && !dpy->next_event && uses_present_buffers(dpy)) {
+		// IdleNotify events don't end xcb_wait_for_event, we have to
+		// wait for the connection ourselves to not miss them.
+		// Both poll functions read everything the server sent so far.
+		while(!(dpy->next_event = xcb_poll_for_event(dpy->conn))) {
+			if(check_error(dpy)) {
+				return false;
+			}
+
+			if(dispatch_present_idle(dpy)) {
+				break;
+			}
+
+			struct pollfd pfd = {
+				.fd = xcb_get_file_descriptor(dpy->conn),
+				.events = POLLIN,
+			};
+			if(poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+				dlg_warn("poll: %s", strerror(errno));
+				return !check_error(dpy);
+			}
+		}
+	} else if(block && !dpy->next_event) {
 		dpy->next_event = xcb_wait_for_event(dpy->conn);
 		if(!dpy->next_event) {
 			dlg_warn("xcb_wait_for_event failed");
@@ -1131,6 +2069,7 @@ static bool display_dispatch(struct swa_display* base, bool block) {
 		free(event);
 	}
 
+	dispatch_present_idle(dpy);
 	return !check_error(dpy);
 }
 
@@ -1256,7 +2195,32 @@ static enum swa_image_format visual_to_format(const xcb_visualtype_t* v,
 	// - depth = bpp = 24: rgb 8-bit format
 	// - depth = bpp = 32: rgba 8-bit format
 	// - depth = 24, bpp = 32: rgbx 8-bit format
-	// These cover all formats in swa_image_format
+	// - depth = bpp = 16: rgb565
+	// - depth = 30, bpp = 32: xrgb2101010
+	// These cover all formats in swa_image_format usable for visuals
+	if(depth == 16 || depth == 30) {
+		static const struct {
+			uint32_t depth, bpp;
+			uint32_t r, g, b;
+			enum swa_image_format format; // packed, i.e. in word order
+		} packed[] = {
+			{16, 16, 0xF800u, 0x07E0u, 0x001Fu, swa_image_format_rgb565},
+			{30, 32, 0x3FF00000u, 0x000FFC00u, 0x000003FFu,
+				swa_image_format_xrgb2101010},
+		};
+
+		for(unsigned i = 0u; i < sizeof(packed) / sizeof(packed[0]); ++i) {
+			if(depth == packed[i].depth && bpp == packed[i].bpp &&
+					v->red_mask == packed[i].r &&
+					v->green_mask == packed[i].g &&
+					v->blue_mask == packed[i].b) {
+				return packed[i].format;
+			}
+		}
+
+		return swa_image_format_none;
+	}
+
 	if(depth != 24 && depth != 32) {
 		return swa_image_format_none;
 	}
@@ -1279,9 +2243,10 @@ static enum swa_image_format visual_to_format(const xcb_visualtype_t* v,
 		uint32_t r, g, b, a;
 		enum swa_image_format format; // in word order
 	} formats[] = {
-		{32, b1, b2, b3, b4, swa_image_format_rgba32},
-		{32, b3, b2, b1, b4, swa_image_format_bgra32},
-		{32, b2, b3, b4, b1, swa_image_format_argb32},
+		// compositors interpret the alpha of 32-bit visuals as premultiplied
+		{32, b1, b2, b3, b4, swa_image_format_rgba32_premul},
+		{32, b3, b2, b1, b4, swa_image_format_bgra32_premul},
+		{32, b2, b3, b4, b1, swa_image_format_argb32_premul},
 		{24, b1, b2, b3, 0u, swa_image_format_rgb24},
 		{24, b3, b2, b1, 0u, swa_image_format_bgr24},
 		{32, b3, b2, b1, 0u, swa_image_format_bgrx32},
@@ -1322,22 +2287,35 @@ static int rate_visual(struct swa_display_x11* dpy,
 		perfect = false;
 	}
 
+	// 16-bit and 30-bit visuals are only used when explicitly
+	// requested, they are usually not what the application expects.
+	bool packed = format == swa_image_format_rgb565 ||
+		format == swa_image_format_xrgb2101010;
 	bool known_format = format != swa_image_format_none;
 	if(known_format) {
 		if(settings->surface == swa_surface_buffer) {
-			s += (1 << 3);
 			enum swa_image_format pref =
 				settings->surface_settings.buffer.preferred_format;
-			if(format == pref) {
+			// the alpha convention is given by the visual,
+			// the application has to handle it in any case
+			if(format == swa_image_format_premultiplied(pref)) {
+				s += (1 << 3);
 				s += (1 << 5);
 				dlg_assertlm(dlg_level_warn,
 					settings->transparent == (depth == 32),
 					"Preferred buffer format and 'transparent' don't match");
-			} else if(pref != swa_image_format_none) {
+			} else if(packed) {
 				perfect = false;
+			} else {
+				s += (1 << 3);
+				if(pref != swa_image_format_none) {
+					perfect = false;
+				}
 			}
-		} else {
+		} else if(!packed) {
 			s += (1 << 1); // always nice to have a common format
+		} else {
+			perfect = false;
 		}
 	} else {
 		perfect = false;
@@ -1534,15 +2512,11 @@ static struct swa_window* display_create_window(struct swa_display* base,
 	uint32_t valuelist[] = {0, eventmask, win->colormap, XCB_NONE};
 
 	win->window = xcb_generate_id(dpy->conn);
-	xcb_void_cookie_t cookie = xcb_create_window_checked(dpy->conn, win->depth,
+	xcb_void_cookie_t cookie = xcb_create_window(dpy->conn, win->depth,
 		win->window, xparent, x, y, win->width, win->height, 0,
 		XCB_WINDOW_CLASS_INPUT_OUTPUT, win->visualtype->visual_id,
 		valuemask, valuelist);
-	xcb_generic_error_t* err = xcb_request_check(dpy->conn, cookie);
-	if(err) {
-		handle_error(dpy, err, "xcb_create_window");
-		goto error;
-	}
+	track_request(dpy, cookie, "xcb_create_window");
 
 	// set properties
 	if(settings->state != swa_window_state_none &&
@@ -1630,17 +2604,28 @@ static struct swa_window* display_create_window(struct swa_display* base,
 
 		win->buffer.gc = xcb_generate_id(dpy->conn);
 		uint32_t value[] = {0, 0};
-		xcb_void_cookie_t c = xcb_create_gc_checked(dpy->conn, win->buffer.gc,
+		xcb_void_cookie_t c = xcb_create_gc(dpy->conn, win->buffer.gc,
 			win->window, XCB_GC_FOREGROUND, value);
-		xcb_generic_error_t* e = xcb_request_check(dpy->conn, c);
-		if(e) {
-			handle_error(dpy, e, "xcb_create_gc");
-			goto error;
-		}
+		track_request(dpy, c, "xcb_create_gc");
 
 		dlg_assert(visual_scanline_pad % 8 == 0);
 		win->buffer.format = visual_format;
 		win->buffer.scanline_align = visual_scanline_pad / 8;
+
+		// yuv formats can be presented natively via XVideo,
+		// swa_window_get_buffer converts them otherwise
+		enum swa_image_format pref =
+			settings->surface_settings.buffer.preferred_format;
+		if(swa_image_format_is_planar(pref) && dpy->ext.shm && dpy->ext.xv &&
+				!init_xv_port(win, pref)) {
+			dlg_info("No XVideo port for format %d found", pref);
+		}
+
+		// the present buffers are shm pixmaps
+		if(dpy->ext.shm_pixmaps && dpy->ext.xpresent &&
+				!init_present_buffers(win)) {
+			dlg_info("Not using present pixmaps for buffer surface");
+		}
 	} else if(win->surface_type == swa_surface_gl) {
 #ifdef SWA_WITH_GL
 		if(!(win->gl.surface = swa_egl_create_surface(dpy->egl, &win->window,
@@ -1756,15 +2741,12 @@ struct swa_display* swa_display_x11_create(const char* appname) {
 
 	// create dummy window used for selections and wakeup
 	dpy->dummy_window = xcb_generate_id(dpy->conn);
-	xcb_void_cookie_t cookie = xcb_create_window_checked(dpy->conn,
+	xcb_void_cookie_t cookie = xcb_create_window(dpy->conn,
 		XCB_COPY_FROM_PARENT, dpy->dummy_window,
 		dpy->screen->root, 0, 0, 1, 1, 0, XCB_WINDOW_CLASS_INPUT_ONLY,
 		XCB_COPY_FROM_PARENT, 0, NULL);
-	xcb_generic_error_t* err = xcb_request_check(dpy->conn, cookie);
-	if(err) {
-		handle_error(dpy, err, "xcb_create_window (dummy)");
-		goto err;
-	}
+	track_request(dpy, cookie, "xcb_create_window (dummy)");
+	xcb_generic_error_t* err = NULL;
 
 	// load atoms
 	xcb_intern_atom_cookie_t* ewmh_cookie =
@@ -1916,16 +2898,35 @@ struct swa_display* swa_display_x11_create(const char* appname) {
 		dlg_warn("xpresent not available, no frame callbacks");
 	}
 
+	// xfixes regions are only used for the update region of presents,
+	// version 2 is needed for region requests
+	ext = xcb_get_extension_data(dpy->conn, &xcb_xfixes_id);
+	if(dpy->ext.xpresent && ext && ext->present) {
+		xcb_xfixes_query_version_cookie_t c =
+			xcb_xfixes_query_version(dpy->conn, 2, 0);
+		xcb_xfixes_query_version_reply_t* reply =
+			xcb_xfixes_query_version_reply(dpy->conn, c, &err);
+		if(!reply) {
+			handle_error(dpy, err, "xcb_xfixes_query_version");
+		} else {
+			dpy->ext.xfixes = reply->major_version >= 2;
+		}
+		free(reply);
+	}
+
+	// XVideo is only used for presenting yuv buffers
+	ext = xcb_get_extension_data(dpy->conn, &xcb_xv_id);
+	dpy->ext.xv = ext && ext->present;
+
 	// check for shm extension support
 	xcb_shm_query_version_cookie_t sc = xcb_shm_query_version(dpy->conn);
 	xcb_shm_query_version_reply_t* sreply =
 		xcb_shm_query_version_reply(dpy->conn, sc, &err);
 	if(!sreply) {
 		handle_error(dpy, err, "xcb_shm_query_version");
-	} else if(/*sreply->shared_pixmaps && */ // we don't need shared pixmaps
-			sreply->major_version >= 1 &&
-			sreply->minor_version >= 2) {
+	} else if(sreply->major_version >= 1 && sreply->minor_version >= 2) {
 		dpy->ext.shm = true;
+		dpy->ext.shm_pixmaps = sreply->shared_pixmaps;
 	} else {
 		dlg_warn("xshm not fully supported: version %d.%d, pixmaps: %d",
 			sreply->major_version, sreply->minor_version,
@@ -1933,6 +2934,13 @@ struct swa_display* swa_display_x11_create(const char* appname) {
 	}
 	free(sreply);
 
+	// Buffers are sent with put_image requests without shm.
+	// This enables BIG-REQUESTS if available.
+	if(!dpy->ext.shm) {
+		dpy->max_request_size =
+			4 * (uint64_t) xcb_get_maximum_request_length(dpy->conn);
+	}
+
 	// xkb: we require this extension for keyboard support
 	// NOTE: instead of erroring out, we could simply not report
 	// the keyboard capability
@@ -1991,14 +2999,10 @@ struct swa_display* swa_display_x11_create(const char* appname) {
 	details.affectState = req_state_details;
 	details.stateDetails = req_state_details;
 
-	xcb_void_cookie_t xkbc = xcb_xkb_select_events_aux_checked(dpy->conn,
+	xcb_void_cookie_t xkbc = xcb_xkb_select_events_aux(dpy->conn,
 		dpy->keyboard.device_id, req_events, 0, 0,
 		req_map_parts, req_map_parts, &details);
-	err = xcb_request_check(dpy->conn, xkbc);
-	if(err) {
-		handle_error(dpy, err, "xcb_xkb_select_events_aux_checked");
-		goto err;
-	}
+	track_request(dpy, xkbc, "xcb_xkb_select_events_aux");
 
 	if(!swa_xkb_init_compose(xkb)) {
 		goto err;